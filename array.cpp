@@ -0,0 +1,60 @@
+#include "array.h"
+#include "gc.h"
+#include "value.h"
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+static_assert(sizeof(Array) <= Array::header_size);
+
+Array::Array(size_t size, ValueType element_type, int64_t length)
+    : Gc::Object(Kind::Array, size)
+    , element_type { element_type }
+    , length { length }
+    , data { reinterpret_cast<char*>(this) + header_size }
+{
+}
+
+Array* Array::make(ValueType element_type, int64_t length)
+{
+    if (length < 0 || length > max_length)
+        return nullptr;
+    const auto element_size
+        = is_unboxed(element_type) ? sizeof(int64_t) : sizeof(Value);
+    // rounded up to whole cache lines, so vector loops can read past the end
+    // of the last element
+    const auto size = (static_cast<size_t>(length) * element_size + alignment
+                          - 1)
+        / alignment * alignment;
+    const auto array = new (Gc::heap().allocate(
+        header_size + size, !is_unboxed(element_type)))
+        Array(header_size + size, element_type, length);
+    if (is_unboxed(element_type)) {
+        std::memset(array->data, 0, size);
+    } else {
+        for (int64_t i = 0; i < length; i++)
+            new (array->values() + i) Value();
+    }
+    return array;
+}
+
+Value Array::get(int64_t index) const
+{
+    switch (element_type) {
+    case ValueType::Int: return Value::make_int(ints()[index]);
+    case ValueType::Float: return Value::make_float(floats()[index]);
+    default: return values()[index];
+    }
+}
+
+void Array::set(int64_t index, const Value& value)
+{
+    switch (element_type) {
+    case ValueType::Int: ints()[index] = value.int_value; break;
+    case ValueType::Float: floats()[index] = value.float_value; break;
+    default:
+        values()[index] = value;
+        Gc::heap().write_barrier(*this, value);
+        break;
+    }
+}
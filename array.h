@@ -0,0 +1,52 @@
+#pragma once
+
+#include "gc.h"
+#include "value.h"
+#include <cstddef>
+#include <cstdint>
+
+// Contiguous storage for the elements of an array, which all have the type
+// `element_type`.
+//
+// `Int`s and `Float`s are stored unboxed as `int64_t`s and `double`s, other
+// types as `Value`s. The storage follows the array in the same allocation,
+// `header_size` bytes in, and is aligned to `alignment`, so loops over numbers
+// start on a cache line and can use aligned vector loads.
+//
+// Arrays have a fixed length and are allocated on the collected heap, see
+// gc.h.
+struct Array : Gc::Object {
+    static constexpr size_t alignment = Gc::Heap::alignment;
+    static constexpr size_t header_size = alignment;
+    static constexpr int64_t max_length = int64_t { 1 } << 32;
+
+    // returns nullptr when `length` is negative or above `max_length`, the
+    // elements are zeroed, or units when they are stored as values
+    static Array* make(ValueType element_type, int64_t length);
+
+    // whether elements of `type` are stored unboxed
+    static bool is_unboxed(ValueType type)
+    {
+        return type == ValueType::Int || type == ValueType::Float;
+    }
+
+    bool in_bounds(int64_t index) const
+    {
+        return static_cast<uint64_t>(index) < static_cast<uint64_t>(length);
+    }
+    // the index has to be in bounds
+    Value get(int64_t index) const;
+    // the index has to be in bounds and the value of the element type
+    void set(int64_t index, const Value& value);
+
+    int64_t* ints() const { return static_cast<int64_t*>(data); }
+    double* floats() const { return static_cast<double*>(data); }
+    Value* values() const { return static_cast<Value*>(data); }
+
+    ValueType element_type;
+    int64_t length;
+    void* data;
+
+private:
+    Array(size_t size, ValueType element_type, int64_t length);
+};
@@ -0,0 +1,480 @@
+#include "checker.h"
+#include "compiler.h"
+#include "driver.h"
+#include "error.h"
+#include "lexer.h"
+#include "lowering.h"
+#include "parser.h"
+#include "passes.h"
+#include "vm.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// `lpl_bench`, the throughput of the lexer in MB/s and of the parser in nodes
+// per second on programs generated in memory, and of the VM in operations per
+// second on generated loops.
+//
+// The programs are scaled to `--size` bytes, with wide expressions, deeply
+// nested ifs, long identifiers, mostly comments, mostly strings, or many small
+// blocks and functions. The loops run for `--iterations` iterations, and their
+// operations are the arithmetic, calls, indexing and stores in their bodies.
+//
+// Each benchmark runs once to warm up, then `--runs` times. The mean, standard
+// deviation and range of the runs are printed and written as JSON to
+// `--output`, to be compared with a previous one with `--compare`. Large
+// programs are parsed on `LPL_THREADS` threads, see `Parser`.
+
+namespace {
+
+struct BenchOptions {
+    size_t size { size_t { 1 } << 18 };
+    size_t iterations { 1000000 };
+    size_t runs { 10 };
+    // only the benchmarks with names containing it
+    std::string filter {};
+    std::string output { "lpl_bench.json" };
+    std::optional<std::string> compare {};
+};
+
+// one run of a benchmark, how much it processed, and how long that took
+struct Sample {
+    double amount;
+    std::chrono::duration<double> time;
+};
+
+struct Result {
+    std::string name;
+    std::string unit;
+    double mean { 0 };
+    double stddev { 0 };
+    double min { 0 };
+    double max { 0 };
+};
+
+using Clock = std::chrono::steady_clock;
+
+// names are made of letters and underscores only, so numbers are spelled
+// with letters
+std::string name(const std::string& prefix, size_t number)
+{
+    auto result = prefix + "_";
+    do {
+        result += static_cast<char>('a' + number % 26);
+        number /= 26;
+    } while (number > 0);
+    return result;
+}
+
+std::string wide_expressions(size_t size)
+{
+    const char* const operators[] = { " + ", " - ", " * ", " / ", " % " };
+    auto text = std::string {};
+    for (size_t line = 0; text.size() < size; line++) {
+        text += "let " + name("wide", line) + " = ";
+        for (size_t i = 0; i < 64; i++) {
+            if (i > 0)
+                text += operators[(line + i) % 5];
+            if (i % 4 == 1 && line > 0)
+                text += name("wide", line - 1);
+            else if (i % 4 == 3)
+                text.append("(").append(std::to_string(i)).append(" * ")
+                    .append(std::to_string(line)).append(")");
+            else
+                text += std::to_string(i * 7 + line);
+        }
+        text += ";\n";
+    }
+    return text;
+}
+
+std::string deep_nesting(size_t size)
+{
+    // statements which may be assignments are parsed again when they turn
+    // out not to be, so the time doubles with each block, see
+    // `Parser::maybe_parse_assignment`
+    constexpr auto depth = size_t { 8 };
+    auto text = std::string {};
+    for (size_t line = 0; text.size() < size; line++) {
+        text += "let " + name("deep", line) + " = ";
+        for (size_t i = 0; i < depth; i++)
+            text += i % 2 == 0 ? "if true { " : "{ ";
+        text += "(((" + std::to_string(line) + ")))";
+        for (size_t i = depth; i > 0; i--)
+            text += i % 2 == 1 ? " } else { " + std::to_string(i) + " }" : " }";
+        text += ";\n";
+    }
+    return text;
+}
+
+std::string identifier_runs(size_t size)
+{
+    const auto identifier = [](size_t i) {
+        return name("a_rather_long_identifier_naming_the_value_number", i);
+    };
+    auto text = "let " + identifier(0) + " = 0;\n";
+    for (size_t i = 1; text.size() < size; i++) {
+        text += "let " + identifier(i) + " = " + identifier(i - 1) + " + "
+            + identifier(i / 2) + " * " + identifier(i / 3) + ";\n";
+    }
+    return text;
+}
+
+std::string comment_heavy(size_t size)
+{
+    auto text = std::string {};
+    for (size_t i = 0; text.size() < size; i++) {
+        text += "// a line comment describing the binding below, which is "
+                "not much more than a number\n"
+                "/* and a block comment, over several lines,\n"
+                " * with / and * in it, and even // a line comment\n"
+                " */\n"
+                "let "
+            + name("commented", i) + " = " + std::to_string(i) + ";\n";
+    }
+    return text;
+}
+
+std::string string_heavy(size_t size)
+{
+    auto text = std::string {};
+    for (size_t i = 0; text.size() < size; i++) {
+        text += "let " + name("string", i)
+            + " = \"a string literal with \\\"quotes\\\", \\n newlines, \\t "
+              "tabs, and UTF-8: héllo wörld ☃ "
+            + std::to_string(i) + "\";\n";
+    }
+    return text;
+}
+
+std::string small_blocks(size_t size)
+{
+    auto text = std::string {};
+    for (size_t i = 0; text.size() < size; i++) {
+        const auto n = std::to_string(i);
+        const auto block = name("block", i);
+        text += "func " + block + "(a, b) { let c = a + b; { c * " + n
+            + " } }\n";
+        text += "let " + name("small", i) + " = { { " + n + " }; { " + block
+            + "(" + n + ", 1) } };\n";
+    }
+    return text;
+}
+
+// loops for the VM, the operations each iteration does, and its text
+struct Loop {
+    std::string name;
+    size_t operations;
+    std::string text;
+};
+
+std::vector<Loop> loops(size_t iterations)
+{
+    const auto n = std::to_string(iterations);
+    return {
+        { "arithmetic", 3,
+            "let mut x = 0;\n"
+            "for i in 0.."
+                + n
+                + " { x = (x + i * 3) % 1000003; };\n"
+                  "x\n" },
+        { "calls", 3,
+            "func step(x: int, i: int) -> int { (x + i) % 1000003 }\n"
+            "let mut x = 0;\n"
+            "for i in 0.."
+                + n
+                + " { x = step(x, i); };\n"
+                  "x\n" },
+        { "arrays", 6,
+            "let a = array(1024, 0);\n"
+            "for i in 0.."
+                + n
+                + " { a[i % 1024] = a[(i + 1) % 1024] + i; };\n"
+                  "a[0]\n" },
+    };
+}
+
+Compiled compile_program(std::string text)
+{
+    auto compiled = Compiled {};
+    compiled.tokens = Lexer(text).tokenize();
+    compiled.ast = Parser(compiled.tokens).parse();
+    Checker().check(*compiled.ast);
+    compiled.module = Lowering().lower(*compiled.ast);
+    PassManager().optimize(*compiled.module);
+    compiled.program = Compiler().compile(*compiled.module);
+    return compiled;
+}
+
+Result measure(const BenchOptions& options, const std::string& name,
+    const std::string& unit, const std::function<Sample()>& run)
+{
+    run();
+    auto throughputs = std::vector<double> {};
+    for (size_t i = 0; i < options.runs; i++) {
+        const auto sample = run();
+        throughputs.push_back(sample.amount / sample.time.count());
+    }
+    auto result = Result { name, unit };
+    for (const auto throughput : throughputs)
+        result.mean += throughput;
+    result.mean /= static_cast<double>(throughputs.size());
+    for (const auto throughput : throughputs) {
+        const auto deviation = throughput - result.mean;
+        result.stddev += deviation * deviation;
+    }
+    if (throughputs.size() > 1)
+        result.stddev = std::sqrt(
+            result.stddev / static_cast<double>(throughputs.size() - 1));
+    else
+        result.stddev = 0;
+    const auto [min, max]
+        = std::minmax_element(throughputs.begin(), throughputs.end());
+    result.min = *min;
+    result.max = *max;
+    return result;
+}
+
+void write_result(std::ostream& out, const Result& result)
+{
+    out << std::left << std::setw(28) << result.name << std::right
+        << std::fixed << std::setprecision(2) << std::setw(14) << result.mean
+        << " " << std::left << std::setw(8) << result.unit << std::right
+        << " +- " << std::setw(12) << result.stddev << " ("
+        << std::setprecision(1)
+        << (result.mean > 0 ? 100 * result.stddev / result.mean : 0.0)
+        << "%), " << std::setprecision(2) << result.min << " to "
+        << result.max << "\n"
+        << std::flush;
+}
+
+void write_json(std::ostream& out, const BenchOptions& options,
+    const std::vector<Result>& results)
+{
+    out << "{\n"
+        << "  \"version\": \"" << LPL_VERSION << "\",\n"
+        << "  \"size\": " << options.size << ",\n"
+        << "  \"iterations\": " << options.iterations << ",\n"
+        << "  \"runs\": " << options.runs << ",\n"
+        << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto& result = results[i];
+        out << "    {\"name\": \"" << result.name << "\", \"unit\": \""
+            << result.unit << "\", \"mean\": " << result.mean
+            << ", \"stddev\": " << result.stddev << ", \"min\": " << result.min
+            << ", \"max\": " << result.max << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n"
+        << "}\n";
+}
+
+// the value of `"key": ` in a line of the JSON written by `write_json`
+std::optional<std::string> json_field(
+    const std::string& line, const std::string& key)
+{
+    const auto prefix = "\"" + key + "\": ";
+    auto begin = line.find(prefix);
+    if (begin == std::string::npos)
+        return std::nullopt;
+    begin += prefix.size();
+    if (line[begin] == '"') {
+        const auto end = line.find('"', begin + 1);
+        return line.substr(begin + 1, end - begin - 1);
+    }
+    const auto end = line.find_first_of(",}", begin);
+    return line.substr(begin, end - begin);
+}
+
+// the results of a file written by `write_json`, by name
+std::map<std::string, Result> read_json(const std::string& filename)
+{
+    auto file = std::ifstream(filename);
+    if (!file.is_open()) {
+        throw CompileError { "error: file \"" + filename
+            + "\" could not be read\n" };
+    }
+    auto results = std::map<std::string, Result> {};
+    auto line = std::string {};
+    while (std::getline(file, line)) {
+        const auto name = json_field(line, "name");
+        const auto mean = json_field(line, "mean");
+        const auto stddev = json_field(line, "stddev");
+        if (!name || !mean || !stddev)
+            continue;
+        auto& result = results[*name];
+        result.name = *name;
+        result.unit = json_field(line, "unit").value_or("");
+        result.mean = std::strtod(mean->c_str(), nullptr);
+        result.stddev = std::strtod(stddev->c_str(), nullptr);
+    }
+    return results;
+}
+
+// the change of each result from the baseline, a change within twice the
+// deviation of both is most likely noise
+void write_comparison(std::ostream& out,
+    const std::map<std::string, Result>& baseline,
+    const std::vector<Result>& results)
+{
+    out << "\nCompared to the baseline:\n";
+    for (const auto& result : results) {
+        const auto old = baseline.find(result.name);
+        if (old == baseline.end() || old->second.mean <= 0) {
+            out << std::left << std::setw(28) << result.name << std::right
+                << "  not in the baseline\n";
+            continue;
+        }
+        const auto change = result.mean - old->second.mean;
+        const auto noise = 2
+            * std::sqrt(old->second.stddev * old->second.stddev
+                + result.stddev * result.stddev);
+        out << std::left << std::setw(28) << result.name << std::right
+            << std::fixed << std::setprecision(2) << std::setw(14)
+            << old->second.mean << " -> " << std::setw(14) << result.mean
+            << " " << result.unit << " (" << std::showpos
+            << std::setprecision(1) << 100 * change / old->second.mean
+            << std::noshowpos << "%"
+            << (std::abs(change) <= noise ? ", within noise" : "") << ")\n";
+    }
+}
+
+std::vector<Result> run_benchmarks(const BenchOptions& options)
+{
+    const auto selected = [&](const std::string& name) {
+        return name.find(options.filter) != std::string::npos;
+    };
+    auto results = std::vector<Result> {};
+    const auto add = [&](Result result) {
+        write_result(std::cout, result);
+        results.push_back(std::move(result));
+    };
+    const std::pair<std::string, std::function<std::string(size_t)>>
+        generators[] = {
+            { "wide_expressions", wide_expressions },
+            { "deep_nesting", deep_nesting },
+            { "identifier_runs", identifier_runs },
+            { "comment_heavy", comment_heavy },
+            { "string_heavy", string_heavy },
+            { "small_blocks", small_blocks },
+        };
+    for (const auto& [name, generate] : generators) {
+        const auto lex_name = "lex/" + name;
+        const auto parse_name = "parse/" + name;
+        if (!selected(lex_name) && !selected(parse_name))
+            continue;
+        const auto text = generate(options.size);
+        auto tokens = std::vector<Token> {};
+        const auto lex = [&]() {
+            auto copy = text;
+            const auto start = Clock::now();
+            tokens = Lexer(copy).tokenize();
+            return Sample { static_cast<double>(text.size()) / (1 << 20),
+                Clock::now() - start };
+        };
+        if (selected(lex_name))
+            add(measure(options, lex_name, "MB/s", lex));
+        else
+            lex();
+        if (!selected(parse_name))
+            continue;
+        add(measure(options, parse_name, "nodes/s", [&]() {
+            // every function body is parsed up front
+            auto parser = Parser(tokens, true);
+            const auto start = Clock::now();
+            const auto ast = parser.parse();
+            return Sample { static_cast<double>(parser.nodes_count()),
+                Clock::now() - start };
+        }));
+    }
+    for (const auto& loop : loops(options.iterations)) {
+        const auto name = "vm/" + loop.name;
+        if (!selected(name))
+            continue;
+        auto compiled = compile_program(loop.text);
+        add(measure(options, name, "ops/s", [&]() {
+            auto vm = VM(*compiled.program);
+            const auto start = Clock::now();
+            vm.run();
+            return Sample { static_cast<double>(
+                                loop.operations * options.iterations),
+                Clock::now() - start };
+        }));
+    }
+    return results;
+}
+
+std::optional<BenchOptions> parse_bench_options(
+    const std::vector<std::string>& args)
+{
+    const auto value = [](const std::string& arg, const std::string& prefix)
+        -> std::optional<std::string> {
+        if (arg.rfind(prefix, 0) != 0)
+            return std::nullopt;
+        return arg.substr(prefix.size());
+    };
+    auto options = BenchOptions {};
+    for (const auto& arg : args) {
+        if (const auto size = value(arg, "--size=")) {
+            options.size = std::strtoull(size->c_str(), nullptr, 10);
+        } else if (const auto iterations = value(arg, "--iterations=")) {
+            options.iterations
+                = std::strtoull(iterations->c_str(), nullptr, 10);
+        } else if (const auto runs = value(arg, "--runs=")) {
+            options.runs = std::strtoull(runs->c_str(), nullptr, 10);
+        } else if (const auto filter = value(arg, "--filter=")) {
+            options.filter = *filter;
+        } else if (const auto output = value(arg, "--output=")) {
+            options.output = *output;
+        } else if (const auto compare = value(arg, "--compare=")) {
+            options.compare = *compare;
+        } else {
+            return std::nullopt;
+        }
+    }
+    options.runs = std::max(options.runs, size_t { 1 });
+    return options;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    const auto options = parse_bench_options(
+        std::vector<std::string>(argv + 1, argv + argc));
+    if (!options) {
+        std::cerr << "USAGE: lpl_bench [--size=<bytes>] [--iterations=<n>] "
+                     "[--runs=<n>] [--filter=<name>] [--output=<json>] "
+                     "[--compare=<json>]\n";
+        return 1;
+    }
+    try {
+        const auto baseline = options->compare
+            ? std::optional(read_json(*options->compare))
+            : std::nullopt;
+        const auto results = run_benchmarks(*options);
+        auto file = std::ofstream(options->output);
+        if (!file.is_open()) {
+            throw CompileError { "error: file \"" + options->output
+                + "\" could not be written\n" };
+        }
+        write_json(file, *options, results);
+        if (baseline)
+            write_comparison(std::cout, *baseline, results);
+    } catch (const CompileError& error) {
+        std::cerr << error.what();
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,14 @@
+# Writes OUTPUT, a header defining LPL_BUILD_ID as a hash of SOURCES, the
+# compiler's own sources, so whatever changes them changes the id, see
+# CMakeLists.txt.
+#
+#   cmake -DSOURCES=<files> -DOUTPUT=<header> -P build_id.cmake
+
+set(hashes "")
+foreach(source IN LISTS SOURCES)
+  file(SHA256 ${source} hash)
+  string(APPEND hashes ${hash})
+endforeach()
+string(SHA256 id "${hashes}")
+string(SUBSTRING ${id} 0 16 id)
+file(WRITE ${OUTPUT} "#pragma once\n\n#define LPL_BUILD_ID \"${id}\"\n")
@@ -0,0 +1,250 @@
+#include "builtins.h"
+#include "array.h"
+#include "kernels.h"
+#include "str.h"
+#include "value.h"
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+[[noreturn]] void runtime_error_and_exit(const std::string& msg)
+{
+    std::cerr << "RuntimeError: " << msg << "\n";
+    exit(1);
+}
+
+Value builtin_print(const Value* args, size_t args_count)
+{
+    for (size_t i = 0; i < args_count; i++)
+        std::cout << args[i].to_string();
+    return Value::make_unit();
+}
+
+Value builtin_println(const Value* args, size_t args_count)
+{
+    builtin_print(args, args_count);
+    std::cout << "\n";
+    return Value::make_unit();
+}
+
+Value builtin_len(const Value* args, size_t)
+{
+    switch (args[0].type) {
+    case ValueType::Array: return Value::make_int(args[0].array_value->length);
+    case ValueType::String:
+        return Value::make_int(args[0].string_value->length);
+    default:
+        runtime_error_and_exit("`len` expected `Array` or `String`, got `"
+            + value_type_to_string(args[0].type) + "`");
+    }
+}
+
+// an array of `length` copies of `value`, of the type of `value`
+Value builtin_array(const Value* args, size_t)
+{
+    if (args[0].type != ValueType::Int)
+        runtime_error_and_exit("`array` expected `Int` length, got `"
+            + value_type_to_string(args[0].type) + "`");
+    const auto array = Array::make(args[1].type, args[0].int_value);
+    if (!array)
+        runtime_error_and_exit(
+            "invalid array length " + std::to_string(args[0].int_value));
+    for (int64_t i = 0; i < array->length; i++)
+        array->set(i, args[1]);
+    return Value::make_array(array);
+}
+
+std::string describe(const Value& value)
+{
+    if (value.type == ValueType::Array)
+        return std::string { "`Array` of `" }
+            + value_type_to_string(value.array_value->element_type) + "`";
+    return std::string { "`" } + value_type_to_string(value.type) + "`";
+}
+
+// the array of `Int`s or `Float`s a reduction is over
+const Array& numbers(const std::string& name, const Value& value)
+{
+    if (value.type != ValueType::Array
+        || !Array::is_unboxed(value.array_value->element_type))
+        runtime_error_and_exit("`" + name
+            + "` expected `Array` of `Int` or `Float`, got " + describe(value));
+    return *value.array_value;
+}
+
+Value builtin_sum(const Value* args, size_t)
+{
+    const auto& array = numbers("sum", args[0]);
+    const auto length = static_cast<size_t>(array.length);
+    if (array.element_type == ValueType::Int)
+        return Value::make_int(Kernels::sum(array.ints(), length));
+    return Value::make_float(Kernels::sum(array.floats(), length));
+}
+
+template <bool is_min> Value extremum(const std::string& name, const Value& value)
+{
+    const auto& array = numbers(name, value);
+    const auto length = static_cast<size_t>(array.length);
+    if (length == 0)
+        runtime_error_and_exit("`" + name + "` of an empty array");
+    if (array.element_type == ValueType::Int)
+        return Value::make_int(is_min ? Kernels::min(array.ints(), length)
+                                      : Kernels::max(array.ints(), length));
+    return Value::make_float(is_min ? Kernels::min(array.floats(), length)
+                                    : Kernels::max(array.floats(), length));
+}
+
+Value builtin_min(const Value* args, size_t)
+{
+    return extremum<true>("min", args[0]);
+}
+
+Value builtin_max(const Value* args, size_t)
+{
+    return extremum<false>("max", args[0]);
+}
+
+Value builtin_dot(const Value* args, size_t)
+{
+    const auto& left = numbers("dot", args[0]);
+    const auto& right = numbers("dot", args[1]);
+    if (left.element_type != right.element_type)
+        runtime_error_and_exit("`dot` expected arrays of the same type, got "
+            + describe(args[0]) + " and " + describe(args[1]));
+    if (left.length != right.length)
+        runtime_error_and_exit("mismatched array lengths "
+            + std::to_string(left.length) + " and "
+            + std::to_string(right.length));
+    const auto length = static_cast<size_t>(left.length);
+    if (left.element_type == ValueType::Int)
+        return Value::make_int(Kernels::dot(left.ints(), right.ints(), length));
+    return Value::make_float(
+        Kernels::dot(left.floats(), right.floats(), length));
+}
+
+const String& string_argument(const std::string& name, const Value& value)
+{
+    if (value.type != ValueType::String)
+        runtime_error_and_exit("`" + name + "` expected `String`, got `"
+            + value_type_to_string(value.type) + "`");
+    return *value.string_value;
+}
+
+// the index of the first occurrence of `needle` from `start` on, or
+// `Kernels::not_found`
+size_t find_from(std::string_view haystack, std::string_view needle,
+    size_t start)
+{
+    const auto found = Kernels::find(haystack.data() + start,
+        haystack.size() - start, needle.data(), needle.size());
+    return found == Kernels::not_found ? found : start + found;
+}
+
+// the index of the first occurrence of a substring, or -1
+Value builtin_find(const Value* args, size_t)
+{
+    const auto found = find_from(string_argument("find", args[0]).view(),
+        string_argument("find", args[1]).view(), 0);
+    return Value::make_int(
+        found == Kernels::not_found ? -1 : static_cast<int64_t>(found));
+}
+
+Value builtin_contains(const Value* args, size_t)
+{
+    return Value::make_bool(
+        find_from(string_argument("contains", args[0]).view(),
+            string_argument("contains", args[1]).view(), 0)
+        != Kernels::not_found);
+}
+
+Value builtin_starts_with(const Value* args, size_t)
+{
+    const auto& string = string_argument("starts_with", args[0]);
+    const auto& prefix = string_argument("starts_with", args[1]);
+    const auto size = static_cast<size_t>(prefix.length);
+    return Value::make_bool(prefix.length <= string.length
+        && Kernels::mismatch(string.view().data(), prefix.view().data(), size)
+            == size);
+}
+
+// the parts of a string between the occurrences of a separator, which can't
+// be empty
+Value builtin_split(const Value* args, size_t)
+{
+    const auto string = string_argument("split", args[0]).view();
+    const auto separator = string_argument("split", args[1]).view();
+    if (separator.empty())
+        runtime_error_and_exit("`split` expected a non-empty separator");
+    auto parts = std::vector<const String*> {};
+    auto start = size_t { 0 };
+    for (auto found = find_from(string, separator, start);
+         found != Kernels::not_found;
+         found = find_from(string, separator, start)) {
+        parts.push_back(String::make(string.substr(start, found - start)));
+        start = found + separator.size();
+    }
+    parts.push_back(String::make(string.substr(start)));
+    const auto array
+        = Array::make(ValueType::String, static_cast<int64_t>(parts.size()));
+    for (size_t i = 0; i < parts.size(); i++)
+        array->set(static_cast<int64_t>(i), Value::make_string(parts[i]));
+    return Value::make_array(array);
+}
+
+// every occurrence of a pattern, which can't be empty, replaced from left to
+// right
+Value builtin_replace(const Value* args, size_t)
+{
+    const auto string = string_argument("replace", args[0]).view();
+    const auto pattern = string_argument("replace", args[1]).view();
+    const auto replacement = string_argument("replace", args[2]).view();
+    if (pattern.empty())
+        runtime_error_and_exit("`replace` expected a non-empty pattern");
+    auto found = find_from(string, pattern, 0);
+    if (found == Kernels::not_found)
+        return args[0];
+    auto result = std::string {};
+    auto start = size_t { 0 };
+    for (; found != Kernels::not_found;
+         found = find_from(string, pattern, start)) {
+        result.append(string.substr(start, found - start));
+        result.append(replacement);
+        start = found + pattern.size();
+    }
+    result.append(string.substr(start));
+    return Value::make_string(String::make(result));
+}
+
+}
+
+const std::vector<Builtin>& builtins()
+{
+    static const auto builtins = std::vector<Builtin> {
+        Builtin("print", -1, builtin_print, ValueType::Unit),
+        Builtin("println", -1, builtin_println, ValueType::Unit),
+        Builtin("len", 1, builtin_len, ValueType::Int),
+        Builtin("array", 2, builtin_array, ValueType::Array),
+        Builtin("sum", 1, builtin_sum),
+        Builtin("min", 1, builtin_min),
+        Builtin("max", 1, builtin_max),
+        Builtin("dot", 2, builtin_dot),
+        Builtin("find", 2, builtin_find, ValueType::Int),
+        Builtin("contains", 2, builtin_contains, ValueType::Bool),
+        Builtin("starts_with", 2, builtin_starts_with, ValueType::Bool),
+        Builtin("split", 2, builtin_split, ValueType::Array),
+        Builtin("replace", 3, builtin_replace, ValueType::String),
+    };
+    return builtins;
+}
+
+const Builtin* find_builtin(const std::string& name)
+{
+    for (const auto& builtin : builtins())
+        if (builtin.name == name)
+            return &builtin;
+    return nullptr;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "value.h"
+#include <string>
+#include <vector>
+
+const std::vector<Builtin>& builtins();
+const Builtin* find_builtin(const std::string& name);
@@ -0,0 +1,109 @@
+#include "bytecode.h"
+#include "str.h"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+using Bytecode::Op;
+
+int64_t Bytecode::switch_key(const Value& value)
+{
+    switch (value.type) {
+    case ValueType::Char: return value.char_value;
+    case ValueType::Bool: return value.bool_value;
+    case ValueType::String:
+        return static_cast<int64_t>(value.string_value->hash);
+    default: return value.int_value;
+    }
+}
+
+Op Bytecode::int_variant(Op op)
+{
+    switch (op) {
+    case Op::Add: return Op::AddInt;
+    case Op::Subtract: return Op::SubtractInt;
+    case Op::Multiply: return Op::MultiplyInt;
+    case Op::Divide: return Op::DivideInt;
+    case Op::Modulus: return Op::ModulusInt;
+    case Op::Exponentiate: return Op::ExponentiateInt;
+    case Op::BitwiseAnd: return Op::BitwiseAndInt;
+    case Op::BitwiseOr: return Op::BitwiseOrInt;
+    case Op::BitwiseXor: return Op::BitwiseXorInt;
+    case Op::BitwiseLeftShift: return Op::BitwiseLeftShiftInt;
+    case Op::BitwiseRightShift: return Op::BitwiseRightShiftInt;
+    case Op::LessThan: return Op::LessThanInt;
+    case Op::LessThanEqual: return Op::LessThanEqualInt;
+    case Op::GreaterThan: return Op::GreaterThanInt;
+    case Op::GreaterThanEqual: return Op::GreaterThanEqualInt;
+    case Op::Equal: return Op::EqualInt;
+    case Op::NotEqual: return Op::NotEqualInt;
+    default: return op;
+    }
+}
+
+Op Bytecode::float_variant(Op op)
+{
+    switch (op) {
+    case Op::Add: return Op::AddFloat;
+    case Op::Subtract: return Op::SubtractFloat;
+    case Op::Multiply: return Op::MultiplyFloat;
+    case Op::Divide: return Op::DivideFloat;
+    case Op::Modulus: return Op::ModulusFloat;
+    case Op::Exponentiate: return Op::ExponentiateFloat;
+    case Op::LessThan: return Op::LessThanFloat;
+    case Op::LessThanEqual: return Op::LessThanEqualFloat;
+    case Op::GreaterThan: return Op::GreaterThanFloat;
+    case Op::GreaterThanEqual: return Op::GreaterThanEqualFloat;
+    case Op::Equal: return Op::EqualFloat;
+    case Op::NotEqual: return Op::NotEqualFloat;
+    default: return op;
+    }
+}
+
+Op Bytecode::generic_variant(Op op)
+{
+    switch (op) {
+    case Op::AddInt:
+    case Op::AddFloat: return Op::Add;
+    case Op::SubtractInt:
+    case Op::SubtractFloat: return Op::Subtract;
+    case Op::MultiplyInt:
+    case Op::MultiplyFloat: return Op::Multiply;
+    case Op::DivideInt:
+    case Op::DivideFloat: return Op::Divide;
+    case Op::ModulusInt:
+    case Op::ModulusFloat: return Op::Modulus;
+    case Op::ExponentiateInt:
+    case Op::ExponentiateFloat: return Op::Exponentiate;
+    case Op::BitwiseAndInt: return Op::BitwiseAnd;
+    case Op::BitwiseOrInt: return Op::BitwiseOr;
+    case Op::BitwiseXorInt: return Op::BitwiseXor;
+    case Op::BitwiseLeftShiftInt: return Op::BitwiseLeftShift;
+    case Op::BitwiseRightShiftInt: return Op::BitwiseRightShift;
+    case Op::LessThanInt:
+    case Op::LessThanFloat: return Op::LessThan;
+    case Op::LessThanEqualInt:
+    case Op::LessThanEqualFloat: return Op::LessThanEqual;
+    case Op::GreaterThanInt:
+    case Op::GreaterThanFloat: return Op::GreaterThan;
+    case Op::GreaterThanEqualInt:
+    case Op::GreaterThanEqualFloat: return Op::GreaterThanEqual;
+    case Op::EqualInt:
+    case Op::EqualFloat: return Op::Equal;
+    case Op::NotEqualInt:
+    case Op::NotEqualFloat: return Op::NotEqual;
+    default: return op;
+    }
+}
+
+std::optional<Bytecode::SourcePosition> Bytecode::Function::position_of(
+    size_t ip) const
+{
+    const auto entry = std::upper_bound(line_table.begin(), line_table.end(),
+        ip, [](size_t ip, const LineTableEntry& entry) {
+            return ip < entry.ip;
+        });
+    if (entry == line_table.begin())
+        return std::nullopt;
+    return std::prev(entry)->position;
+}
@@ -0,0 +1,281 @@
+#pragma once
+
+#include "kernels.h"
+#include "value.h"
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct JitContext;
+
+namespace Bytecode {
+
+using NativeFunction = int64_t (*)(JitContext* context, const int64_t* args);
+using Trampoline = void (*)(void* context);
+
+enum class Op : uint8_t {
+    PushConstant,
+    PushUnit,
+    Pop,
+    Dup,
+    LoadLocal,
+    StoreLocal,
+    LoadGlobal,
+    StoreGlobal,
+    DefineGlobal,
+    Jump,
+    JumpIfFalse,
+    // pop a value and jump to where `switch_tables[operand]` goes for it,
+    // see `SwitchTable`
+    TableSwitch,
+    LookupSwitch,
+    StringSwitch,
+    Call,
+    CallGlobal,
+    // calls in tail position, these replace the current frame when calling a
+    // function and behave like their non-tail variants otherwise
+    TailCall,
+    TailCallGlobal,
+    Return,
+    // fails unless the value on top of the stack has the type `operand`
+    CheckType,
+    // pop `operand` elements and push an array of them
+    NewArray,
+    // pop an index and an array and push the element, or pop a value too and
+    // store it; the in bounds variants skip the bounds check, which the
+    // compiler proved redundant
+    Index,
+    IndexInBounds,
+    StoreIndex,
+    StoreIndexInBounds,
+    // pops the operands of `kernels[operand]` and pushes its result
+    Map,
+    LogicalNot,
+    BitwiseNot,
+    Plus,
+    Negate,
+
+    // generic binary operations, these record the operand types they see and
+    // quicken themselves into one of the specialized variants below; their
+    // operand is the frame slot plus one a resulting array is made in, or 0
+    // to make it on the heap, see `Gc::Slot`
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    Modulus,
+    Exponentiate,
+    BitwiseAnd,
+    BitwiseOr,
+    BitwiseXor,
+    BitwiseLeftShift,
+    BitwiseRightShift,
+    LessThan,
+    LessThanEqual,
+    GreaterThan,
+    GreaterThanEqual,
+    Equal,
+    NotEqual,
+
+    // int-int specializations
+    AddInt,
+    SubtractInt,
+    MultiplyInt,
+    DivideInt,
+    ModulusInt,
+    ExponentiateInt,
+    BitwiseAndInt,
+    BitwiseOrInt,
+    BitwiseXorInt,
+    BitwiseLeftShiftInt,
+    BitwiseRightShiftInt,
+    LessThanInt,
+    LessThanEqualInt,
+    GreaterThanInt,
+    GreaterThanEqualInt,
+    EqualInt,
+    NotEqualInt,
+
+    // float-float specializations
+    AddFloat,
+    SubtractFloat,
+    MultiplyFloat,
+    DivideFloat,
+    ModulusFloat,
+    ExponentiateFloat,
+    LessThanFloat,
+    LessThanEqualFloat,
+    GreaterThanFloat,
+    GreaterThanEqualFloat,
+    EqualFloat,
+    NotEqualFloat,
+};
+
+std::string op_to_string(Op op);
+
+// the key switches look values up by, ints, chars and bools are their own
+// keys and strings are keyed by their hash
+int64_t switch_key(const Value& value);
+
+// maps generic binary operations to their int-int and float-float
+// specializations and back, ops without such a variant map to themselves
+Op int_variant(Op op);
+Op float_variant(Op op);
+Op generic_variant(Op op);
+
+// type feedback recorded by generic binary operations
+enum class Feedback : uint8_t {
+    None,
+    IntInt,
+    FloatFloat,
+    Other,
+};
+
+struct Instruction {
+    Instruction(Op op, uint32_t operand = 0)
+        : op { op }
+        , operand { operand }
+    {
+    }
+
+    std::string to_string() const;
+
+    Op op;
+    Feedback feedback { Feedback::None };
+    uint8_t feedback_hits { 0 };
+    uint8_t deopts { 0 };
+    uint32_t operand;
+};
+
+struct SourcePosition {
+    bool operator==(const SourcePosition& other) const
+    {
+        return row == other.row && col == other.col;
+    }
+    bool operator!=(const SourcePosition& other) const
+    {
+        return !(*this == other);
+    }
+
+    uint32_t row { 0 };
+    uint32_t col { 0 };
+};
+
+// the instructions from `ip` up to the next entry's originate from `position`
+struct LineTableEntry {
+    uint32_t ip;
+    SourcePosition position;
+};
+
+struct Function;
+
+// a resolved callee, exactly one of the pointers is set
+struct CallTarget {
+    const Builtin* builtin { nullptr };
+    Function* function { nullptr };
+};
+
+// inline cache attached to a `Call` or `CallGlobal` instruction, or to
+// their tail call variants.
+//
+// `Call` takes its callee from the stack and caches up to `max_targets`
+// callees whose kind and arity have already been checked.
+// `CallGlobal` calls the global binding `global` directly and caches the
+// single target it resolved to, valid as long as the binding's version is
+// `global_version`. Reassigning the binding bumps its version, which
+// invalidates the cache.
+struct CallCache {
+    static constexpr size_t max_targets = 4;
+
+    CallCache(uint32_t args_count, std::optional<uint32_t> global)
+        : args_count { args_count }
+        , global { global.value_or(0) }
+    {
+    }
+
+    const uint32_t args_count;
+    const uint32_t global;
+    // the frame slot plus one the array made by a call to `array` is made
+    // in, or 0
+    uint32_t slot { 0 };
+    uint32_t global_version { std::numeric_limits<uint32_t>::max() };
+    std::array<CallTarget, max_targets> targets {};
+    uint8_t targets_count { 0 };
+};
+
+// Where a switch jumps to for the values of `type`, values of other types
+// and keys without a target go to `default_target`.
+//
+// A `TableSwitch` goes to `targets[key - first]` for keys up to `first +
+// targets.size()`, in constant time. A `LookupSwitch` binary searches the
+// sorted `keys`, and goes to `targets[i]` for `keys[i]`. A `StringSwitch`
+// does the same and then compares the string to `strings[i]`, its keys can
+// repeat when they collide. Keys are the values' `switch_key`.
+struct SwitchTable {
+    ValueType type;
+    int64_t first { 0 };
+    std::vector<int64_t> keys {};
+    std::vector<const String*> strings {};
+    std::vector<uint32_t> targets {};
+    uint32_t default_target { 0 };
+};
+
+// the element-wise expression of a `Map`, and the frame slot plus one its
+// result is made in, or 0
+struct Kernel {
+    Kernels::Expression expression;
+    uint32_t slot { 0 };
+};
+
+struct Function {
+    Function(const std::string name, uint32_t arity)
+        : name { name }
+        , arity { arity }
+    {
+    }
+
+    std::string to_string() const;
+    // returns `std::nullopt` for instructions without a known position
+    std::optional<SourcePosition> position_of(size_t ip) const;
+
+    const std::string name;
+    const uint32_t arity;
+    std::vector<Instruction> code {};
+    std::vector<Value> constants {};
+    std::vector<CallCache> call_caches {};
+    std::vector<SwitchTable> switch_tables {};
+    std::vector<Kernel> kernels {};
+    size_t locals_count { 0 };
+    // for the arrays which don't escape, see `Gc::Slot`
+    uint32_t slots_count { 0 };
+    // position of the declaration
+    SourcePosition position {};
+    // sorted by `ip`, with an entry wherever the position changes
+    std::vector<LineTableEntry> line_table {};
+
+    // baseline JIT state, see jit.h
+    uint32_t calls { 0 };
+    uint32_t bailouts { 0 };
+    bool jit_failed { false };
+    NativeFunction native { nullptr };
+    ValueType native_return_type { ValueType::Unit };
+    Trampoline trampoline { nullptr };
+};
+
+struct Program {
+    std::string to_string() const;
+
+    // name of the source file, used when reporting positions
+    std::string filename {};
+    std::unique_ptr<Function> main {};
+    // top level functions and the globals they are bound to
+    std::vector<std::unique_ptr<Function>> functions {};
+    std::vector<uint32_t> function_globals {};
+    std::vector<std::string> globals {};
+};
+
+}
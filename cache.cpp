@@ -0,0 +1,235 @@
+#include "cache.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#if defined(__unix__)
+#define LPL_CACHE_SUPPORTED 1
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#else
+#define LPL_CACHE_SUPPORTED 0
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// 64-bit FNV-1a, with another offset basis for the check stored in entries
+uint64_t hash(const std::string& text, uint64_t basis = 0xcbf29ce484222325)
+{
+    auto result = basis;
+    for (const auto c : text) {
+        result ^= static_cast<unsigned char>(c);
+        result *= 0x100000001b3;
+    }
+    return result;
+}
+
+// what an entry's `key` file holds, keys include whole programs, so rather
+// than the key, a second hash of it and its length
+std::string key_check(const std::string& key)
+{
+    auto result = std::stringstream {};
+    result << std::hex << hash(key, 0x84222325cbf29ce4) << " " << std::dec
+           << key.size() << "\n";
+    return result.str();
+}
+
+std::optional<fs::path> cache_directory()
+{
+    if (const auto directory = std::getenv("LPL_CACHE_DIR"))
+        return fs::path(directory);
+    if (const auto directory = std::getenv("XDG_CACHE_HOME"))
+        return fs::path(directory) / "lpl";
+    if (const auto home = std::getenv("HOME"))
+        return fs::path(home) / ".cache" / "lpl";
+    return std::nullopt;
+}
+
+std::string read_file(const fs::path& path)
+{
+    auto file = std::ifstream(path, std::ios::binary);
+    auto result = std::stringstream {};
+    result << file.rdbuf();
+    return result.str();
+}
+
+uint64_t directory_size(const fs::path& directory)
+{
+    auto size = uint64_t { 0 };
+    auto error = std::error_code {};
+    for (const auto& entry : fs::recursive_directory_iterator(directory, error))
+        if (entry.is_regular_file(error))
+            size += entry.file_size(error);
+    return size;
+}
+
+}
+
+ArtifactCache::ArtifactCache()
+{
+#if LPL_CACHE_SUPPORTED
+    if (std::getenv("LPL_NO_CACHE") != nullptr)
+        return;
+    const auto directory = cache_directory();
+    if (!directory)
+        return;
+    auto error = std::error_code {};
+    fs::create_directories(*directory, error);
+    if (error)
+        return;
+    if (const auto max_size = std::getenv("LPL_CACHE_MAX_SIZE"))
+        m_max_size = std::strtoull(max_size, nullptr, 10);
+    // not inherited by the executables run with `execv`, which are mapped
+    // by then, so evicting them can't break them
+    m_lock = open(
+        (*directory / "lock").c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (m_lock < 0 || flock(m_lock, LOCK_SH) != 0)
+        return;
+    m_directory = *directory;
+    m_enabled = true;
+#endif
+}
+
+ArtifactCache::~ArtifactCache()
+{
+#if LPL_CACHE_SUPPORTED
+    if (m_lock >= 0)
+        close(m_lock);
+#endif
+}
+
+std::optional<fs::path> ArtifactCache::lookup(const std::string& key)
+{
+    if (!m_enabled)
+        return std::nullopt;
+    const auto entry = entry_directory(key);
+    const auto lock = std::lock_guard(m_mutex);
+    if (!matches(entry, key))
+        return std::nullopt;
+    m_used.insert(entry);
+    auto error = std::error_code {};
+    fs::last_write_time(entry / "key", fs::file_time_type::clock::now(), error);
+    return entry;
+}
+
+std::optional<fs::path> ArtifactCache::insert(
+    const std::string& key, const std::function<bool(const fs::path&)>& build)
+{
+    if (!m_enabled)
+        return std::nullopt;
+    const auto entry = entry_directory(key);
+#if LPL_CACHE_SUPPORTED
+    const auto building = m_directory
+        / ("tmp-" + std::to_string(getpid()) + "-"
+            + entry.filename().string());
+#else
+    const auto building = m_directory / ("tmp-" + entry.filename().string());
+#endif
+    auto error = std::error_code {};
+    fs::remove_all(building, error);
+    fs::create_directories(building, error);
+    if (error)
+        return std::nullopt;
+    {
+        auto key_file = std::ofstream(building / "key", std::ios::binary);
+        key_file << key_check(key);
+    }
+    if (!build(building)) {
+        fs::remove_all(building, error);
+        return std::nullopt;
+    }
+    const auto lock = std::lock_guard(m_mutex);
+    // losing the race to another build of the same key leaves its entry
+    fs::rename(building, entry, error);
+    if (error) {
+        // the build is reaped by the first eviction after this process
+        if (!matches(entry, key))
+            return building;
+        fs::remove_all(building, error);
+    }
+    m_used.insert(entry);
+    evict();
+    return entry;
+}
+
+fs::path ArtifactCache::entry_directory(const std::string& key) const
+{
+    auto name = std::stringstream {};
+    name << std::hex << hash(key);
+    return m_directory / name.str();
+}
+
+bool ArtifactCache::matches(const fs::path& entry, const std::string& key)
+{
+    auto error = std::error_code {};
+    return fs::exists(entry / "key", error)
+        && read_file(entry / "key") == key_check(key);
+}
+
+void ArtifactCache::evict()
+{
+#if LPL_CACHE_SUPPORTED
+    if (flock(m_lock, LOCK_EX | LOCK_NB) != 0)
+        return;
+    struct Entry {
+        fs::path path;
+        fs::file_time_type last_used;
+        uint64_t size;
+    };
+    auto entries = std::vector<Entry> {};
+    auto total_size = uint64_t { 0 };
+    auto error = std::error_code {};
+    const auto own_builds = "tmp-" + std::to_string(getpid()) + "-";
+    auto stale_builds = std::vector<fs::path> {};
+    for (const auto& entry : fs::directory_iterator(m_directory, error)) {
+        const auto name = entry.path().filename().string();
+        if (!entry.is_directory(error))
+            continue;
+        // no other process uses the cache, so the builds of others were left
+        // by processes which died, or which lost the race for an entry whose
+        // name collided with another key's and ran their build from there
+        if (name.rfind("tmp-", 0) == 0) {
+            if (name.rfind(own_builds, 0) != 0)
+                stale_builds.push_back(entry.path());
+            continue;
+        }
+        if (m_used.count(entry.path()))
+            continue;
+        const auto last_used = fs::last_write_time(entry.path() / "key", error);
+        const auto size = directory_size(entry.path());
+        entries.push_back({ entry.path(), last_used, size });
+        total_size += size;
+    }
+    for (const auto& build : stale_builds)
+        fs::remove_all(build, error);
+    std::sort(entries.begin(), entries.end(),
+        [](const Entry& a, const Entry& b) {
+            return a.last_used < b.last_used;
+        });
+    for (const auto& entry : entries) {
+        if (total_size <= m_max_size)
+            break;
+        fs::remove_all(entry.path, error);
+        total_size -= entry.size;
+    }
+    flock(m_lock, LOCK_SH);
+#endif
+}
+
+ArtifactCache& artifact_cache()
+{
+    static auto cache = ArtifactCache {};
+    return cache;
+}
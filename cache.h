@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+
+// Content addressed cache for executables built by the C backend.
+//
+// Entries live in `$LPL_CACHE_DIR`, or `$XDG_CACHE_HOME/lpl`, or
+// `~/.cache/lpl`, in a directory named after the hash of their key. A second
+// hash of the key is stored alongside, so a collision of the first is a miss
+// rather than a wrong program. Entries are built in a private directory and
+// renamed into place, so concurrent builds of the same program are safe, and
+// the first one wins. There is one cache per process, see `artifact_cache()`,
+// which holds a shared lock on the cache until the process exits or execs, so
+// running an executable from the cache is safe. Eviction only happens when it
+// gets an exclusive lock without waiting, that is when no other process uses
+// the cache, and never removes the entries this process looked up or inserted.
+// Least recently used entries are evicted once the cache exceeds
+// `$LPL_CACHE_MAX_SIZE` bytes. Setting `LPL_NO_CACHE` disables it.
+class ArtifactCache {
+public:
+    static constexpr uint64_t default_max_size = 256 * 1024 * 1024;
+
+    ArtifactCache();
+    ~ArtifactCache();
+    ArtifactCache(const ArtifactCache&) = delete;
+    ArtifactCache& operator=(const ArtifactCache&) = delete;
+
+    bool enabled() const { return m_enabled; }
+    // returns the entry's directory and marks it as recently used
+    std::optional<std::filesystem::path> lookup(const std::string& key);
+    // `build` fills the directory it is given, returns the entry's directory
+    // or `std::nullopt` when building fails
+    std::optional<std::filesystem::path> insert(const std::string& key,
+        const std::function<bool(const std::filesystem::path&)>& build);
+
+private:
+    std::filesystem::path entry_directory(const std::string& key) const;
+    bool matches(const std::filesystem::path& entry, const std::string& key);
+    // called with `m_mutex` held
+    void evict();
+
+    bool m_enabled { false };
+    std::filesystem::path m_directory {};
+    uint64_t m_max_size { default_max_size };
+    int m_lock { -1 };
+    // guards `m_used` and eviction, the files of a batch are emitted on
+    // several threads
+    std::mutex m_mutex {};
+    // the entries this process handed out, which aren't evicted
+    std::set<std::filesystem::path> m_used {};
+};
+
+// the process' cache, created on first use
+ArtifactCache& artifact_cache();
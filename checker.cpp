@@ -0,0 +1,446 @@
+#include "checker.h"
+#include "builtins.h"
+#include "error.h"
+#include "ir.h"
+#include "lowering.h"
+#include "parser.h"
+#include <array>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+void Checker::check(Parsed::Block& program)
+{
+    auto funcs = std::vector<Parsed::Func*> {};
+    for (const auto& statement : program.statements) {
+        if (statement->statement_type() == Parsed::StatementType::Let) {
+            const auto& let = static_cast<const Parsed::Let&>(*statement);
+            m_let_globals.insert(parameter_name(*let.parameter));
+            if (let.parameter->type)
+                m_globals[parameter_name(*let.parameter)]
+                    = annotation(**let.parameter->type);
+        }
+        if (statement->statement_type() != Parsed::StatementType::Func)
+            continue;
+        auto& func = static_cast<Parsed::Func&>(*statement);
+        funcs.push_back(&func);
+        auto signature = Signature {};
+        for (const auto& parameter : func.parameters)
+            signature.parameters.push_back(parameter_type(*parameter));
+        signature.is_annotated = func.return_type.has_value();
+        if (func.return_type)
+            signature.result = annotation(**func.return_type);
+        m_signatures[func.name] = std::move(signature);
+    }
+
+    // the inferred return types grow from unknown as the functions they
+    // depend on are inferred, until nothing changes, each round fixes at
+    // least one function unless they only depend on each other
+    for (size_t round = 0; round <= funcs.size(); round++) {
+        auto changed = false;
+        for (const auto func : funcs) {
+            const auto result = check_func(*func);
+            auto& signature = m_signatures.at(func->name);
+            if (!signature.is_annotated && signature.result != result) {
+                signature.result = result;
+                changed = true;
+            }
+        }
+        if (!changed)
+            break;
+    }
+
+    m_locals.clear();
+    m_scopes.clear();
+    for (const auto& statement : program.statements) {
+        if (statement->statement_type() == Parsed::StatementType::Let)
+            check_global_let(static_cast<Parsed::Let&>(*statement));
+        else if (statement->statement_type() != Parsed::StatementType::Func)
+            check_statement(*statement);
+    }
+    if (program.value)
+        check_expression(**program.value, std::nullopt);
+}
+
+ValueType Checker::annotation(const Parsed::Type& type)
+{
+    switch (type.type_type()) {
+    case Parsed::TypeType::Symbol: {
+        const auto& name = static_cast<const Parsed::SymbolType&>(type).value;
+        if (name == "unit")
+            return ValueType::Unit;
+        if (name == "int")
+            return ValueType::Int;
+        if (name == "float")
+            return ValueType::Float;
+        if (name == "char")
+            return ValueType::Char;
+        if (name == "bool")
+            return ValueType::Bool;
+        if (name == "string")
+            return ValueType::String;
+        if (name == "func")
+            return ValueType::Function;
+        if (name == "array")
+            return ValueType::Array;
+        error_and_exit(type, "unknown type `" + name + "`");
+    }
+    }
+    std::cerr << "internal: unexhaustive match at " << __FILE__ << ":"
+              << __LINE__ << ": in " << __func__ << "\n";
+    exit(1);
+}
+
+Checker::Type Checker::check_func(Parsed::Func& func)
+{
+    m_locals.clear();
+    m_scopes.clear();
+    const auto& signature = m_signatures.at(func.name);
+    for (const auto& parameter : func.parameters)
+        declare_local(*parameter, std::nullopt);
+    const auto expected
+        = signature.is_annotated ? signature.result : std::nullopt;
+    return check_expression(func.body(), expected);
+}
+
+void Checker::check_statement(Parsed::Statement& statement)
+{
+    switch (statement.statement_type()) {
+    case Parsed::StatementType::Func:
+        // rejected by lowering
+        return;
+    case Parsed::StatementType::Let:
+        return check_let(static_cast<Parsed::Let&>(statement));
+    case Parsed::StatementType::Assignment:
+        return check_assignment(static_cast<Parsed::Assignment&>(statement));
+    case Parsed::StatementType::Expression:
+        check_expression(
+            *static_cast<Parsed::ExpressionStatement&>(statement).expression,
+            std::nullopt);
+        return;
+    }
+    std::cerr << "internal: unexhaustive match at " << __FILE__ << ":"
+              << __LINE__ << ": in " << __func__ << "\n";
+    exit(1);
+}
+
+void Checker::check_let(Parsed::Let& let)
+{
+    const auto expected = parameter_type(*let.parameter);
+    auto type = Type(ValueType::Unit);
+    if (let.value)
+        type = check_expression(**let.value, expected);
+    else
+        expect(let, expected, type);
+    declare_local(*let.parameter, type);
+}
+
+void Checker::check_global_let(Parsed::Let& let)
+{
+    const auto expected = parameter_type(*let.parameter);
+    if (let.value)
+        check_expression(**let.value, expected);
+    else
+        expect(let, expected, ValueType::Unit);
+}
+
+void Checker::check_assignment(Parsed::Assignment& assignment)
+{
+    auto expected = Type {};
+    if (assignment.target->expression_type()
+        == Parsed::ExpressionType::Index) {
+        // arrays are typed by their elements at runtime
+        check_expression(*assignment.target, std::nullopt);
+    } else if (assignment.target->expression_type()
+        == Parsed::ExpressionType::Symbol) {
+        const auto& name
+            = static_cast<const Parsed::Symbol&>(*assignment.target).value;
+        // assigning to immutable locals is rejected by lowering
+        if (const auto local = resolve_local(name)) {
+            if (local->is_annotated)
+                expected = local->type;
+        } else if (const auto global = m_globals.find(name);
+                   global != m_globals.end()) {
+            expected = global->second;
+        }
+    }
+    check_expression(*assignment.value, expected);
+}
+
+Checker::Type Checker::check_expression(
+    Parsed::Expression& expression, Type expected)
+{
+    const auto type = check_expression_kind(expression, expected);
+    expect(expression, expected, type);
+    expression.value_type = type;
+    return type;
+}
+
+Checker::Type Checker::check_expression_kind(
+    Parsed::Expression& expression, Type expected)
+{
+    switch (expression.expression_type()) {
+    case Parsed::ExpressionType::If:
+        return check_if(static_cast<Parsed::If&>(expression), expected);
+    case Parsed::ExpressionType::Match:
+        return check_match(static_cast<Parsed::Match&>(expression), expected);
+    case Parsed::ExpressionType::Block:
+        return check_block(static_cast<Parsed::Block&>(expression), expected);
+    case Parsed::ExpressionType::While: {
+        auto& while_ = static_cast<Parsed::While&>(expression);
+        check_expression(*while_.condition, std::nullopt);
+        check_expression(*while_.body, std::nullopt);
+        return ValueType::Unit;
+    }
+    case Parsed::ExpressionType::Loop:
+        check_expression(
+            *static_cast<Parsed::Loop&>(expression).body, std::nullopt);
+        return ValueType::Unit;
+    case Parsed::ExpressionType::For:
+        return check_for(static_cast<Parsed::For&>(expression));
+    // they don't produce a value where they are
+    case Parsed::ExpressionType::Break:
+    case Parsed::ExpressionType::Continue: return std::nullopt;
+    case Parsed::ExpressionType::BinaryOperation: {
+        auto& operation = static_cast<Parsed::BinaryOperation&>(expression);
+        const auto left = check_expression(*operation.left, std::nullopt);
+        const auto right = check_expression(*operation.right, std::nullopt);
+        // the left operand is the result only when it is a `Bool`
+        if (operation.operator_ == Parsed::BinaryOperator::LogicalAnd
+            || operation.operator_ == Parsed::BinaryOperator::LogicalOr)
+            return right == ValueType::Bool ? right : std::nullopt;
+        return Ir::binary_type(
+            Lowering::binary_operator_op(operation.operator_), left, right);
+    }
+    case Parsed::ExpressionType::UnaryOperation: {
+        auto& operation = static_cast<Parsed::UnaryOperation&>(expression);
+        return Ir::unary_type(
+            Lowering::unary_operator_op(operation.operator_),
+            check_expression(*operation.expression, std::nullopt));
+    }
+    case Parsed::ExpressionType::Call:
+        return check_call(static_cast<Parsed::Call&>(expression));
+    case Parsed::ExpressionType::Index: {
+        auto& index = static_cast<Parsed::Index&>(expression);
+        const auto indexed = check_expression(*index.array, std::nullopt);
+        check_expression(*index.index, ValueType::Int);
+        if (indexed == ValueType::String)
+            return ValueType::Char;
+        expect(*index.array, ValueType::Array, indexed);
+        return std::nullopt;
+    }
+    case Parsed::ExpressionType::Array: {
+        // like the literals of a match, the elements have a single type
+        auto& array = static_cast<Parsed::Array&>(expression);
+        auto element = Type {};
+        for (const auto& value : array.elements) {
+            const auto type = check_expression(*value, std::nullopt);
+            expect(*value, element, type);
+            element = element ? element : type;
+        }
+        return ValueType::Array;
+    }
+    case Parsed::ExpressionType::Int: return ValueType::Int;
+    case Parsed::ExpressionType::Float: return ValueType::Float;
+    case Parsed::ExpressionType::Char: return ValueType::Char;
+    case Parsed::ExpressionType::String: return ValueType::String;
+    case Parsed::ExpressionType::Bool: return ValueType::Bool;
+    case Parsed::ExpressionType::Symbol:
+        return symbol_type(static_cast<Parsed::Symbol&>(expression).value);
+    }
+    std::cerr << "internal: unexhaustive match at " << __FILE__ << ":"
+              << __LINE__ << ": in " << __func__ << "\n";
+    exit(1);
+}
+
+Checker::Type Checker::check_block(Parsed::Block& block, Type expected)
+{
+    begin_scope();
+    for (const auto& statement : block.statements)
+        check_statement(*statement);
+    auto type = Type(ValueType::Unit);
+    if (block.value)
+        type = check_expression(**block.value, expected);
+    else
+        expect(block, expected, type);
+    end_scope();
+    return type;
+}
+
+Checker::Type Checker::check_if(Parsed::If& if_, Type expected)
+{
+    check_expression(*if_.condition, std::nullopt);
+    const auto truthy = check_expression(*if_.body_truthy, expected);
+    auto falsy = Type(ValueType::Unit);
+    if (if_.body_falsy)
+        falsy = check_expression(**if_.body_falsy, expected);
+    else
+        expect(if_, expected, falsy);
+    return truthy == falsy ? truthy : std::nullopt;
+}
+
+// the literals of the patterns have a single type, the one of the matched
+// value when that is known, and the value is `()` unless an arm without a
+// guard matches anything
+Checker::Type Checker::check_match(Parsed::Match& match, Type expected)
+{
+    const auto value = check_expression(*match.value, std::nullopt);
+    auto literals = value;
+    auto result = Type {};
+    auto is_exhaustive = false;
+    // an unguarded `true` and `false` cover a statically known `Bool`
+    auto bools = std::array { false, false };
+    for (size_t i = 0; i < match.arms.size(); i++) {
+        auto& arm = *match.arms[i];
+        for (const auto& pattern : arm.patterns) {
+            const auto type = check_expression(*pattern, std::nullopt);
+            expect(*pattern, literals, type);
+            literals = type;
+            if (type == ValueType::Bool && !arm.guard)
+                bools[static_cast<const Parsed::Bool&>(*pattern).value] = true;
+        }
+        begin_scope();
+        if (arm.binding)
+            m_locals.push_back(Local { *arm.binding, value, false });
+        if (arm.guard)
+            check_expression(**arm.guard, ValueType::Bool);
+        const auto type = check_expression(*arm.body, expected);
+        end_scope();
+        result = i == 0 || result == type ? type : std::nullopt;
+        is_exhaustive |= arm.patterns.empty() && !arm.guard;
+    }
+    is_exhaustive |= value == ValueType::Bool && bools[0] && bools[1];
+    if (is_exhaustive)
+        return result;
+    expect(match, expected, ValueType::Unit);
+    return match.arms.empty() || result == ValueType::Unit
+        ? Type(ValueType::Unit)
+        : std::nullopt;
+}
+
+// the bounds are guarded like annotated `int`s, so the loop variable is one
+Checker::Type Checker::check_for(Parsed::For& for_)
+{
+    check_expression(*for_.start, ValueType::Int);
+    check_expression(*for_.end, ValueType::Int);
+    begin_scope();
+    m_locals.push_back(Local { for_.name, ValueType::Int, false });
+    check_expression(*for_.body, std::nullopt);
+    end_scope();
+    return ValueType::Unit;
+}
+
+Checker::Type Checker::check_call(Parsed::Call& call)
+{
+    const auto callee = check_expression(*call.callee, std::nullopt);
+    const auto name = call.callee->expression_type()
+            == Parsed::ExpressionType::Symbol
+        ? &static_cast<const Parsed::Symbol&>(*call.callee).value
+        : nullptr;
+    const auto signature = [&]() -> const Signature* {
+        if (!name || resolve_local(*name))
+            return nullptr;
+        return this->signature(*name);
+    }();
+    // mismatched arities are left to fail at runtime
+    if (!signature || signature->parameters.size() != call.args.size()) {
+        for (const auto& arg : call.args)
+            check_expression(*arg, std::nullopt);
+        const auto builtin = name && callee == ValueType::Builtin
+                && !resolve_local(*name)
+            ? find_builtin(*name)
+            : nullptr;
+        return builtin ? builtin->result_type : std::nullopt;
+    }
+    for (size_t i = 0; i < call.args.size(); i++)
+        check_expression(*call.args[i], signature->parameters[i]);
+    return signature->result;
+}
+
+Checker::Type Checker::symbol_type(const std::string& name) const
+{
+    if (const auto local = resolve_local(name))
+        return local->type;
+    if (const auto global = m_globals.find(name); global != m_globals.end())
+        return global->second;
+    if (signature(name))
+        return ValueType::Function;
+    if (!m_let_globals.count(name) && find_builtin(name))
+        return ValueType::Builtin;
+    return std::nullopt;
+}
+
+const Checker::Signature* Checker::signature(const std::string& name) const
+{
+    if (m_let_globals.count(name))
+        return nullptr;
+    const auto found = m_signatures.find(name);
+    return found == m_signatures.end() ? nullptr : &found->second;
+}
+
+const Checker::Local* Checker::resolve_local(const std::string& name) const
+{
+    for (auto it = m_locals.rbegin(); it != m_locals.rend(); ++it)
+        if (it->name == name)
+            return &*it;
+    return nullptr;
+}
+
+Checker::Type Checker::parameter_type(const Parsed::Parameter& parameter)
+{
+    if (!parameter.type)
+        return std::nullopt;
+    return annotation(**parameter.type);
+}
+
+const std::string& Checker::parameter_name(const Parsed::Parameter& parameter)
+{
+    const auto& target = *parameter.target;
+    switch (target.parameter_target_type()) {
+    case Parsed::ParameterTargetType::Symbol:
+        return static_cast<const Parsed::SymbolTarget&>(target).value;
+    }
+    std::cerr << "internal: unexhaustive match at " << __FILE__ << ":"
+              << __LINE__ << ": in " << __func__ << "\n";
+    exit(1);
+}
+
+// unannotated mutable locals may be assigned values of any type, so only
+// immutable ones keep the type of their value
+void Checker::declare_local(const Parsed::Parameter& parameter, Type inferred)
+{
+    const auto annotated = parameter_type(parameter);
+    const auto type = parameter.type ? annotated
+        : parameter.is_mutable       ? std::nullopt
+                                     : inferred;
+    m_locals.push_back(
+        Local { parameter_name(parameter), type, parameter.type.has_value() });
+}
+
+void Checker::begin_scope() { m_scopes.push_back(m_locals.size()); }
+
+void Checker::end_scope()
+{
+    m_locals.resize(m_scopes.back());
+    m_scopes.pop_back();
+}
+
+void Checker::expect(const Parsed::Node& node, Type expected, Type actual)
+{
+    if (!expected || !actual || *expected == *actual)
+        return;
+    error_and_exit(node,
+        "expected `" + value_type_to_string(*expected) + "`, got `"
+            + value_type_to_string(*actual) + "`");
+}
+
+void Checker::error_and_exit(const Parsed::Node& node, const std::string& msg)
+{
+    auto message = std::string { "TypeError: " };
+    if (node.pos) {
+        message += std::to_string(node.pos->row) + ":"
+            + std::to_string(node.pos->col) + ": ";
+    }
+    throw CompileError { message + msg + "\n" };
+}
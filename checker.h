@@ -0,0 +1,89 @@
+#pragma once
+
+#include "parser.h"
+#include "value.h"
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Gradual type checker, run on the AST before it is lowered.
+//
+// Parameters, lets and return types may be annotated with `unit`, `int`,
+// `float`, `char`, `bool`, `string`, `func` or `array`. The types of
+// expressions are inferred bottom up from literals, operators, variables, the
+// signatures of top level functions, whose return types are inferred from
+// their bodies unless annotated, and the result types of builtins. The
+// elements of arrays are typed at runtime. Where an expression flows into an annotation, its type is
+// checked top down, through the branches of `if`s and the values of blocks.
+// Every expression whose type is known gets it in `value_type`.
+//
+// Unannotated code stays dynamically typed: only contradictions of
+// annotations are errors, which exit with a `TypeError` at the position of
+// the offending expression. Values of unknown type may still flow into
+// annotations, lowering guards those with a `CheckType` at runtime.
+class Checker {
+public:
+    Checker() = default;
+
+    void check(Parsed::Block& program);
+
+    // the type an annotation names
+    static ValueType annotation(const Parsed::Type& type);
+
+private:
+    using Type = std::optional<ValueType>;
+
+    struct Signature {
+        std::vector<Type> parameters;
+        Type result;
+        bool is_annotated;
+    };
+
+    struct Local {
+        std::string name;
+        Type type;
+        // whether `type` is annotated, otherwise it is inferred
+        bool is_annotated;
+    };
+
+    Type check_func(Parsed::Func& func);
+    void check_statement(Parsed::Statement& statement);
+    void check_let(Parsed::Let& let);
+    void check_global_let(Parsed::Let& let);
+    void check_assignment(Parsed::Assignment& assignment);
+    // infers the type of the expression, and checks it against `expected`
+    // when that is known
+    Type check_expression(Parsed::Expression& expression, Type expected);
+    Type check_expression_kind(Parsed::Expression& expression, Type expected);
+    Type check_block(Parsed::Block& block, Type expected);
+    Type check_if(Parsed::If& if_, Type expected);
+    Type check_match(Parsed::Match& match, Type expected);
+    Type check_for(Parsed::For& for_);
+    Type check_call(Parsed::Call& call);
+    Type symbol_type(const std::string& name) const;
+    // the signature of the top level function `name` refers to, when calls
+    // to it are direct
+    const Signature* signature(const std::string& name) const;
+    const Local* resolve_local(const std::string& name) const;
+    static Type parameter_type(const Parsed::Parameter& parameter);
+    static const std::string& parameter_name(
+        const Parsed::Parameter& parameter);
+    void declare_local(const Parsed::Parameter& parameter, Type inferred);
+    void begin_scope();
+    void end_scope();
+    static void expect(const Parsed::Node& node, Type expected, Type actual);
+    // throws a `CompileError`
+    [[noreturn]] static void error_and_exit(
+        const Parsed::Node& node, const std::string& msg);
+
+    std::unordered_map<std::string, Signature> m_signatures {};
+    // annotated top level lets, unannotated ones are absent
+    std::unordered_map<std::string, Type> m_globals {};
+    // names bound by top level lets, which may rebind functions
+    std::unordered_set<std::string> m_let_globals {};
+    std::vector<Local> m_locals {};
+    std::vector<size_t> m_scopes {};
+};
@@ -0,0 +1,610 @@
+#include "compiler.h"
+#include "bytecode.h"
+#include "ir.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <tuple>
+
+namespace {
+
+bool is_rematerialized(const Ir::Instruction& value)
+{
+    return value.op == Ir::Op::Constant || value.op == Ir::Op::Parameter;
+}
+
+// the IR's operations are in the same order as the bytecode's
+Bytecode::Op bytecode_op(Ir::Op op, Ir::Op first, Bytecode::Op first_bytecode)
+{
+    return static_cast<Bytecode::Op>(static_cast<uint8_t>(first_bytecode)
+        + (static_cast<uint8_t>(op) - static_cast<uint8_t>(first)));
+}
+
+// constants are the same when their type and bits are, so -0.0 and 0.0 get
+// separate entries
+uint64_t constant_bits(const Value& value)
+{
+    static_assert(sizeof(value.int_value) == sizeof(uint64_t));
+    auto result = uint64_t {};
+    std::memcpy(&result, &value.int_value, sizeof(result));
+    return result;
+}
+
+}
+
+std::unique_ptr<Bytecode::Program> Compiler::compile(const Ir::Module& module)
+{
+    m_program = std::make_unique<Bytecode::Program>();
+    m_program->globals = module.globals;
+    m_program->function_globals = module.function_globals;
+    m_program->main = std::make_unique<Bytecode::Function>("main", 0);
+    m_program->main->position = module.main->position;
+    for (const auto& function : module.functions) {
+        m_program->functions.push_back(std::make_unique<Bytecode::Function>(
+            function->name, function->arity));
+        m_program->functions.back()->position = function->position;
+    }
+    for (size_t i = 0; i < module.functions.size(); i++)
+        compile_function(*module.functions[i], *m_program->functions[i]);
+    compile_function(*module.main, *m_program->main);
+    return std::move(m_program);
+}
+
+void Compiler::compile_function(
+    const Ir::Function& function, Bytecode::Function& result)
+{
+    m_function = &result;
+    m_position = std::nullopt;
+    m_uses.clear();
+    for (const auto& [value, count] : function.use_counts())
+        m_uses[value] = count;
+    m_nodes.clear();
+    m_stacked.clear();
+    m_slots.clear();
+    m_labels.clear();
+    m_jumps.clear();
+    m_switch_jumps.clear();
+    m_constants.clear();
+
+    for (const auto& block : function.blocks)
+        build_nodes(*block);
+    for (const auto& block : function.blocks)
+        stackify(*block);
+    allocate_slots(function);
+    for (size_t i = 0; i < function.blocks.size(); i++) {
+        const auto next = i + 1 < function.blocks.size()
+            ? function.blocks[i + 1].get()
+            : nullptr;
+        compile_block(*function.blocks[i], next);
+    }
+    for (const auto& [jump, target] : m_jumps)
+        result.code[jump].operand = static_cast<uint32_t>(m_labels.at(target));
+    for (const auto& [index, entry, target] : m_switch_jumps) {
+        auto& table = result.switch_tables[index];
+        const auto label = static_cast<uint32_t>(m_labels.at(target));
+        if (entry == table.targets.size())
+            table.default_target = label;
+        else
+            table.targets[entry] = label;
+    }
+}
+
+void Compiler::build_nodes(const Ir::Block& block)
+{
+    auto& nodes = m_nodes[&block];
+    for (const auto& instruction : block.instructions) {
+        if (is_rematerialized(*instruction) || instruction->op == Ir::Op::Phi)
+            continue;
+        if (instruction->op == Ir::Op::Jump
+            && has_copies(*instruction->targets[0]))
+            nodes.push_back({ instruction.get(), instruction->targets[0] });
+        nodes.push_back({ instruction.get(), nullptr });
+    }
+}
+
+std::vector<const Ir::Instruction*> Compiler::node_operands(
+    const Node& node) const
+{
+    auto operands = std::vector<const Ir::Instruction*> {};
+    if (!node.copies_to) {
+        operands.assign(node.instruction->operands.begin(),
+            node.instruction->operands.end());
+        return operands;
+    }
+    const auto& to = *node.copies_to;
+    const auto index = to.predecessor_index(node.instruction->block);
+    for (size_t i = 0; i < to.phis_count(); i++)
+        if (m_uses.count(to.instructions[i].get()))
+            operands.push_back(to.instructions[i]->operands[index]);
+    return operands;
+}
+
+void Compiler::stackify(const Ir::Block& block)
+{
+    const auto& nodes = m_nodes.at(&block);
+    auto index = std::unordered_map<const Ir::Instruction*, size_t> {};
+    for (size_t i = 0; i < nodes.size(); i++)
+        if (!nodes[i].copies_to)
+            index[nodes[i].instruction] = i;
+    for (size_t i = nodes.size(); i-- > 0;) {
+        if (!nodes[i].copies_to && m_stacked.count(nodes[i].instruction))
+            continue;
+        auto cursor = i;
+        stackify_operands(node_operands(nodes[i]), index, cursor);
+        i = cursor;
+    }
+}
+
+// an operand stays on the stack when it is evaluated right before the
+// operands to its right, so the evaluation order doesn't change
+void Compiler::stackify_operands(
+    const std::vector<const Ir::Instruction*>& operands,
+    const std::unordered_map<const Ir::Instruction*, size_t>& index,
+    size_t& cursor)
+{
+    for (auto it = operands.rbegin(); it != operands.rend(); ++it) {
+        const auto found = index.find(*it);
+        if (found == index.end() || found->second + 1 != cursor
+            || m_uses.at(*it) != 1)
+            continue;
+        m_stacked.insert(*it);
+        cursor = found->second;
+        stackify_operands(std::vector<const Ir::Instruction*>(
+                              (*it)->operands.begin(), (*it)->operands.end()),
+            index, cursor);
+    }
+}
+
+// Values live in slots from their definition to their last use. Each
+// value's range is widened to cover the positions it is live at, including
+// whole blocks it is live into or out of, so values whose ranges don't
+// overlap never need their slot at the same time. Uses are at even
+// positions and definitions at the odd one after, so a value can take the
+// slot of an operand used for the last time.
+void Compiler::allocate_slots(const Ir::Function& function)
+{
+    struct Liveness {
+        std::unordered_set<const Ir::Instruction*> uses {};
+        std::unordered_set<const Ir::Instruction*> defs {};
+        std::unordered_set<const Ir::Instruction*> in {};
+        std::unordered_set<const Ir::Instruction*> out {};
+        size_t start { 0 };
+        size_t end { 0 };
+    };
+    auto liveness = std::unordered_map<const Ir::Block*, Liveness> {};
+    auto ranges
+        = std::unordered_map<const Ir::Instruction*, std::pair<size_t, size_t>> {};
+    const auto extend = [&](const Ir::Instruction* value, size_t position) {
+        const auto [range, inserted]
+            = ranges.try_emplace(value, position, position);
+        range->second.first = std::min(range->second.first, position);
+        range->second.second = std::max(range->second.second, position);
+    };
+    const auto define = [&](const Ir::Instruction* value, size_t position) {
+        extend(value, 2 * position + 1);
+    };
+
+    auto position = size_t { 0 };
+    for (const auto& block : function.blocks) {
+        auto& live = liveness[block.get()];
+        const auto use = [&](const Ir::Instruction* value) {
+            const auto load = [&](const auto& self,
+                                  const Ir::Instruction* value) -> void {
+                if (m_stacked.count(value)) {
+                    for (const auto operand : value->operands)
+                        self(self, operand);
+                } else if (needs_slot(*value)) {
+                    extend(value, 2 * position);
+                    if (value->block != block.get() || value->op == Ir::Op::Phi)
+                        live.uses.insert(value);
+                }
+            };
+            load(load, value);
+        };
+        const auto copy = [&](const Ir::Block& to) {
+            const auto index = to.predecessor_index(block.get());
+            for (size_t i = 0; i < to.phis_count(); i++) {
+                const auto phi = to.instructions[i].get();
+                if (!m_uses.count(phi))
+                    continue;
+                use(phi->operands[index]);
+                define(phi, position);
+            }
+        };
+
+        live.start = 2 * position;
+        for (const auto& node : m_nodes.at(block.get())) {
+            const auto instruction = node.instruction;
+            if (node.copies_to) {
+                copy(*node.copies_to);
+            } else if (m_stacked.count(instruction)) {
+                continue;
+            } else {
+                for (const auto operand : instruction->operands)
+                    use(operand);
+                if (instruction->op == Ir::Op::Branch
+                    || instruction->op == Ir::Op::Switch)
+                    for (const auto target : instruction->targets)
+                        if (has_copies(*target))
+                            copy(*target);
+                if (needs_slot(*instruction)) {
+                    define(instruction, position);
+                    live.defs.insert(instruction);
+                }
+            }
+            position++;
+        }
+        live.end = 2 * position - 1;
+    }
+
+    for (auto changed = true; changed;) {
+        changed = false;
+        for (auto it = function.blocks.rbegin(); it != function.blocks.rend();
+             ++it) {
+            auto& live = liveness.at(it->get());
+            for (const auto successor : (*it)->successors())
+                for (const auto value : liveness.at(successor).in)
+                    if (value->op != Ir::Op::Phi || value->block != successor)
+                        live.out.insert(value);
+            const auto in_count = live.in.size();
+            live.in.insert(live.uses.begin(), live.uses.end());
+            for (const auto value : live.out)
+                if (!live.defs.count(value))
+                    live.in.insert(value);
+            changed |= live.in.size() != in_count;
+        }
+    }
+    for (const auto& [block, live] : liveness) {
+        for (const auto value : live.in)
+            extend(value, live.start);
+        for (const auto value : live.out)
+            extend(value, live.end);
+    }
+
+    auto values = std::vector<const Ir::Instruction*> {};
+    for (const auto& [value, range] : ranges)
+        values.push_back(value);
+    std::sort(values.begin(), values.end(), [&](const auto* a, const auto* b) {
+        return std::tuple(ranges.at(a).first, a->id)
+            < std::tuple(ranges.at(b).first, b->id);
+    });
+    // slots are only shared between values of the same type, which keeps
+    // the types of locals consistent for the JIT
+    auto free = std::map<std::optional<ValueType>, std::vector<uint32_t>> {};
+    auto active = std::vector<const Ir::Instruction*> {};
+    auto slots_count = m_function->arity;
+    for (const auto value : values) {
+        const auto start = ranges.at(value).first;
+        const auto expired = std::stable_partition(
+            active.begin(), active.end(), [&](const auto* other) {
+                return ranges.at(other).second >= start;
+            });
+        for (auto it = expired; it != active.end(); ++it)
+            free[(*it)->type].push_back(m_slots.at(*it));
+        active.erase(expired, active.end());
+        auto& pool = free[value->type];
+        if (pool.empty()) {
+            m_slots[value] = slots_count++;
+        } else {
+            m_slots[value] = pool.back();
+            pool.pop_back();
+        }
+        active.push_back(value);
+    }
+    m_function->locals_count = slots_count;
+}
+
+void Compiler::compile_block(const Ir::Block& block, const Ir::Block* next)
+{
+    m_labels[&block] = m_function->code.size();
+    for (const auto& node : m_nodes.at(&block)) {
+        const auto& instruction = *node.instruction;
+        if (node.copies_to) {
+            compile_copies(block, *node.copies_to);
+        } else if (m_stacked.count(&instruction)) {
+            continue;
+        } else if (Ir::is_terminator(instruction.op)) {
+            compile_terminator(instruction, block, next);
+        } else {
+            compile_tree(instruction);
+            if (!Ir::has_result(instruction.op))
+                continue;
+            if (needs_slot(instruction))
+                emit(Bytecode::Op::StoreLocal, m_slots.at(&instruction));
+            else
+                emit(Bytecode::Op::Pop);
+        }
+    }
+}
+
+void Compiler::compile_terminator(const Ir::Instruction& terminator,
+    const Ir::Block& block, const Ir::Block* next)
+{
+    const auto compile_value = [&](const Ir::Instruction& value, bool tail) {
+        if (m_stacked.count(&value))
+            compile_tree(value, tail);
+        else
+            compile_operand(value);
+        if (terminator.position)
+            m_position = terminator.position;
+    };
+    if (terminator.position)
+        m_position = terminator.position;
+    switch (terminator.op) {
+    case Ir::Op::Jump:
+        if (terminator.targets[0] != next)
+            compile_jump(Bytecode::Op::Jump, terminator.targets[0]);
+        return;
+    case Ir::Op::Return:
+        // calls in tail position reuse the caller's frame
+        compile_value(*terminator.operands[0], true);
+        emit(Bytecode::Op::Return);
+        return;
+    case Ir::Op::Branch: {
+        compile_value(*terminator.operands[0], false);
+        const auto truthy = terminator.targets[0];
+        const auto falsy = terminator.targets[1];
+        if (!has_copies(*truthy) && !has_copies(*falsy)) {
+            compile_jump(Bytecode::Op::JumpIfFalse, falsy);
+            if (truthy != next)
+                compile_jump(Bytecode::Op::Jump, truthy);
+            return;
+        }
+        // the copies into the phis of each target go on its edge
+        const auto jump_to_falsy = emit(Bytecode::Op::JumpIfFalse);
+        compile_copies(block, *truthy);
+        compile_jump(Bytecode::Op::Jump, truthy);
+        m_function->code[jump_to_falsy].operand
+            = static_cast<uint32_t>(m_function->code.size());
+        compile_copies(block, *falsy);
+        if (falsy != next)
+            compile_jump(Bytecode::Op::Jump, falsy);
+        return;
+    }
+    case Ir::Op::Switch:
+        compile_value(*terminator.operands[0], false);
+        compile_switch(terminator, block);
+        return;
+    default: break;
+    }
+    std::cerr << "internal: unexhaustive match at " << __FILE__ << ":"
+              << __LINE__ << ": in " << __func__ << "\n";
+    exit(1);
+}
+
+// Dense cases get a jump table, sparse ones a table of sorted keys to binary
+// search, which strings are looked up in by their hash. Targets with phis
+// are jumped to through the copies into them, placed after the switch.
+void Compiler::compile_switch(
+    const Ir::Instruction& switch_, const Ir::Block& block)
+{
+    const auto& cases = switch_.cases;
+    auto order = std::vector<size_t>(cases.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return Bytecode::switch_key(cases[a]) < Bytecode::switch_key(cases[b]);
+    });
+    auto table = Bytecode::SwitchTable { cases[0].type };
+    // the index of the target each entry of the table goes to
+    auto entries = std::vector<size_t> {};
+    auto op = Bytecode::Op::LookupSwitch;
+    const auto first = Bytecode::switch_key(cases[order.front()]);
+    const auto span = static_cast<uint64_t>(
+                          Bytecode::switch_key(cases[order.back()]))
+        - static_cast<uint64_t>(first);
+    if (table.type == ValueType::String) {
+        op = Bytecode::Op::StringSwitch;
+        for (const auto i : order)
+            table.strings.push_back(cases[i].string_value);
+    } else if (span < 2 * cases.size()) {
+        op = Bytecode::Op::TableSwitch;
+        table.first = first;
+        entries.assign(span + 1, cases.size());
+        for (const auto i : order)
+            entries[static_cast<uint64_t>(Bytecode::switch_key(cases[i]))
+                - static_cast<uint64_t>(first)]
+                = i;
+    }
+    if (op != Bytecode::Op::TableSwitch) {
+        for (const auto i : order) {
+            table.keys.push_back(Bytecode::switch_key(cases[i]));
+            entries.push_back(i);
+        }
+    }
+    entries.push_back(cases.size());
+    table.targets.resize(entries.size() - 1);
+
+    const auto index = m_function->switch_tables.size();
+    m_function->switch_tables.push_back(std::move(table));
+    emit(op, static_cast<uint32_t>(index));
+    auto stubs = std::vector<std::optional<uint32_t>>(switch_.targets.size());
+    for (size_t i = 0; i < switch_.targets.size(); i++) {
+        const auto target = switch_.targets[i];
+        if (!has_copies(*target))
+            continue;
+        stubs[i] = static_cast<uint32_t>(m_function->code.size());
+        compile_copies(block, *target);
+        compile_jump(Bytecode::Op::Jump, target);
+    }
+    auto& compiled = m_function->switch_tables[index];
+    for (size_t entry = 0; entry < entries.size(); entry++) {
+        const auto target = entries[entry];
+        auto& address = entry == compiled.targets.size()
+            ? compiled.default_target
+            : compiled.targets[entry];
+        if (stubs[target])
+            address = *stubs[target];
+        else
+            m_switch_jumps.push_back({ index, entry, switch_.targets[target] });
+    }
+}
+
+void Compiler::compile_tree(const Ir::Instruction& instruction, bool tail)
+{
+    for (const auto operand : instruction.operands) {
+        if (instruction.position)
+            m_position = instruction.position;
+        if (m_stacked.count(operand))
+            compile_tree(*operand);
+        else
+            compile_operand(*operand);
+    }
+    if (instruction.position)
+        m_position = instruction.position;
+
+    const auto op = instruction.op;
+    if (Ir::is_unary(op)) {
+        emit(bytecode_op(op, Ir::Op::LogicalNot, Bytecode::Op::LogicalNot));
+        return;
+    }
+    if (Ir::is_binary(op)) {
+        // statically typed operations skip the type checks and the
+        // quickening of the generic ones
+        const auto generic = bytecode_op(op, Ir::Op::Add, Bytecode::Op::Add);
+        const auto left = instruction.operands[0]->type;
+        const auto right = instruction.operands[1]->type;
+        if (left == ValueType::Int && right == ValueType::Int)
+            emit(Bytecode::int_variant(generic));
+        else if (left == ValueType::Float && right == ValueType::Float)
+            emit(Bytecode::float_variant(generic));
+        else
+            emit(generic, frame_slot(instruction));
+        return;
+    }
+    switch (op) {
+    case Ir::Op::LoadGlobal:
+        emit(Bytecode::Op::LoadGlobal, instruction.index);
+        return;
+    case Ir::Op::StoreGlobal:
+        emit(Bytecode::Op::StoreGlobal, instruction.index);
+        return;
+    case Ir::Op::DefineGlobal:
+        emit(Bytecode::Op::DefineGlobal, instruction.index);
+        return;
+    case Ir::Op::CheckType:
+        emit(Bytecode::Op::CheckType, static_cast<uint32_t>(*instruction.type));
+        return;
+    case Ir::Op::NewArray:
+        emit(Bytecode::Op::NewArray,
+            static_cast<uint32_t>(instruction.operands.size()));
+        return;
+    case Ir::Op::Map:
+        m_function->kernels.push_back(Bytecode::Kernel {
+            instruction.expression, frame_slot(instruction) });
+        emit(Bytecode::Op::Map,
+            static_cast<uint32_t>(m_function->kernels.size() - 1));
+        return;
+    case Ir::Op::Index:
+        emit(instruction.in_bounds ? Bytecode::Op::IndexInBounds
+                                   : Bytecode::Op::Index);
+        return;
+    case Ir::Op::StoreIndex:
+        emit(instruction.in_bounds ? Bytecode::Op::StoreIndexInBounds
+                                   : Bytecode::Op::StoreIndex);
+        return;
+    case Ir::Op::Call:
+        m_function->call_caches.push_back(Bytecode::CallCache(
+            static_cast<uint32_t>(instruction.operands.size() - 1),
+            std::nullopt));
+        emit(tail ? Bytecode::Op::TailCall : Bytecode::Op::Call,
+            static_cast<uint32_t>(m_function->call_caches.size() - 1));
+        return;
+    case Ir::Op::CallGlobal:
+        m_function->call_caches.push_back(Bytecode::CallCache(
+            static_cast<uint32_t>(instruction.operands.size()),
+            instruction.index));
+        m_function->call_caches.back().slot = frame_slot(instruction);
+        emit(tail ? Bytecode::Op::TailCallGlobal : Bytecode::Op::CallGlobal,
+            static_cast<uint32_t>(m_function->call_caches.size() - 1));
+        return;
+    default: break;
+    }
+    std::cerr << "internal: unexhaustive match at " << __FILE__ << ":"
+              << __LINE__ << ": in " << __func__ << "\n";
+    exit(1);
+}
+
+void Compiler::compile_operand(const Ir::Instruction& value)
+{
+    switch (value.op) {
+    case Ir::Op::Constant: compile_constant(value.value); return;
+    case Ir::Op::Parameter: emit(Bytecode::Op::LoadLocal, value.index); return;
+    default: emit(Bytecode::Op::LoadLocal, m_slots.at(&value)); return;
+    }
+}
+
+// all values are pushed before any phi is stored, since a phi can be the
+// value of another one
+void Compiler::compile_copies(const Ir::Block& from, const Ir::Block& to)
+{
+    const auto index = to.predecessor_index(&from);
+    auto phis = std::vector<const Ir::Instruction*> {};
+    for (size_t i = 0; i < to.phis_count(); i++) {
+        const auto phi = to.instructions[i].get();
+        if (!m_uses.count(phi))
+            continue;
+        phis.push_back(phi);
+        const auto value = phi->operands[index];
+        if (m_stacked.count(value))
+            compile_tree(*value);
+        else
+            compile_operand(*value);
+    }
+    for (auto it = phis.rbegin(); it != phis.rend(); ++it)
+        emit(Bytecode::Op::StoreLocal, m_slots.at(*it));
+}
+
+void Compiler::compile_jump(Bytecode::Op op, const Ir::Block* target)
+{
+    m_jumps.push_back({ emit(op), target });
+}
+
+void Compiler::compile_constant(Value value)
+{
+    if (value.type == ValueType::Unit) {
+        emit(Bytecode::Op::PushUnit);
+        return;
+    }
+    auto& constants = m_function->constants;
+    const auto [entry, is_new] = m_constants[value.type].try_emplace(
+        constant_bits(value), static_cast<uint32_t>(constants.size()));
+    if (is_new)
+        constants.push_back(value);
+    emit(Bytecode::Op::PushConstant, entry->second);
+}
+
+uint32_t Compiler::frame_slot(const Ir::Instruction& instruction)
+{
+    return instruction.local ? ++m_function->slots_count : 0;
+}
+
+size_t Compiler::emit(Bytecode::Op op, uint32_t operand)
+{
+    auto& line_table = m_function->line_table;
+    if (m_position
+        && (line_table.empty() || line_table.back().position != *m_position))
+        line_table.push_back({
+            static_cast<uint32_t>(m_function->code.size()),
+            *m_position,
+        });
+    m_function->code.push_back(Bytecode::Instruction(op, operand));
+    return m_function->code.size() - 1;
+}
+
+bool Compiler::needs_slot(const Ir::Instruction& value) const
+{
+    return !is_rematerialized(value) && !m_stacked.count(&value)
+        && m_uses.count(&value);
+}
+
+bool Compiler::has_copies(const Ir::Block& to) const
+{
+    for (size_t i = 0; i < to.phis_count(); i++)
+        if (m_uses.count(to.instructions[i].get()))
+            return true;
+    return false;
+}
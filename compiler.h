@@ -0,0 +1,83 @@
+#pragma once
+
+#include "bytecode.h"
+#include "ir.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Generates bytecode from the IR.
+//
+// Constants and parameters are rematerialized wherever they are used. Other
+// values with a single use, in the same block right before it, stay on the
+// stack as operands of their user, so expressions compile to trees like they
+// would from the AST. The remaining values live in local slots, which are
+// shared between values whose live ranges don't overlap. Phis are slots
+// written at the end of each predecessor.
+class Compiler {
+public:
+    Compiler() = default;
+
+    std::unique_ptr<Bytecode::Program> compile(const Ir::Module& module);
+
+private:
+    // what a block compiles to, in order: the instructions which aren't
+    // rematerialized, the copies into the phis of the block jumped to, and
+    // the terminator
+    struct Node {
+        const Ir::Instruction* instruction;
+        // set for the copies, `instruction` is the block's `Jump` then
+        const Ir::Block* copies_to;
+    };
+
+    void compile_function(
+        const Ir::Function& function, Bytecode::Function& result);
+    void build_nodes(const Ir::Block& block);
+    std::vector<const Ir::Instruction*> node_operands(const Node& node) const;
+    void stackify(const Ir::Block& block);
+    void stackify_operands(const std::vector<const Ir::Instruction*>& operands,
+        const std::unordered_map<const Ir::Instruction*, size_t>& index,
+        size_t& cursor);
+    void allocate_slots(const Ir::Function& function);
+    void compile_block(const Ir::Block& block, const Ir::Block* next);
+    void compile_terminator(const Ir::Instruction& terminator,
+        const Ir::Block& block, const Ir::Block* next);
+    void compile_switch(const Ir::Instruction& switch_, const Ir::Block& block);
+    void compile_tree(const Ir::Instruction& instruction, bool tail = false);
+    void compile_operand(const Ir::Instruction& value);
+    void compile_copies(const Ir::Block& from, const Ir::Block& to);
+    void compile_jump(Bytecode::Op op, const Ir::Block* target);
+    void compile_constant(Value value);
+    size_t emit(Bytecode::Op op, uint32_t operand = 0);
+    // a new slot plus one in the frame for the arrays made by a `local`
+    // instruction, 0 for other instructions
+    uint32_t frame_slot(const Ir::Instruction& instruction);
+    bool needs_slot(const Ir::Instruction& value) const;
+    bool has_copies(const Ir::Block& to) const;
+
+    std::unique_ptr<Bytecode::Program> m_program {};
+    Bytecode::Function* m_function { nullptr };
+    std::optional<Bytecode::SourcePosition> m_position {};
+
+    // state of the function being compiled
+    std::unordered_map<const Ir::Instruction*, size_t> m_uses {};
+    std::unordered_map<const Ir::Block*, std::vector<Node>> m_nodes {};
+    std::unordered_set<const Ir::Instruction*> m_stacked {};
+    std::unordered_map<const Ir::Instruction*, uint32_t> m_slots {};
+    std::unordered_map<const Ir::Block*, size_t> m_labels {};
+    // indices in the constant pool by type and bits
+    std::unordered_map<ValueType, std::unordered_map<uint64_t, uint32_t>>
+        m_constants {};
+    // jumps to patch once all blocks have their label
+    std::vector<std::pair<size_t, const Ir::Block*>> m_jumps {};
+    // likewise for switch tables, the entries are indices of their targets,
+    // with the default target last
+    std::vector<std::tuple<size_t, size_t, const Ir::Block*>>
+        m_switch_jumps {};
+};
@@ -0,0 +1,583 @@
+#include "build_id.h"
+#include "cache.h"
+#include "checker.h"
+#include "compiler.h"
+#include "driver.h"
+#include "error.h"
+#include "gc.h"
+#include "ir.h"
+#include "lexer.h"
+#include "lowering.h"
+#include "parallel.h"
+#include "parser.h"
+#include "passes.h"
+#include "profiler.h"
+#include "report.h"
+#include "transpiler.h"
+#include "vm.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#if defined(__unix__)
+#include <unistd.h>
+#endif
+
+Options parse_options(const std::vector<std::string>& args)
+{
+    auto options = Options {};
+    for (size_t i = 0; i < args.size(); i++) {
+        const auto& arg = args[i];
+        if (arg == "--profile") {
+            options.profile = "lpl.folded";
+        } else if (arg.rfind("--profile=", 0) == 0) {
+            options.profile = arg.substr(std::string("--profile=").size());
+        } else if (arg == "--emit=ir") {
+            options.emit = Emit::Ir;
+        } else if (arg == "--emit=c") {
+            options.emit = Emit::C;
+        } else if (arg == "--emit=exe") {
+            options.emit = Emit::Executable;
+        } else if (arg == "--native") {
+            options.native = true;
+        } else if (arg == "--check") {
+            options.check = true;
+        } else if (arg == "--strict") {
+            options.strict = true;
+        } else if (arg == "-O0") {
+            options.optimize = false;
+        } else if (arg == "--time-passes") {
+            options.time_passes = true;
+        } else if (arg == "--time-report") {
+            options.time_report = true;
+        } else if (arg.rfind("--time-report=", 0) == 0) {
+            options.time_report = true;
+            options.time_report_file
+                = arg.substr(std::string("--time-report=").size());
+        } else if (arg == "--gc-stats") {
+            options.gc_stats = true;
+        } else if (arg.rfind("--inline-budget=", 0) == 0) {
+            options.inlining.budget = std::strtoull(
+                arg.c_str() + std::string("--inline-budget=").size(), nullptr,
+                10);
+        } else if (arg.rfind("--profile-use=", 0) == 0) {
+            const auto filename
+                = arg.substr(std::string("--profile-use=").size());
+            auto file = std::ifstream(filename);
+            if (!file.is_open()) {
+                throw CompileError { "error: file \"" + filename
+                    + "\" could not be read\n" };
+            }
+            options.inlining.profile = Passes::read_call_profile(file);
+        } else if (arg == "-o" && i + 1 < args.size()) {
+            options.output = args[++i];
+        } else if (arg == "-j" && i + 1 < args.size()) {
+            options.jobs = std::strtoull(args[++i].c_str(), nullptr, 10);
+        } else if (arg.rfind("-j", 0) == 0) {
+            options.jobs = std::strtoull(arg.c_str() + 2, nullptr, 10);
+        } else if (arg.rfind("-", 0) == 0) {
+            throw CompileError { "fatal: unknown option \"" + arg + "\"\n" };
+        } else {
+            options.inputs.push_back(arg);
+        }
+    }
+    if (options.native)
+        options.emit = Emit::Executable;
+    // checking, or compiling a batch without running it, is about finding
+    // every error, including those in functions which are never called
+    if (options.check || options.inputs.size() > 1
+        || (options.inputs.size() == 1
+            && std::filesystem::is_directory(options.inputs.front())))
+        options.strict = true;
+    options.jobs = std::max(options.jobs, size_t { 1 });
+    return options;
+}
+
+// throws a `CompileError` when the file can't be written, it may be called
+// by the threads compiling a batch
+void write_string_to_file(const std::string& filename, const std::string& text)
+{
+    std::ofstream file(filename);
+    file << text;
+    if (!file) {
+        throw CompileError { "error: file \"" + filename
+            + "\" could not be written\n" };
+    }
+}
+
+std::string c_compiler()
+{
+    const auto cc = std::getenv("CC");
+    return cc ? cc : "cc";
+}
+
+const auto c_flags = std::string { "-std=c99 -O2" };
+
+// writes the program's C, and compiles it with `$CC`, or `cc`, when given
+// an executable to build
+bool build(const std::string& c_source, const std::filesystem::path& c_filename,
+    const std::optional<std::filesystem::path>& executable, std::ostream& out)
+{
+    out << "Transpiling to " << c_filename.string() << "\n";
+    write_string_to_file(c_filename, c_source);
+    if (!executable)
+        return true;
+    const auto command = c_compiler() + " " + c_flags + " -o \""
+        + executable->string() + "\" \"" + c_filename.string() + "\" -lm";
+    out << command << "\n" << std::flush;
+    return std::system(command.c_str()) == 0;
+}
+
+// everything the cached artifacts depend on: the program, the options
+// changing the C emitted for it, this build of lplc and the C compiler. So
+// a hit can skip compiling the program, and nothing built by another
+// version of the backend is reused.
+std::string cache_key(const Options& options, const std::string& source)
+{
+    auto key = std::stringstream {};
+    key << "lplc " << LPL_VERSION << " " << LPL_BUILD_ID << "\n"
+        << options.filename << "\n"
+        << "optimize " << options.optimize << "\n"
+        << "inline " << options.inlining.budget << "\n";
+    if (const auto& profile = options.inlining.profile) {
+        key << "profile " << profile->samples << "\n";
+        for (const auto& [call, samples] : profile->calls)
+            key << call.first << " " << call.second << " " << samples << "\n";
+    }
+    if (options.emit == Emit::C)
+        key << "c\n";
+    else
+        key << "exe " << c_compiler() << " " << c_flags << " -lm\n";
+    key << source;
+    return key.str();
+}
+
+// where the C and, unless only C is emitted, the executable go
+struct EmitPaths {
+    std::filesystem::path output;
+    std::filesystem::path c_filename;
+    std::optional<std::filesystem::path> executable;
+};
+
+EmitPaths emit_paths(const Options& options)
+{
+    namespace fs = std::filesystem;
+    const auto output = fs::path(options.output.value_or(
+        fs::path(options.filename)
+            .replace_extension(options.emit == Emit::C ? ".c" : "")
+            .string()));
+    if (options.emit == Emit::C)
+        return { output, output, std::nullopt };
+    return { output, fs::path(output.string() + ".c"), output };
+}
+
+// the cache entry with what the C backend made of `source` with the same
+// options, if any, compiling the program can stop after reading it then
+std::optional<std::filesystem::path> cached_artifacts(
+    const Options& options, const std::string& source, std::ostream& out)
+{
+    if (options.check
+        || (options.emit != Emit::C && options.emit != Emit::Executable))
+        return std::nullopt;
+    const auto entry = artifact_cache().lookup(cache_key(options, source));
+    if (entry)
+        out << "Using cached " << entry->string() << "\n";
+    return entry;
+}
+
+// copies the artifacts of a cache entry to where they were asked for,
+// returns the path of the executable
+std::optional<std::filesystem::path> copy_artifacts(const Options& options,
+    const std::filesystem::path& entry, std::ostream& err)
+{
+    namespace fs = std::filesystem;
+    // running natively needs nothing outside the cache
+    if (options.native && !options.output)
+        return entry / "program";
+    const auto paths = emit_paths(options);
+    auto error = std::error_code {};
+    fs::copy_file(entry / "program.c", paths.c_filename,
+        fs::copy_options::overwrite_existing, error);
+    if (!error && paths.executable) {
+        fs::copy_file(entry / "program", *paths.executable,
+            fs::copy_options::overwrite_existing, error);
+    }
+    if (error) {
+        err << "error: " << error.message() << "\n";
+        return std::nullopt;
+    }
+    return paths.output;
+}
+
+// transpiles the program and builds it into the artifact cache, or straight
+// to the output when the cache is disabled, returns the path of the
+// executable
+std::optional<std::filesystem::path> emit(const Options& options,
+    const std::string& source, const Ir::Module& module, std::ostream& out,
+    std::ostream& err)
+{
+    namespace fs = std::filesystem;
+    const auto paths = emit_paths(options);
+    const auto c_source = Transpiler(options.filename).transpile(module);
+    auto& cache = artifact_cache();
+    if (!cache.enabled()) {
+        if (!build(c_source, paths.c_filename, paths.executable, out))
+            return std::nullopt;
+        return paths.output;
+    }
+    const auto entry
+        = cache.insert(cache_key(options, source), [&](const fs::path& dir) {
+              return build(c_source, dir / "program.c",
+                  paths.executable ? std::optional(dir / "program")
+                                   : std::nullopt,
+                  out);
+          });
+    if (!entry)
+        return std::nullopt;
+    return copy_artifacts(options, *entry, err);
+}
+
+// replaces the process with the native executable
+int run_native(const std::filesystem::path& executable)
+{
+    std::cout << "Running\n" << std::flush;
+#if defined(__unix__)
+    const auto path = executable.string();
+    char* const args[] = { const_cast<char*>(path.c_str()), nullptr };
+    execv(path.c_str(), args);
+#endif
+    const auto command = "\"" + executable.string() + "\"";
+    return std::system(command.c_str()) == 0 ? 0 : 1;
+}
+
+std::string read_file_to_string(std::string filename)
+{
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        throw CompileError { "error: file \"" + filename
+            + "\" could not be opened\n" };
+    }
+    std::ostringstream ss {};
+    ss << file.rdbuf();
+    return ss.str();
+}
+
+Compiled compile(const Options& options, std::ostream& out, std::ostream& err)
+{
+    auto compiled = Compiled {};
+    auto& phases = compiled.phases;
+    auto& text = compiled.source;
+    phases.measure(
+        "read", [&]() { text = read_file_to_string(options.filename); });
+    compiled.artifacts = cached_artifacts(options, text, out);
+    if (compiled.artifacts)
+        return compiled;
+    out << "Tokenizing\n";
+    auto& lex = phases.measure(
+        "lex", [&]() { compiled.tokens = Lexer(text).tokenize(); });
+    lex.count = { "tokens", compiled.tokens.size() };
+    out << "Lexer yeilded " << compiled.tokens.size() << " tokens\n";
+    for (auto& t : compiled.tokens) {
+        out << "\t" << t.to_string() << "\n";
+    }
+    out << "Parsing\n";
+    auto parser = Parser(compiled.tokens, options.strict);
+    auto& parse = phases.measure(
+        "parse", [&]() { compiled.ast = parser.parse(); });
+    parse.count = { "nodes", parser.nodes_count() };
+    out << compiled.ast->to_string() << "\n";
+    phases.measure("check", [&]() { Checker().check(*compiled.ast); });
+    if (options.check)
+        return compiled;
+    auto passes = PassManager(options.inlining);
+    auto& module = compiled.module;
+    passes.time(
+        "lowering", [&]() { module = Lowering().lower(*compiled.ast); });
+    passes.verify(*module, "lowering");
+    if (options.optimize)
+        passes.optimize(*module);
+    if (options.emit == Emit::Ir) {
+        if (options.output) {
+            out << "Writing IR to " << *options.output << "\n";
+            write_string_to_file(*options.output, module->to_string());
+        } else {
+            out << module->to_string();
+        }
+    }
+    // the C backend works from the IR
+    if (options.emit == Emit::None) {
+        out << "Compiling\n";
+        auto& program = compiled.program;
+        passes.time(
+            "codegen", [&]() { program = Compiler().compile(*module); });
+        program->filename = options.filename;
+        out << program->to_string();
+    }
+    if (options.time_passes)
+        passes.write_report(err);
+    phases.append(passes.phases());
+    return compiled;
+}
+
+// for `--time-report`
+void write_time_report(const Options& options, const Report::Phases& phases)
+{
+    if (!options.time_report)
+        return;
+    if (!options.time_report_file) {
+        phases.write_text(std::cerr);
+        return;
+    }
+    auto file = std::ofstream(*options.time_report_file);
+    if (!file.is_open()) {
+        std::cerr << "error: file \"" << *options.time_report_file
+                  << "\" could not be written\n";
+        return;
+    }
+    phases.write_json(file, options.filename);
+    file << "\n";
+}
+
+int run(const Options& options, Compiled& compiled)
+{
+    if (options.check || options.emit == Emit::Ir) {
+        write_time_report(options, compiled.phases);
+        return 0;
+    }
+    if (options.emit != Emit::None) {
+        auto executable = std::optional<std::filesystem::path> {};
+        compiled.phases.measure("emit", [&]() {
+            executable = compiled.artifacts
+                ? copy_artifacts(options, *compiled.artifacts, std::cerr)
+                : emit(options, compiled.source, *compiled.module, std::cout,
+                    std::cerr);
+        });
+        write_time_report(options, compiled.phases);
+        if (!executable)
+            return 1;
+        return options.native ? run_native(*executable) : 0;
+    }
+    std::cout << "Running\n";
+    auto profiler = Profiler {};
+    auto vm = VM(*compiled.program, options.profile ? &profiler : nullptr);
+    if (options.profile)
+        profiler.start();
+    const auto start = std::chrono::steady_clock::now();
+    compiled.phases.measure(
+        "run", [&]() { std::cout << vm.run().to_string() << "\n"; });
+    if (options.gc_stats)
+        Gc::heap().write_report(
+            std::cerr, std::chrono::steady_clock::now() - start);
+    if (options.profile) {
+        profiler.stop();
+        auto folded = std::ofstream(*options.profile);
+        profiler.write_collapsed(folded);
+        profiler.write_report(std::cerr, options.filename);
+    }
+    write_time_report(options, compiled.phases);
+    return 0;
+}
+
+int compile_and_run(const Options& options)
+{
+    auto compiled = compile(options, std::cout, std::cerr);
+    return run(options, compiled);
+}
+
+BatchResult compile_batch_file(const Options& options)
+{
+    auto output = std::ostringstream {};
+    auto errors = std::ostringstream {};
+    auto phases = Report::Phases {};
+    try {
+        auto text = std::string {};
+        phases.measure(
+            "read", [&]() { text = read_file_to_string(options.filename); });
+        if (const auto cached = cached_artifacts(options, text, output)) {
+            auto copied = std::optional<std::filesystem::path> {};
+            phases.measure("emit", [&]() {
+                copied = copy_artifacts(options, *cached, errors);
+            });
+            if (!copied)
+                return { output.str(), errors.str(), phases };
+            if (options.time_report && !options.time_report_file)
+                phases.write_text(output);
+            return { output.str(), std::nullopt, phases };
+        }
+        auto tokens = std::vector<Token> {};
+        auto& lex = phases.measure(
+            "lex", [&]() { tokens = Lexer(text).tokenize(); });
+        lex.count = { "tokens", tokens.size() };
+        auto parser = Parser(tokens, options.strict);
+        auto ast = std::unique_ptr<Parsed::Block> {};
+        auto& parse
+            = phases.measure("parse", [&]() { ast = parser.parse(); });
+        parse.count = { "nodes", parser.nodes_count() };
+        phases.measure("check", [&]() { Checker().check(*ast); });
+        if (!options.check) {
+            auto passes = PassManager(options.inlining);
+            auto module = std::unique_ptr<Ir::Module> {};
+            passes.time(
+                "lowering", [&]() { module = Lowering().lower(*ast); });
+            passes.verify(*module, "lowering");
+            if (options.optimize)
+                passes.optimize(*module);
+            if (options.emit == Emit::None)
+                passes.time("codegen", [&]() { Compiler().compile(*module); });
+            phases.append(passes.phases());
+            if (options.emit == Emit::Ir)
+                output << module->to_string();
+            if (options.emit == Emit::C || options.emit == Emit::Executable) {
+                auto emitted = std::optional<std::filesystem::path> {};
+                phases.measure("emit", [&]() {
+                    emitted = emit(options, text, *module, output, errors);
+                });
+                if (!emitted)
+                    return { output.str(), errors.str(), phases };
+            }
+            if (options.time_passes)
+                passes.write_report(output);
+        }
+    } catch (const CompileError& error) {
+        return { output.str(), error.what(), phases };
+    } catch (const InternalError& error) {
+        return { output.str(), error.what(), phases };
+    } catch (const std::exception& error) {
+        // thrown on a worker thread, where it mustn't escape
+        return { output.str(), "fatal: " + std::string { error.what() } + "\n",
+            phases };
+    }
+    if (options.time_report && !options.time_report_file)
+        phases.write_text(output);
+    return { output.str(), std::nullopt, phases };
+}
+
+std::vector<std::string> batch_files(const std::vector<std::string>& inputs)
+{
+    namespace fs = std::filesystem;
+    auto files = std::vector<std::string> {};
+    for (const auto& input : inputs) {
+        auto error = std::error_code {};
+        if (!fs::is_directory(input, error)) {
+            files.push_back(input);
+            continue;
+        }
+        auto found = std::vector<std::string> {};
+        for (auto entry = fs::recursive_directory_iterator(input, error);
+             !error && entry != fs::recursive_directory_iterator {};
+             entry.increment(error)) {
+            auto type_error = std::error_code {};
+            if (entry->is_regular_file(type_error)
+                && entry->path().extension() == ".lpl")
+                found.push_back(entry->path().string());
+        }
+        // what can't be listed fails like a file which can't be read
+        if (error)
+            found.push_back(input);
+        std::sort(found.begin(), found.end());
+        files.insert(files.end(), found.begin(), found.end());
+    }
+    return files;
+}
+
+// for `--time-report=<file>`, an array of the reports of the files
+void write_batch_time_report(const std::string& filename,
+    const std::vector<std::string>& files,
+    const std::vector<BatchResult>& results)
+{
+    auto file = std::ofstream(filename);
+    if (!file.is_open()) {
+        std::cerr << "error: file \"" << filename
+                  << "\" could not be written\n";
+        return;
+    }
+    file << "[";
+    for (size_t i = 0; i < files.size(); i++) {
+        file << (i > 0 ? ",\n " : "");
+        results[i].phases.write_json(file, files[i]);
+    }
+    file << "]\n";
+}
+
+int compile_batch(const Options& options)
+{
+    if (options.native || options.output || options.profile) {
+        std::cerr << "fatal: --native, --profile and -o take a single file\n";
+        return 1;
+    }
+    const auto files = batch_files(options.inputs);
+    auto results = std::vector<BatchResult>(files.size());
+    Parallel::for_each(files.size(), options.jobs, [&](size_t i) {
+        auto file_options = options;
+        file_options.filename = files[i];
+        results[i] = compile_batch_file(file_options);
+    });
+    if (options.time_report_file)
+        write_batch_time_report(*options.time_report_file, files, results);
+    return write_batch_results(files, results, std::cout, std::cerr);
+}
+
+int write_batch_results(const std::vector<std::string>& files,
+    const std::vector<BatchResult>& results, std::ostream& out,
+    std::ostream& err)
+{
+    auto failed = size_t { 0 };
+    for (size_t i = 0; i < files.size(); i++) {
+        out << results[i].output;
+        if (results[i].error) {
+            failed++;
+            out << std::flush;
+            err << files[i] << ": " << *results[i].error << std::flush;
+        } else {
+            out << files[i] << ": ok\n";
+        }
+    }
+    out << files.size() - failed << " of " << files.size()
+        << " files compiled\n"
+        << std::flush;
+    return failed > 0 ? 1 : 0;
+}
+
+void write_usage(std::ostream& out)
+{
+    out << "fatal: lack of args :(\n"
+        << "USAGE: lpl [-O0] [--check] [--strict] [--time-passes] "
+           "[--time-report[=<json output>]] [--gc-stats] "
+           "[--inline-budget=<n>] "
+           "[--profile-use=<folded>] [--profile[=<folded output>]] "
+           "[--emit=ir|c|exe|--native [-o <output>]] <file>\n"
+        << "       lpl [-j <jobs>] [-O0] [--check] [--strict] "
+           "[--time-passes] [--time-report[=<json output>]] "
+           "[--emit=ir|c|exe] <file or directory>...\n"
+        << "       lpl --server[=<socket>]\n"
+        << "       lpl --client[=<socket>] <arguments>...\n";
+}
+
+int drive(Options options)
+{
+    auto error = std::error_code {};
+    if (options.inputs.size() > 1
+        || std::filesystem::is_directory(options.inputs.front(), error))
+        return compile_batch(options);
+    options.filename = options.inputs.front();
+    try {
+        return compile_and_run(options);
+    } catch (const CompileError& error) {
+        std::cerr << error.what();
+        return 1;
+    } catch (const InternalError& error) {
+        std::cerr << error.what();
+        return 1;
+    }
+}
+
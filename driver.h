@@ -0,0 +1,109 @@
+#pragma once
+
+#include "bytecode.h"
+#include "ir.h"
+#include "lexer.h"
+#include "parallel.h"
+#include "parser.h"
+#include "passes.h"
+#include "report.h"
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// The compiler driver: the options of `lplc`, and compiling and running a
+// file, or a batch of them, with them.
+
+enum class Emit {
+    None,
+    // the optimized IR, see ir.h
+    Ir,
+    C,
+    // C compiled to a native binary with the system's C compiler
+    Executable,
+};
+
+struct Options {
+    // the files and directories given, several of them are compiled as a
+    // batch
+    std::vector<std::string> inputs {};
+    // the file being compiled
+    std::string filename {};
+    // how many files of a batch are compiled at once, `-j`
+    size_t jobs { Parallel::default_threads() };
+    Emit emit { Emit::None };
+    std::optional<std::string> output {};
+    // run the executable built by the C backend instead of the VM
+    bool native { false };
+    // where the collapsed stacks are written when profiling
+    std::optional<std::string> profile {};
+    // parse and check every function body up front, see `Parser`, implied
+    // by `--check` and batches
+    bool strict { false };
+    // run the IR passes, disabled with `-O0`
+    bool optimize { true };
+    // report how long lowering, each pass and code generation took
+    bool time_passes { false };
+    // report the time and memory each phase took, to stderr, or as JSON to
+    // `time_report_file` for `--time-report=<file>`
+    bool time_report { false };
+    std::optional<std::string> time_report_file {};
+    // stop after checking the program
+    bool check { false };
+    // report the collector's pauses and throughput after running
+    bool gc_stats { false };
+    Passes::InlineOptions inlining {};
+};
+
+// throws a `CompileError` for invalid options
+Options parse_options(const std::vector<std::string>& args);
+
+// a file compiled up to what `Options` asks for, the tokens are kept since
+// the AST points into them until every function body is parsed
+struct Compiled {
+    std::string source {};
+    // set instead of the rest when the artifact cache has what the C backend
+    // makes of the program
+    std::optional<std::filesystem::path> artifacts {};
+    std::vector<Token> tokens {};
+    std::unique_ptr<Parsed::Block> ast {};
+    std::unique_ptr<Ir::Module> module {};
+    std::unique_ptr<Bytecode::Program> program {};
+    Report::Phases phases {};
+};
+
+// compiles `options.filename`, printing what each phase made to `out` and
+// the timings to `err`, throws a `CompileError` when the program is invalid
+Compiled compile(const Options& options, std::ostream& out, std::ostream& err);
+// does what `Options` asks for with a compiled program, emitting it or
+// running it, and returns the exit status
+int run(const Options& options, Compiled& compiled);
+int compile_and_run(const Options& options);
+
+// what compiling a file of a batch printed, and its error if it failed
+struct BatchResult {
+    std::string output {};
+    std::optional<std::string> error {};
+    Report::Phases phases {};
+};
+
+BatchResult compile_batch_file(const Options& options);
+// the files to compile for the inputs, a directory stands for the `.lpl`
+// files under it, in order of their paths
+std::vector<std::string> batch_files(const std::vector<std::string>& inputs);
+// compiles the files on `options.jobs` threads without running them, and
+// prints the results in the order of the files
+int compile_batch(const Options& options);
+// prints the results of a batch, returns the exit status
+int write_batch_results(const std::vector<std::string>& files,
+    const std::vector<BatchResult>& results, std::ostream& out,
+    std::ostream& err);
+
+void write_usage(std::ostream& out);
+// compiles the inputs of `options`, as a batch when there are several of
+// them, otherwise compiles and runs the file, returns the exit status
+int drive(Options options);
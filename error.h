@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+// An error in the program being compiled, thrown by the phases up to code
+// generation with the whole message they report, e.g. `TypeError: 1:5: ...`.
+// The driver prints it and exits, or records it for the file it was compiling
+// when compiling a batch of them.
+class CompileError : public std::runtime_error {
+public:
+    explicit CompileError(const std::string& message)
+        : std::runtime_error { message }
+    {
+    }
+};
+
+// A bug in the compiler found while compiling, e.g. IR which doesn't verify,
+// with the whole message, `internal: ...`. Thrown rather than exiting so a
+// compile server outlives it. Unexhaustive matches, which no valid value
+// reaches, still exit right away.
+class InternalError : public std::logic_error {
+public:
+    explicit InternalError(const std::string& message)
+        : std::logic_error { message }
+    {
+    }
+};
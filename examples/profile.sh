@@ -0,0 +1,56 @@
+#!/bin/sh
+# Profiles a program which runs long enough to be sampled, and checks the
+# collapsed stacks of `--profile=<file>` and the report printed without one.
+#
+#   examples/profile.sh <lplc>
+
+if [ $# -ne 1 ]; then
+    echo "usage: $0 <lplc>" >&2
+    exit 2
+fi
+# run from the scratch directory below
+lplc=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+
+scratch=$(mktemp -d)
+trap 'rm -rf "$scratch"' EXIT
+export LPL_CACHE_DIR="$scratch/cache"
+
+cat > "$scratch/fib.lpl" << 'LPL'
+func fib(n: int) -> int {
+    if n < 2 { n } else { fib(n - 1) + fib(n - 2) }
+}
+
+fib(25)
+LPL
+
+failed=0
+fail() {
+    echo "FAIL $1"
+    failed=1
+}
+
+# in the interpreter, so all of the samples are taken in `fib`
+LPL_NO_JIT=1 "$lplc" --profile="$scratch/folded" "$scratch/fib.lpl" \
+    > "$scratch/out" 2>&1 || fail "--profile=<file> exited with $?"
+# `fib;fib;fib 12`, the stack outermost first and the number of samples
+if [ ! -s "$scratch/folded" ]; then
+    fail "no collapsed stacks"
+elif ! awk '
+    $NF !~ /^[1-9][0-9]*$/ || $1 !~ /^fib(;fib)*$/ { bad = 1 }
+    END { exit bad }' "$scratch/folded"; then
+    fail "malformed collapsed stacks"
+    sed 's/^/    /' "$scratch/folded"
+fi
+grep -q '^75025$' "$scratch/out" || fail "--profile changed the result"
+
+# which also writes the collapsed stacks to `lpl.folded`
+(cd "$scratch" && LPL_NO_JIT=1 "$lplc" --profile fib.lpl > out 2>&1) \
+    || fail "--profile exited with $?"
+if ! grep -q '^Profile of fib.lpl: [1-9][0-9]* samples' "$scratch/out" \
+    || ! grep -q ' fib$' "$scratch/out"; then
+    fail "no profile report"
+    sed 's/^/    /' "$scratch/out"
+fi
+
+[ "$failed" -eq 0 ] && echo "passed"
+[ "$failed" -eq 0 ]
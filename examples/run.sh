@@ -0,0 +1,65 @@
+#!/bin/sh
+# Runs the examples whose expected output has a `Running` section, under each
+# of the given modes, and diffs what they print from `Running` on against it.
+#
+#   examples/run.sh <lplc> [vm|jit|native|gc]...
+#
+# vm runs them in the interpreter only (`LPL_NO_JIT=1`), jit compiles every
+# function on its first call (`LPL_JIT_THRESHOLD=1`) and native runs the C
+# they transpile to (`--native`), and gc runs them with the smallest nursery
+# (`LPL_GC_NURSERY_SIZE=1`), so they go through minor collections. Without
+# modes, all of them are run.
+
+if [ $# -lt 1 ]; then
+    echo "usage: $0 <lplc> [vm|jit|native|gc]..." >&2
+    exit 2
+fi
+lplc=$1
+shift
+modes=${*:-vm jit native gc}
+examples=$(dirname "$0")
+for mode in $modes; do
+    case $mode in
+    vm | jit | native | gc) ;;
+    *)
+        echo "unknown mode \"$mode\"" >&2
+        exit 2
+        ;;
+    esac
+done
+
+# keeps build outputs out of the tree, and runs don't share cache entries
+# with the user's
+scratch=$(mktemp -d)
+trap 'rm -rf "$scratch"' EXIT
+export LPL_CACHE_DIR="$scratch/cache"
+
+run() {
+    case $1 in
+    vm) LPL_NO_JIT=1 "$lplc" "$2" ;;
+    jit) LPL_JIT_THRESHOLD=1 "$lplc" "$2" ;;
+    native) "$lplc" --native "$2" ;;
+    gc) LPL_GC_NURSERY_SIZE=1 "$lplc" "$2" ;;
+    esac
+}
+
+failed=0
+passed=0
+for file in $(find "$examples" -name '*.lpl' | sort); do
+    grep -q '^Running$' "$file" || continue
+    sed -n '/^Running$/,/^\*\/$/p' "$file" | sed '$d' > "$scratch/expected"
+    for mode in $modes; do
+        run "$mode" "$file" 2> "$scratch/errors" \
+            | sed -n '/^Running$/,$p' > "$scratch/actual"
+        if diff -u "$scratch/expected" "$scratch/actual" \
+            > "$scratch/diff"; then
+            passed=$((passed + 1))
+        else
+            failed=$((failed + 1))
+            echo "FAIL $mode $file"
+            sed 's/^/    /' "$scratch/diff" "$scratch/errors"
+        fi
+    done
+done
+echo "$passed passed, $failed failed"
+[ "$failed" -eq 0 ]
@@ -0,0 +1,98 @@
+#!/bin/sh
+# Starts a compile server on a private socket and checks that what its
+# clients print and exit with matches running `lplc` itself, for programs,
+# compile errors and batches, twice so the second time comes from its cache,
+# and that it keeps serving while a program which doesn't terminate runs.
+#
+#   examples/server.sh <lplc>
+
+if [ $# -ne 1 ]; then
+    echo "usage: $0 <lplc>" >&2
+    exit 2
+fi
+lplc=$1
+examples=$(dirname "$0")
+
+scratch=$(mktemp -d)
+chmod 700 "$scratch"
+export LPL_CACHE_DIR="$scratch/cache"
+socket="$scratch/lplc.sock"
+server=
+forever=
+cleanup() {
+    [ -n "$forever" ] && kill "$forever" 2> /dev/null
+    [ -n "$server" ] && kill "$server" 2> /dev/null
+    rm -rf "$scratch"
+}
+trap cleanup EXIT
+# so the server is killed along with the script, e.g. by a ctest timeout
+trap 'exit 1' HUP INT TERM
+
+"$lplc" --server="$socket" > "$scratch/server.log" 2>&1 &
+server=$!
+tries=0
+until grep -q '^Listening on ' "$scratch/server.log"; do
+    tries=$((tries + 1))
+    if [ "$tries" -gt 50 ] || ! kill -0 "$server" 2> /dev/null; then
+        echo "FAIL the server didn't start"
+        sed 's/^/    /' "$scratch/server.log"
+        exit 1
+    fi
+    sleep 0.1
+done
+
+printf 'let x: int = "one";\n' > "$scratch/type_error.lpl"
+printf 'println("started");\nwhile true { };\n' > "$scratch/forever.lpl"
+
+failed=0
+passed=0
+# runs the invocation locally and through the server
+compare() {
+    "$lplc" "$@" > "$scratch/expected" 2>&1
+    expected_status=$?
+    "$lplc" --client="$socket" "$@" > "$scratch/actual" 2>&1
+    actual_status=$?
+    if [ "$expected_status" -eq "$actual_status" ] \
+        && diff -u "$scratch/expected" "$scratch/actual" > "$scratch/diff"; then
+        passed=$((passed + 1))
+    else
+        failed=$((failed + 1))
+        echo "FAIL lplc $* exited with $actual_status, not $expected_status"
+        sed 's/^/    /' "$scratch/diff"
+    fi
+}
+
+for round in first cached; do
+    compare "$examples/statements/func.lpl"
+    compare "$examples/expressions/string_concat.lpl"
+    compare --emit=ir "$examples/statements/while.lpl"
+    compare "$scratch/type_error.lpl"
+    compare --check "$examples/statements"
+done
+
+# a program which never ends mustn't hold up the other clients
+"$lplc" --client="$socket" "$scratch/forever.lpl" > /dev/null 2>&1 &
+forever=$!
+sleep 0.5
+compare "$examples/statements/func.lpl"
+kill "$forever"
+wait "$forever" 2> /dev/null
+forever=
+# and is killed once its client is
+tries=0
+until grep -q 'forever.lpl: 137$' "$scratch/server.log"; do
+    tries=$((tries + 1))
+    if [ "$tries" -gt 50 ]; then
+        failed=$((failed + 1))
+        echo "FAIL the program outlived its client"
+        break
+    fi
+    sleep 0.1
+done
+
+kill -0 "$server" 2> /dev/null || {
+    failed=$((failed + 1))
+    echo "FAIL the server exited"
+}
+echo "$passed passed, $failed failed"
+[ "$failed" -eq 0 ]
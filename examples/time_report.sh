@@ -0,0 +1,54 @@
+#!/bin/sh
+# Checks that `--time-report=<file>` writes valid JSON, for a file and for a
+# batch of them, with python3's JSON parser. Skipped, with status 77,
+# without python3.
+#
+#   examples/time_report.sh <lplc>
+
+if [ $# -ne 1 ]; then
+    echo "usage: $0 <lplc>" >&2
+    exit 2
+fi
+lplc=$1
+examples=$(dirname "$0")
+if ! command -v python3 > /dev/null; then
+    echo "skipped, no python3"
+    exit 77
+fi
+
+scratch=$(mktemp -d)
+trap 'rm -rf "$scratch"' EXIT
+export LPL_CACHE_DIR="$scratch/cache"
+
+# a report of the file's phases, or an array of them for a batch
+check='
+import json, sys
+report = json.load(open(sys.argv[1]))
+reports = report if isinstance(report, list) else [report]
+assert len(reports) == int(sys.argv[2]), "expected %s reports" % sys.argv[2]
+for report in reports:
+    assert report["file"].endswith(".lpl"), report["file"]
+    assert report["phases"], "no phases"
+    for phase in report["phases"]:
+        assert phase["name"] and phase["wall_ms"] >= 0, phase
+'
+
+failed=0
+report() {
+    "$lplc" --time-report="$scratch/report.json" "$@" > "$scratch/out" 2>&1
+    if ! python3 -c "$check" "$scratch/report.json" "$count" \
+        > "$scratch/errors" 2>&1; then
+        failed=1
+        echo "FAIL --time-report $*"
+        sed 's/^/    /' "$scratch/errors"
+    fi
+}
+
+count=1
+report "$examples/statements/func.lpl"
+report --emit=ir "$examples/expressions/string_concat.lpl"
+count=$(find "$examples/statements" -name '*.lpl' | wc -l)
+report --check "$examples/statements"
+
+[ "$failed" -eq 0 ] && echo "passed"
+[ "$failed" -eq 0 ]
@@ -0,0 +1,318 @@
+#include "gc.h"
+#include "array.h"
+#include "str.h"
+#include "value.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <new>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+namespace Gc {
+
+namespace {
+
+    constexpr size_t min_nursery_size = size_t { 64 } << 10;
+
+    size_t size_from_env(const char* name, size_t fallback)
+    {
+        if (const auto value = std::getenv(name))
+            return std::strtoull(value, nullptr, 10);
+        return fallback;
+    }
+
+    double megabytes(size_t bytes)
+    {
+        return static_cast<double>(bytes) / (1024 * 1024);
+    }
+
+    double milliseconds(std::chrono::duration<double> duration)
+    {
+        return duration.count() * 1000;
+    }
+
+}
+
+bool Heap::collection_pending = false;
+
+Heap::Heap()
+    : m_nursery_size { std::max(
+          size_from_env("LPL_GC_NURSERY_SIZE", default_nursery_size),
+          min_nursery_size)
+          / alignment * alignment }
+    , m_heap_size { size_from_env("LPL_GC_HEAP_SIZE", default_heap_size) }
+    , m_nursery { static_cast<char*>(
+          ::operator new(m_nursery_size, std::align_val_t { alignment })) }
+    , m_nursery_end { m_nursery + m_nursery_size }
+    , m_top { m_nursery }
+    , m_next_major { m_heap_size }
+{
+}
+
+Heap::~Heap()
+{
+    for (const auto object : m_young_externals) {
+        if (!object->forwarded)
+            free_external(object);
+    }
+    for (const auto object : m_old)
+        free_object(object);
+    for (const auto object : m_permanent)
+        ::operator delete(object, std::align_val_t { alignment });
+    for (const auto memory : m_slot_memory)
+        ::operator delete(memory, std::align_val_t { alignment });
+    ::operator delete(m_nursery, std::align_val_t { alignment });
+}
+
+void* Heap::allocate(size_t size, bool has_references)
+{
+    size = (size + alignment - 1) / alignment * alignment;
+    m_stats.allocated += size;
+    if (m_slot && !has_references) {
+        const auto slot = std::exchange(m_slot, nullptr);
+        m_stats.local += size;
+        if (slot->size < size) {
+            slot->size = std::max(size, 2 * slot->size);
+            slot->memory
+                = ::operator new(slot->size, std::align_val_t { alignment });
+            m_slot_memory.push_back(slot->memory);
+        }
+        return slot->memory;
+    }
+    if (size > m_nursery_size / 4)
+        return allocate_old(size);
+    if (size > static_cast<size_t>(m_nursery_end - m_top)) {
+        collection_pending = true;
+        return allocate_old(size);
+    }
+    const auto result = m_top;
+    m_top += size;
+    return result;
+}
+
+void* Heap::allocate_permanent(size_t size)
+{
+    const auto result = ::operator new(size, std::align_val_t { alignment });
+    m_permanent.push_back(static_cast<Object*>(result));
+    return result;
+}
+
+void* Heap::allocate_old(size_t size)
+{
+    const auto result = ::operator new(size, std::align_val_t { alignment });
+    m_old.push_back(static_cast<Object*>(result));
+    m_old_size += size;
+    if (m_old_size >= m_next_major)
+        collection_pending = true;
+    return result;
+}
+
+void Heap::write_barrier(Object& owner, const Object* target)
+{
+    if (target && !owner.remembered && is_young(target) && !is_young(&owner)) {
+        owner.remembered = true;
+        m_remembered.push_back(&owner);
+    }
+}
+
+void Heap::write_barrier(Object& owner, const Value& value)
+{
+    if (value.type == ValueType::String)
+        write_barrier(owner, value.string_value);
+    else if (value.type == ValueType::Array)
+        write_barrier(owner, value.array_value);
+}
+
+void Heap::add_external(Object& object)
+{
+    // old objects free theirs when they are swept
+    if (is_young(&object))
+        m_young_externals.push_back(&object);
+}
+
+template <typename F> void Heap::trace(Value& value, F&& update)
+{
+    if (value.type == ValueType::String) {
+        value.string_value = static_cast<const String*>(
+            update(const_cast<String*>(value.string_value)));
+    } else if (value.type == ValueType::Array) {
+        value.array_value = static_cast<Array*>(update(value.array_value));
+    }
+}
+
+template <typename F> void Heap::trace(Object& object, F&& update)
+{
+    switch (object.kind) {
+    case Object::Kind::String: {
+        auto& string = static_cast<String&>(object);
+        if (!string.is_rope())
+            return;
+        string.m_left = static_cast<const String*>(
+            update(const_cast<String*>(string.m_left)));
+        string.m_right = static_cast<const String*>(
+            update(const_cast<String*>(string.m_right)));
+        return;
+    }
+    case Object::Kind::Array: {
+        auto& array = static_cast<Array&>(object);
+        if (Array::is_unboxed(array.element_type))
+            return;
+        for (int64_t i = 0; i < array.length; i++)
+            trace(array.values()[i], update);
+        return;
+    }
+    }
+}
+
+Object* Heap::evacuate(Object* object, std::vector<Object*>& copied)
+{
+    if (!is_young(object))
+        return object;
+    if (object->forwarded)
+        return object->forwarded;
+    const auto result = static_cast<Object*>(allocate_old(object->size));
+    std::memcpy(static_cast<void*>(result), object, object->size);
+    // interior pointers moved along with the object
+    switch (object->kind) {
+    case Object::Kind::String: {
+        auto& string = static_cast<String&>(*result);
+        if (string.m_data == static_cast<String*>(object)->inline_data())
+            string.m_data = string.inline_data();
+        break;
+    }
+    case Object::Kind::Array: {
+        auto& array = static_cast<Array&>(*result);
+        array.data = reinterpret_cast<char*>(result) + Array::header_size;
+        break;
+    }
+    }
+    object->forwarded = result;
+    m_stats.promoted += object->size;
+    copied.push_back(result);
+    return result;
+}
+
+void Heap::collect(const std::function<void(const Visitor&)>& visit_roots)
+{
+    const auto start = std::chrono::steady_clock::now();
+    minor_collection(visit_roots);
+    if (m_old_size >= m_next_major)
+        major_collection(visit_roots);
+    collection_pending = false;
+    const auto pause = std::chrono::steady_clock::now() - start;
+    m_stats.total_pause += pause;
+    m_stats.max_pause = std::max(
+        m_stats.max_pause, std::chrono::duration<double>(pause));
+}
+
+void Heap::minor_collection(
+    const std::function<void(const Visitor&)>& visit_roots)
+{
+    m_stats.minor_collections++;
+    auto copied = std::vector<Object*> {};
+    const auto forward
+        = [&](Object* object) { return evacuate(object, copied); };
+    visit_roots([&](Value& value) { trace(value, forward); });
+    for (const auto object : m_remembered) {
+        object->remembered = false;
+        trace(*object, forward);
+    }
+    m_remembered.clear();
+    while (!copied.empty()) {
+        const auto object = copied.back();
+        copied.pop_back();
+        trace(*object, forward);
+    }
+    // the buffers of copied objects are now owned by their copies
+    for (const auto object : m_young_externals) {
+        if (!object->forwarded)
+            free_external(object);
+    }
+    m_young_externals.clear();
+    m_top = m_nursery;
+}
+
+void Heap::major_collection(
+    const std::function<void(const Visitor&)>& visit_roots)
+{
+    m_stats.major_collections++;
+    auto pending = std::vector<Object*> {};
+    const auto mark = [&](Object* object) {
+        if (!object->marked && !object->permanent) {
+            object->marked = true;
+            pending.push_back(object);
+        }
+        return object;
+    };
+    visit_roots([&](Value& value) { trace(value, mark); });
+    while (!pending.empty()) {
+        const auto object = pending.back();
+        pending.pop_back();
+        trace(*object, mark);
+    }
+    auto live = std::vector<Object*> {};
+    for (const auto object : m_old) {
+        if (object->marked) {
+            object->marked = false;
+            live.push_back(object);
+        } else {
+            m_old_size -= object->size;
+            m_stats.freed += object->size;
+            free_object(object);
+        }
+    }
+    m_old = std::move(live);
+    m_next_major = std::max(m_heap_size, 2 * m_old_size);
+}
+
+void Heap::free_external(Object* object)
+{
+    if (object->kind != Object::Kind::String)
+        return;
+    const auto& string = static_cast<String&>(*object);
+    if (string.m_data && string.m_data != string.inline_data())
+        delete[] string.m_data;
+}
+
+void Heap::free_object(Object* object)
+{
+    free_external(object);
+    ::operator delete(object, std::align_val_t { alignment });
+}
+
+void Heap::write_report(
+    std::ostream& out, std::chrono::duration<double> run_time) const
+{
+    out << std::fixed << std::setprecision(2);
+    out << "GC: " << m_stats.minor_collections << " minor, "
+        << m_stats.major_collections << " major collections\n";
+    out << "  pauses: " << milliseconds(m_stats.total_pause) << " ms total, "
+        << milliseconds(m_stats.max_pause) << " ms max, "
+        << (m_stats.minor_collections > 0
+                   ? milliseconds(m_stats.total_pause)
+                       / static_cast<double>(m_stats.minor_collections)
+                   : 0.0)
+        << " ms mean\n";
+    out << "  allocated " << megabytes(m_stats.allocated) << " MB ("
+        << megabytes(m_stats.local) << " MB in frames), promoted "
+        << megabytes(m_stats.promoted) << " MB, freed "
+        << megabytes(m_stats.freed) << " MB\n";
+    out << "  throughput: "
+        << (run_time.count() > 0
+                   ? 100 * (1 - m_stats.total_pause / run_time)
+                   : 100.0)
+        << "% of " << milliseconds(run_time)
+        << " ms outside of collections\n";
+}
+
+Heap& heap()
+{
+    static auto heap = Heap {};
+    return heap;
+}
+
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "value.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <vector>
+
+// A generational, tracing collector for the objects of the VM, strings and
+// arrays.
+//
+// Objects are allocated by bumping a pointer through the nursery. When it
+// fills up a collection is requested, and the VM collects at its next safe
+// point, the start of an instruction, where every live value is a root, on
+// its stack or in its globals. Until then objects go to the old generation.
+//
+// A minor collection copies the nursery objects reachable from the roots and
+// from remembered old objects into the old generation and empties the
+// nursery. Storing a nursery object into an old one goes through
+// `write_barrier`, which remembers the old object. The old generation is
+// marked and swept by a major collection once it has grown to `heap_size`
+// bytes, or twice what survived the last one.
+//
+// Objects larger than a quarter of the nursery go straight to the old
+// generation. Permanent objects, the interned strings, are never collected.
+// Neither are arrays made in a `Slot` of a frame.
+//
+// `LPL_GC_NURSERY_SIZE` and `LPL_GC_HEAP_SIZE` set the sizes in bytes.
+namespace Gc {
+
+struct Object {
+    enum class Kind : uint8_t {
+        String,
+        Array,
+    };
+
+    Object(Kind kind, size_t size)
+        : kind { kind }
+        , size { size }
+    {
+    }
+
+    Kind kind;
+    bool marked { false };
+    bool remembered { false };
+    // never collected, nor traced as it can't point to collected objects
+    bool permanent { false };
+    // of the whole allocation, which can hold more than the object
+    size_t size;
+    // where a minor collection copied a nursery object to
+    Object* forwarded { nullptr };
+};
+
+// Storage in a frame of the VM for the arrays made by an operation which
+// don't escape the function, see `Passes::analyze_escapes`. The operation only
+// runs again once the array it made last is dead, so each one reuses the
+// memory, which grows as needed. The slots of returned frames are reused by
+// the next frames called at the same depth.
+struct Slot {
+    void* memory { nullptr };
+    size_t size { 0 };
+};
+
+class Heap {
+public:
+    using Visitor = std::function<void(Value&)>;
+
+    static constexpr size_t default_nursery_size = size_t { 4 } << 20;
+    static constexpr size_t default_heap_size = size_t { 64 } << 20;
+    static constexpr size_t alignment = 64;
+
+    // set when a collection is due, the VM checks it before each instruction
+    static bool collection_pending;
+
+    Heap();
+    ~Heap();
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+
+    // memory for an object of `size` bytes, aligned to `alignment`, objects
+    // without references are made in the current slot when there is one
+    void* allocate(size_t size, bool has_references = true);
+    void* allocate_permanent(size_t size);
+    // records that `owner` now points to `target`
+    void write_barrier(Object& owner, const Object* target);
+    void write_barrier(Object& owner, const Value& value);
+    // `object` points to memory of its own, freed when it dies
+    void add_external(Object& object);
+    // the VM sets the slot of an operation making a local array while it
+    // runs, the next object without references is made in it
+    void set_slot(Slot* slot) { m_slot = slot; }
+
+    // `visit_roots` calls its argument on each root, which is updated when
+    // the object it points to moves
+    void collect(const std::function<void(const Visitor&)>& visit_roots);
+
+    // pauses, and how much of `run_time` was spent outside of collections
+    void write_report(
+        std::ostream& out, std::chrono::duration<double> run_time) const;
+
+private:
+    struct Stats {
+        size_t minor_collections { 0 };
+        size_t major_collections { 0 };
+        size_t allocated { 0 };
+        // of `allocated`, in slots
+        size_t local { 0 };
+        size_t promoted { 0 };
+        size_t freed { 0 };
+        std::chrono::duration<double> total_pause {};
+        std::chrono::duration<double> max_pause {};
+    };
+
+    bool is_young(const Object* object) const
+    {
+        const auto address = reinterpret_cast<const char*>(object);
+        return address >= m_nursery && address < m_nursery_end;
+    }
+    void* allocate_old(size_t size);
+    Object* evacuate(Object* object, std::vector<Object*>& copied);
+    void minor_collection(
+        const std::function<void(const Visitor&)>& visit_roots);
+    void major_collection(
+        const std::function<void(const Visitor&)>& visit_roots);
+    // frees the memory `object` points to of its own
+    void free_external(Object* object);
+    void free_object(Object* object);
+
+    // calls `update` on the objects `object` points to, and points to what
+    // it returns instead
+    template <typename F> static void trace(Object& object, F&& update);
+    template <typename F> static void trace(Value& value, F&& update);
+
+    size_t m_nursery_size;
+    size_t m_heap_size;
+    char* m_nursery;
+    char* m_nursery_end;
+    char* m_top;
+    std::vector<Object*> m_old {};
+    size_t m_old_size { 0 };
+    // the old generation is collected when it grows to this size
+    size_t m_next_major;
+    std::vector<Object*> m_remembered {};
+    std::vector<Object*> m_young_externals {};
+    std::vector<Object*> m_permanent {};
+    Slot* m_slot { nullptr };
+    // the memory of slots, including what they grew out of, which dead
+    // values in their frames may still point to
+    std::vector<void*> m_slot_memory {};
+    Stats m_stats {};
+};
+
+Heap& heap();
+
+}
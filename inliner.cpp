@@ -0,0 +1,325 @@
+#include "ir.h"
+#include "passes.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <istream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using Ir::Op;
+
+// callers don't grow past this many instructions by inlining
+constexpr size_t max_caller_size = 2000;
+// added to the budget for each argument which is constant at the call site
+constexpr size_t constant_argument_bonus = 8;
+// calls in at least 1 / `hot_call_ratio` of the samples are hot
+constexpr uint64_t hot_call_ratio = 100;
+constexpr size_t hot_call_factor = 4;
+constexpr size_t cold_call_divisor = 4;
+
+// constants and parameters don't cost anything once inlined, they are
+// rematerialized or replaced by the arguments
+size_t inline_size(const Ir::Function& function)
+{
+    size_t size = 0;
+    for (const auto& block : function.blocks)
+        for (const auto& instruction : block->instructions)
+            if (instruction->op != Op::Constant
+                && instruction->op != Op::Parameter)
+                size++;
+    return size;
+}
+
+class Inliner {
+public:
+    Inliner(Ir::Module& module, const Passes::InlineOptions& options)
+        : m_module { module }
+        , m_options { options }
+    {
+    }
+
+    bool run();
+
+private:
+    Ir::Function* callee(const Ir::Instruction& call) const;
+    std::vector<Ir::Function*> callees(const Ir::Function& function) const;
+    void visit(Ir::Function* function);
+    size_t budget(const Ir::Function& caller, const Ir::Instruction& call,
+        const Ir::Function& callee) const;
+    bool inline_calls(Ir::Function& caller);
+    void inline_call(
+        Ir::Function& caller, Ir::Instruction* call, const Ir::Function& callee);
+
+    Ir::Module& m_module;
+    const Passes::InlineOptions& m_options;
+    std::unordered_map<uint32_t, Ir::Function*> m_functions {};
+    std::unordered_set<const Ir::Function*> m_recursive {};
+    std::unordered_map<const Ir::Function*, size_t> m_sizes {};
+
+    // Tarjan's strongly connected components, which come out callees first
+    std::vector<Ir::Function*> m_order {};
+    std::unordered_map<const Ir::Function*, size_t> m_indices {};
+    std::unordered_map<const Ir::Function*, size_t> m_lowlinks {};
+    std::vector<Ir::Function*> m_stack {};
+    std::unordered_set<const Ir::Function*> m_on_stack {};
+};
+
+bool Inliner::run()
+{
+    if (m_options.budget == 0)
+        return false;
+    for (size_t i = 0; i < m_module.functions.size(); i++)
+        m_functions[m_module.function_globals[i]]
+            = m_module.functions[i].get();
+    visit(m_module.main.get());
+    for (const auto& function : m_module.functions)
+        if (!m_indices.count(function.get()))
+            visit(function.get());
+
+    auto changed = false;
+    for (const auto function : m_order) {
+        if (inline_calls(*function)) {
+            function->sort_blocks();
+            changed = true;
+        }
+        m_sizes[function] = inline_size(*function);
+    }
+    return changed;
+}
+
+// calls to a function global are direct unless a top level `let` may rebind
+// it, since functions are bound before `main` runs
+Ir::Function* Inliner::callee(const Ir::Instruction& call) const
+{
+    if (call.op != Op::CallGlobal || m_module.defined_globals[call.index])
+        return nullptr;
+    const auto found = m_functions.find(call.index);
+    return found == m_functions.end() ? nullptr : found->second;
+}
+
+std::vector<Ir::Function*> Inliner::callees(const Ir::Function& function) const
+{
+    auto result = std::vector<Ir::Function*> {};
+    for (const auto& block : function.blocks)
+        for (const auto& instruction : block->instructions)
+            if (const auto target = callee(*instruction))
+                result.push_back(target);
+    return result;
+}
+
+void Inliner::visit(Ir::Function* function)
+{
+    const auto index = m_indices.size();
+    m_indices[function] = index;
+    m_lowlinks[function] = index;
+    m_stack.push_back(function);
+    m_on_stack.insert(function);
+    for (const auto callee : callees(*function)) {
+        if (callee == function)
+            m_recursive.insert(function);
+        if (!m_indices.count(callee)) {
+            visit(callee);
+            m_lowlinks[function]
+                = std::min(m_lowlinks[function], m_lowlinks[callee]);
+        } else if (m_on_stack.count(callee)) {
+            m_lowlinks[function]
+                = std::min(m_lowlinks[function], m_indices[callee]);
+        }
+    }
+    if (m_lowlinks[function] != index)
+        return;
+    auto component = std::vector<Ir::Function*> {};
+    do {
+        component.push_back(m_stack.back());
+        m_on_stack.erase(m_stack.back());
+        m_stack.pop_back();
+    } while (component.back() != function);
+    if (component.size() > 1)
+        m_recursive.insert(component.begin(), component.end());
+    m_order.insert(m_order.end(), component.begin(), component.end());
+}
+
+size_t Inliner::budget(const Ir::Function& caller, const Ir::Instruction& call,
+    const Ir::Function& callee) const
+{
+    // the call and pushing its arguments go away
+    auto budget = m_options.budget + call.operands.size() + 1;
+    // constant arguments are likely to fold parts of the callee away
+    for (const auto operand : call.operands)
+        if (operand->op == Op::Constant)
+            budget += constant_argument_bonus;
+    if (!m_options.profile || m_options.profile->samples == 0)
+        return budget;
+    const auto& profile = *m_options.profile;
+    const auto found = profile.calls.find({ caller.name, callee.name });
+    const auto samples = found == profile.calls.end() ? 0 : found->second;
+    if (samples * hot_call_ratio >= profile.samples)
+        return budget * hot_call_factor;
+    if (samples == 0)
+        return budget / cold_call_divisor;
+    return budget;
+}
+
+bool Inliner::inline_calls(Ir::Function& caller)
+{
+    auto calls = std::vector<Ir::Instruction*> {};
+    for (const auto& block : caller.blocks)
+        for (const auto& instruction : block->instructions)
+            if (callee(*instruction))
+                calls.push_back(instruction.get());
+
+    auto size = inline_size(caller);
+    auto changed = false;
+    for (const auto call : calls) {
+        const auto& function = *callee(*call);
+        // mismatched arities are left to fail at runtime
+        if (m_recursive.count(&function)
+            || function.arity != call->operands.size())
+            continue;
+        // callees come first, so they already have their calls inlined
+        const auto function_size = m_sizes.at(&function);
+        if (function_size > budget(caller, *call, function)
+            || size + function_size > max_caller_size)
+            continue;
+        inline_call(caller, call, function);
+        size += function_size;
+        changed = true;
+    }
+    return changed;
+}
+
+// splits the block of the call at the call, with the callee's blocks in
+// between, whose returns jump to the rest of the block
+void Inliner::inline_call(
+    Ir::Function& caller, Ir::Instruction* call, const Ir::Function& callee)
+{
+    const auto block = call->block;
+    auto& instructions = block->instructions;
+    const auto position = static_cast<size_t>(
+        std::find_if(instructions.begin(), instructions.end(),
+            [&](const auto& instruction) {
+                return instruction.get() == call;
+            })
+        - instructions.begin());
+    const auto continuation = caller.create_block();
+    for (size_t i = position + 1; i < instructions.size(); i++)
+        continuation->append(std::move(instructions[i]));
+    const auto owned_call = std::move(instructions[position]);
+    instructions.erase(instructions.begin()
+            + static_cast<std::ptrdiff_t>(position),
+        instructions.end());
+    for (const auto target : continuation->successors())
+        std::replace(target->predecessors.begin(), target->predecessors.end(),
+            block, continuation);
+
+    auto blocks = std::unordered_map<const Ir::Block*, Ir::Block*> {};
+    for (const auto& original : callee.blocks)
+        blocks[original.get()] = caller.create_block();
+    auto values = std::unordered_map<const Ir::Instruction*, Ir::Instruction*> {};
+    auto clones = std::vector<std::pair<const Ir::Instruction*, Ir::Instruction*>> {};
+    auto returns = std::vector<std::pair<Ir::Block*, const Ir::Instruction*>> {};
+    for (const auto& original : callee.blocks) {
+        const auto copy = blocks.at(original.get());
+        for (const auto predecessor : original->predecessors)
+            copy->predecessors.push_back(blocks.at(predecessor));
+        for (const auto& instruction : original->instructions) {
+            if (instruction->op == Op::Parameter) {
+                values[instruction.get()] = call->operands[instruction->index];
+                continue;
+            }
+            auto clone = caller.create(
+                instruction->op == Op::Return ? Op::Jump : instruction->op);
+            clone->value = instruction->value;
+            clone->cases = instruction->cases;
+            clone->index = instruction->index;
+            clone->type = instruction->type;
+            clone->in_bounds = instruction->in_bounds;
+            clone->local = instruction->local;
+            clone->expression = instruction->expression;
+            clone->position = instruction->position;
+            if (instruction->op == Op::Return) {
+                clone->targets.push_back(continuation);
+                returns.push_back({ copy, instruction->operands[0] });
+            } else {
+                for (const auto target : instruction->targets)
+                    clone->targets.push_back(blocks.at(target));
+                clones.push_back({ instruction.get(), clone.get() });
+            }
+            values[instruction.get()] = copy->append(std::move(clone));
+        }
+    }
+    for (const auto& [original, clone] : clones)
+        for (const auto operand : original->operands)
+            clone->operands.push_back(values.at(operand));
+
+    block->append(caller.create(Op::Jump))->targets.push_back(
+        blocks.at(callee.entry()));
+    blocks.at(callee.entry())->predecessors.push_back(block);
+
+    for (const auto& [from, value] : returns)
+        continuation->predecessors.push_back(from);
+    auto result = static_cast<Ir::Instruction*>(nullptr);
+    if (returns.size() == 1) {
+        result = values.at(returns[0].second);
+    } else if (returns.empty()) {
+        // the callee always fails, the rest of the block is unreachable
+        auto unit = caller.create(Op::Constant);
+        unit->value = Value::make_unit();
+        unit->type = ValueType::Unit;
+        result = caller.entry()->insert(0, std::move(unit));
+    } else {
+        auto phi = caller.create(Op::Phi);
+        phi->position = call->position;
+        for (const auto& [from, value] : returns)
+            phi->operands.push_back(values.at(value));
+        result = continuation->insert(0, std::move(phi));
+    }
+    caller.replace_uses({ { call, result } });
+}
+
+}
+
+Passes::CallProfile Passes::read_call_profile(std::istream& in)
+{
+    auto profile = CallProfile {};
+    auto line = std::string {};
+    while (std::getline(in, line)) {
+        const auto space = line.rfind(' ');
+        if (space == std::string::npos)
+            continue;
+        const auto samples = static_cast<uint64_t>(
+            std::strtoull(line.c_str() + space + 1, nullptr, 10));
+        profile.samples += samples;
+        auto caller = std::string {};
+        size_t start = 0;
+        while (start < space) {
+            const auto end = std::min(line.find(';', start), space);
+            auto frame = line.substr(start, end - start);
+            // functions compiled by the JIT are the same functions
+            const auto jit = std::string { " [jit]" };
+            if (frame.size() >= jit.size()
+                && frame.compare(frame.size() - jit.size(), jit.size(), jit)
+                    == 0)
+                frame.resize(frame.size() - jit.size());
+            if (!caller.empty())
+                profile.calls[{ caller, frame }] += samples;
+            caller = std::move(frame);
+            start = end + 1;
+        }
+    }
+    return profile;
+}
+
+bool Passes::inline_functions(
+    Ir::Module& module, const InlineOptions& options)
+{
+    return Inliner(module, options).run();
+}
@@ -0,0 +1,313 @@
+#include "ir.h"
+#include "error.h"
+#include "str.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using Ir::Op;
+
+bool Ir::is_unary(Op op)
+{
+    switch (op) {
+    case Op::LogicalNot:
+    case Op::BitwiseNot:
+    case Op::Plus:
+    case Op::Negate: return true;
+    default: return false;
+    }
+}
+
+bool Ir::is_binary(Op op)
+{
+    return op >= Op::Add && op <= Op::NotEqual;
+}
+
+std::optional<Kernels::Op> Ir::kernel_op(Op op)
+{
+    switch (op) {
+    case Op::Add: return Kernels::Op::Add;
+    case Op::Subtract: return Kernels::Op::Subtract;
+    case Op::Multiply: return Kernels::Op::Multiply;
+    case Op::BitwiseAnd: return Kernels::Op::BitwiseAnd;
+    case Op::BitwiseOr: return Kernels::Op::BitwiseOr;
+    case Op::BitwiseXor: return Kernels::Op::BitwiseXor;
+    default: return std::nullopt;
+    }
+}
+
+bool Ir::is_terminator(Op op)
+{
+    return op == Op::Jump || op == Op::Branch || op == Op::Switch
+        || op == Op::Return;
+}
+
+bool Ir::has_result(Op op)
+{
+    return op != Op::StoreGlobal && op != Op::DefineGlobal
+        && op != Op::StoreIndex && !is_terminator(op);
+}
+
+std::optional<ValueType> Ir::binary_type(
+    Op op, std::optional<ValueType> left, std::optional<ValueType> right)
+{
+    const auto is_number = [](std::optional<ValueType> type) {
+        return type == ValueType::Int || type == ValueType::Float;
+    };
+    if (op >= Op::LessThan && op <= Op::NotEqual)
+        return ValueType::Bool;
+    if (left == ValueType::Array && right == ValueType::Array && kernel_op(op))
+        return ValueType::Array;
+    if (op == Op::Add && left == ValueType::String
+        && right == ValueType::String)
+        return ValueType::String;
+    if (left == ValueType::Int && right == ValueType::Int)
+        return ValueType::Int;
+    if (is_number(left) && is_number(right))
+        return ValueType::Float;
+    if (left == ValueType::Char
+        && (right == ValueType::Char || right == ValueType::Int))
+        return ValueType::Char;
+    return std::nullopt;
+}
+
+bool Ir::matches_case(const Value& value, const Value& case_)
+{
+    if (value.type != case_.type)
+        return false;
+    switch (case_.type) {
+    case ValueType::Int: return value.int_value == case_.int_value;
+    case ValueType::Char: return value.char_value == case_.char_value;
+    case ValueType::Bool: return value.bool_value == case_.bool_value;
+    case ValueType::String:
+        return value.string_value->equals(*case_.string_value);
+    default: return false;
+    }
+}
+
+std::optional<ValueType> Ir::unary_type(
+    Op op, std::optional<ValueType> operand)
+{
+    switch (op) {
+    case Op::LogicalNot: return ValueType::Bool;
+    case Op::BitwiseNot: return ValueType::Int;
+    case Op::Plus:
+    case Op::Negate:
+        if (operand == ValueType::Int || operand == ValueType::Float)
+            return operand;
+        return std::nullopt;
+    default: return std::nullopt;
+    }
+}
+
+Ir::Instruction* Ir::Block::terminator() const
+{
+    if (instructions.empty() || !is_terminator(instructions.back()->op))
+        return nullptr;
+    return instructions.back().get();
+}
+
+std::vector<Ir::Block*> Ir::Block::successors() const
+{
+    const auto last = terminator();
+    return last ? last->targets : std::vector<Block*> {};
+}
+
+size_t Ir::Block::phis_count() const
+{
+    size_t count = 0;
+    while (count < instructions.size()
+        && instructions[count]->op == Op::Phi)
+        count++;
+    return count;
+}
+
+size_t Ir::Block::predecessor_index(const Block* predecessor) const
+{
+    const auto found
+        = std::find(predecessors.begin(), predecessors.end(), predecessor);
+    return static_cast<size_t>(found - predecessors.begin());
+}
+
+Ir::Instruction* Ir::Block::append(std::unique_ptr<Instruction> instruction)
+{
+    return insert(instructions.size(), std::move(instruction));
+}
+
+Ir::Instruction* Ir::Block::insert(
+    size_t position, std::unique_ptr<Instruction> instruction)
+{
+    instruction->block = this;
+    const auto result = instruction.get();
+    instructions.insert(instructions.begin()
+            + static_cast<std::ptrdiff_t>(position),
+        std::move(instruction));
+    return result;
+}
+
+void Ir::Block::remove_predecessor(const Block* predecessor)
+{
+    const auto index = predecessor_index(predecessor);
+    if (index == predecessors.size())
+        return;
+    predecessors.erase(
+        predecessors.begin() + static_cast<std::ptrdiff_t>(index));
+    for (size_t i = 0; i < phis_count(); i++) {
+        auto& operands = instructions[i]->operands;
+        operands.erase(operands.begin() + static_cast<std::ptrdiff_t>(index));
+    }
+}
+
+Ir::Block* Ir::Function::create_block()
+{
+    blocks.push_back(std::make_unique<Block>(blocks_count++));
+    return blocks.back().get();
+}
+
+std::unique_ptr<Ir::Instruction> Ir::Function::create(Op op)
+{
+    return std::make_unique<Instruction>(op, values_count++);
+}
+
+std::vector<Ir::Block*> Ir::Function::reverse_postorder() const
+{
+    auto order = std::vector<Block*> {};
+    auto visited = std::unordered_set<const Block*> {};
+    // (block, index of the next target to visit)
+    auto stack = std::vector<std::pair<Block*, size_t>> { { entry(), 0 } };
+    visited.insert(entry());
+    while (!stack.empty()) {
+        auto& [block, next] = stack.back();
+        const auto targets = block->successors();
+        if (next == targets.size()) {
+            order.push_back(block);
+            stack.pop_back();
+            continue;
+        }
+        // the last target is visited first, so the first one comes first
+        // in reverse postorder
+        const auto target = targets[targets.size() - 1 - next++];
+        if (visited.insert(target).second)
+            stack.push_back({ target, 0 });
+    }
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+void Ir::Function::sort_blocks()
+{
+    const auto order = reverse_postorder();
+    auto reachable = std::unordered_set<const Block*>(order.begin(), order.end());
+    for (const auto& block : blocks) {
+        if (reachable.count(block.get()))
+            continue;
+        for (const auto target : block->successors())
+            if (reachable.count(target))
+                target->remove_predecessor(block.get());
+    }
+    auto owned = std::unordered_map<Block*, std::unique_ptr<Block>> {};
+    for (auto& block : blocks)
+        owned[block.get()] = std::move(block);
+    blocks.clear();
+    for (const auto block : order)
+        blocks.push_back(std::move(owned[block]));
+}
+
+void Ir::Function::replace_uses(
+    const std::unordered_map<Instruction*, Instruction*>& replacements)
+{
+    if (replacements.empty())
+        return;
+    const auto resolve = [&](Instruction* value) {
+        auto found = replacements.find(value);
+        while (found != replacements.end()) {
+            value = found->second;
+            found = replacements.find(value);
+        }
+        return value;
+    };
+    for (const auto& block : blocks)
+        for (const auto& instruction : block->instructions)
+            for (auto& operand : instruction->operands)
+                operand = resolve(operand);
+}
+
+std::unordered_map<const Ir::Instruction*, size_t>
+Ir::Function::use_counts() const
+{
+    auto counts = std::unordered_map<const Instruction*, size_t> {};
+    for (const auto& block : blocks)
+        for (const auto& instruction : block->instructions)
+            for (const auto operand : instruction->operands)
+                counts[operand]++;
+    return counts;
+}
+
+void Ir::verify(const Function& function, const std::string& pass)
+{
+    const auto fail = [&](const Block& block, const std::string& msg) {
+        throw InternalError { "internal: invalid IR after " + pass + " in "
+            + function.name + " at b" + std::to_string(block.id) + ": " + msg
+            + "\n" + function.to_string() };
+    };
+    auto blocks = std::unordered_set<const Block*> {};
+    auto defined = std::unordered_set<const Instruction*> {};
+    for (const auto& block : function.blocks) {
+        blocks.insert(block.get());
+        for (const auto& instruction : block->instructions)
+            defined.insert(instruction.get());
+    }
+    if (!function.entry()->predecessors.empty())
+        fail(*function.entry(), "entry has predecessors");
+    for (const auto& block : function.blocks) {
+        if (!block->terminator())
+            fail(*block, "missing terminator");
+        const auto phis = block->phis_count();
+        for (size_t i = 0; i < block->instructions.size(); i++) {
+            const auto& instruction = *block->instructions[i];
+            if (instruction.block != block.get())
+                fail(*block, "v" + std::to_string(instruction.id)
+                        + " has the wrong block");
+            if (instruction.op == Op::Phi && i >= phis)
+                fail(*block, "phi after the start of the block");
+            if (instruction.op == Op::Phi
+                && instruction.operands.size() != block->predecessors.size())
+                fail(*block, "phi operands don't match the predecessors");
+            if (is_terminator(instruction.op)
+                && i + 1 != block->instructions.size())
+                fail(*block, "terminator in the middle of the block");
+            if (instruction.op == Op::Switch
+                && instruction.cases.size() + 1 != instruction.targets.size())
+                fail(*block, "switch cases don't match the targets");
+            for (const auto operand : instruction.operands)
+                if (!defined.count(operand) || !has_result(operand->op))
+                    fail(*block,
+                        std::string { "v" }
+                                .append(std::to_string(instruction.id))
+                            + " uses an invalid value");
+        }
+        for (const auto target : block->successors()) {
+            if (!blocks.count(target))
+                fail(*block, "jumps to a removed block");
+            if (std::count(target->predecessors.begin(),
+                    target->predecessors.end(), block.get())
+                != 1)
+                fail(*block, "is not a predecessor of b"
+                        + std::to_string(target->id));
+        }
+        for (const auto predecessor : block->predecessors) {
+            const auto successors = predecessor->successors();
+            if (!blocks.count(predecessor)
+                || std::find(successors.begin(), successors.end(),
+                       block.get())
+                    == successors.end())
+                fail(*block, "has a stale predecessor");
+        }
+    }
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include "bytecode.h"
+#include "kernels.h"
+#include "value.h"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Mid-level intermediate representation in SSA form.
+//
+// It is lowered from the AST by `Lowering`, optimized by the passes in
+// passes.h, and consumed by both `Compiler`, which generates bytecode from
+// it, and `Transpiler`, which generates C.
+//
+// A function is a list of basic blocks, the first of which is the entry.
+// Blocks start with their phis, whose operands are in the order of the
+// block's predecessors, and end with exactly one terminator. Instructions
+// are values, their `type` is set when the type of the result is statically
+// known.
+namespace Ir {
+
+enum class Op : uint8_t {
+    Constant,
+    Parameter,
+    Phi,
+    LoadGlobal,
+    StoreGlobal,
+    DefineGlobal,
+    // operands are the callee followed by the arguments
+    Call,
+    // operands are the arguments, the global is resolved after evaluating
+    // them, like `Bytecode::Op::CallGlobal`
+    CallGlobal,
+    // fails unless the operand's type is `type`, the result is the operand,
+    // guards values of unknown type flowing into type annotations
+    CheckType,
+    // operands are the elements, which all have to be of the same type
+    NewArray,
+    // operands are the array and the index, and the value for `StoreIndex`,
+    // they fail on anything but an `Array` and an `Int` index in bounds
+    Index,
+    StoreIndex,
+    // evaluates the element-wise `expression`, whose `Load`s take the
+    // operands in order, fused from operations on arrays
+    Map,
+
+    LogicalNot,
+    BitwiseNot,
+    Plus,
+    Negate,
+
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    Modulus,
+    Exponentiate,
+    BitwiseAnd,
+    BitwiseOr,
+    BitwiseXor,
+    BitwiseLeftShift,
+    BitwiseRightShift,
+    LessThan,
+    LessThanEqual,
+    GreaterThan,
+    GreaterThanEqual,
+    Equal,
+    NotEqual,
+
+    Jump,
+    // goes to the first target when the operand is `true` and to the second
+    // when it is `false`, fails on anything but a `Bool`
+    Branch,
+    // goes to the target of the case equal to the operand, and to the last
+    // target when there is none, including for values of another type than
+    // the cases
+    Switch,
+    Return,
+};
+
+std::string op_to_string(Op op);
+bool is_unary(Op op);
+bool is_binary(Op op);
+// the element-wise operation on arrays of a binary operation, if any
+std::optional<Kernels::Op> kernel_op(Op op);
+bool is_terminator(Op op);
+bool has_result(Op op);
+// the types of the results of operations whenever they succeed, following
+// the VM's semantics
+std::optional<ValueType> binary_type(
+    Op op, std::optional<ValueType> left, std::optional<ValueType> right);
+std::optional<ValueType> unary_type(Op op, std::optional<ValueType> operand);
+// whether a `Switch` on `value` goes to the target of `case_`
+bool matches_case(const Value& value, const Value& case_);
+
+struct Block;
+
+struct Instruction {
+    Instruction(Op op, uint32_t id)
+        : op { op }
+        , id { id }
+    {
+    }
+
+    std::string to_string() const;
+
+    Op op;
+    // unique within the function, values are printed as `v<id>`
+    uint32_t id;
+    std::vector<Instruction*> operands {};
+    std::vector<Block*> targets {};
+    // the value of a `Constant`
+    Value value {};
+    // the distinct constants a `Switch` goes to the corresponding target
+    // for, all of the same type, `Int`, `Char`, `Bool` or `String`
+    std::vector<Value> cases {};
+    // the index of a `Parameter`, or the global of the global operations
+    uint32_t index { 0 };
+    std::optional<ValueType> type {};
+    // set on an `Index` or `StoreIndex` whose index is known to be in bounds
+    bool in_bounds { false };
+    // set on an operation making an array which doesn't escape the function,
+    // see `Passes::analyze_escapes`
+    bool local { false };
+    Kernels::Expression expression {};
+    std::optional<Bytecode::SourcePosition> position {};
+    Block* block { nullptr };
+};
+
+struct Block {
+    Block(uint32_t id)
+        : id { id }
+    {
+    }
+
+    std::string to_string() const;
+    // returns nullptr while the block is still being built
+    Instruction* terminator() const;
+    std::vector<Block*> successors() const;
+    size_t phis_count() const;
+    size_t predecessor_index(const Block* predecessor) const;
+
+    Instruction* append(std::unique_ptr<Instruction> instruction);
+    Instruction* insert(
+        size_t position, std::unique_ptr<Instruction> instruction);
+    // removes `predecessor` along with its operand in every phi
+    void remove_predecessor(const Block* predecessor);
+
+    const uint32_t id;
+    std::vector<std::unique_ptr<Instruction>> instructions {};
+    std::vector<Block*> predecessors {};
+};
+
+struct Function {
+    Function(const std::string name, uint32_t arity)
+        : name { name }
+        , arity { arity }
+    {
+    }
+
+    std::string to_string() const;
+    Block* entry() const { return blocks.front().get(); }
+    Block* create_block();
+    std::unique_ptr<Instruction> create(Op op);
+    // blocks in reverse postorder, visiting the targets of a block in order,
+    // unreachable blocks are left out
+    std::vector<Block*> reverse_postorder() const;
+    // drops unreachable blocks and puts the rest in reverse postorder
+    void sort_blocks();
+    // rewrites every operand according to `replacements`, following chains
+    void replace_uses(
+        const std::unordered_map<Instruction*, Instruction*>& replacements);
+    std::unordered_map<const Instruction*, size_t> use_counts() const;
+
+    const std::string name;
+    const uint32_t arity;
+    // position of the declaration
+    Bytecode::SourcePosition position {};
+    std::vector<std::unique_ptr<Block>> blocks {};
+    uint32_t values_count { 0 };
+    uint32_t blocks_count { 0 };
+};
+
+struct Module {
+    std::string to_string() const;
+
+    std::unique_ptr<Function> main {};
+    // top level functions and the globals they are bound to
+    std::vector<std::unique_ptr<Function>> functions {};
+    std::vector<uint32_t> function_globals {};
+    std::vector<std::string> globals {};
+    // globals bound by top level lets, which may rebind a function's global
+    std::vector<bool> defined_globals {};
+};
+
+// checks the invariants above and exits with an internal error when they
+// don't hold, `pass` names the pass that ran last
+void verify(const Function& function, const std::string& pass);
+
+}
@@ -0,0 +1,882 @@
+#include "jit.h"
+#include "bytecode.h"
+#include "value.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define LPL_JIT_SUPPORTED 1
+#include <sys/mman.h>
+#else
+#define LPL_JIT_SUPPORTED 0
+#endif
+
+namespace {
+
+using Bytecode::Op;
+
+enum Register : uint8_t {
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RBX = 3,
+    RSP = 4,
+    RBP = 5,
+    RSI = 6,
+    RDI = 7,
+    R12 = 12,
+    R13 = 13,
+    R14 = 14,
+    R15 = 15,
+};
+
+// r15 holds the JitContext, the first locals are cached in the remaining
+// callee-saved registers, the rest are spilled below the saved registers
+constexpr Register local_registers[] = { RBX, R12, R13, R14 };
+constexpr size_t register_locals_count = 4;
+constexpr int32_t saved_registers_size = 40;
+
+class Assembler {
+public:
+    void byte(uint8_t value) { code.push_back(value); }
+    void bytes(std::initializer_list<uint8_t> values)
+    {
+        code.insert(code.end(), values);
+    }
+    void u32(uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+            byte(static_cast<uint8_t>(value >> (i * 8)));
+    }
+    void u64(uint64_t value)
+    {
+        for (int i = 0; i < 8; i++)
+            byte(static_cast<uint8_t>(value >> (i * 8)));
+    }
+    size_t size() const { return code.size(); }
+
+    void push(Register r)
+    {
+        if (r >= 8)
+            byte(0x41);
+        byte(static_cast<uint8_t>(0x50 + (r & 7)));
+    }
+    void pop(Register r)
+    {
+        if (r >= 8)
+            byte(0x41);
+        byte(static_cast<uint8_t>(0x58 + (r & 7)));
+    }
+    void mov_imm64(Register r, uint64_t value)
+    {
+        byte(r >= 8 ? 0x49 : 0x48);
+        byte(static_cast<uint8_t>(0xb8 + (r & 7)));
+        u64(value);
+    }
+    void push_imm(int64_t value)
+    {
+        if (value >= INT32_MIN && value <= INT32_MAX) {
+            byte(0x68);
+            u32(static_cast<uint32_t>(value));
+        } else {
+            mov_imm64(RAX, static_cast<uint64_t>(value));
+            push(RAX);
+        }
+    }
+    // mov dst, src
+    void mov(Register dst, Register src)
+    {
+        byte(static_cast<uint8_t>(
+            0x48 | (src >= 8 ? 0x04 : 0) | (dst >= 8 ? 0x01 : 0)));
+        byte(0x89);
+        byte(static_cast<uint8_t>(0xc0 | ((src & 7) << 3) | (dst & 7)));
+    }
+    // mov dst, [rsi + disp]
+    void load_rsi(Register dst, int32_t disp)
+    {
+        byte(dst >= 8 ? 0x4c : 0x48);
+        byte(0x8b);
+        byte(static_cast<uint8_t>(0x80 | ((dst & 7) << 3) | RSI));
+        u32(static_cast<uint32_t>(disp));
+    }
+    // mov [rbp + disp], rax
+    void store_rbp_rax(int32_t disp)
+    {
+        bytes({ 0x48, 0x89, 0x85 });
+        u32(static_cast<uint32_t>(disp));
+    }
+    // push qword [rbp + disp]
+    void push_rbp(int32_t disp)
+    {
+        bytes({ 0xff, 0xb5 });
+        u32(static_cast<uint32_t>(disp));
+    }
+    // pop qword [rbp + disp]
+    void pop_rbp(int32_t disp)
+    {
+        bytes({ 0x8f, 0x85 });
+        u32(static_cast<uint32_t>(disp));
+    }
+    void add_rsp(int32_t value)
+    {
+        bytes({ 0x48, 0x81, 0xc4 });
+        u32(static_cast<uint32_t>(value));
+    }
+    void sub_rsp(int32_t value)
+    {
+        bytes({ 0x48, 0x81, 0xec });
+        u32(static_cast<uint32_t>(value));
+    }
+    // jmp/jcc rel32, returns the offset of the rel32 to patch
+    size_t jmp()
+    {
+        byte(0xe9);
+        u32(0);
+        return size() - 4;
+    }
+    size_t jcc(uint8_t condition)
+    {
+        bytes({ 0x0f, condition });
+        u32(0);
+        return size() - 4;
+    }
+    // jmp/jcc rel8, returns the offset of the rel8 to patch
+    size_t jmp8()
+    {
+        bytes({ 0xeb, 0 });
+        return size() - 1;
+    }
+    size_t jcc8(uint8_t condition)
+    {
+        bytes({ static_cast<uint8_t>(condition - 0x10), 0 });
+        return size() - 1;
+    }
+    void patch_rel32(size_t at, size_t target)
+    {
+        const auto rel = static_cast<int32_t>(
+            static_cast<int64_t>(target) - static_cast<int64_t>(at + 4));
+        std::memcpy(&code[at], &rel, sizeof(rel));
+    }
+    void patch_rel8(size_t at, size_t target)
+    {
+        code[at] = static_cast<uint8_t>(
+            static_cast<int8_t>(static_cast<int64_t>(target)
+                - static_cast<int64_t>(at + 1)));
+    }
+
+    std::vector<uint8_t> code {};
+};
+
+// condition codes as used by the second byte of `jcc rel32`
+constexpr uint8_t jae = 0x83;
+constexpr uint8_t jz = 0x84;
+constexpr uint8_t jnz = 0x85;
+constexpr uint8_t ja = 0x87;
+constexpr uint8_t jl = 0x8c;
+
+bool is_int_binary(Op op)
+{
+    switch (op) {
+    case Op::Add:
+    case Op::Subtract:
+    case Op::Multiply:
+    case Op::Divide:
+    case Op::Modulus:
+    case Op::BitwiseAnd:
+    case Op::BitwiseOr:
+    case Op::BitwiseXor:
+    case Op::BitwiseLeftShift:
+    case Op::BitwiseRightShift: return true;
+    default: return false;
+    }
+}
+
+bool is_comparison(Op op)
+{
+    switch (op) {
+    case Op::LessThan:
+    case Op::LessThanEqual:
+    case Op::GreaterThan:
+    case Op::GreaterThanEqual:
+    case Op::Equal:
+    case Op::NotEqual: return true;
+    default: return false;
+    }
+}
+
+// the `setcc al` opcode byte for a comparison
+uint8_t setcc(Op op)
+{
+    switch (op) {
+    case Op::LessThan: return 0x9c;
+    case Op::LessThanEqual: return 0x9e;
+    case Op::GreaterThan: return 0x9f;
+    case Op::GreaterThanEqual: return 0x9d;
+    case Op::Equal: return 0x94;
+    default: return 0x95;
+    }
+}
+
+}
+
+Jit::Jit(const std::string& filename,
+    const std::vector<std::optional<Value>>& globals,
+    const std::vector<uint32_t>& global_versions)
+    : m_filename { filename }
+    , m_globals { globals }
+    , m_global_versions { global_versions }
+{
+    m_enabled = LPL_JIT_SUPPORTED && std::getenv("LPL_NO_JIT") == nullptr;
+    if (const auto threshold = std::getenv("LPL_JIT_THRESHOLD"))
+        m_threshold
+            = static_cast<uint32_t>(std::strtoul(threshold, nullptr, 10));
+}
+
+Jit::~Jit()
+{
+#if LPL_JIT_SUPPORTED
+    for (const auto& [region, size] : m_regions)
+        munmap(region, size);
+#endif
+}
+
+std::optional<Value> Jit::try_run(
+    Bytecode::Function& function, const Value* args)
+{
+    if (function.jit_failed)
+        return std::nullopt;
+    if (!function.native) {
+        if (++function.calls < m_threshold || !compile(function))
+            return std::nullopt;
+    }
+    int64_t native_args[max_arity];
+    for (uint32_t i = 0; i < function.arity; i++) {
+        if (args[i].type != ValueType::Int)
+            return std::nullopt;
+        native_args[function.arity - 1 - i] = args[i].int_value;
+    }
+    auto context = JitContext { 0, 0 };
+    const auto result = function.native(&context, native_args);
+    if (context.bailout) {
+        if (++function.bailouts >= max_bailouts)
+            function.jit_failed = true;
+        return std::nullopt;
+    }
+    switch (function.native_return_type) {
+    case ValueType::Int: return Value::make_int(result);
+    case ValueType::Bool: return Value::make_bool(result != 0);
+    default: return Value::make_unit();
+    }
+}
+
+bool Jit::compile(Bytecode::Function& function)
+{
+    auto group = std::vector<Bytecode::Function*> {};
+    if (!discover(function, group)) {
+        function.jit_failed = true;
+        return false;
+    }
+
+    // return types of functions in the group are assumed to be ints and
+    // refined until the analysis reaches a fixed point
+    auto return_types = std::vector<ValueType>(group.size(), ValueType::Int);
+    auto analyses = std::vector<Analysis>(group.size());
+    auto stable = false;
+    for (int iteration = 0; iteration < 4 && !stable; iteration++) {
+        stable = true;
+        for (size_t i = 0; i < group.size(); i++) {
+            auto analysis = analyze(*group[i], group, return_types);
+            if (!analysis || !analysis->return_type) {
+                function.jit_failed = true;
+                return false;
+            }
+            if (*analysis->return_type != return_types[i]) {
+                return_types[i] = *analysis->return_type;
+                stable = false;
+            }
+            analyses[i] = std::move(*analysis);
+        }
+    }
+    if (!stable) {
+        function.jit_failed = true;
+        return false;
+    }
+    for (size_t i = 0; i < group.size(); i++) {
+        group[i]->native_return_type = return_types[i];
+        if (!emit(*group[i], analyses[i])) {
+            function.jit_failed = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Jit::discover(
+    Bytecode::Function& function, std::vector<Bytecode::Function*>& group)
+{
+    if (function.native
+        || std::find(group.begin(), group.end(), &function) != group.end())
+        return true;
+    if (function.jit_failed || function.arity > max_arity)
+        return false;
+    group.push_back(&function);
+    for (const auto& instruction : function.code) {
+        if (instruction.op != Op::CallGlobal
+            && instruction.op != Op::TailCallGlobal)
+            continue;
+        const auto call_site = resolve_call_site(function, instruction);
+        if (!call_site || !discover(*call_site->callee, group))
+            return false;
+    }
+    return true;
+}
+
+std::optional<Jit::CallSite> Jit::resolve_call_site(
+    const Bytecode::Function& function, const Bytecode::Instruction& call)
+{
+    const auto& cache = function.call_caches[call.operand];
+    const auto& global = m_globals[cache.global];
+    if (!global || global->type != ValueType::Function
+        || global->function_value->arity != cache.args_count)
+        return std::nullopt;
+    return CallSite {
+        global->function_value,
+        cache.global,
+        m_global_versions[cache.global],
+    };
+}
+
+std::optional<Jit::Analysis> Jit::analyze(const Bytecode::Function& function,
+    const std::vector<Bytecode::Function*>& group,
+    const std::vector<ValueType>& return_types)
+{
+    const auto& code = function.code;
+    auto analysis = Analysis {};
+    analysis.stacks.resize(code.size());
+    analysis.locals.resize(function.locals_count);
+    analysis.call_sites.resize(code.size());
+    for (uint32_t i = 0; i < function.arity; i++)
+        analysis.locals[i] = ValueType::Int;
+
+    auto worklist = std::vector<size_t> { 0 };
+    analysis.stacks[0] = std::vector<ValueType> {};
+    const auto flow = [&](size_t target, const std::vector<ValueType>& stack) {
+        if (target >= code.size())
+            return false;
+        auto& state = analysis.stacks[target];
+        if (!state) {
+            state = stack;
+            worklist.push_back(target);
+            return true;
+        }
+        return *state == stack;
+    };
+    const auto return_type_of = [&](const Bytecode::Function* callee) {
+        const auto found = std::find(group.begin(), group.end(), callee);
+        if (found != group.end())
+            return return_types[static_cast<size_t>(found - group.begin())];
+        return callee->native_return_type;
+    };
+
+    while (!worklist.empty()) {
+        const auto ip = worklist.back();
+        worklist.pop_back();
+        auto stack = *analysis.stacks[ip];
+        const auto& instruction = code[ip];
+        const auto pop = [&](std::optional<ValueType> expected) {
+            if (stack.empty() || (expected && stack.back() != *expected))
+                return false;
+            stack.pop_back();
+            return true;
+        };
+        const auto op = Bytecode::generic_variant(instruction.op);
+        auto falls_through = true;
+        switch (op) {
+        case Op::PushConstant: {
+            const auto type = function.constants[instruction.operand].type;
+            if (type != ValueType::Int && type != ValueType::Bool)
+                return std::nullopt;
+            stack.push_back(type);
+            break;
+        }
+        case Op::PushUnit: stack.push_back(ValueType::Unit); break;
+        case Op::Pop:
+            if (!pop(std::nullopt))
+                return std::nullopt;
+            break;
+        case Op::Dup:
+            if (stack.empty())
+                return std::nullopt;
+            stack.push_back(stack.back());
+            break;
+        case Op::LoadLocal: {
+            const auto& local = analysis.locals[instruction.operand];
+            if (!local)
+                return std::nullopt;
+            stack.push_back(*local);
+            break;
+        }
+        case Op::StoreLocal: {
+            if (stack.empty())
+                return std::nullopt;
+            auto& local = analysis.locals[instruction.operand];
+            if (local && *local != stack.back())
+                return std::nullopt;
+            local = stack.back();
+            stack.pop_back();
+            break;
+        }
+        case Op::Jump:
+            if (!flow(instruction.operand, stack))
+                return std::nullopt;
+            falls_through = false;
+            break;
+        case Op::JumpIfFalse:
+            if (!pop(ValueType::Bool) || !flow(instruction.operand, stack))
+                return std::nullopt;
+            break;
+        case Op::TableSwitch:
+        case Op::LookupSwitch: {
+            const auto& table = function.switch_tables[instruction.operand];
+            if (!pop(table.type) || !flow(table.default_target, stack))
+                return std::nullopt;
+            for (const auto target : table.targets)
+                if (!flow(target, stack))
+                    return std::nullopt;
+            falls_through = false;
+            break;
+        }
+        case Op::CallGlobal:
+        case Op::TailCallGlobal: {
+            const auto call_site = resolve_call_site(function, instruction);
+            if (!call_site)
+                return std::nullopt;
+            for (uint32_t i = 0; i < call_site->callee->arity; i++)
+                if (!pop(ValueType::Int))
+                    return std::nullopt;
+            stack.push_back(return_type_of(call_site->callee));
+            analysis.call_sites[ip] = call_site;
+            break;
+        }
+        case Op::Return: {
+            if (stack.size() != 1)
+                return std::nullopt;
+            if (analysis.return_type && *analysis.return_type != stack[0])
+                return std::nullopt;
+            analysis.return_type = stack[0];
+            falls_through = false;
+            break;
+        }
+        // checks of values whose type is known pass without code
+        case Op::CheckType:
+            if (stack.empty()
+                || stack.back() != static_cast<ValueType>(instruction.operand))
+                return std::nullopt;
+            break;
+        case Op::LogicalNot:
+            if (!pop(ValueType::Bool))
+                return std::nullopt;
+            stack.push_back(ValueType::Bool);
+            break;
+        case Op::BitwiseNot:
+        case Op::Plus:
+        case Op::Negate:
+            if (!pop(ValueType::Int))
+                return std::nullopt;
+            stack.push_back(ValueType::Int);
+            break;
+        default:
+            if (is_int_binary(op)) {
+                if (!pop(ValueType::Int) || !pop(ValueType::Int))
+                    return std::nullopt;
+                stack.push_back(ValueType::Int);
+            } else if (is_comparison(op)) {
+                if (stack.size() < 2)
+                    return std::nullopt;
+                const auto type = stack.back();
+                if (type == ValueType::Unit
+                    || (type == ValueType::Bool && op != Op::Equal
+                        && op != Op::NotEqual)
+                    || !pop(type) || !pop(type))
+                    return std::nullopt;
+                stack.push_back(ValueType::Bool);
+            } else {
+                return std::nullopt;
+            }
+            break;
+        }
+        if (falls_through && !flow(ip + 1, stack))
+            return std::nullopt;
+    }
+    return analysis;
+}
+
+bool Jit::emit(Bytecode::Function& function, const Analysis& analysis)
+{
+#if LPL_JIT_SUPPORTED
+    auto a = Assembler {};
+    const auto spilled_count
+        = function.locals_count > register_locals_count
+        ? function.locals_count - register_locals_count
+        : 0;
+    auto spill_size = static_cast<int32_t>(spilled_count * 8);
+    // keep rsp 16 byte aligned with an empty operand stack
+    if ((saved_registers_size + spill_size) % 16 != 0)
+        spill_size += 8;
+    const auto spill_offset = [&](size_t local) {
+        return -saved_registers_size
+            - static_cast<int32_t>((local - register_locals_count + 1) * 8);
+    };
+    const auto push_local = [&](size_t local) {
+        if (local < register_locals_count)
+            a.push(local_registers[local]);
+        else
+            a.push_rbp(spill_offset(local));
+    };
+    const auto pop_local = [&](size_t local) {
+        if (local < register_locals_count)
+            a.pop(local_registers[local]);
+        else
+            a.pop_rbp(spill_offset(local));
+    };
+
+    auto bailout_jumps = std::vector<size_t> {};
+    auto epilogue_jumps = std::vector<size_t> {};
+    // (rel32 offset, instruction index) pairs
+    auto jumps = std::vector<std::pair<size_t, size_t>> {};
+    // (offset, jump table offset, instruction index) of jump table entries,
+    // which are relative to the table
+    auto table_entries = std::vector<std::tuple<size_t, size_t, size_t>> {};
+    auto offsets = std::vector<size_t>(function.code.size(), 0);
+
+    // prologue
+    a.push(RBP);
+    a.mov(RBP, RSP);
+    a.push(RBX);
+    a.push(R12);
+    a.push(R13);
+    a.push(R14);
+    a.push(R15);
+    a.sub_rsp(spill_size);
+    a.mov(R15, RDI);
+    // inc qword [r15 + depth]; cmp qword [r15 + depth], max_depth; ja bailout
+    a.bytes({ 0x49, 0xff, 0x87 });
+    a.u32(offsetof(JitContext, depth));
+    a.bytes({ 0x49, 0x81, 0xbf });
+    a.u32(offsetof(JitContext, depth));
+    a.u32(static_cast<uint32_t>(max_depth));
+    bailout_jumps.push_back(a.jcc(ja));
+    for (uint32_t i = 0; i < function.arity; i++) {
+        const auto disp = static_cast<int32_t>((function.arity - 1 - i) * 8);
+        if (i < register_locals_count) {
+            a.load_rsi(local_registers[i], disp);
+        } else {
+            a.load_rsi(RAX, disp);
+            a.store_rbp_rax(spill_offset(i));
+        }
+    }
+
+    const auto guard_version = [&](const CallSite& call_site) {
+        // mov rax, &version; cmp dword [rax], version; jnz bailout
+        a.mov_imm64(RAX,
+            reinterpret_cast<uint64_t>(&m_global_versions[call_site.global]));
+        a.bytes({ 0x81, 0x38 });
+        a.u32(call_site.global_version);
+        bailout_jumps.push_back(a.jcc(jnz));
+    };
+
+    for (size_t ip = 0; ip < function.code.size(); ip++) {
+        offsets[ip] = a.size();
+        if (!analysis.stacks[ip])
+            continue;
+        const auto depth = analysis.stacks[ip]->size();
+        const auto& instruction = function.code[ip];
+        const auto op = Bytecode::generic_variant(instruction.op);
+        switch (op) {
+        case Op::PushConstant: {
+            const auto& constant = function.constants[instruction.operand];
+            a.push_imm(constant.type == ValueType::Int ? constant.int_value
+                                                       : constant.bool_value);
+            break;
+        }
+        case Op::PushUnit: a.push_imm(0); break;
+        case Op::Pop: a.add_rsp(8); break;
+        case Op::Dup: a.bytes({ 0xff, 0x34, 0x24 }); break;
+        case Op::LoadLocal: push_local(instruction.operand); break;
+        case Op::StoreLocal: pop_local(instruction.operand); break;
+        case Op::Jump: jumps.push_back({ a.jmp(), instruction.operand }); break;
+        case Op::JumpIfFalse:
+            a.pop(RAX);
+            a.bytes({ 0x48, 0x85, 0xc0 });
+            jumps.push_back({ a.jcc(jz), instruction.operand });
+            break;
+        case Op::TableSwitch: {
+            const auto& table = function.switch_tables[instruction.operand];
+            a.pop(RAX);
+            // sub rax, first; cmp rax, size; jae default
+            a.mov_imm64(RCX, static_cast<uint64_t>(table.first));
+            a.bytes({ 0x48, 0x29, 0xc8 });
+            a.mov_imm64(RCX, table.targets.size());
+            a.bytes({ 0x48, 0x39, 0xc8 });
+            jumps.push_back({ a.jcc(jae), table.default_target });
+            // lea rcx, [rip + table]; movsxd rax, dword [rcx + rax * 4];
+            // add rax, rcx; jmp rax
+            a.bytes({ 0x48, 0x8d, 0x0d });
+            const auto lea = a.size();
+            a.u32(0);
+            a.bytes({ 0x48, 0x63, 0x04, 0x81, 0x48, 0x01, 0xc8, 0xff, 0xe0 });
+            a.patch_rel32(lea, a.size());
+            const auto base = a.size();
+            for (const auto target : table.targets) {
+                table_entries.push_back({ a.size(), base, target });
+                a.u32(0);
+            }
+            break;
+        }
+        case Op::LookupSwitch: {
+            const auto& table = function.switch_tables[instruction.operand];
+            a.pop(RAX);
+            const auto compare = [&](int64_t key) {
+                if (key >= INT32_MIN && key <= INT32_MAX) {
+                    // cmp rax, imm32
+                    a.bytes({ 0x48, 0x3d });
+                    a.u32(static_cast<uint32_t>(key));
+                } else {
+                    // mov rcx, key; cmp rax, rcx
+                    a.mov_imm64(RCX, static_cast<uint64_t>(key));
+                    a.bytes({ 0x48, 0x39, 0xc8 });
+                }
+            };
+            // a binary search over the sorted keys, unrolled into compares
+            const auto search
+                = [&](const auto& self, size_t low, size_t high) -> void {
+                if (high - low <= 3) {
+                    for (auto i = low; i < high; i++) {
+                        compare(table.keys[i]);
+                        jumps.push_back({ a.jcc(jz), table.targets[i] });
+                    }
+                    jumps.push_back({ a.jmp(), table.default_target });
+                    return;
+                }
+                const auto middle = low + (high - low) / 2;
+                compare(table.keys[middle]);
+                jumps.push_back({ a.jcc(jz), table.targets[middle] });
+                const auto to_lower = a.jcc(jl);
+                self(self, middle + 1, high);
+                a.patch_rel32(to_lower, a.size());
+                self(self, low, middle);
+            };
+            search(search, 0, table.keys.size());
+            break;
+        }
+        case Op::CallGlobal:
+        case Op::TailCallGlobal: {
+            const auto& call_site = *analysis.call_sites[ip];
+            const auto args_count = call_site.callee->arity;
+            guard_version(call_site);
+            // self tail calls with nothing but the arguments on the operand
+            // stack become a jump back to the start of the body
+            if (op == Op::TailCallGlobal && call_site.callee == &function
+                && depth == args_count) {
+                for (uint32_t i = args_count; i > 0; i--)
+                    pop_local(i - 1);
+                jumps.push_back({ a.jmp(), 0 });
+                break;
+            }
+            a.mov(RDI, R15);
+            a.mov(RSI, RSP);
+            const auto misaligned = depth % 2 != 0;
+            if (misaligned)
+                a.sub_rsp(8);
+            // mov rax, &callee.native; call [rax]
+            a.mov_imm64(
+                RAX, reinterpret_cast<uint64_t>(&call_site.callee->native));
+            a.bytes({ 0xff, 0x10 });
+            a.add_rsp(
+                static_cast<int32_t>(args_count * 8 + (misaligned ? 8 : 0)));
+            // cmp byte [r15 + bailout], 0; jnz bailout
+            a.bytes({ 0x41, 0x80, 0xbf });
+            a.u32(offsetof(JitContext, bailout));
+            a.byte(0);
+            bailout_jumps.push_back(a.jcc(jnz));
+            a.push(RAX);
+            break;
+        }
+        case Op::Return:
+            a.pop(RAX);
+            epilogue_jumps.push_back(a.jmp());
+            break;
+        case Op::CheckType: break;
+        case Op::LogicalNot:
+            a.pop(RAX);
+            a.bytes({ 0x48, 0x83, 0xf0, 0x01 });
+            a.push(RAX);
+            break;
+        case Op::BitwiseNot:
+            a.pop(RAX);
+            a.bytes({ 0x48, 0xf7, 0xd0 });
+            a.push(RAX);
+            break;
+        case Op::Plus: break;
+        case Op::Negate:
+            a.pop(RAX);
+            a.bytes({ 0x48, 0xf7, 0xd8 });
+            a.push(RAX);
+            break;
+        case Op::Divide:
+        case Op::Modulus: {
+            a.pop(RCX);
+            a.pop(RAX);
+            // test rcx, rcx; jz bailout
+            a.bytes({ 0x48, 0x85, 0xc9 });
+            bailout_jumps.push_back(a.jcc(jz));
+            // cmp rcx, -1; jnz divide
+            a.bytes({ 0x48, 0x83, 0xf9, 0xff });
+            const auto to_divide = a.jcc8(jnz);
+            if (op == Op::Divide)
+                a.bytes({ 0x48, 0xf7, 0xd8 });
+            else
+                a.bytes({ 0x31, 0xc0 });
+            const auto to_done = a.jmp8();
+            a.patch_rel8(to_divide, a.size());
+            // cqo; idiv rcx
+            a.bytes({ 0x48, 0x99, 0x48, 0xf7, 0xf9 });
+            if (op == Op::Modulus)
+                a.mov(RAX, RDX);
+            a.patch_rel8(to_done, a.size());
+            a.push(RAX);
+            break;
+        }
+        default: {
+            a.pop(RCX);
+            a.pop(RAX);
+            switch (op) {
+            case Op::Add: a.bytes({ 0x48, 0x01, 0xc8 }); break;
+            case Op::Subtract: a.bytes({ 0x48, 0x29, 0xc8 }); break;
+            case Op::Multiply: a.bytes({ 0x48, 0x0f, 0xaf, 0xc1 }); break;
+            case Op::BitwiseAnd: a.bytes({ 0x48, 0x21, 0xc8 }); break;
+            case Op::BitwiseOr: a.bytes({ 0x48, 0x09, 0xc8 }); break;
+            case Op::BitwiseXor: a.bytes({ 0x48, 0x31, 0xc8 }); break;
+            case Op::BitwiseLeftShift: a.bytes({ 0x48, 0xd3, 0xe0 }); break;
+            case Op::BitwiseRightShift: a.bytes({ 0x48, 0xd3, 0xf8 }); break;
+            default:
+                // cmp rax, rcx; setcc al; movzx eax, al
+                a.bytes({ 0x48, 0x39, 0xc8, 0x0f, setcc(op), 0xc0 });
+                a.bytes({ 0x0f, 0xb6, 0xc0 });
+                break;
+            }
+            a.push(RAX);
+            break;
+        }
+        }
+    }
+
+    const auto bailout = a.size();
+    // mov byte [r15 + bailout], 1
+    a.bytes({ 0x41, 0xc6, 0x87 });
+    a.u32(offsetof(JitContext, bailout));
+    a.byte(1);
+    const auto epilogue = a.size();
+    // dec qword [r15 + depth]; lea rsp, [rbp - 40]
+    a.bytes({ 0x49, 0xff, 0x8f });
+    a.u32(offsetof(JitContext, depth));
+    a.bytes({ 0x48, 0x8d, 0x65, static_cast<uint8_t>(-saved_registers_size) });
+    a.pop(R15);
+    a.pop(R14);
+    a.pop(R13);
+    a.pop(R12);
+    a.pop(RBX);
+    a.pop(RBP);
+    a.byte(0xc3);
+
+    for (const auto at : bailout_jumps)
+        a.patch_rel32(at, bailout);
+    for (const auto at : epilogue_jumps)
+        a.patch_rel32(at, epilogue);
+    for (const auto& [at, target] : jumps)
+        a.patch_rel32(at, offsets[target]);
+    for (const auto& [at, base, target] : table_entries)
+        a.patch_rel32(at, offsets[target] + at + 4 - base);
+
+    const auto region = static_cast<uint8_t*>(load(a.code));
+    if (!region)
+        return false;
+    function.native = reinterpret_cast<Bytecode::NativeFunction>(region);
+    if (m_perf.enabled()) {
+        auto lines = std::vector<Perf::Line> {};
+        for (const auto& entry : function.line_table)
+            lines.push_back({ region + offsets[entry.ip], entry.position.row });
+        m_perf.code_loaded(
+            symbol(function, "jit"), region, a.size(), m_filename, lines);
+    }
+    return true;
+#else
+    (void)function;
+    (void)analysis;
+    return false;
+#endif
+}
+
+bool Jit::perf_enabled() const { return LPL_JIT_SUPPORTED && m_perf.enabled(); }
+
+Bytecode::Trampoline Jit::make_trampoline(
+    const Bytecode::Function& function, Bytecode::Trampoline entry)
+{
+#if LPL_JIT_SUPPORTED
+    auto a = Assembler {};
+    // push rbp; mov rbp, rsp; mov rax, entry; call rax; pop rbp; ret
+    a.push(RBP);
+    a.mov(RBP, RSP);
+    a.mov_imm64(RAX, reinterpret_cast<uint64_t>(entry));
+    a.bytes({ 0xff, 0xd0 });
+    a.pop(RBP);
+    a.byte(0xc3);
+    const auto region = load(a.code);
+    if (!region)
+        return entry;
+    const auto position = Perf::Line { region, function.position.row };
+    m_perf.code_loaded(
+        symbol(function, "vm"), region, a.size(), m_filename, { position });
+    return reinterpret_cast<Bytecode::Trampoline>(region);
+#else
+    (void)function;
+    return entry;
+#endif
+}
+
+void* Jit::load(const std::vector<uint8_t>& code)
+{
+#if LPL_JIT_SUPPORTED
+    const auto size = code.size();
+    const auto region = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED)
+        return nullptr;
+    std::memcpy(region, code.data(), size);
+    if (mprotect(region, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(region, size);
+        return nullptr;
+    }
+    m_regions.push_back({ region, size });
+    return region;
+#else
+    (void)code;
+    return nullptr;
+#endif
+}
+
+std::string Jit::symbol(
+    const Bytecode::Function& function, const std::string& tier) const
+{
+    return "lpl:" + function.name + " [" + tier + "] " + m_filename + ":"
+        + std::to_string(function.position.row) + ":"
+        + std::to_string(function.position.col);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "bytecode.h"
+#include "perf.h"
+#include "value.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct JitContext {
+    uint64_t depth;
+    uint8_t bailout;
+};
+
+// Baseline template JIT for x86-64 Linux.
+//
+// Functions are compiled once they have been called `threshold` times. Only
+// functions that are pure and provably operate on ints and bools are
+// compiled, which is checked by abstract interpretation of their bytecode.
+// Because of that, native code can bail out at any point, e.g. on division
+// by zero, exceeding `max_depth` or a callee binding being reassigned, and
+// the call is simply restarted in the VM.
+//
+// Native functions take their arguments as an array in reverse order, which
+// is the order they are pushed onto the machine stack by native callers.
+// Locals live in callee-saved registers where possible, the operand stack
+// is the machine stack.
+//
+// The JIT is disabled by setting `LPL_NO_JIT`, `LPL_JIT_THRESHOLD` overrides
+// the call threshold. Compiled code is reported to `perf`, see perf.h.
+class Jit {
+public:
+    static constexpr uint32_t default_threshold = 1000;
+    static constexpr uint32_t max_bailouts = 16;
+    static constexpr uint64_t max_depth = 10000;
+    static constexpr uint32_t max_arity = 16;
+
+    Jit(const std::string& filename,
+        const std::vector<std::optional<Value>>& globals,
+        const std::vector<uint32_t>& global_versions);
+    ~Jit();
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    bool enabled() const { return m_enabled; }
+    // returns `std::nullopt` when the call should run in the VM
+    std::optional<Value> try_run(
+        Bytecode::Function& function, const Value* args);
+
+    // when profiling with `perf`, the VM runs interpreted functions through
+    // a trampoline per function, so samples taken in the interpreter are
+    // attributed to the function being interpreted
+    bool perf_enabled() const;
+    // returns a function calling `entry` with its argument, reported to
+    // `perf` under `function`'s name
+    Bytecode::Trampoline make_trampoline(
+        const Bytecode::Function& function, Bytecode::Trampoline entry);
+
+private:
+    struct CallSite {
+        Bytecode::Function* callee;
+        uint32_t global;
+        uint32_t global_version;
+    };
+
+    struct Analysis {
+        // operand stack types before each instruction, unset if unreachable
+        std::vector<std::optional<std::vector<ValueType>>> stacks {};
+        std::vector<std::optional<ValueType>> locals {};
+        std::optional<ValueType> return_type {};
+        std::vector<std::optional<CallSite>> call_sites {};
+    };
+
+    bool compile(Bytecode::Function& function);
+    bool discover(Bytecode::Function& function,
+        std::vector<Bytecode::Function*>& group);
+    std::optional<CallSite> resolve_call_site(
+        const Bytecode::Function& function, const Bytecode::Instruction& call);
+    std::optional<Analysis> analyze(const Bytecode::Function& function,
+        const std::vector<Bytecode::Function*>& group,
+        const std::vector<ValueType>& return_types);
+    bool emit(Bytecode::Function& function, const Analysis& analysis);
+    // copies `code` into executable memory, returns nullptr on failure
+    void* load(const std::vector<uint8_t>& code);
+    std::string symbol(
+        const Bytecode::Function& function, const std::string& tier) const;
+
+    const std::string& m_filename;
+    const std::vector<std::optional<Value>>& m_globals;
+    const std::vector<uint32_t>& m_global_versions;
+    bool m_enabled { false };
+    uint32_t m_threshold { default_threshold };
+    std::vector<std::pair<void*, size_t>> m_regions {};
+    Perf m_perf {};
+};
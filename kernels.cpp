@@ -0,0 +1,1025 @@
+#include "kernels.h"
+#include "array.h"
+#include "value.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define LPL_KERNELS_X86 1
+#include <immintrin.h>
+#define LPL_AVX2 [[gnu::target("avx2")]]
+#else
+#define LPL_KERNELS_X86 0
+#endif
+
+namespace {
+
+using Kernels::lanes;
+using Kernels::Op;
+
+int64_t wrapping_add(int64_t left, int64_t right)
+{
+    return static_cast<int64_t>(
+        static_cast<uint64_t>(left) + static_cast<uint64_t>(right));
+}
+
+int64_t wrapping_multiply(int64_t left, int64_t right)
+{
+    return static_cast<int64_t>(
+        static_cast<uint64_t>(left) * static_cast<uint64_t>(right));
+}
+
+int64_t int_operation(Op op, int64_t left, int64_t right)
+{
+    switch (op) {
+    case Op::Add: return wrapping_add(left, right);
+    case Op::Subtract:
+        return static_cast<int64_t>(
+            static_cast<uint64_t>(left) - static_cast<uint64_t>(right));
+    case Op::Multiply: return wrapping_multiply(left, right);
+    case Op::BitwiseAnd: return left & right;
+    case Op::BitwiseOr: return left | right;
+    case Op::BitwiseXor: return left ^ right;
+    case Op::Load: break;
+    }
+    return 0;
+}
+
+double float_operation(Op op, double left, double right)
+{
+    switch (op) {
+    case Op::Add: return left + right;
+    case Op::Subtract: return left - right;
+    case Op::Multiply: return left * right;
+    default: return 0;
+    }
+}
+
+double float_add(double left, double right) { return left + right; }
+
+template <typename T> T pick_min(T current, T value)
+{
+    return value < current ? value : current;
+}
+
+template <typename T> T pick_max(T current, T value)
+{
+    return value > current ? value : current;
+}
+
+// Every reduction goes through here, whatever the instruction set: element
+// `i` is accumulated into `lane[i % lanes]`, then the upper half of the
+// lanes is combined into the lower half until one is left. The vector
+// versions accumulate whole blocks of `lanes` elements and leave the rest
+// from `from` on to this.
+template <typename T, typename Step, typename Combine>
+T finish(T* lane, size_t from, size_t count, Step step, Combine combine)
+{
+    for (auto i = from; i < count; i++)
+        lane[i % lanes] = step(lane[i % lanes], i);
+    for (auto width = lanes / 2; width > 0; width /= 2)
+        for (size_t j = 0; j < width; j++)
+            lane[j] = combine(lane[j], lane[j + width]);
+    return lane[0];
+}
+
+void scalar_ints(Op op, const int64_t* left, const int64_t* right,
+    int64_t* result, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        result[i] = int_operation(op, left[i], right[i]);
+}
+
+void scalar_floats(Op op, const double* left, const double* right,
+    double* result, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        result[i] = float_operation(op, left[i], right[i]);
+}
+
+template <typename T> T sum_from(T* lane, const T* values, size_t from,
+    size_t count)
+{
+    if constexpr (std::is_same_v<T, int64_t>)
+        return finish(
+            lane, from, count,
+            [&](T sum, size_t i) { return wrapping_add(sum, values[i]); },
+            wrapping_add);
+    else
+        return finish(
+            lane, from, count,
+            [&](T sum, size_t i) { return sum + values[i]; }, float_add);
+}
+
+template <typename T> T dot_from(
+    T* lane, const T* left, const T* right, size_t from, size_t count)
+{
+    if constexpr (std::is_same_v<T, int64_t>)
+        return finish(
+            lane, from, count,
+            [&](T sum, size_t i) {
+                return wrapping_add(sum, wrapping_multiply(left[i], right[i]));
+            },
+            wrapping_add);
+    else
+        return finish(
+            lane, from, count,
+            [&](T sum, size_t i) { return sum + left[i] * right[i]; },
+            float_add);
+}
+
+template <typename T> T min_from(
+    T* lane, const T* values, size_t from, size_t count)
+{
+    return finish(
+        lane, from, count,
+        [&](T min, size_t i) { return pick_min(min, values[i]); },
+        pick_min<T>);
+}
+
+template <typename T> T max_from(
+    T* lane, const T* values, size_t from, size_t count)
+{
+    return finish(
+        lane, from, count,
+        [&](T max, size_t i) { return pick_max(max, values[i]); },
+        pick_max<T>);
+}
+
+template <typename T> T scalar_sum(const T* values, size_t count)
+{
+    T lane[lanes] = {};
+    return sum_from(lane, values, 0, count);
+}
+
+template <typename T> T scalar_dot(const T* left, const T* right, size_t count)
+{
+    T lane[lanes] = {};
+    return dot_from(lane, left, right, 0, count);
+}
+
+template <typename T> T scalar_min(const T* values, size_t count)
+{
+    T lane[lanes];
+    std::fill_n(lane, lanes, values[0]);
+    return min_from(lane, values, 0, count);
+}
+
+template <typename T> T scalar_max(const T* values, size_t count)
+{
+    T lane[lanes];
+    std::fill_n(lane, lanes, values[0]);
+    return max_from(lane, values, 0, count);
+}
+
+size_t scalar_find(const char* haystack, size_t haystack_size,
+    const char* needle, size_t needle_size)
+{
+    return std::string_view(haystack, haystack_size)
+        .find(std::string_view(needle, needle_size));
+}
+
+size_t mismatch_from(
+    const char* left, const char* right, size_t i, size_t count)
+{
+    while (i < count && left[i] == right[i])
+        i++;
+    return i;
+}
+
+size_t scalar_mismatch(const char* left, const char* right, size_t count)
+{
+    return mismatch_from(left, right, 0, count);
+}
+
+size_t ascii_from(const char* data, size_t i, size_t size)
+{
+    while (i < size && static_cast<uint8_t>(data[i]) < 0x80)
+        i++;
+    return i;
+}
+
+size_t scalar_ascii_prefix(const char* data, size_t size)
+{
+    return ascii_from(data, 0, size);
+}
+
+// the length of the multi-byte sequence `bytes` starts with, or 0 when it is
+// invalid, which includes overlong forms, surrogates and code points above
+// U+10FFFF
+size_t utf8_sequence(const uint8_t* bytes, size_t size)
+{
+    const auto lead = bytes[0];
+    auto length = size_t { 0 };
+    // the range of the second byte, which rules those out
+    auto low = uint8_t { 0x80 };
+    auto high = uint8_t { 0xbf };
+    if (lead >= 0xc2 && lead <= 0xdf) {
+        length = 2;
+    } else if (lead >= 0xe0 && lead <= 0xef) {
+        length = 3;
+        low = lead == 0xe0 ? 0xa0 : low;
+        high = lead == 0xed ? 0x9f : high;
+    } else if (lead >= 0xf0 && lead <= 0xf4) {
+        length = 4;
+        low = lead == 0xf0 ? 0x90 : low;
+        high = lead == 0xf4 ? 0x8f : high;
+    } else {
+        return 0;
+    }
+    if (size < length || bytes[1] < low || bytes[1] > high)
+        return 0;
+    for (size_t i = 2; i < length; i++)
+        if (bytes[i] < 0x80 || bytes[i] > 0xbf)
+            return 0;
+    return length;
+}
+
+#if LPL_KERNELS_X86
+
+// SSE2 is part of x86-64, it has no 64-bit multiplication or comparison, so
+// those are made of 32-bit multiplications or left to the scalar loops
+
+__m128i sse2_multiply(__m128i left, __m128i right)
+{
+    const auto low = _mm_mul_epu32(left, right);
+    const auto cross
+        = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(left, 32), right),
+            _mm_mul_epu32(left, _mm_srli_epi64(right, 32)));
+    return _mm_add_epi64(low, _mm_slli_epi64(cross, 32));
+}
+
+template <Op op> __m128i sse2_int(__m128i left, __m128i right)
+{
+    if constexpr (op == Op::Add)
+        return _mm_add_epi64(left, right);
+    else if constexpr (op == Op::Subtract)
+        return _mm_sub_epi64(left, right);
+    else if constexpr (op == Op::Multiply)
+        return sse2_multiply(left, right);
+    else if constexpr (op == Op::BitwiseAnd)
+        return _mm_and_si128(left, right);
+    else if constexpr (op == Op::BitwiseOr)
+        return _mm_or_si128(left, right);
+    else
+        return _mm_xor_si128(left, right);
+}
+
+template <Op op> __m128d sse2_float(__m128d left, __m128d right)
+{
+    if constexpr (op == Op::Add)
+        return _mm_add_pd(left, right);
+    else if constexpr (op == Op::Subtract)
+        return _mm_sub_pd(left, right);
+    else
+        return _mm_mul_pd(left, right);
+}
+
+template <Op op> void sse2_ints_of(const int64_t* left, const int64_t* right,
+    int64_t* result, size_t count)
+{
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(result + i),
+            sse2_int<op>(
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(left + i)),
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(right + i))));
+    scalar_ints(op, left + i, right + i, result + i, count - i);
+}
+
+template <Op op> void sse2_floats_of(const double* left, const double* right,
+    double* result, size_t count)
+{
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2)
+        _mm_storeu_pd(result + i,
+            sse2_float<op>(_mm_loadu_pd(left + i), _mm_loadu_pd(right + i)));
+    scalar_floats(op, left + i, right + i, result + i, count - i);
+}
+
+void sse2_ints(Op op, const int64_t* left, const int64_t* right,
+    int64_t* result, size_t count)
+{
+    switch (op) {
+    case Op::Add: return sse2_ints_of<Op::Add>(left, right, result, count);
+    case Op::Subtract:
+        return sse2_ints_of<Op::Subtract>(left, right, result, count);
+    case Op::Multiply:
+        return sse2_ints_of<Op::Multiply>(left, right, result, count);
+    case Op::BitwiseAnd:
+        return sse2_ints_of<Op::BitwiseAnd>(left, right, result, count);
+    case Op::BitwiseOr:
+        return sse2_ints_of<Op::BitwiseOr>(left, right, result, count);
+    case Op::BitwiseXor:
+        return sse2_ints_of<Op::BitwiseXor>(left, right, result, count);
+    case Op::Load: return;
+    }
+}
+
+void sse2_floats(Op op, const double* left, const double* right,
+    double* result, size_t count)
+{
+    switch (op) {
+    case Op::Add: return sse2_floats_of<Op::Add>(left, right, result, count);
+    case Op::Subtract:
+        return sse2_floats_of<Op::Subtract>(left, right, result, count);
+    case Op::Multiply:
+        return sse2_floats_of<Op::Multiply>(left, right, result, count);
+    default: return scalar_floats(op, left, right, result, count);
+    }
+}
+
+int64_t sse2_sum_ints(const int64_t* values, size_t count)
+{
+    __m128i sums[lanes / 2];
+    std::fill_n(sums, lanes / 2, _mm_setzero_si128());
+    size_t i = 0;
+    for (; i + lanes <= count; i += lanes)
+        for (size_t k = 0; k < lanes / 2; k++)
+            sums[k] = _mm_add_epi64(sums[k],
+                _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(values + i + 2 * k)));
+    int64_t lane[lanes];
+    std::memcpy(lane, sums, sizeof(lane));
+    return sum_from(lane, values, i, count);
+}
+
+double sse2_sum_floats(const double* values, size_t count)
+{
+    __m128d sums[lanes / 2];
+    std::fill_n(sums, lanes / 2, _mm_setzero_pd());
+    size_t i = 0;
+    for (; i + lanes <= count; i += lanes)
+        for (size_t k = 0; k < lanes / 2; k++)
+            sums[k] = _mm_add_pd(sums[k], _mm_loadu_pd(values + i + 2 * k));
+    double lane[lanes];
+    std::memcpy(lane, sums, sizeof(lane));
+    return sum_from(lane, values, i, count);
+}
+
+template <bool is_min> double sse2_extremum(const double* values, size_t count)
+{
+    __m128d extrema[lanes / 2];
+    std::fill_n(extrema, lanes / 2, _mm_set1_pd(values[0]));
+    size_t i = 0;
+    for (; i + lanes <= count; i += lanes) {
+        for (size_t k = 0; k < lanes / 2; k++) {
+            const auto value = _mm_loadu_pd(values + i + 2 * k);
+            extrema[k] = is_min ? _mm_min_pd(value, extrema[k])
+                                : _mm_max_pd(value, extrema[k]);
+        }
+    }
+    double lane[lanes];
+    std::memcpy(lane, extrema, sizeof(lane));
+    return is_min ? min_from(lane, values, i, count)
+                  : max_from(lane, values, i, count);
+}
+
+int64_t sse2_dot_ints(const int64_t* left, const int64_t* right, size_t count)
+{
+    __m128i sums[lanes / 2];
+    std::fill_n(sums, lanes / 2, _mm_setzero_si128());
+    size_t i = 0;
+    for (; i + lanes <= count; i += lanes)
+        for (size_t k = 0; k < lanes / 2; k++)
+            sums[k] = _mm_add_epi64(sums[k],
+                sse2_multiply(_mm_loadu_si128(reinterpret_cast<const __m128i*>(
+                                  left + i + 2 * k)),
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+                        right + i + 2 * k))));
+    int64_t lane[lanes];
+    std::memcpy(lane, sums, sizeof(lane));
+    return dot_from(lane, left, right, i, count);
+}
+
+double sse2_dot_floats(const double* left, const double* right, size_t count)
+{
+    __m128d sums[lanes / 2];
+    std::fill_n(sums, lanes / 2, _mm_setzero_pd());
+    size_t i = 0;
+    for (; i + lanes <= count; i += lanes)
+        for (size_t k = 0; k < lanes / 2; k++)
+            sums[k] = _mm_add_pd(sums[k],
+                _mm_mul_pd(_mm_loadu_pd(left + i + 2 * k),
+                    _mm_loadu_pd(right + i + 2 * k)));
+    double lane[lanes];
+    std::memcpy(lane, sums, sizeof(lane));
+    return dot_from(lane, left, right, i, count);
+}
+
+// AVX2 has no 64-bit multiplication either, but it compares 64-bit ints
+
+LPL_AVX2 __m256i avx2_multiply(__m256i left, __m256i right)
+{
+    const auto low = _mm256_mul_epu32(left, right);
+    const auto cross = _mm256_add_epi64(
+        _mm256_mul_epu32(_mm256_srli_epi64(left, 32), right),
+        _mm256_mul_epu32(left, _mm256_srli_epi64(right, 32)));
+    return _mm256_add_epi64(low, _mm256_slli_epi64(cross, 32));
+}
+
+template <Op op> LPL_AVX2 __m256i avx2_int(__m256i left, __m256i right)
+{
+    if constexpr (op == Op::Add)
+        return _mm256_add_epi64(left, right);
+    else if constexpr (op == Op::Subtract)
+        return _mm256_sub_epi64(left, right);
+    else if constexpr (op == Op::Multiply)
+        return avx2_multiply(left, right);
+    else if constexpr (op == Op::BitwiseAnd)
+        return _mm256_and_si256(left, right);
+    else if constexpr (op == Op::BitwiseOr)
+        return _mm256_or_si256(left, right);
+    else
+        return _mm256_xor_si256(left, right);
+}
+
+template <Op op> LPL_AVX2 __m256d avx2_float(__m256d left, __m256d right)
+{
+    if constexpr (op == Op::Add)
+        return _mm256_add_pd(left, right);
+    else if constexpr (op == Op::Subtract)
+        return _mm256_sub_pd(left, right);
+    else
+        return _mm256_mul_pd(left, right);
+}
+
+template <Op op> LPL_AVX2 void avx2_ints_of(const int64_t* left,
+    const int64_t* right, int64_t* result, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(result + i),
+            avx2_int<op>(_mm256_loadu_si256(
+                             reinterpret_cast<const __m256i*>(left + i)),
+                _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(right + i))));
+    scalar_ints(op, left + i, right + i, result + i, count - i);
+}
+
+template <Op op> LPL_AVX2 void avx2_floats_of(const double* left,
+    const double* right, double* result, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+        _mm256_storeu_pd(result + i,
+            avx2_float<op>(
+                _mm256_loadu_pd(left + i), _mm256_loadu_pd(right + i)));
+    scalar_floats(op, left + i, right + i, result + i, count - i);
+}
+
+void avx2_ints(Op op, const int64_t* left, const int64_t* right,
+    int64_t* result, size_t count)
+{
+    switch (op) {
+    case Op::Add: return avx2_ints_of<Op::Add>(left, right, result, count);
+    case Op::Subtract:
+        return avx2_ints_of<Op::Subtract>(left, right, result, count);
+    case Op::Multiply:
+        return avx2_ints_of<Op::Multiply>(left, right, result, count);
+    case Op::BitwiseAnd:
+        return avx2_ints_of<Op::BitwiseAnd>(left, right, result, count);
+    case Op::BitwiseOr:
+        return avx2_ints_of<Op::BitwiseOr>(left, right, result, count);
+    case Op::BitwiseXor:
+        return avx2_ints_of<Op::BitwiseXor>(left, right, result, count);
+    case Op::Load: return;
+    }
+}
+
+void avx2_floats(Op op, const double* left, const double* right,
+    double* result, size_t count)
+{
+    switch (op) {
+    case Op::Add: return avx2_floats_of<Op::Add>(left, right, result, count);
+    case Op::Subtract:
+        return avx2_floats_of<Op::Subtract>(left, right, result, count);
+    case Op::Multiply:
+        return avx2_floats_of<Op::Multiply>(left, right, result, count);
+    default: return scalar_floats(op, left, right, result, count);
+    }
+}
+
+LPL_AVX2 int64_t avx2_sum_ints(const int64_t* values, size_t count)
+{
+    __m256i sums[lanes / 4];
+    std::fill_n(sums, lanes / 4, _mm256_setzero_si256());
+    size_t i = 0;
+    for (; i + lanes <= count; i += lanes)
+        for (size_t k = 0; k < lanes / 4; k++)
+            sums[k] = _mm256_add_epi64(sums[k],
+                _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(values + i + 4 * k)));
+    int64_t lane[lanes];
+    std::memcpy(lane, sums, sizeof(lane));
+    return sum_from(lane, values, i, count);
+}
+
+LPL_AVX2 double avx2_sum_floats(const double* values, size_t count)
+{
+    __m256d sums[lanes / 4];
+    std::fill_n(sums, lanes / 4, _mm256_setzero_pd());
+    size_t i = 0;
+    for (; i + lanes <= count; i += lanes)
+        for (size_t k = 0; k < lanes / 4; k++)
+            sums[k]
+                = _mm256_add_pd(sums[k], _mm256_loadu_pd(values + i + 4 * k));
+    double lane[lanes];
+    std::memcpy(lane, sums, sizeof(lane));
+    return sum_from(lane, values, i, count);
+}
+
+template <bool is_min>
+LPL_AVX2 int64_t avx2_int_extremum(const int64_t* values, size_t count)
+{
+    __m256i extrema[lanes / 4];
+    std::fill_n(extrema, lanes / 4, _mm256_set1_epi64x(values[0]));
+    size_t i = 0;
+    for (; i + lanes <= count; i += lanes) {
+        for (size_t k = 0; k < lanes / 4; k++) {
+            const auto value = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(values + i + 4 * k));
+            const auto replaced = is_min
+                ? _mm256_cmpgt_epi64(extrema[k], value)
+                : _mm256_cmpgt_epi64(value, extrema[k]);
+            extrema[k] = _mm256_blendv_epi8(extrema[k], value, replaced);
+        }
+    }
+    int64_t lane[lanes];
+    std::memcpy(lane, extrema, sizeof(lane));
+    return is_min ? min_from(lane, values, i, count)
+                  : max_from(lane, values, i, count);
+}
+
+template <bool is_min>
+LPL_AVX2 double avx2_float_extremum(const double* values, size_t count)
+{
+    __m256d extrema[lanes / 4];
+    std::fill_n(extrema, lanes / 4, _mm256_set1_pd(values[0]));
+    size_t i = 0;
+    for (; i + lanes <= count; i += lanes) {
+        for (size_t k = 0; k < lanes / 4; k++) {
+            const auto value = _mm256_loadu_pd(values + i + 4 * k);
+            extrema[k] = is_min ? _mm256_min_pd(value, extrema[k])
+                                : _mm256_max_pd(value, extrema[k]);
+        }
+    }
+    double lane[lanes];
+    std::memcpy(lane, extrema, sizeof(lane));
+    return is_min ? min_from(lane, values, i, count)
+                  : max_from(lane, values, i, count);
+}
+
+LPL_AVX2 int64_t avx2_dot_ints(
+    const int64_t* left, const int64_t* right, size_t count)
+{
+    __m256i sums[lanes / 4];
+    std::fill_n(sums, lanes / 4, _mm256_setzero_si256());
+    size_t i = 0;
+    for (; i + lanes <= count; i += lanes)
+        for (size_t k = 0; k < lanes / 4; k++)
+            sums[k] = _mm256_add_epi64(sums[k],
+                avx2_multiply(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+                                  left + i + 4 * k)),
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+                        right + i + 4 * k))));
+    int64_t lane[lanes];
+    std::memcpy(lane, sums, sizeof(lane));
+    return dot_from(lane, left, right, i, count);
+}
+
+LPL_AVX2 double avx2_dot_floats(
+    const double* left, const double* right, size_t count)
+{
+    __m256d sums[lanes / 4];
+    std::fill_n(sums, lanes / 4, _mm256_setzero_pd());
+    size_t i = 0;
+    for (; i + lanes <= count; i += lanes)
+        for (size_t k = 0; k < lanes / 4; k++)
+            sums[k] = _mm256_add_pd(sums[k],
+                _mm256_mul_pd(_mm256_loadu_pd(left + i + 4 * k),
+                    _mm256_loadu_pd(right + i + 4 * k)));
+    double lane[lanes];
+    std::memcpy(lane, sums, sizeof(lane));
+    return dot_from(lane, left, right, i, count);
+}
+
+// Substrings are searched for a block at a time, as in Muła's "SIMD-friendly
+// algorithms for substring searching": the positions where both the first
+// and the last byte of the needle match are candidates, and only those
+// compare the bytes in between.
+
+size_t find_candidate(uint32_t candidates, const char* haystack, size_t i,
+    const char* needle, size_t needle_size)
+{
+    for (; candidates != 0; candidates &= candidates - 1) {
+        const auto position
+            = i + static_cast<size_t>(__builtin_ctz(candidates));
+        if (std::memcmp(haystack + position + 1, needle + 1, needle_size - 2)
+            == 0)
+            return position;
+    }
+    return Kernels::not_found;
+}
+
+size_t find_rest(const char* haystack, size_t haystack_size,
+    const char* needle, size_t needle_size, size_t i)
+{
+    const auto found
+        = scalar_find(haystack + i, haystack_size - i, needle, needle_size);
+    return found == Kernels::not_found ? found : i + found;
+}
+
+size_t sse2_find(const char* haystack, size_t haystack_size,
+    const char* needle, size_t needle_size)
+{
+    if (needle_size < 2 || needle_size > haystack_size)
+        return scalar_find(haystack, haystack_size, needle, needle_size);
+    const auto first = _mm_set1_epi8(needle[0]);
+    const auto last = _mm_set1_epi8(needle[needle_size - 1]);
+    size_t i = 0;
+    for (; i + needle_size - 1 + 16 <= haystack_size; i += 16) {
+        const auto starts = _mm_cmpeq_epi8(first,
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack + i)));
+        const auto ends = _mm_cmpeq_epi8(last,
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+                haystack + i + needle_size - 1)));
+        const auto found = find_candidate(
+            static_cast<uint32_t>(
+                _mm_movemask_epi8(_mm_and_si128(starts, ends))),
+            haystack, i, needle, needle_size);
+        if (found != Kernels::not_found)
+            return found;
+    }
+    return find_rest(haystack, haystack_size, needle, needle_size, i);
+}
+
+size_t sse2_mismatch(const char* left, const char* right, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const auto equal = static_cast<uint32_t>(_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128(
+                               reinterpret_cast<const __m128i*>(left + i)),
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(right + i)))));
+        if (equal != 0xffff)
+            return i + static_cast<size_t>(__builtin_ctz(~equal));
+    }
+    return mismatch_from(left, right, i, count);
+}
+
+size_t sse2_ascii_prefix(const char* data, size_t size)
+{
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        const auto high = static_cast<uint32_t>(_mm_movemask_epi8(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i))));
+        if (high != 0)
+            return i + static_cast<size_t>(__builtin_ctz(high));
+    }
+    return ascii_from(data, i, size);
+}
+
+LPL_AVX2 size_t avx2_find(const char* haystack, size_t haystack_size,
+    const char* needle, size_t needle_size)
+{
+    if (needle_size < 2 || needle_size > haystack_size)
+        return scalar_find(haystack, haystack_size, needle, needle_size);
+    const auto first = _mm256_set1_epi8(needle[0]);
+    const auto last = _mm256_set1_epi8(needle[needle_size - 1]);
+    size_t i = 0;
+    for (; i + needle_size - 1 + 32 <= haystack_size; i += 32) {
+        const auto starts = _mm256_cmpeq_epi8(first,
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(haystack + i)));
+        const auto ends = _mm256_cmpeq_epi8(last,
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+                haystack + i + needle_size - 1)));
+        const auto found = find_candidate(
+            static_cast<uint32_t>(
+                _mm256_movemask_epi8(_mm256_and_si256(starts, ends))),
+            haystack, i, needle, needle_size);
+        if (found != Kernels::not_found)
+            return found;
+    }
+    return find_rest(haystack, haystack_size, needle, needle_size, i);
+}
+
+LPL_AVX2 size_t avx2_mismatch(
+    const char* left, const char* right, size_t count)
+{
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        const auto equal = static_cast<uint32_t>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(left + i)),
+                _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(right + i)))));
+        if (equal != 0xffffffff)
+            return i + static_cast<size_t>(__builtin_ctz(~equal));
+    }
+    return mismatch_from(left, right, i, count);
+}
+
+LPL_AVX2 size_t avx2_ascii_prefix(const char* data, size_t size)
+{
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        const auto high = static_cast<uint32_t>(_mm256_movemask_epi8(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i))));
+        if (high != 0)
+            return i + static_cast<size_t>(__builtin_ctz(high));
+    }
+    return ascii_from(data, i, size);
+}
+
+#endif
+
+// the kernels of an instruction set
+struct Table {
+    const char* name;
+    void (*ints)(Op, const int64_t*, const int64_t*, int64_t*, size_t);
+    void (*floats)(Op, const double*, const double*, double*, size_t);
+    int64_t (*sum_ints)(const int64_t*, size_t);
+    double (*sum_floats)(const double*, size_t);
+    int64_t (*min_ints)(const int64_t*, size_t);
+    double (*min_floats)(const double*, size_t);
+    int64_t (*max_ints)(const int64_t*, size_t);
+    double (*max_floats)(const double*, size_t);
+    int64_t (*dot_ints)(const int64_t*, const int64_t*, size_t);
+    double (*dot_floats)(const double*, const double*, size_t);
+    size_t (*find)(const char*, size_t, const char*, size_t);
+    size_t (*mismatch)(const char*, const char*, size_t);
+    size_t (*ascii_prefix)(const char*, size_t);
+};
+
+const auto scalar = Table {
+    "scalar",
+    scalar_ints,
+    scalar_floats,
+    scalar_sum<int64_t>,
+    scalar_sum<double>,
+    scalar_min<int64_t>,
+    scalar_min<double>,
+    scalar_max<int64_t>,
+    scalar_max<double>,
+    scalar_dot<int64_t>,
+    scalar_dot<double>,
+    scalar_find,
+    scalar_mismatch,
+    scalar_ascii_prefix,
+};
+
+#if LPL_KERNELS_X86
+
+const auto sse2 = Table {
+    "sse2",
+    sse2_ints,
+    sse2_floats,
+    sse2_sum_ints,
+    sse2_sum_floats,
+    scalar_min<int64_t>,
+    sse2_extremum<true>,
+    scalar_max<int64_t>,
+    sse2_extremum<false>,
+    sse2_dot_ints,
+    sse2_dot_floats,
+    sse2_find,
+    sse2_mismatch,
+    sse2_ascii_prefix,
+};
+
+const auto avx2 = Table {
+    "avx2",
+    avx2_ints,
+    avx2_floats,
+    avx2_sum_ints,
+    avx2_sum_floats,
+    avx2_int_extremum<true>,
+    avx2_float_extremum<true>,
+    avx2_int_extremum<false>,
+    avx2_float_extremum<false>,
+    avx2_dot_ints,
+    avx2_dot_floats,
+    avx2_find,
+    avx2_mismatch,
+    avx2_ascii_prefix,
+};
+
+#endif
+
+const Table& select_table()
+{
+    const auto cap = std::getenv("LPL_KERNELS");
+    const auto allows
+        = [&](const char* name) { return !cap || std::strcmp(cap, name) != 0; };
+#if LPL_KERNELS_X86
+    __builtin_cpu_init();
+    if (allows("scalar") && allows("sse2") && __builtin_cpu_supports("avx2"))
+        return avx2;
+    if (allows("scalar"))
+        return sse2;
+#else
+    (void)allows;
+#endif
+    return scalar;
+}
+
+// picked before `main` runs
+const Table& table = select_table();
+
+template <typename T>
+void apply(Op op, const T* left, const T* right, T* result, size_t count)
+{
+    if constexpr (std::is_same_v<T, int64_t>)
+        table.ints(op, left, right, result, count);
+    else
+        table.floats(op, left, right, result, count);
+}
+
+template <typename T> void evaluate_as(const Kernels::Expression& expression,
+    const Array* const* operands, T* result, size_t length)
+{
+    auto depth = size_t { 0 };
+    auto max_depth = size_t { 0 };
+    for (const auto op : expression) {
+        depth = op == Op::Load ? depth + 1 : depth - 1;
+        max_depth = std::max(max_depth, depth);
+    }
+    // a chunk for the intermediate results at each depth of the stack, the
+    // last operation writes straight into the result
+    auto scratch = std::vector<T>(
+        expression.size() > 3 ? max_depth * Kernels::chunk : 0);
+    auto stack = std::vector<const T*> {};
+    stack.reserve(max_depth);
+    for (size_t start = 0; start < length; start += Kernels::chunk) {
+        const auto count = std::min(Kernels::chunk, length - start);
+        auto next = size_t { 0 };
+        for (size_t i = 0; i < expression.size(); i++) {
+            const auto op = expression[i];
+            if (op == Op::Load) {
+                stack.push_back(
+                    static_cast<const T*>(operands[next++]->data) + start);
+                continue;
+            }
+            const auto right = stack.back();
+            stack.pop_back();
+            const auto left = stack.back();
+            stack.pop_back();
+            const auto target = i + 1 == expression.size()
+                ? result + start
+                : scratch.data() + stack.size() * Kernels::chunk;
+            apply(op, left, right, target, count);
+            stack.push_back(target);
+        }
+        stack.clear();
+    }
+}
+
+}
+
+const char* Kernels::instruction_set() { return table.name; }
+
+void Kernels::ints(Op op, const int64_t* left, const int64_t* right,
+    int64_t* result, size_t count)
+{
+    table.ints(op, left, right, result, count);
+}
+
+void Kernels::floats(Op op, const double* left, const double* right,
+    double* result, size_t count)
+{
+    table.floats(op, left, right, result, count);
+}
+
+int64_t Kernels::sum(const int64_t* values, size_t count)
+{
+    return table.sum_ints(values, count);
+}
+
+double Kernels::sum(const double* values, size_t count)
+{
+    return table.sum_floats(values, count);
+}
+
+int64_t Kernels::min(const int64_t* values, size_t count)
+{
+    return table.min_ints(values, count);
+}
+
+double Kernels::min(const double* values, size_t count)
+{
+    return table.min_floats(values, count);
+}
+
+int64_t Kernels::max(const int64_t* values, size_t count)
+{
+    return table.max_ints(values, count);
+}
+
+double Kernels::max(const double* values, size_t count)
+{
+    return table.max_floats(values, count);
+}
+
+int64_t Kernels::dot(const int64_t* left, const int64_t* right, size_t count)
+{
+    return table.dot_ints(left, right, count);
+}
+
+double Kernels::dot(const double* left, const double* right, size_t count)
+{
+    return table.dot_floats(left, right, count);
+}
+
+size_t Kernels::find(const char* haystack, size_t haystack_size,
+    const char* needle, size_t needle_size)
+{
+    return table.find(haystack, haystack_size, needle, needle_size);
+}
+
+size_t Kernels::mismatch(const char* left, const char* right, size_t count)
+{
+    return table.mismatch(left, right, count);
+}
+
+// ASCII runs are skipped a block at a time, the multi-byte sequences in
+// between are checked one at a time
+size_t Kernels::valid_utf8_prefix(const char* data, size_t size)
+{
+    const auto bytes = reinterpret_cast<const uint8_t*>(data);
+    auto i = size_t { 0 };
+    while (true) {
+        i += table.ascii_prefix(data + i, size - i);
+        if (i == size)
+            return size;
+        const auto length = utf8_sequence(bytes + i, size - i);
+        if (length == 0)
+            return i;
+        i += length;
+    }
+}
+
+std::optional<ValueType> Kernels::result_type(
+    Op op, ValueType left, ValueType right)
+{
+    if (op == Op::Load || left != right)
+        return std::nullopt;
+    if (left == ValueType::Int)
+        return left;
+    if (left == ValueType::Float && op <= Op::Multiply)
+        return left;
+    return std::nullopt;
+}
+
+std::optional<std::string> Kernels::check(
+    const Expression& expression, const Array* const* operands)
+{
+    auto stack = std::vector<const Array*> {};
+    auto types = std::vector<ValueType> {};
+    auto next = size_t { 0 };
+    for (const auto op : expression) {
+        if (op == Op::Load) {
+            stack.push_back(operands[next]);
+            types.push_back(operands[next++]->element_type);
+            continue;
+        }
+        const auto right = stack.back();
+        const auto right_type = types.back();
+        stack.pop_back();
+        types.pop_back();
+        const auto type = result_type(op, types.back(), right_type);
+        if (!type)
+            return "unsupported array elements `"
+                + value_type_to_string(types.back()) + "` " + op_to_string(op)
+                + " `" + value_type_to_string(right_type) + "`";
+        if (stack.back()->length != right->length)
+            return "mismatched array lengths "
+                + std::to_string(stack.back()->length) + " and "
+                + std::to_string(right->length);
+        types.back() = *type;
+    }
+    return std::nullopt;
+}
+
+Array* Kernels::evaluate(
+    const Expression& expression, const Array* const* operands)
+{
+    const auto type = operands[0]->element_type;
+    const auto length = operands[0]->length;
+    const auto result = Array::make(type, length);
+    if (type == ValueType::Int)
+        evaluate_as(expression, operands, result->ints(),
+            static_cast<size_t>(length));
+    else
+        evaluate_as(expression, operands, result->floats(),
+            static_cast<size_t>(length));
+    return result;
+}
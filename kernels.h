@@ -0,0 +1,86 @@
+#pragma once
+
+#include "value.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Element-wise operations and reductions over the unboxed storage of arrays,
+// see array.h, and searches over the bytes of strings.
+//
+// They are vectorized with AVX2 or SSE2, whichever the CPU has, picked once
+// at startup, and fall back to scalar loops elsewhere. `LPL_KERNELS` set to
+// `scalar` or `sse2` caps the instruction set, for comparing them. Results
+// don't depend on the instruction set: reductions of floats accumulate in
+// `lanes` interleaved lanes, combined in a fixed order, and multiplications
+// are never fused with additions.
+namespace Kernels {
+
+constexpr size_t lanes = 8;
+// element-wise expressions are evaluated this many elements at a time
+constexpr size_t chunk = 256;
+constexpr size_t max_operands = 8;
+
+enum class Op : uint8_t {
+    Load,
+    Add,
+    Subtract,
+    Multiply,
+    BitwiseAnd,
+    BitwiseOr,
+    BitwiseXor,
+};
+
+std::string op_to_string(Op op);
+
+// Element-wise operations over arrays of the same length, in postfix order:
+// `Load` pushes the next operand, the others pop two arrays and push the
+// array of their results. Ints wrap around like the VM's, floats only add,
+// subtract and multiply, and both operands have the same element type.
+using Expression = std::vector<Op>;
+
+// "avx2", "sse2" or "scalar"
+const char* instruction_set();
+
+// `result[i] = left[i] op right[i]`, `result` may be one of the operands
+void ints(Op op, const int64_t* left, const int64_t* right, int64_t* result,
+    size_t count);
+void floats(Op op, const double* left, const double* right, double* result,
+    size_t count);
+
+int64_t sum(const int64_t* values, size_t count);
+double sum(const double* values, size_t count);
+// `count` has to be positive, NaNs are compared like `x < min ? x : min`
+int64_t min(const int64_t* values, size_t count);
+double min(const double* values, size_t count);
+int64_t max(const int64_t* values, size_t count);
+double max(const double* values, size_t count);
+int64_t dot(const int64_t* left, const int64_t* right, size_t count);
+double dot(const double* left, const double* right, size_t count);
+
+constexpr size_t not_found = SIZE_MAX;
+
+// the index of the first occurrence of `needle` in `haystack`, or
+// `not_found`
+size_t find(const char* haystack, size_t haystack_size, const char* needle,
+    size_t needle_size);
+// the index of the first byte that differs, or `count`
+size_t mismatch(const char* left, const char* right, size_t count);
+// the length of the longest prefix of `data` that is valid UTF-8
+size_t valid_utf8_prefix(const char* data, size_t size);
+
+// the element type of `op` on arrays of `left` and `right`, if supported
+std::optional<ValueType> result_type(Op op, ValueType left, ValueType right);
+
+// the error evaluating `expression` one operation at a time would fail with,
+// the operands are its `Load`s in order
+std::optional<std::string> check(
+    const Expression& expression, const Array* const* operands);
+
+// evaluates a checked expression chunk by chunk, in a single pass over the
+// operands and without arrays for the intermediate results
+Array* evaluate(const Expression& expression, const Array* const* operands);
+
+}
@@ -1,4 +1,6 @@
 #include "lexer.h"
+#include "error.h"
+#include "kernels.h"
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -13,6 +15,7 @@ std::vector<Token> Lexer::tokenize()
     }
 
     while (m_index < m_text.length()) {
+        begin_token();
         if (std::isdigit(m_text[m_index])) {
             tokens.push_back(make_number());
         } else if (std::isalpha(m_text[m_index]) || m_text[m_index] == '_') {
@@ -68,8 +71,9 @@ std::vector<Token> Lexer::tokenize()
                     TokenType::BitwiseRightShift, '>'));
                 break;
             case '=':
-                tokens.push_back(make_single_or_double(
-                    TokenType::AssignEqual, TokenType::Equal, '='));
+                tokens.push_back(make_single_or_two_double(
+                    TokenType::AssignEqual, TokenType::Equal, '=',
+                    TokenType::FatArrow, '>'));
                 break;
             case '(': tokens.push_back(single_char(TokenType::LParen)); break;
             case ')': tokens.push_back(single_char(TokenType::RParen)); break;
@@ -82,14 +86,23 @@ std::vector<Token> Lexer::tokenize()
             case ';':
                 tokens.push_back(single_char(TokenType::Semicolon));
                 break;
+            case '.':
+                if (m_index + 1 < m_text.length()
+                    && m_text[m_index + 1] == '.') {
+                    tokens.push_back(Token(TokenType::DotDot, "..", pos(2)));
+                    step();
+                    step();
+                    break;
+                }
+                error_and_exit("unexpected char '.'");
             default:
                 std::stringstream errormsg {};
                 errormsg << "unexpected char '" << m_text[m_index] << "'";
-                print_error(errormsg.str());
-                exit(1);
+                error_and_exit(errormsg.str());
             }
         }
     }
+    begin_token();
     tokens.push_back(Token(TokenType::EndOfFile, "", pos(0)));
     return tokens;
 }
@@ -101,16 +114,19 @@ Token Lexer::make_number()
     int dots = 0;
     while (
         !done() && (std::isdigit(m_text[m_index]) || m_text[m_index] == '.')) {
-        if (m_text[m_index] == '.' && dots < 1) {
-            if (dots >= 1)
+        if (m_text[m_index] == '.') {
+            // `..` ends the number, as in `0..10` or `0.5..3`
+            if (m_index + 1 < m_text.length() && m_text[m_index + 1] == '.')
                 break;
+            if (dots > 0)
+                error_and_exit("unexpected second '.' in number literal");
             dots++;
         }
         value.push_back(m_text[m_index]);
         step();
     }
-    const auto type = m_text.find('.') != std::string::npos ? TokenType::Float
-                                                            : TokenType::Int;
+    const auto type = value.find('.') != std::string::npos ? TokenType::Float
+                                                           : TokenType::Int;
     return Token(type, value, pos(value.length()));
 }
 
@@ -153,6 +169,8 @@ Token Lexer::make_string()
     }
     if (done() || m_text[m_index] != '\"')
         error_and_exit("expected `\"` at end of string literal");
+    if (Kernels::valid_utf8_prefix(value.data(), value.size()) != value.size())
+        error_and_exit("invalid UTF-8 in string literal");
     value.push_back(m_text[m_index]);
     step();
     return Token(TokenType::String, value, pos(value.length()));
@@ -174,10 +192,22 @@ TokenType Lexer::identifier_token_type(const std::string& value)
 {
     if (value.compare("if") == 0)
         return TokenType::If;
+    else if (value.compare("else") == 0)
+        return TokenType::Else;
+    else if (value.compare("match") == 0)
+        return TokenType::Match;
     else if (value.compare("while") == 0)
         return TokenType::While;
+    else if (value.compare("loop") == 0)
+        return TokenType::Loop;
+    else if (value.compare("for") == 0)
+        return TokenType::For;
+    else if (value.compare("in") == 0)
+        return TokenType::In;
     else if (value.compare("break") == 0)
         return TokenType::Break;
+    else if (value.compare("continue") == 0)
+        return TokenType::Continue;
     else if (value.compare("func") == 0)
         return TokenType::Func;
     else if (value.compare("return") == 0)
@@ -269,7 +299,7 @@ void Lexer::step()
     }
 }
 
-void Lexer::print_error(const std::string& msg)
+std::string Lexer::error_message(const std::string& msg)
 {
     const auto span = [&]() {
         const size_t start_of_line = m_index - (m_col - 1);
@@ -282,19 +312,27 @@ void Lexer::print_error(const std::string& msg)
     //           << "m_col = " << m_col << ", "
     //           << "m_row = " << m_row << ", "
     //           << "span = " << span << "\n";
-    std::cerr << "LexerError: " << msg << "\n\n"
-              << m_row << ":\t" << m_text.substr(m_index - (m_col - 1), span)
-              << "\n\t" << std::string((m_col - 1), ' ') << "^ " << msg
-              << "\n\n";
+    auto result = std::stringstream {};
+    result << "LexerError: " << msg << "\n\n"
+           << m_row << ":\t" << m_text.substr(m_index - (m_col - 1), span)
+           << "\n\t" << std::string((m_col - 1), ' ') << "^ " << msg
+           << "\n\n";
+    return result.str();
 }
 
 void Lexer::error_and_exit(const std::string& msg)
 {
-    print_error(msg);
-    exit(1);
+    throw CompileError { error_message(msg) };
+}
+
+void Lexer::begin_token()
+{
+    m_token_index = m_index;
+    m_token_row = m_row;
+    m_token_col = m_col;
 }
 
 Position Lexer::pos(int length)
 {
-    return Position(m_index, length, m_col, m_row);
+    return Position(m_token_index, length, m_token_row, m_token_col);
 }
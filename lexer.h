@@ -23,8 +23,13 @@ enum class TokenType {
     Name,
     If,
     Else,
+    Match,
     While,
+    Loop,
+    For,
+    In,
     Break,
+    Continue,
     Func,
     Return,
     Let,
@@ -63,6 +68,8 @@ enum class TokenType {
     Colon,
     Semicolon,
     ThinArrow,
+    FatArrow,
+    DotDot,
 };
 
 std::string token_type_to_string(TokenType type);
@@ -106,11 +113,16 @@ private:
     void push_slash_or_comment(std::vector<Token>& tokens);
     bool done();
     void step();
-    void print_error(const std::string& msg);
-    void error_and_exit(const std::string& msg);
+    std::string error_message(const std::string& msg);
+    // throws a `CompileError`
+    [[noreturn]] void error_and_exit(const std::string& msg);
+    // positions refer to the first char of the token being made
+    void begin_token();
     Position pos(int length);
 
     const std::string& m_text;
     size_t m_index { 0 };
     int m_row { 1 }, m_col { 1 };
+    size_t m_token_index { 0 };
+    int m_token_row { 1 }, m_token_col { 1 };
 };
@@ -0,0 +1,971 @@
+#include "lowering.h"
+#include "checker.h"
+#include "error.h"
+#include "ir.h"
+#include "parser.h"
+#include "str.h"
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+using Ir::Op;
+
+std::unique_ptr<Ir::Module> Lowering::lower(const Parsed::Block& program)
+{
+    m_module = std::make_unique<Ir::Module>();
+    m_module->main = std::make_unique<Ir::Function>("main", 0);
+    m_module->main->position = { 1, 1 };
+
+    // functions are hoisted, so they can call each other regardless of the
+    // order they are declared in
+    auto funcs = std::vector<const Parsed::Func*> {};
+    auto let_globals = std::vector<uint32_t> {};
+    for (const auto& statement : program.statements) {
+        if (statement->statement_type() == Parsed::StatementType::Let) {
+            const auto& let = static_cast<const Parsed::Let&>(*statement);
+            let_globals.push_back(define_global(*let.parameter));
+        }
+        if (statement->statement_type() != Parsed::StatementType::Func)
+            continue;
+        const auto& func = static_cast<const Parsed::Func&>(*statement);
+        funcs.push_back(&func);
+        m_module->functions.push_back(std::make_unique<Ir::Function>(
+            func.name, static_cast<uint32_t>(func.parameters.size())));
+        m_module->functions.back()->position = source_position(func);
+        m_module->function_globals.push_back(
+            define_global(func.name, false));
+    }
+    for (size_t i = 0; i < funcs.size(); i++)
+        lower_func(*funcs[i], *m_module->functions[i]);
+
+    // top level lets are globals, everything else goes into `main`
+    begin_function(*m_module->main);
+    m_position = std::nullopt;
+    for (const auto& statement : program.statements) {
+        if (statement->statement_type() == Parsed::StatementType::Let) {
+            m_position = source_position(*statement);
+            const auto& let = static_cast<const Parsed::Let&>(*statement);
+            const auto value = let.value ? lower_expression(**let.value)
+                                         : constant(Value::make_unit());
+            const auto global = define_global(*let.parameter);
+            const auto type = let.parameter->type
+                ? std::optional(Checker::annotation(**let.parameter->type))
+                : std::nullopt;
+            emit(Op::DefineGlobal, { guard(value, type) })->index = global;
+        } else if (statement->statement_type()
+            != Parsed::StatementType::Func) {
+            lower_statement(*statement);
+        }
+    }
+    if (program.value)
+        lower_tail(**program.value);
+    else
+        emit(Op::Return, { constant(Value::make_unit()) });
+    m_function->sort_blocks();
+
+    m_module->defined_globals.resize(m_module->globals.size(), false);
+    for (const auto global : let_globals)
+        m_module->defined_globals[global] = true;
+    return std::move(m_module);
+}
+
+void Lowering::begin_function(Ir::Function& function)
+{
+    m_function = &function;
+    m_locals.clear();
+    m_loops.clear();
+    m_return_type = std::nullopt;
+    m_variables_count = 0;
+    m_definitions.clear();
+    m_sealed.clear();
+    m_incomplete_phis.clear();
+    m_replaced.clear();
+    m_removed_phis.clear();
+    m_block = function.create_block();
+    seal_block(m_block);
+}
+
+void Lowering::lower_func(const Parsed::Func& func, Ir::Function& function)
+{
+    begin_function(function);
+    m_position = function.position;
+    if (func.return_type)
+        m_return_type = Checker::annotation(**func.return_type);
+    for (uint32_t i = 0; i < func.parameters.size(); i++) {
+        const auto variable = declare_local(*func.parameters[i]);
+        const auto value = emit(Op::Parameter);
+        value->index = i;
+        write_variable(
+            variable, m_block, guard(value, m_locals.back().type));
+    }
+    lower_tail(func.body());
+    function.sort_blocks();
+}
+
+void Lowering::lower_statement(const Parsed::Statement& statement)
+{
+    const auto outer_position = enter(statement);
+    lower_statement_kind(statement);
+    m_position = outer_position;
+}
+
+void Lowering::lower_statement_kind(const Parsed::Statement& statement)
+{
+    switch (statement.statement_type()) {
+    case Parsed::StatementType::Func:
+        error_and_exit("functions can only be declared at top level");
+    case Parsed::StatementType::Let:
+        return lower_let(static_cast<const Parsed::Let&>(statement));
+    case Parsed::StatementType::Assignment:
+        return lower_assignment(
+            static_cast<const Parsed::Assignment&>(statement));
+    case Parsed::StatementType::Expression:
+        lower_expression(
+            *static_cast<const Parsed::ExpressionStatement&>(statement)
+                 .expression);
+        return;
+    }
+    std::cerr << "internal: unexhaustive match at " << __FILE__ << ":"
+              << __LINE__ << ": in " << __func__ << "\n";
+    exit(1);
+}
+
+void Lowering::lower_let(const Parsed::Let& let)
+{
+    const auto value = let.value ? lower_expression(**let.value)
+                                 : constant(Value::make_unit());
+    const auto variable = declare_local(*let.parameter);
+    write_variable(variable, m_block, guard(value, m_locals.back().type));
+}
+
+void Lowering::lower_assignment(const Parsed::Assignment& assignment)
+{
+    if (assignment.target->expression_type()
+        == Parsed::ExpressionType::Index) {
+        const auto& target
+            = static_cast<const Parsed::Index&>(*assignment.target);
+        const auto array = lower_expression(*target.array);
+        const auto index = lower_expression(*target.index);
+        emit(Op::StoreIndex,
+            { array, index, lower_expression(*assignment.value) });
+        return;
+    }
+    if (assignment.target->expression_type() != Parsed::ExpressionType::Symbol)
+        error_and_exit("invalid assignment target");
+    const auto& name
+        = static_cast<const Parsed::Symbol&>(*assignment.target).value;
+    const auto value = lower_expression(*assignment.value);
+    if (const auto local = resolve_local(name)) {
+        if (!local->is_mutable)
+            error_and_exit("cannot assign twice to immutable `" + name + "`");
+        write_variable(local->variable, m_block, guard(value, local->type));
+    } else {
+        const auto mutability = m_global_mutability.find(name);
+        if (mutability != m_global_mutability.end() && !mutability->second)
+            error_and_exit("cannot assign twice to immutable `" + name + "`");
+        const auto type = m_global_types.find(name);
+        emit(Op::StoreGlobal,
+            { type == m_global_types.end() ? value
+                                           : guard(value, type->second) })
+            ->index
+            = global_index(name);
+    }
+}
+
+Ir::Instruction* Lowering::lower_expression(
+    const Parsed::Expression& expression)
+{
+    const auto outer_position = enter(expression);
+    const auto value = lower_expression_kind(expression);
+    if (!value->type)
+        value->type = expression.value_type;
+    m_position = outer_position;
+    return value;
+}
+
+Ir::Instruction* Lowering::lower_expression_kind(
+    const Parsed::Expression& expression)
+{
+    switch (expression.expression_type()) {
+    case Parsed::ExpressionType::If:
+        return lower_if(static_cast<const Parsed::If&>(expression));
+    case Parsed::ExpressionType::Match:
+        return lower_match(static_cast<const Parsed::Match&>(expression));
+    case Parsed::ExpressionType::Block:
+        return lower_block(static_cast<const Parsed::Block&>(expression));
+    case Parsed::ExpressionType::While:
+        return lower_while(static_cast<const Parsed::While&>(expression));
+    case Parsed::ExpressionType::Loop:
+        return lower_loop(static_cast<const Parsed::Loop&>(expression));
+    case Parsed::ExpressionType::For:
+        return lower_for(static_cast<const Parsed::For&>(expression));
+    case Parsed::ExpressionType::Break: return lower_loop_exit(true);
+    case Parsed::ExpressionType::Continue: return lower_loop_exit(false);
+    case Parsed::ExpressionType::BinaryOperation:
+        return lower_binary_operation(
+            static_cast<const Parsed::BinaryOperation&>(expression));
+    case Parsed::ExpressionType::UnaryOperation:
+        return lower_unary_operation(
+            static_cast<const Parsed::UnaryOperation&>(expression));
+    case Parsed::ExpressionType::Call:
+        return lower_call(static_cast<const Parsed::Call&>(expression));
+    case Parsed::ExpressionType::Index: {
+        const auto& index = static_cast<const Parsed::Index&>(expression);
+        const auto array = lower_expression(*index.array);
+        return emit(Op::Index, { array, lower_expression(*index.index) });
+    }
+    case Parsed::ExpressionType::Array: {
+        auto elements = std::vector<Ir::Instruction*> {};
+        for (const auto& element :
+            static_cast<const Parsed::Array&>(expression).elements)
+            elements.push_back(lower_expression(*element));
+        return emit(Op::NewArray, elements);
+    }
+    case Parsed::ExpressionType::Int:
+        return constant(Value::make_int(
+            static_cast<const Parsed::Int&>(expression).value));
+    case Parsed::ExpressionType::Float:
+        return constant(Value::make_float(
+            static_cast<const Parsed::Float&>(expression).value));
+    case Parsed::ExpressionType::Char:
+        return constant(Value::make_char(
+            static_cast<const Parsed::Char&>(expression).value));
+    case Parsed::ExpressionType::String:
+        return lower_string(static_cast<const Parsed::String&>(expression));
+    case Parsed::ExpressionType::Bool:
+        return constant(Value::make_bool(
+            static_cast<const Parsed::Bool&>(expression).value));
+    case Parsed::ExpressionType::Symbol:
+        return lower_symbol(static_cast<const Parsed::Symbol&>(expression));
+    }
+    std::cerr << "internal: unexhaustive match at " << __FILE__ << ":"
+              << __LINE__ << ": in " << __func__ << "\n";
+    exit(1);
+}
+
+void Lowering::lower_tail(const Parsed::Expression& expression)
+{
+    const auto outer_position = enter(expression);
+    lower_tail_kind(expression);
+    m_position = outer_position;
+}
+
+void Lowering::lower_tail_kind(const Parsed::Expression& expression)
+{
+    switch (expression.expression_type()) {
+    case Parsed::ExpressionType::If: {
+        const auto& if_ = static_cast<const Parsed::If&>(expression);
+        const auto condition = lower_expression(*if_.condition);
+        const auto truthy = m_function->create_block();
+        const auto falsy = m_function->create_block();
+        branch(condition, truthy, falsy);
+        seal_block(truthy);
+        seal_block(falsy);
+        m_block = truthy;
+        lower_tail(*if_.body_truthy);
+        m_block = falsy;
+        if (if_.body_falsy)
+            lower_tail(**if_.body_falsy);
+        else
+            emit(Op::Return, { constant(Value::make_unit()) });
+        m_block = nullptr;
+        return;
+    }
+    case Parsed::ExpressionType::Match: {
+        const auto& match = static_cast<const Parsed::Match&>(expression);
+        const auto value = lower_expression(*match.value);
+        auto no_arm = static_cast<Ir::Block*>(nullptr);
+        const auto bodies = lower_match_tests(match, value, no_arm);
+        for (size_t i = 0; i < bodies.size(); i++) {
+            if (!bodies[i])
+                continue;
+            m_block = bodies[i];
+            begin_match_arm(*match.arms[i], value);
+            lower_tail(*match.arms[i]->body);
+            end_scope();
+        }
+        if (no_arm) {
+            m_block = no_arm;
+            emit(Op::Return, { constant(Value::make_unit()) });
+        }
+        m_block = nullptr;
+        return;
+    }
+    case Parsed::ExpressionType::Block: {
+        const auto& block = static_cast<const Parsed::Block&>(expression);
+        begin_scope();
+        for (const auto& statement : block.statements)
+            lower_statement(*statement);
+        if (block.value)
+            lower_tail(**block.value);
+        else
+            emit(Op::Return, { constant(Value::make_unit()) });
+        end_scope();
+        return;
+    }
+    default: break;
+    }
+    const auto value = lower_expression_kind(expression);
+    if (!value->type)
+        value->type = expression.value_type;
+    emit(Op::Return, { guard(value, m_return_type) });
+    m_block = nullptr;
+}
+
+Ir::Instruction* Lowering::lower_if(const Parsed::If& if_)
+{
+    const auto condition = lower_expression(*if_.condition);
+    const auto truthy = m_function->create_block();
+    const auto falsy = m_function->create_block();
+    const auto join = m_function->create_block();
+    branch(condition, truthy, falsy);
+    seal_block(truthy);
+    seal_block(falsy);
+    m_block = truthy;
+    const auto truthy_value = lower_block(*if_.body_truthy);
+    jump(join);
+    m_block = falsy;
+    const auto falsy_value = if_.body_falsy ? lower_block(**if_.body_falsy)
+                                            : constant(Value::make_unit());
+    jump(join);
+    seal_block(join);
+    m_block = join;
+    const auto phi = create_phi(join);
+    phi->operands = { truthy_value, falsy_value };
+    return try_remove_trivial_phi(phi);
+}
+
+Ir::Instruction* Lowering::lower_block(const Parsed::Block& block)
+{
+    begin_scope();
+    for (const auto& statement : block.statements)
+        lower_statement(*statement);
+    const auto value = block.value ? lower_expression(**block.value)
+                                   : constant(Value::make_unit());
+    end_scope();
+    return value;
+}
+
+Ir::Instruction* Lowering::lower_match(const Parsed::Match& match)
+{
+    const auto value = lower_expression(*match.value);
+    auto no_arm = static_cast<Ir::Block*>(nullptr);
+    const auto bodies = lower_match_tests(match, value, no_arm);
+    const auto join = m_function->create_block();
+    auto values = std::vector<Ir::Instruction*> {};
+    for (size_t i = 0; i < bodies.size(); i++) {
+        if (!bodies[i])
+            continue;
+        m_block = bodies[i];
+        begin_match_arm(*match.arms[i], value);
+        values.push_back(lower_expression(*match.arms[i]->body));
+        end_scope();
+        jump(join);
+    }
+    if (no_arm) {
+        m_block = no_arm;
+        values.push_back(constant(Value::make_unit()));
+        jump(join);
+    }
+    seal_block(join);
+    m_block = join;
+    const auto phi = create_phi(join);
+    phi->operands = values;
+    return try_remove_trivial_phi(phi);
+}
+
+// A single `Switch` on the distinct literals of the patterns picks the arms
+// which may match, its targets then test their guards in order. Backends
+// choose how to dispatch on the cases, so no chain of comparisons is built
+// here. Guards of arms matching several literals are lowered once per
+// literal, each arm's body only once.
+std::vector<Ir::Block*> Lowering::lower_match_tests(
+    const Parsed::Match& match, Ir::Instruction* value, Ir::Block*& no_arm)
+{
+    const auto& arms = match.arms;
+    auto literals = std::vector<Value> {};
+    auto arm_literals = std::vector<std::vector<Value>>(arms.size());
+    for (size_t i = 0; i < arms.size(); i++) {
+        for (const auto& pattern : arms[i]->patterns) {
+            const auto literal = pattern_value(*pattern);
+            arm_literals[i].push_back(literal);
+            if (std::none_of(literals.begin(), literals.end(),
+                    [&](const Value& other) {
+                        return Ir::matches_case(literal, other);
+                    }))
+                literals.push_back(literal);
+        }
+    }
+
+    auto bodies = std::vector<Ir::Block*>(arms.size(), nullptr);
+    no_arm = nullptr;
+    // tests the arms which may match `literal`, or any other value when
+    // unset, in the current block
+    const auto lower_tests = [&](const std::optional<Value>& literal) {
+        for (size_t i = 0; i < arms.size(); i++) {
+            const auto& arm = *arms[i];
+            const auto& patterns = arm_literals[i];
+            if (!patterns.empty()
+                && (!literal
+                    || std::none_of(patterns.begin(), patterns.end(),
+                        [&](const Value& pattern) {
+                            return Ir::matches_case(*literal, pattern);
+                        })))
+                continue;
+            if (!bodies[i])
+                bodies[i] = m_function->create_block();
+            if (!arm.guard) {
+                jump(bodies[i]);
+                return;
+            }
+            begin_match_arm(arm, value);
+            const auto condition = lower_expression(**arm.guard);
+            end_scope();
+            const auto next = m_function->create_block();
+            branch(condition, bodies[i], next);
+            seal_block(next);
+            m_block = next;
+        }
+        if (!no_arm)
+            no_arm = m_function->create_block();
+        jump(no_arm);
+    };
+
+    // a `Bool` known to be neither case is the other one, so its default
+    // tests the arms of the last case, which can then be dropped
+    auto default_literal = std::optional<Value> {};
+    if (match.value->value_type == ValueType::Bool && literals.size() == 2) {
+        default_literal = literals.back();
+        literals.pop_back();
+    }
+    if (literals.empty()) {
+        lower_tests(default_literal);
+    } else {
+        const auto switch_ = emit(Op::Switch, { value });
+        switch_->cases = literals;
+        for (size_t i = 0; i <= literals.size(); i++) {
+            switch_->targets.push_back(m_function->create_block());
+            add_edge(m_block, switch_->targets.back());
+        }
+        for (size_t i = 0; i <= literals.size(); i++) {
+            m_block = switch_->targets[i];
+            seal_block(m_block);
+            lower_tests(i < literals.size() ? std::optional(literals[i])
+                                            : default_literal);
+        }
+    }
+    for (const auto body : bodies)
+        if (body)
+            seal_block(body);
+    if (no_arm)
+        seal_block(no_arm);
+    return bodies;
+}
+
+void Lowering::begin_match_arm(
+    const Parsed::MatchArm& arm, Ir::Instruction* value)
+{
+    begin_scope();
+    if (arm.binding)
+        write_variable(
+            declare_local(*arm.binding, false, std::nullopt), m_block, value);
+}
+
+Value Lowering::pattern_value(const Parsed::Expression& pattern)
+{
+    switch (pattern.expression_type()) {
+    case Parsed::ExpressionType::Int:
+        return Value::make_int(static_cast<const Parsed::Int&>(pattern).value);
+    case Parsed::ExpressionType::Char:
+        return Value::make_char(
+            static_cast<const Parsed::Char&>(pattern).value);
+    case Parsed::ExpressionType::Bool:
+        return Value::make_bool(
+            static_cast<const Parsed::Bool&>(pattern).value);
+    case Parsed::ExpressionType::String:
+        return Value::make_string(String::intern(
+            static_cast<const Parsed::String&>(pattern).value));
+    default: break;
+    }
+    std::cerr << "internal: unexhaustive match at " << __FILE__ << ":"
+              << __LINE__ << ": in " << __func__ << "\n";
+    exit(1);
+}
+
+// the header is sealed once the body has jumped back to it, the exit once
+// every `break` has jumped to it
+Ir::Instruction* Lowering::lower_while(const Parsed::While& while_)
+{
+    const auto header = m_function->create_block();
+    const auto body = m_function->create_block();
+    const auto exit = m_function->create_block();
+    jump(header);
+    m_block = header;
+    branch(lower_expression(*while_.condition), body, exit);
+    seal_block(body);
+    m_block = body;
+    m_loops.push_back({ header, exit });
+    lower_block(*while_.body);
+    m_loops.pop_back();
+    jump(header);
+    seal_block(header);
+    seal_block(exit);
+    m_block = exit;
+    return constant(Value::make_unit());
+}
+
+Ir::Instruction* Lowering::lower_loop(const Parsed::Loop& loop)
+{
+    const auto header = m_function->create_block();
+    const auto exit = m_function->create_block();
+    jump(header);
+    m_block = header;
+    m_loops.push_back({ header, exit });
+    lower_block(*loop.body);
+    m_loops.pop_back();
+    jump(header);
+    seal_block(header);
+    seal_block(exit);
+    m_block = exit;
+    return constant(Value::make_unit());
+}
+
+// A counted loop: the bounds are evaluated once, and the counter is an `Int`
+// variable of its own, incremented in the latch `continue` jumps to. The loop
+// variable is bound to the counter in each iteration, so nothing the body
+// does changes the iterations.
+Ir::Instruction* Lowering::lower_for(const Parsed::For& for_)
+{
+    const auto start = guard(lower_expression(*for_.start), ValueType::Int);
+    const auto end = guard(lower_expression(*for_.end), ValueType::Int);
+    const auto counter = m_variables_count++;
+    write_variable(counter, m_block, start);
+    const auto header = m_function->create_block();
+    const auto body = m_function->create_block();
+    const auto latch = m_function->create_block();
+    const auto exit = m_function->create_block();
+    jump(header);
+    m_block = header;
+    const auto index = read_variable(counter, header);
+    index->type = ValueType::Int;
+    const auto condition = emit(Op::LessThan, { index, end });
+    condition->type = ValueType::Bool;
+    branch(condition, body, exit);
+    seal_block(body);
+    m_block = body;
+    begin_scope();
+    write_variable(
+        declare_local(for_.name, false, ValueType::Int), m_block, index);
+    m_loops.push_back({ latch, exit });
+    lower_block(*for_.body);
+    m_loops.pop_back();
+    end_scope();
+    jump(latch);
+    seal_block(latch);
+    m_block = latch;
+    const auto next = emit(Op::Add,
+        { read_variable(counter, latch), constant(Value::make_int(1)) });
+    next->type = ValueType::Int;
+    write_variable(counter, latch, next);
+    jump(header);
+    seal_block(header);
+    seal_block(exit);
+    m_block = exit;
+    return constant(Value::make_unit());
+}
+
+Ir::Instruction* Lowering::lower_loop_exit(bool is_break)
+{
+    if (m_loops.empty())
+        error_and_exit(std::string("`") + (is_break ? "break" : "continue")
+            + "` outside of a loop");
+    const auto& loop = m_loops.back();
+    jump(is_break ? loop.break_target : loop.continue_target);
+    m_block = m_function->create_block();
+    seal_block(m_block);
+    return constant(Value::make_unit());
+}
+
+Ir::Instruction* Lowering::lower_binary_operation(
+    const Parsed::BinaryOperation& operation)
+{
+    if (operation.operator_ == Parsed::BinaryOperator::LogicalAnd
+        || operation.operator_ == Parsed::BinaryOperator::LogicalOr)
+        return lower_logical_operation(operation);
+    const auto left = lower_expression(*operation.left);
+    const auto right = lower_expression(*operation.right);
+    return emit(binary_operator_op(operation.operator_), { left, right });
+}
+
+Ir::Op Lowering::binary_operator_op(Parsed::BinaryOperator op)
+{
+    switch (op) {
+    case Parsed::BinaryOperator::Add: return Op::Add;
+    case Parsed::BinaryOperator::Subtract: return Op::Subtract;
+    case Parsed::BinaryOperator::Multiply: return Op::Multiply;
+    case Parsed::BinaryOperator::Divide: return Op::Divide;
+    case Parsed::BinaryOperator::Modulus: return Op::Modulus;
+    case Parsed::BinaryOperator::Exponentiate: return Op::Exponentiate;
+    case Parsed::BinaryOperator::BitwiseAnd: return Op::BitwiseAnd;
+    case Parsed::BinaryOperator::BitwiseOr: return Op::BitwiseOr;
+    case Parsed::BinaryOperator::BitwiseXor: return Op::BitwiseXor;
+    case Parsed::BinaryOperator::BitwiseLeftShift: return Op::BitwiseLeftShift;
+    case Parsed::BinaryOperator::BitwiseRightShift:
+        return Op::BitwiseRightShift;
+    case Parsed::BinaryOperator::LessThan: return Op::LessThan;
+    case Parsed::BinaryOperator::LessThanEqual: return Op::LessThanEqual;
+    case Parsed::BinaryOperator::GreaterThan: return Op::GreaterThan;
+    case Parsed::BinaryOperator::GreaterThanEqual:
+        return Op::GreaterThanEqual;
+    case Parsed::BinaryOperator::Equal: return Op::Equal;
+    case Parsed::BinaryOperator::NotEqual: return Op::NotEqual;
+    // lowered to branches
+    case Parsed::BinaryOperator::LogicalAnd:
+    case Parsed::BinaryOperator::LogicalOr: break;
+    }
+    std::cerr << "internal: unexhaustive match at " << __FILE__ << ":"
+              << __LINE__ << ": in " << __func__ << "\n";
+    exit(1);
+}
+
+Ir::Instruction* Lowering::lower_logical_operation(
+    const Parsed::BinaryOperation& operation)
+{
+    // like the VM, the left operand has to be a `Bool` and is the result
+    // when it decides the operation, the right operand is the result as is
+    const auto left = lower_expression(*operation.left);
+    const auto right_block = m_function->create_block();
+    const auto join = m_function->create_block();
+    if (operation.operator_ == Parsed::BinaryOperator::LogicalAnd)
+        branch(left, right_block, join);
+    else
+        branch(left, join, right_block);
+    seal_block(right_block);
+    m_block = right_block;
+    const auto right = lower_expression(*operation.right);
+    jump(join);
+    seal_block(join);
+    m_block = join;
+    const auto phi = create_phi(join);
+    phi->operands = { left, right };
+    return try_remove_trivial_phi(phi);
+}
+
+Ir::Instruction* Lowering::lower_unary_operation(
+    const Parsed::UnaryOperation& operation)
+{
+    const auto value = lower_expression(*operation.expression);
+    return emit(unary_operator_op(operation.operator_), { value });
+}
+
+Ir::Op Lowering::unary_operator_op(Parsed::UnaryOperator op)
+{
+    switch (op) {
+    case Parsed::UnaryOperator::LogicalNot: return Op::LogicalNot;
+    case Parsed::UnaryOperator::BitwiseNot: return Op::BitwiseNot;
+    case Parsed::UnaryOperator::Add: return Op::Plus;
+    case Parsed::UnaryOperator::Negate: return Op::Negate;
+    }
+    std::cerr << "internal: unexhaustive match at " << __FILE__ << ":"
+              << __LINE__ << ": in " << __func__ << "\n";
+    exit(1);
+}
+
+Ir::Instruction* Lowering::lower_call(const Parsed::Call& call)
+{
+    const auto global = [&]() -> std::optional<uint32_t> {
+        if (call.callee->expression_type() != Parsed::ExpressionType::Symbol)
+            return std::nullopt;
+        const auto& name = static_cast<const Parsed::Symbol&>(*call.callee);
+        if (resolve_local(name.value))
+            return std::nullopt;
+        return global_index(name.value);
+    }();
+    auto operands = std::vector<Ir::Instruction*> {};
+    if (!global)
+        operands.push_back(lower_expression(*call.callee));
+    for (const auto& arg : call.args)
+        operands.push_back(lower_expression(*arg));
+    if (!global)
+        return emit(Op::Call, operands);
+    const auto result = emit(Op::CallGlobal, operands);
+    result->index = *global;
+    return result;
+}
+
+Ir::Instruction* Lowering::lower_symbol(const Parsed::Symbol& symbol)
+{
+    if (const auto local = resolve_local(symbol.value))
+        return read_variable(local->variable, m_block);
+    const auto result = emit(Op::LoadGlobal);
+    result->index = global_index(symbol.value);
+    return result;
+}
+
+Ir::Instruction* Lowering::lower_string(const Parsed::String& string)
+{
+    return constant(Value::make_string(String::intern(string.value)));
+}
+
+Ir::Instruction* Lowering::constant(Value value)
+{
+    const auto result = emit(Op::Constant);
+    result->value = value;
+    result->type = value.type;
+    return result;
+}
+
+Ir::Instruction* Lowering::guard(
+    Ir::Instruction* value, std::optional<ValueType> type)
+{
+    if (!type || value->type == type)
+        return value;
+    const auto result = emit(Op::CheckType, { value });
+    result->type = type;
+    return result;
+}
+
+Ir::Instruction* Lowering::emit(
+    Ir::Op op, std::vector<Ir::Instruction*> operands)
+{
+    if (!m_block) {
+        const auto at = std::string { __FILE__ } + ":"
+            + std::to_string(__LINE__) + ": in " + __func__;
+        throw InternalError {
+            "internal: emitting into an unreachable block at " + at + "\n"
+        };
+    }
+    auto instruction = m_function->create(op);
+    instruction->operands = std::move(operands);
+    instruction->position = m_position;
+    return m_block->append(std::move(instruction));
+}
+
+void Lowering::jump(Ir::Block* target)
+{
+    emit(Op::Jump)->targets = { target };
+    add_edge(m_block, target);
+    m_block = nullptr;
+}
+
+void Lowering::branch(
+    Ir::Instruction* condition, Ir::Block* truthy, Ir::Block* falsy)
+{
+    emit(Op::Branch, { condition })->targets = { truthy, falsy };
+    add_edge(m_block, truthy);
+    add_edge(m_block, falsy);
+    m_block = nullptr;
+}
+
+void Lowering::add_edge(Ir::Block* from, Ir::Block* to)
+{
+    to->predecessors.push_back(from);
+}
+
+std::optional<Bytecode::SourcePosition> Lowering::enter(
+    const Parsed::Node& node)
+{
+    const auto outer_position = m_position;
+    if (node.pos)
+        m_position = source_position(node);
+    return outer_position;
+}
+
+Bytecode::SourcePosition Lowering::source_position(const Parsed::Node& node)
+{
+    if (!node.pos)
+        return {};
+    return {
+        static_cast<uint32_t>(node.pos->row),
+        static_cast<uint32_t>(node.pos->col),
+    };
+}
+
+uint32_t Lowering::declare_local(const Parsed::Parameter& parameter)
+{
+    return declare_local(parameter_name(parameter), parameter.is_mutable,
+        parameter.type ? std::optional(Checker::annotation(**parameter.type))
+                       : std::nullopt);
+}
+
+uint32_t Lowering::declare_local(
+    const std::string& name, bool is_mutable, std::optional<ValueType> type)
+{
+    const auto variable = m_variables_count++;
+    m_locals.push_back(Local { name, variable, is_mutable, type });
+    return variable;
+}
+
+std::optional<Lowering::Local> Lowering::resolve_local(
+    const std::string& name) const
+{
+    for (auto it = m_locals.rbegin(); it != m_locals.rend(); ++it)
+        if (it->name == name)
+            return *it;
+    return std::nullopt;
+}
+
+uint32_t Lowering::global_index(const std::string& name)
+{
+    auto& globals = m_module->globals;
+    const auto [entry, is_new] = m_global_indices.try_emplace(
+        name, static_cast<uint32_t>(globals.size()));
+    if (is_new)
+        globals.push_back(name);
+    return entry->second;
+}
+
+uint32_t Lowering::define_global(const Parsed::Parameter& parameter)
+{
+    const auto& name = parameter_name(parameter);
+    if (parameter.type)
+        m_global_types[name] = Checker::annotation(**parameter.type);
+    return define_global(name, parameter.is_mutable);
+}
+
+uint32_t Lowering::define_global(const std::string& name, bool is_mutable)
+{
+    m_global_mutability[name] = is_mutable;
+    return global_index(name);
+}
+
+const std::string& Lowering::parameter_name(const Parsed::Parameter& parameter)
+{
+    const auto& target = *parameter.target;
+    switch (target.parameter_target_type()) {
+    case Parsed::ParameterTargetType::Symbol:
+        return static_cast<const Parsed::SymbolTarget&>(target).value;
+    }
+    std::cerr << "internal: unexhaustive match at " << __FILE__ << ":"
+              << __LINE__ << ": in " << __func__ << "\n";
+    exit(1);
+}
+
+void Lowering::begin_scope() { m_scopes.push_back(m_locals.size()); }
+
+void Lowering::end_scope()
+{
+    m_locals.resize(m_scopes.back());
+    m_scopes.pop_back();
+}
+
+void Lowering::write_variable(
+    uint32_t variable, Ir::Block* block, Ir::Instruction* value)
+{
+    m_definitions[variable][block] = value;
+}
+
+Ir::Instruction* Lowering::read_variable(uint32_t variable, Ir::Block* block)
+{
+    const auto& definitions = m_definitions[variable];
+    const auto found = definitions.find(block);
+    if (found != definitions.end())
+        return found->second;
+    return read_variable_recursive(variable, block);
+}
+
+Ir::Instruction* Lowering::read_variable_recursive(
+    uint32_t variable, Ir::Block* block)
+{
+    auto value = static_cast<Ir::Instruction*>(nullptr);
+    if (!m_sealed.count(block)) {
+        value = create_phi(block);
+        m_incomplete_phis[block].push_back({ variable, value });
+    } else if (block->predecessors.size() == 1) {
+        value = read_variable(variable, block->predecessors.front());
+    } else {
+        // breaks cycles of reads through loops
+        const auto phi = create_phi(block);
+        write_variable(variable, block, phi);
+        value = add_phi_operands(variable, phi);
+    }
+    write_variable(variable, block, value);
+    return value;
+}
+
+Ir::Instruction* Lowering::add_phi_operands(
+    uint32_t variable, Ir::Instruction* phi)
+{
+    for (const auto predecessor : phi->block->predecessors)
+        phi->operands.push_back(read_variable(variable, predecessor));
+    return try_remove_trivial_phi(phi);
+}
+
+Ir::Instruction* Lowering::try_remove_trivial_phi(Ir::Instruction* phi)
+{
+    auto same = static_cast<Ir::Instruction*>(nullptr);
+    for (const auto operand : phi->operands) {
+        if (operand == same || operand == phi)
+            continue;
+        if (same)
+            return phi;
+        same = operand;
+    }
+    if (!same) {
+        // only reachable from blocks without predecessors
+        auto unit = m_function->create(Op::Constant);
+        unit->type = ValueType::Unit;
+        same = m_function->entry()->insert(
+            m_function->entry()->phis_count(), std::move(unit));
+    }
+
+    auto users = std::vector<Ir::Instruction*> {};
+    for (const auto& block : m_function->blocks) {
+        for (const auto& instruction : block->instructions) {
+            if (instruction.get() == phi)
+                continue;
+            auto used = false;
+            for (auto& operand : instruction->operands) {
+                if (operand == phi) {
+                    operand = same;
+                    used = true;
+                }
+            }
+            if (used && instruction->op == Op::Phi)
+                users.push_back(instruction.get());
+        }
+    }
+    for (auto& [variable, definitions] : m_definitions)
+        for (auto& [block, value] : definitions)
+            if (value == phi)
+                value = same;
+    m_replaced[phi] = same;
+    auto& instructions = phi->block->instructions;
+    const auto found = std::find_if(instructions.begin(), instructions.end(),
+        [&](const auto& instruction) { return instruction.get() == phi; });
+    m_removed_phis.push_back(std::move(*found));
+    instructions.erase(found);
+
+    for (const auto user : users)
+        if (!m_replaced.count(user))
+            try_remove_trivial_phi(user);
+    // `same` may have been removed as a trivial user in turn
+    while (m_replaced.count(same))
+        same = m_replaced.at(same);
+    return same;
+}
+
+Ir::Instruction* Lowering::create_phi(Ir::Block* block)
+{
+    return block->insert(block->phis_count(), m_function->create(Op::Phi));
+}
+
+void Lowering::seal_block(Ir::Block* block)
+{
+    const auto incomplete = m_incomplete_phis.find(block);
+    if (incomplete != m_incomplete_phis.end()) {
+        const auto phis = std::move(incomplete->second);
+        m_incomplete_phis.erase(incomplete);
+        for (const auto& [variable, phi] : phis)
+            add_phi_operands(variable, phi);
+    }
+    m_sealed.insert(block);
+}
+
+void Lowering::error_and_exit(const std::string& msg)
+{
+    throw CompileError { "CompilerError: " + msg + "\n" };
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "ir.h"
+#include "parser.h"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Lowers the AST to SSA form, see ir.h.
+//
+// Locals become SSA values directly, following Braun et al., "Simple and
+// Efficient Construction of Static Single Assignment Form": reading a local
+// looks up its definition in the current block and recursively in the
+// predecessors, placing phis where definitions meet. Blocks whose
+// predecessors aren't all known yet are unsealed, reads in them create
+// incomplete phis which are completed once the block is sealed.
+//
+// The checks which need scopes, e.g. assigning to immutable locals, are done
+// here and exit with a `CompilerError`. Values get the types `Checker` found
+// for their expressions, and values of unknown type flowing into annotations
+// are guarded with a `CheckType`.
+class Lowering {
+public:
+    Lowering() = default;
+
+    std::unique_ptr<Ir::Module> lower(const Parsed::Block& program);
+
+    static Ir::Op binary_operator_op(Parsed::BinaryOperator op);
+    static Ir::Op unary_operator_op(Parsed::UnaryOperator op);
+
+private:
+    struct Local {
+        std::string name;
+        uint32_t variable;
+        bool is_mutable;
+        // the annotated type
+        std::optional<ValueType> type;
+    };
+
+    // where `continue` and `break` jump to in the innermost loop
+    struct Loop {
+        Ir::Block* continue_target;
+        Ir::Block* break_target;
+    };
+
+    void begin_function(Ir::Function& function);
+    void lower_func(const Parsed::Func& func, Ir::Function& function);
+    void lower_statement(const Parsed::Statement& statement);
+    void lower_statement_kind(const Parsed::Statement& statement);
+    void lower_let(const Parsed::Let& let);
+    void lower_assignment(const Parsed::Assignment& assignment);
+    Ir::Instruction* lower_expression(const Parsed::Expression& expression);
+    Ir::Instruction* lower_expression_kind(
+        const Parsed::Expression& expression);
+    // lowers an expression whose value is returned from the function, so
+    // calls in tail position are directly followed by their `Return`
+    void lower_tail(const Parsed::Expression& expression);
+    void lower_tail_kind(const Parsed::Expression& expression);
+    Ir::Instruction* lower_if(const Parsed::If& if_);
+    Ir::Instruction* lower_match(const Parsed::Match& match);
+    // branches to the arms of the match, returning the blocks their bodies
+    // go in, nullptr for arms which are never taken, and setting `no_arm`
+    // to the block reached when none matches, if any
+    std::vector<Ir::Block*> lower_match_tests(const Parsed::Match& match,
+        Ir::Instruction* value, Ir::Block*& no_arm);
+    // binds the matched value in a new scope
+    void begin_match_arm(const Parsed::MatchArm& arm, Ir::Instruction* value);
+    Value pattern_value(const Parsed::Expression& pattern);
+    Ir::Instruction* lower_block(const Parsed::Block& block);
+    Ir::Instruction* lower_while(const Parsed::While& while_);
+    Ir::Instruction* lower_loop(const Parsed::Loop& loop);
+    Ir::Instruction* lower_for(const Parsed::For& for_);
+    // jumps out of the loop body, the code after it is unreachable
+    Ir::Instruction* lower_loop_exit(bool is_break);
+    Ir::Instruction* lower_binary_operation(
+        const Parsed::BinaryOperation& operation);
+    Ir::Instruction* lower_logical_operation(
+        const Parsed::BinaryOperation& operation);
+    Ir::Instruction* lower_unary_operation(
+        const Parsed::UnaryOperation& operation);
+    Ir::Instruction* lower_call(const Parsed::Call& call);
+    Ir::Instruction* lower_symbol(const Parsed::Symbol& symbol);
+    Ir::Instruction* lower_string(const Parsed::String& string);
+    Ir::Instruction* constant(Value value);
+    // fails at runtime unless `value` has the type, when it isn't known to
+    Ir::Instruction* guard(
+        Ir::Instruction* value, std::optional<ValueType> type);
+    Ir::Instruction* emit(
+        Ir::Op op, std::vector<Ir::Instruction*> operands = {});
+    void jump(Ir::Block* target);
+    void branch(
+        Ir::Instruction* condition, Ir::Block* truthy, Ir::Block* falsy);
+    void add_edge(Ir::Block* from, Ir::Block* to);
+    // instructions emitted while lowering `node` are attributed to its
+    // position, returns the position to restore afterwards
+    std::optional<Bytecode::SourcePosition> enter(const Parsed::Node& node);
+    Bytecode::SourcePosition source_position(const Parsed::Node& node);
+
+    uint32_t declare_local(const Parsed::Parameter& parameter);
+    uint32_t declare_local(const std::string& name, bool is_mutable,
+        std::optional<ValueType> type);
+    std::optional<Local> resolve_local(const std::string& name) const;
+    uint32_t global_index(const std::string& name);
+    uint32_t define_global(const Parsed::Parameter& parameter);
+    uint32_t define_global(const std::string& name, bool is_mutable);
+    const std::string& parameter_name(const Parsed::Parameter& parameter);
+    void begin_scope();
+    void end_scope();
+
+    void write_variable(
+        uint32_t variable, Ir::Block* block, Ir::Instruction* value);
+    Ir::Instruction* read_variable(uint32_t variable, Ir::Block* block);
+    Ir::Instruction* read_variable_recursive(
+        uint32_t variable, Ir::Block* block);
+    Ir::Instruction* add_phi_operands(uint32_t variable, Ir::Instruction* phi);
+    Ir::Instruction* try_remove_trivial_phi(Ir::Instruction* phi);
+    Ir::Instruction* create_phi(Ir::Block* block);
+    void seal_block(Ir::Block* block);
+    // throws a `CompileError`
+    [[noreturn]] void error_and_exit(const std::string& msg);
+
+    std::unique_ptr<Ir::Module> m_module {};
+    Ir::Function* m_function { nullptr };
+    // nullptr after a terminator, until the next block is started
+    Ir::Block* m_block { nullptr };
+    std::vector<Local> m_locals {};
+    std::vector<size_t> m_scopes {};
+    std::vector<Loop> m_loops {};
+    std::optional<Bytecode::SourcePosition> m_position {};
+    std::unordered_map<std::string, bool> m_global_mutability {};
+    // indices of the names in the module's globals
+    std::unordered_map<std::string, uint32_t> m_global_indices {};
+    // annotated types of top level lets
+    std::unordered_map<std::string, ValueType> m_global_types {};
+    // annotated return type of the function being lowered
+    std::optional<ValueType> m_return_type {};
+
+    // SSA construction state of the function being lowered
+    uint32_t m_variables_count { 0 };
+    std::unordered_map<uint32_t,
+        std::unordered_map<const Ir::Block*, Ir::Instruction*>>
+        m_definitions {};
+    std::unordered_set<const Ir::Block*> m_sealed {};
+    std::unordered_map<const Ir::Block*,
+        std::vector<std::pair<uint32_t, Ir::Instruction*>>>
+        m_incomplete_phis {};
+    // removed trivial phis and the values they were replaced with
+    std::unordered_map<const Ir::Instruction*, Ir::Instruction*>
+        m_replaced {};
+    // the removed phis themselves, kept so their addresses aren't reused
+    std::vector<std::unique_ptr<Ir::Instruction>> m_removed_phis {};
+};
@@ -1,42 +1,32 @@
-#include "lexer.h"
-#include "parser.h"
-#include <fstream>
+#include "driver.h"
+#include "error.h"
+#include "server.h"
 #include <iostream>
-#include <iterator>
-#include <memory>
-#include <optional>
-#include <sstream>
-
-std::string read_file_to_string(std::string filename)
-{
-    std::ifstream file(filename);
-    if (!file.is_open()) {
-        std::cout << "error: file \"" << filename << "\" could not be opened\n";
-        exit(1);
-    }
-    std::ostringstream ss {};
-    ss << file.rdbuf();
-    return ss.str();
-}
+#include <string>
+#include <vector>
 
 int main(int argc, char** argv)
 {
-    // auto text = read_file_to_string("../examples/test.lpl");
-    if (argc < 2) {
-        std::cerr << "fatal: lack of args :(\n"
-                  << "USAGE: lpl <file>\n";
-        exit(1);
+    auto args = std::vector<std::string>(argv + 1, argv + argc);
+    if (!args.empty() && args.front().rfind("--server", 0) == 0)
+        return CompileServer(socket_path(args.front())).serve();
+    if (!args.empty() && args.front().rfind("--client", 0) == 0) {
+        const auto path = socket_path(args.front());
+        args.erase(args.begin());
+        // without a server the invocation is handled here
+        if (const auto status = forward_to_server(path, args))
+            return *status;
+    }
+    auto options = Options {};
+    try {
+        options = parse_options(args);
+    } catch (const CompileError& error) {
+        std::cerr << error.what();
+        return 1;
     }
-    auto text = read_file_to_string(argv[1]);
-    std::cout << "Tokenizing\n";
-    auto lexer = Lexer(text);
-    auto tokens = lexer.tokenize();
-    std::cout << "Lexer yeilded " << tokens.size() << " tokens\n";
-    for (auto& t : tokens) {
-        std::cout << "\t" << t.to_string() << "\n";
+    if (options.inputs.empty()) {
+        write_usage(std::cerr);
+        return 1;
     }
-    std::cout << "Parsing\n";
-    auto parser = Parser(tokens);
-    auto ast = parser.parse_expression();
-    std::cout << ast->to_string() << "\n";
+    return drive(options);
 }
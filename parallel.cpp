@@ -0,0 +1,95 @@
+#include "parallel.h"
+#include "report.h"
+#include <algorithm>
+#include <cstdlib>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace Parallel {
+
+namespace {
+
+    // the indices from `begin` up to `end` which are left to a thread
+    struct Share {
+        std::mutex mutex {};
+        size_t begin { 0 };
+        size_t end { 0 };
+    };
+
+    std::optional<size_t> take(std::vector<Share>& shares, size_t thread)
+    {
+        auto& own = shares[thread];
+        {
+            const auto lock = std::lock_guard { own.mutex };
+            if (own.begin < own.end)
+                return own.begin++;
+        }
+        for (size_t i = 1; i < shares.size(); i++) {
+            auto& victim = shares[(thread + i) % shares.size()];
+            auto stolen_begin = size_t { 0 };
+            auto stolen_end = size_t { 0 };
+            {
+                const auto lock = std::lock_guard { victim.mutex };
+                if (victim.begin >= victim.end)
+                    continue;
+                stolen_begin = victim.begin + (victim.end - victim.begin) / 2;
+                stolen_end = victim.end;
+                victim.end = stolen_begin;
+            }
+            // the first stolen index is run right away, other threads
+            // looking for work in the meantime find the rest
+            const auto lock = std::lock_guard { own.mutex };
+            own.begin = stolen_begin + 1;
+            own.end = stolen_end;
+            return stolen_begin;
+        }
+        return std::nullopt;
+    }
+
+}
+
+size_t default_threads()
+{
+    if (const auto value = std::getenv("LPL_THREADS"))
+        return std::max(std::strtoull(value, nullptr, 10), 1ull);
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+void for_each(
+    size_t count, size_t threads, const std::function<void(size_t)>& task)
+{
+    threads = std::min(threads, count);
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; i++)
+            task(i);
+        return;
+    }
+    auto shares = std::vector<Share>(threads);
+    for (size_t i = 0; i < threads; i++) {
+        shares[i].begin = count * i / threads;
+        shares[i].end = count * (i + 1) / threads;
+    }
+    const auto work = [&](size_t thread) {
+        while (const auto index = take(shares, thread))
+            task(*index);
+    };
+    // what the workers used is accounted to the calling thread
+    auto usages = std::vector<Report::Usage>(threads);
+    auto workers = std::vector<std::thread> {};
+    for (size_t i = 1; i < threads; i++) {
+        workers.emplace_back([&, i]() {
+            const auto start = Report::usage();
+            work(i);
+            usages[i] = Report::usage() - start;
+        });
+    }
+    work(0);
+    for (auto& worker : workers)
+        worker.join();
+    for (const auto& usage : usages)
+        Report::inherit(usage);
+}
+
+}
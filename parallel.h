@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+// A work-stealing loop over independent tasks.
+//
+// Each thread starts with a contiguous share of the task indices and takes
+// them from the front. Once it runs out it steals the back half of the share
+// of another thread, so tasks of uneven size are still spread over all of
+// them. The calling thread is one of the threads.
+//
+// `LPL_THREADS` sets how many threads are used by default, otherwise it is
+// the number of hardware threads.
+namespace Parallel {
+
+size_t default_threads();
+
+// runs `task` on each index below `count`, on up to `threads` threads, and
+// returns once all of them are done
+void for_each(
+    size_t count, size_t threads, const std::function<void(size_t)>& task);
+
+}
@@ -1,20 +1,292 @@
 #include "parser.h"
+#include "error.h"
 #include "lexer.h"
+#include "parallel.h"
+#include <charconv>
+#include <cmath>
 #include <cstddef>
+#include <cstdlib>
 #include <exception>
 #include <iostream>
 #include <memory>
 #include <optional>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
-// ParsedNode Parser::parse() {
+std::unique_ptr<Parsed::Block> Parser::parse()
+{
+    const auto pos = current().pos;
+    auto statements = std::vector<std::unique_ptr<Parsed::Statement>> {};
+    auto value
+        = std::optional<std::unique_ptr<Parsed::Expression>> { std::nullopt };
+    const auto threads = Parallel::default_threads();
+    if (threads > 1 && m_tokens.size() - m_index >= min_parallel_tokens)
+        parse_in_parallel(threads, statements, value);
+    else
+        parse_items(m_tokens.size(), statements, value);
+    auto program = at(pos,
+        std::make_unique<Parsed::Block>(
+            std::move(statements), std::move(value)));
+    if (!m_strict)
+        remove_unreferenced_funcs(*program);
+    return program;
+}
+
+void Parser::parse_items(size_t end,
+    std::vector<std::unique_ptr<Parsed::Statement>>& statements,
+    std::optional<std::unique_ptr<Parsed::Expression>>& value)
+{
+    while (!done() && m_index < end
+        && current().type != TokenType::EndOfFile) {
+        if (current().type == TokenType::Func) {
+            const auto begin = m_index;
+            statements.push_back(parse_func());
+            m_func_ranges.emplace_back(begin, m_index);
+        } else {
+            parse_statement(statements, value, TokenType::EndOfFile);
+        }
+    }
+}
+
+std::vector<size_t> Parser::top_level_items() const
+{
+    auto items = std::vector<size_t> { m_index };
+    auto depth = size_t { 0 };
+    for (auto i = m_index;
+         i < m_tokens.size() && m_tokens[i].type != TokenType::EndOfFile;
+         i++) {
+        switch (m_tokens[i].type) {
+        case TokenType::LBrace: depth++; break;
+        case TokenType::RBrace:
+            if (depth > 0)
+                depth--;
+            break;
+        case TokenType::Semicolon:
+            if (depth == 0)
+                items.push_back(i + 1);
+            break;
+        case TokenType::Func:
+            if (depth == 0 && items.back() != i)
+                items.push_back(i);
+            break;
+        default: break;
+        }
+    }
+    return items;
+}
+
+void Parser::parse_in_parallel(size_t threads,
+    std::vector<std::unique_ptr<Parsed::Statement>>& statements,
+    std::optional<std::unique_ptr<Parsed::Expression>>& value)
+{
+    struct Chunk {
+        size_t begin, end;
+        std::vector<std::unique_ptr<Parsed::Statement>> statements {};
+        std::optional<std::unique_ptr<Parsed::Expression>> value {};
+        std::vector<std::pair<size_t, size_t>> func_ranges {};
+        size_t nodes_count { 0 };
+        std::optional<CompileError> error {};
+    };
+    // a few chunks of about the same number of tokens per thread, so the
+    // threads which are done early have some to steal
+    const auto chunk_size
+        = (m_tokens.size() - m_index) / (threads * chunks_per_thread) + 1;
+    auto chunks = std::vector<Chunk> {};
+    for (const auto item : top_level_items()) {
+        if (!chunks.empty() && item - chunks.back().begin < chunk_size)
+            continue;
+        if (!chunks.empty())
+            chunks.back().end = item;
+        chunks.push_back({ item, m_tokens.size() });
+    }
+    Parallel::for_each(chunks.size(), threads, [&](size_t i) {
+        auto& chunk = chunks[i];
+        auto parser = Parser(m_tokens, m_strict);
+        parser.m_index = chunk.begin;
+        try {
+            parser.parse_items(chunk.end, chunk.statements, chunk.value);
+        } catch (const CompileError& error) {
+            chunk.error = error;
+        }
+        chunk.func_ranges = std::move(parser.m_func_ranges);
+        chunk.nodes_count = parser.m_nodes_count;
+    });
+    // merged in source order, so the first error in the source is reported
+    for (auto& chunk : chunks) {
+        if (chunk.error)
+            throw *chunk.error;
+        for (auto& statement : chunk.statements)
+            statements.push_back(std::move(statement));
+        if (chunk.value)
+            value = std::move(chunk.value);
+        m_func_ranges.insert(m_func_ranges.end(), chunk.func_ranges.begin(),
+            chunk.func_ranges.end());
+        m_nodes_count += chunk.nodes_count;
+    }
+    m_index = chunks.back().end;
+}
+
+Parsed::Block& Parsed::Func::body()
+{
+    return const_cast<Block&>(std::as_const(*this).body());
+}
+
+const Parsed::Block& Parsed::Func::body() const
+{
+    if (!m_body) {
+        m_body = Parser(*body_tokens->tokens)
+                     .parse_block_at(body_tokens->begin);
+    }
+    return *m_body;
+}
+
+std::unique_ptr<Parsed::Block> Parser::parse_block_at(size_t index)
+{
+    m_index = index;
+    return parse_block();
+}
+
+void Parser::remove_unreferenced_funcs(Parsed::Block& program) const
+{
+    auto funcs = std::unordered_map<std::string,
+        std::vector<const Parsed::Func*>> {};
+    for (const auto& statement : program.statements) {
+        if (statement->statement_type() == Parsed::StatementType::Func) {
+            const auto& func = static_cast<const Parsed::Func&>(*statement);
+            funcs[func.name].push_back(&func);
+        }
+    }
+    // any name token counts as a reference, even when a local shadows the
+    // function
+    auto referenced = std::unordered_set<const Parsed::Func*> {};
+    auto pending = std::vector<const Parsed::Func*> {};
+    const auto reference_names = [&](size_t begin, size_t end) {
+        for (auto i = begin; i < end; i++) {
+            if (m_tokens[i].type != TokenType::Name)
+                continue;
+            const auto found = funcs.find(m_tokens[i].value);
+            if (found == funcs.end())
+                continue;
+            for (const auto func : found->second) {
+                if (referenced.insert(func).second)
+                    pending.push_back(func);
+            }
+        }
+    };
+    auto begin = size_t { 0 };
+    for (const auto& [func_begin, func_end] : m_func_ranges) {
+        reference_names(begin, func_begin);
+        begin = func_end;
+    }
+    reference_names(begin, m_tokens.size());
+    while (!pending.empty()) {
+        const auto func = pending.back();
+        pending.pop_back();
+        reference_names(func->body_tokens->begin, func->body_tokens->end);
+    }
+    std::erase_if(program.statements, [&](const auto& statement) {
+        return statement->statement_type() == Parsed::StatementType::Func
+            && !referenced.contains(
+                static_cast<const Parsed::Func*>(statement.get()));
+    });
+}
+
+void Parser::parse_statements(
+    std::vector<std::unique_ptr<Parsed::Statement>>& statements,
+    std::optional<std::unique_ptr<Parsed::Expression>>& value, TokenType end)
+{
+    while (!done() && current().type != end) {
+        if (current().type == TokenType::Func && end == TokenType::EndOfFile)
+            return;
+        parse_statement(statements, value, end);
+    }
+}
+
+void Parser::parse_statement(
+    std::vector<std::unique_ptr<Parsed::Statement>>& statements,
+    std::optional<std::unique_ptr<Parsed::Expression>>& value, TokenType end)
+{
+    if (auto statement = maybe_parse_let()) {
+        statements.push_back(std::move(*statement));
+        if (current().type != TokenType::Semicolon)
+            error_and_exit("expected `;`");
+        step();
+    } else if (auto statement = maybe_parse_assignment()) {
+        statements.push_back(std::move(*statement));
+        if (current().type != TokenType::Semicolon)
+            error_and_exit("expected `;`");
+        step();
+    } else {
+        const auto pos = current().pos;
+        auto expression = parse_expression();
+        if (current().type == TokenType::Semicolon) {
+            statements.push_back(at(pos,
+                std::make_unique<Parsed::ExpressionStatement>(
+                    std::move(expression))));
+            step();
+        } else if (current().type == end) {
+            value = std::move(expression);
+        } else if (end == TokenType::RBrace) {
+            error_and_exit("expected `;` or `}`");
+        } else {
+            error_and_exit("expected `;` or end of file");
+        }
+    }
+}
 
-// }
+std::unique_ptr<Parsed::Func> Parser::parse_func()
+{
+    const auto pos = current().pos;
+    step();
+    if (current().type != TokenType::Name)
+        error_and_exit("expected function name");
+    const auto name = current().value;
+    step();
+    if (current().type != TokenType::LParen)
+        error_and_exit("expected `(`");
+    step();
+    auto parameters = std::vector<std::unique_ptr<Parsed::Parameter>> {};
+    while (!done() && current().type != TokenType::RParen) {
+        parameters.push_back(parse_parameter());
+        if (current().type == TokenType::RParen)
+            break;
+        else if (current().type != TokenType::Comma)
+            error_and_exit("expected `,` or `)`");
+        step();
+    }
+    if (current().type != TokenType::RParen)
+        error_and_exit("expected `)`");
+    step();
+    auto return_type = [&]() -> std::optional<std::unique_ptr<Parsed::Type>> {
+        if (current().type == TokenType::ThinArrow) {
+            step();
+            return std::optional { parse_type() };
+        } else {
+            return std::nullopt;
+        }
+    }();
+    if (current().type != TokenType::LBrace)
+        error_and_exit("expected `{`");
+    if (m_strict) {
+        auto body = parse_block();
+        return at(pos,
+            std::make_unique<Parsed::Func>(name, std::move(parameters),
+                std::move(return_type), std::move(body)));
+    }
+    const auto body_tokens = skip_block();
+    return at(pos,
+        std::make_unique<Parsed::Func>(name, std::move(parameters),
+            std::move(return_type), body_tokens));
+}
 
 std::optional<std::unique_ptr<Parsed::Let>> Parser::maybe_parse_let()
 {
     if (done() || current().type != TokenType::Let)
         return std::nullopt;
+    const auto pos = current().pos;
     step();
     auto parameter = parse_parameter();
     auto value = [&]() -> std::optional<std::unique_ptr<Parsed::Expression>> {
@@ -25,8 +297,8 @@ std::optional<std::unique_ptr<Parsed::Let>> Parser::maybe_parse_let()
             return std::nullopt;
         }
     }();
-    return std::make_unique<Parsed::Let>(
-        std::move(parameter), std::move(value));
+    return at(pos,
+        std::make_unique<Parsed::Let>(std::move(parameter), std::move(value)));
 }
 
 std::unique_ptr<Parsed::Parameter> Parser::parse_parameter()
@@ -43,6 +315,7 @@ std::unique_ptr<Parsed::Parameter> Parser::parse_parameter()
         if (!done() && current().type == TokenType::Name) {
             const auto identifier = current().value;
             step();
+            m_nodes_count++;
             return std::make_unique<Parsed::SymbolTarget>(identifier);
         } else {
             error_and_exit("expected parameter target");
@@ -58,6 +331,7 @@ std::unique_ptr<Parsed::Parameter> Parser::parse_parameter()
         }
     }();
 
+    m_nodes_count++;
     return std::make_unique<Parsed::Parameter>(
         std::move(target), std::move(type), is_mutable);
 }
@@ -76,9 +350,10 @@ std::optional<std::unique_ptr<Parsed::SymbolType>>
 Parser::maybe_parse_symbol_type()
 {
     if (!done() && current().type == TokenType::Name) {
+        const auto pos = current().pos;
         const auto value = current().value;
         step();
-        return std::make_unique<Parsed::SymbolType>(value);
+        return at(pos, std::make_unique<Parsed::SymbolType>(value));
     } else {
         return std::nullopt;
     }
@@ -88,12 +363,14 @@ std::optional<std::unique_ptr<Parsed::Assignment>>
 Parser::maybe_parse_assignment()
 {
     const auto original_index = m_index;
+    const auto pos = current().pos;
     auto target = parse_expression();
     if (current().type == TokenType::AssignEqual) {
         step();
         auto value = parse_expression();
-        return std::make_unique<Parsed::Assignment>(
-            std::move(target), std::move(value));
+        return at(pos,
+            std::make_unique<Parsed::Assignment>(
+                std::move(target), std::move(value)));
     } else {
         m_index = original_index;
         return std::nullopt;
@@ -104,6 +381,20 @@ std::unique_ptr<Parsed::Expression> Parser::parse_expression()
 {
     switch (current().type) {
     case TokenType::If: return parse_if();
+    case TokenType::Match: return parse_match();
+    case TokenType::While: return parse_while();
+    case TokenType::Loop: return parse_loop();
+    case TokenType::For: return parse_for();
+    case TokenType::Break: {
+        const auto pos = current().pos;
+        step();
+        return at(pos, std::make_unique<Parsed::Break>());
+    }
+    case TokenType::Continue: {
+        const auto pos = current().pos;
+        step();
+        return at(pos, std::make_unique<Parsed::Continue>());
+    }
     case TokenType::LBrace: return parse_block();
     default: return parse_binary_operation();
     }
@@ -111,6 +402,7 @@ std::unique_ptr<Parsed::Expression> Parser::parse_expression()
 
 std::unique_ptr<Parsed::If> Parser::parse_if()
 {
+    const auto pos = current().pos;
     step();
     auto condition = parse_expression();
     auto body_truthy = parse_block();
@@ -122,46 +414,162 @@ std::unique_ptr<Parsed::If> Parser::parse_if()
             return std::nullopt;
         }
     }();
-    return std::make_unique<Parsed::If>(
-        std::move(condition), std::move(body_truthy), std::move(body_falsy));
+    return at(pos,
+        std::make_unique<Parsed::If>(std::move(condition),
+            std::move(body_truthy), std::move(body_falsy)));
 }
 
-std::unique_ptr<Parsed::Block> Parser::parse_block()
+std::unique_ptr<Parsed::Match> Parser::parse_match()
 {
+    const auto pos = current().pos;
     step();
-    auto statements = std::vector<std::unique_ptr<Parsed::Statement>> {};
-    auto value
-        = std::optional<std::unique_ptr<Parsed::Expression>> { std::nullopt };
+    auto value = parse_expression();
+    if (current().type != TokenType::LBrace)
+        error_and_exit("expected `{`");
+    step();
+    auto arms = std::vector<std::unique_ptr<Parsed::MatchArm>> {};
     while (!done() && current().type != TokenType::RBrace) {
-        if (auto statement = maybe_parse_let()) {
-            statements.push_back(std::move(*statement));
-            if (current().type != TokenType::Semicolon)
-                error_and_exit("expected `;`");
-            step();
-        } else if (auto statement = maybe_parse_assignment()) {
-            statements.push_back(std::move(*statement));
-            if (current().type != TokenType::Semicolon)
-                error_and_exit("expected `;`");
+        arms.push_back(parse_match_arm());
+        if (current().type == TokenType::RBrace)
+            break;
+        else if (current().type != TokenType::Comma)
+            error_and_exit("expected `,` or `}`");
+        step();
+    }
+    if (current().type != TokenType::RBrace)
+        error_and_exit("expected `}`");
+    step();
+    return at(pos,
+        std::make_unique<Parsed::Match>(std::move(value), std::move(arms)));
+}
+
+std::unique_ptr<Parsed::MatchArm> Parser::parse_match_arm()
+{
+    const auto pos = current().pos;
+    auto patterns = std::vector<std::unique_ptr<Parsed::Expression>> {};
+    auto binding = std::optional<std::string> {};
+    if (current().type == TokenType::Name) {
+        if (current().value != "_")
+            binding = current().value;
+        step();
+    } else {
+        patterns.push_back(parse_pattern());
+        while (current().type == TokenType::BitwiseOr) {
             step();
-        } else {
-            auto expression = parse_expression();
-            if (current().type == TokenType::Semicolon) {
-                statements.push_back(
-                    std::make_unique<Parsed::ExpressionStatement>(
-                        std::move(expression)));
-                step();
-            } else if (current().type == TokenType::RBrace) {
-                value = std::move(expression);
-            } else {
-                error_and_exit("expected `;` or `}`");
-            }
+            patterns.push_back(parse_pattern());
         }
     }
+    auto guard = std::optional<std::unique_ptr<Parsed::Expression>> {};
+    if (current().type == TokenType::If) {
+        step();
+        guard = parse_expression();
+    }
+    if (current().type != TokenType::FatArrow)
+        error_and_exit("expected `=>`");
+    step();
+    auto body = parse_expression();
+    return at(pos,
+        std::make_unique<Parsed::MatchArm>(std::move(patterns),
+            std::move(binding), std::move(guard), std::move(body)));
+}
+
+std::unique_ptr<Parsed::Expression> Parser::parse_pattern()
+{
+    switch (current().type) {
+    case TokenType::Int: return parse_int();
+    case TokenType::Char: return parse_char();
+    case TokenType::String: return parse_string();
+    case TokenType::True:
+    case TokenType::False: return parse_bool();
+    case TokenType::Minus: {
+        const auto pos = current().pos;
+        step();
+        if (current().type != TokenType::Int)
+            error_and_exit("expected integer after `-` in pattern");
+        const auto value = int_value(current(), true);
+        step();
+        return at(pos, std::make_unique<Parsed::Int>(value));
+    }
+    default: error_and_exit("expected pattern");
+    }
+}
+
+std::unique_ptr<Parsed::While> Parser::parse_while()
+{
+    const auto pos = current().pos;
+    step();
+    auto condition = parse_expression();
+    if (current().type != TokenType::LBrace)
+        error_and_exit("expected `{`");
+    auto body = parse_block();
+    return at(pos,
+        std::make_unique<Parsed::While>(std::move(condition), std::move(body)));
+}
+
+std::unique_ptr<Parsed::Loop> Parser::parse_loop()
+{
+    const auto pos = current().pos;
+    step();
+    if (current().type != TokenType::LBrace)
+        error_and_exit("expected `{`");
+    return at(pos, std::make_unique<Parsed::Loop>(parse_block()));
+}
+
+std::unique_ptr<Parsed::For> Parser::parse_for()
+{
+    const auto pos = current().pos;
+    step();
+    if (current().type != TokenType::Name)
+        error_and_exit("expected loop variable");
+    const auto name = current().value;
+    step();
+    if (current().type != TokenType::In)
+        error_and_exit("expected `in`");
+    step();
+    auto start = parse_expression();
+    if (current().type != TokenType::DotDot)
+        error_and_exit("expected `..`");
+    step();
+    auto end = parse_expression();
+    if (current().type != TokenType::LBrace)
+        error_and_exit("expected `{`");
+    auto body = parse_block();
+    return at(pos,
+        std::make_unique<Parsed::For>(
+            name, std::move(start), std::move(end), std::move(body)));
+}
+
+std::unique_ptr<Parsed::Block> Parser::parse_block()
+{
+    const auto pos = current().pos;
+    step();
+    auto statements = std::vector<std::unique_ptr<Parsed::Statement>> {};
+    auto value
+        = std::optional<std::unique_ptr<Parsed::Expression>> { std::nullopt };
+    parse_statements(statements, value, TokenType::RBrace);
     if (done() || current().type != TokenType::RBrace)
         error_and_exit("expected `}`");
     step();
-    return std::make_unique<Parsed::Block>(
-        std::move(statements), std::move(value));
+    return at(pos,
+        std::make_unique<Parsed::Block>(
+            std::move(statements), std::move(value)));
+}
+
+// the pre-parser, which only matches the braces
+Parsed::TokenRange Parser::skip_block()
+{
+    const auto begin = m_index;
+    auto depth = size_t { 0 };
+    do {
+        if (done() || current().type == TokenType::EndOfFile)
+            error_and_exit("expected `}`");
+        if (current().type == TokenType::LBrace)
+            depth++;
+        else if (current().type == TokenType::RBrace)
+            depth--;
+        step();
+    } while (depth > 0);
+    return { &m_tokens, begin, m_index };
 }
 
 std::unique_ptr<Parsed::Expression> Parser::parse_binary_operation()
@@ -178,6 +586,14 @@ std::unique_ptr<Parsed::Expression> Parser::parse_binary_operation()
         operator_stack.pop_back();
         return operator_;
     };
+    const auto make_operation = [&](std::unique_ptr<Parsed::Expression> left,
+                                    std::unique_ptr<Parsed::Expression> right,
+                                    Parsed::BinaryOperator operator_) {
+        const auto pos = *left->pos;
+        return at(pos,
+            std::make_unique<Parsed::BinaryOperation>(
+                std::move(left), std::move(right), operator_));
+    };
     expression_stack.push_back(parse_unary_operation());
     auto last_precedence = 20;
     while (!done()) {
@@ -197,8 +613,7 @@ std::unique_ptr<Parsed::Expression> Parser::parse_binary_operation()
             }
             auto left = pop_expression();
             expression_stack.push_back(
-                std::make_unique<Parsed::BinaryOperation>(
-                    std::move(left), std::move(right), operator_));
+                make_operation(std::move(left), std::move(right), operator_));
         }
         expression_stack.push_back(std::move(right));
         operator_stack.push_back(*operator_);
@@ -206,8 +621,8 @@ std::unique_ptr<Parsed::Expression> Parser::parse_binary_operation()
     while (expression_stack.size() > 1) {
         auto right = pop_expression();
         auto left = pop_expression();
-        expression_stack.push_back(std::make_unique<Parsed::BinaryOperation>(
-            std::move(left), std::move(right), pop_operator()));
+        expression_stack.push_back(
+            make_operation(std::move(left), std::move(right), pop_operator()));
     }
     return std::move(expression_stack[0]);
 }
@@ -216,9 +631,11 @@ std::unique_ptr<Parsed::Expression> Parser::parse_unary_operation()
 {
     const auto& token = current();
     const auto step_and_make_operation = [&](Parsed::UnaryOperator operator_) {
+        const auto pos = token.pos;
         step();
-        return std::make_unique<Parsed::UnaryOperation>(
-            parse_expression(), operator_);
+        return at(pos,
+            std::make_unique<Parsed::UnaryOperation>(
+                parse_expression(), operator_));
     };
     switch (token.type) {
     case TokenType::LogicalNot:
@@ -235,26 +652,40 @@ std::unique_ptr<Parsed::Expression> Parser::parse_unary_operation()
 
 std::unique_ptr<Parsed::Expression> Parser::parse_call()
 {
-    auto callee = parse_value();
-    if (current().type == TokenType::LParen) {
-        step();
-        auto args = std::vector<std::unique_ptr<Parsed::Expression>> {};
-        while (!done() && current().type != TokenType::RParen) {
-            args.push_back(parse_expression());
-            if (current().type == TokenType::RParen)
-                break;
-            else if (current().type != TokenType::Comma)
-                error_and_exit("expected `,` or `)`");
+    const auto pos = current().pos;
+    auto expression = parse_value();
+    while (!done()) {
+        if (current().type == TokenType::LParen) {
             step();
+            auto args = std::vector<std::unique_ptr<Parsed::Expression>> {};
+            while (!done() && current().type != TokenType::RParen) {
+                args.push_back(parse_expression());
+                if (current().type == TokenType::RParen)
+                    break;
+                else if (current().type != TokenType::Comma)
+                    error_and_exit("expected `,` or `)`");
+                step();
+            }
+            if (current().type != TokenType::RParen)
+                error_and_exit("expected `)`");
+            step();
+            expression = at(pos,
+                std::make_unique<Parsed::Call>(
+                    std::move(expression), std::move(args)));
+        } else if (current().type == TokenType::LBracket) {
+            step();
+            auto index = parse_expression();
+            if (current().type != TokenType::RBracket)
+                error_and_exit("expected `]`");
+            step();
+            expression = at(pos,
+                std::make_unique<Parsed::Index>(
+                    std::move(expression), std::move(index)));
+        } else {
+            break;
         }
-        if (current().type != TokenType::RParen)
-            error_and_exit("expected `)`");
-        step();
-        return std::make_unique<Parsed::Call>(
-            std::move(callee), std::move(args));
-    } else {
-        return callee;
     }
+    return expression;
 }
 
 std::unique_ptr<Parsed::Expression> Parser::parse_value()
@@ -268,14 +699,32 @@ std::unique_ptr<Parsed::Expression> Parser::parse_value()
     case TokenType::True: return parse_bool();
     case TokenType::False: return parse_bool();
     case TokenType::Name: return parse_symbol();
+    case TokenType::LBracket: return parse_array();
     default:
-        std::cerr << "internal: unexhaustive match (" << current().to_string()
-                  << ")\n\tat " << __FILE__ << ":" << __LINE__ << ": in "
-                  << __func__ << "\n";
-        std::terminate();
+        // any token can get here in a malformed program
+        error_and_exit("expected value, got " + current().to_string());
     }
 }
 
+std::unique_ptr<Parsed::Array> Parser::parse_array()
+{
+    const auto pos = current().pos;
+    step();
+    auto elements = std::vector<std::unique_ptr<Parsed::Expression>> {};
+    while (!done() && current().type != TokenType::RBracket) {
+        elements.push_back(parse_expression());
+        if (current().type == TokenType::RBracket)
+            break;
+        else if (current().type != TokenType::Comma)
+            error_and_exit("expected `,` or `]`");
+        step();
+    }
+    if (current().type != TokenType::RBracket)
+        error_and_exit("expected `]`");
+    step();
+    return at(pos, std::make_unique<Parsed::Array>(std::move(elements)));
+}
+
 std::unique_ptr<Parsed::Expression> Parser::parse_grouped_expression()
 {
     step();
@@ -290,14 +739,34 @@ std::unique_ptr<Parsed::Int> Parser::parse_int()
 {
     const auto& token = current();
     step();
-    return std::make_unique<Parsed::Int>(std::stoi(token.value));
+    return at(token.pos, std::make_unique<Parsed::Int>(int_value(token)));
+}
+
+int64_t Parser::int_value(const Token& token, bool negative)
+{
+    const auto text = (negative ? "-" : "") + token.value;
+    auto value = int64_t { 0 };
+    const auto end = text.data() + text.size();
+    const auto [rest, error] = std::from_chars(text.data(), end, value);
+    if (error != std::errc {} || rest != end) {
+        error_at(token.pos,
+            std::string("integer literal ").append(text).append(
+                " is out of range"));
+    }
+    return value;
 }
 
 std::unique_ptr<Parsed::Float> Parser::parse_float()
 {
     const auto& token = current();
     step();
-    return std::make_unique<Parsed::Float>(std::stof(token.value));
+    const auto value = std::strtod(token.value.c_str(), nullptr);
+    if (std::isinf(value)) {
+        error_at(token.pos,
+            std::string("float literal ").append(token.value).append(
+                " is out of range"));
+    }
+    return at(token.pos, std::make_unique<Parsed::Float>(value));
 }
 
 std::unique_ptr<Parsed::Char> Parser::parse_char()
@@ -311,15 +780,16 @@ std::unique_ptr<Parsed::Char> Parser::parse_char()
         }
     }();
     step();
-    return std::make_unique<Parsed::Char>(value);
+    return at(token.pos, std::make_unique<Parsed::Char>(value));
 }
 
 std::unique_ptr<Parsed::String> Parser::parse_string()
 {
     const auto& token = current();
     step();
-    return std::make_unique<Parsed::String>(
-        unescape_string_value(token.value.substr(1, token.value.length() - 2)));
+    return at(token.pos,
+        std::make_unique<Parsed::String>(unescape_string_value(
+            token.value.substr(1, token.value.length() - 2))));
 }
 
 std::unique_ptr<Parsed::Bool> Parser::parse_bool()
@@ -337,14 +807,14 @@ std::unique_ptr<Parsed::Bool> Parser::parse_bool()
         }
     }();
     step();
-    return std::make_unique<Parsed::Bool>(value);
+    return at(token.pos, std::make_unique<Parsed::Bool>(value));
 }
 
 std::unique_ptr<Parsed::Symbol> Parser::parse_symbol()
 {
     const auto& token = current();
     step();
-    return std::make_unique<Parsed::Symbol>(token.value);
+    return at(token.pos, std::make_unique<Parsed::Symbol>(token.value));
 }
 
 std::string Parser::unescape_string_value(const std::string& value)
@@ -383,9 +853,15 @@ void Parser::step() { m_index++; }
 
 void Parser::error_and_exit(const std::string& msg)
 {
-    std::cerr << "ParserError: " << msg
-              << "\n    // TODO handle errors in parser\n";
-    std::terminate();
+    throw CompileError { "ParserError: " + msg
+        + "\n    // TODO handle errors in parser\n" };
+}
+
+void Parser::error_at(const Position& pos, const std::string& msg)
+{
+    auto message = std::string { "ParserError: " };
+    message += std::to_string(pos.row) + ":" + std::to_string(pos.col) + ": ";
+    throw CompileError { message + msg + "\n" };
 }
 
 constexpr int Parser::binary_operator_precedence(
@@ -1,8 +1,12 @@
 #pragma once
 
 #include "lexer.h"
+#include "value.h"
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <optional>
+#include <utility>
 #include <vector>
 
 namespace Parsed {
@@ -10,6 +14,9 @@ namespace Parsed {
 struct Node {
     virtual ~Node() = default;
     virtual std::string to_string() const = 0;
+
+    // position of the first token of the node, set by the parser
+    std::optional<Position> pos {};
 };
 
 enum class TypeType {
@@ -75,10 +82,18 @@ struct Parameter final : public Node {
 
 enum class ExpressionType {
     If,
+    Match,
     Block,
+    While,
+    Loop,
+    For,
+    Break,
+    Continue,
     BinaryOperation,
     UnaryOperation,
     Call,
+    Index,
+    Array,
     Int,
     Float,
     Char,
@@ -90,6 +105,9 @@ enum class ExpressionType {
 struct Expression : public Node {
     virtual ~Expression() = default;
     constexpr virtual ExpressionType expression_type() const = 0;
+
+    // type of the value when it is statically known, set by `Checker`
+    std::optional<ValueType> value_type {};
 };
 
 enum class BinaryOperator {
@@ -176,8 +194,40 @@ struct Call final : public Expression {
     const std::vector<std::unique_ptr<Expression>> args;
 };
 
+struct Index final : public Expression {
+    Index(std::unique_ptr<Expression> array, std::unique_ptr<Expression> index)
+        : array { std::move(array) }
+        , index { std::move(index) }
+    {
+    }
+    ~Index() = default;
+    std::string to_string() const override;
+    constexpr ExpressionType expression_type() const override
+    {
+        return ExpressionType::Index;
+    }
+
+    std::unique_ptr<Expression> array;
+    std::unique_ptr<Expression> index;
+};
+
+struct Array final : public Expression {
+    Array(std::vector<std::unique_ptr<Expression>> elements)
+        : elements { std::move(elements) }
+    {
+    }
+    ~Array() = default;
+    std::string to_string() const override;
+    constexpr ExpressionType expression_type() const override
+    {
+        return ExpressionType::Array;
+    }
+
+    std::vector<std::unique_ptr<Expression>> elements;
+};
+
 struct Int final : public Expression {
-    Int(int value)
+    Int(int64_t value)
         : value { value }
     {
     }
@@ -188,7 +238,7 @@ struct Int final : public Expression {
         return ExpressionType::Int;
     }
 
-    const int value;
+    const int64_t value;
 };
 
 struct Float final : public Expression {
@@ -267,6 +317,7 @@ struct Symbol final : public Expression {
 };
 
 enum class StatementType {
+    Func,
     Let,
     Assignment,
     Expression,
@@ -366,16 +417,222 @@ struct If final : public Expression {
     std::optional<std::unique_ptr<Block>> body_falsy;
 };
 
+// `patterns if guard => body`, the patterns are either literals separated by
+// `|` or a single name, which binds the matched value unless it is `_`
+struct MatchArm final : public Node {
+    MatchArm(std::vector<std::unique_ptr<Expression>> patterns,
+        std::optional<std::string> binding,
+        std::optional<std::unique_ptr<Expression>> guard,
+        std::unique_ptr<Expression> body)
+        : patterns { std::move(patterns) }
+        , binding { std::move(binding) }
+        , guard { std::move(guard) }
+        , body { std::move(body) }
+    {
+    }
+    ~MatchArm() = default;
+    std::string to_string() const override;
+
+    // literals, empty when the arm matches any value
+    std::vector<std::unique_ptr<Expression>> patterns;
+    std::optional<std::string> binding;
+    std::optional<std::unique_ptr<Expression>> guard;
+    std::unique_ptr<Expression> body;
+};
+
+// the first arm which matches is taken, the value is `()` when none does
+struct Match final : public Expression {
+    Match(std::unique_ptr<Expression> value,
+        std::vector<std::unique_ptr<MatchArm>> arms)
+        : value { std::move(value) }
+        , arms { std::move(arms) }
+    {
+    }
+    ~Match() = default;
+    std::string to_string() const override;
+    constexpr ExpressionType expression_type() const override
+    {
+        return ExpressionType::Match;
+    }
+
+    std::unique_ptr<Expression> value;
+    std::vector<std::unique_ptr<MatchArm>> arms;
+};
+
+struct While final : public Expression {
+    While(std::unique_ptr<Expression> condition, std::unique_ptr<Block> body)
+        : condition { std::move(condition) }
+        , body { std::move(body) }
+    {
+    }
+    ~While() = default;
+    std::string to_string() const override;
+    constexpr ExpressionType expression_type() const override
+    {
+        return ExpressionType::While;
+    }
+
+    std::unique_ptr<Expression> condition;
+    std::unique_ptr<Block> body;
+};
+
+struct Loop final : public Expression {
+    Loop(std::unique_ptr<Block> body)
+        : body { std::move(body) }
+    {
+    }
+    ~Loop() = default;
+    std::string to_string() const override;
+    constexpr ExpressionType expression_type() const override
+    {
+        return ExpressionType::Loop;
+    }
+
+    std::unique_ptr<Block> body;
+};
+
+// `for name in start..end { body }`, counts from `start` up to but not
+// including `end`, which are both evaluated once before the loop
+struct For final : public Expression {
+    For(const std::string name, std::unique_ptr<Expression> start,
+        std::unique_ptr<Expression> end, std::unique_ptr<Block> body)
+        : name { name }
+        , start { std::move(start) }
+        , end { std::move(end) }
+        , body { std::move(body) }
+    {
+    }
+    ~For() = default;
+    std::string to_string() const override;
+    constexpr ExpressionType expression_type() const override
+    {
+        return ExpressionType::For;
+    }
+
+    const std::string name;
+    std::unique_ptr<Expression> start, end;
+    std::unique_ptr<Block> body;
+};
+
+struct Break final : public Expression {
+    Break() = default;
+    ~Break() = default;
+    std::string to_string() const override;
+    constexpr ExpressionType expression_type() const override
+    {
+        return ExpressionType::Break;
+    }
+};
+
+struct Continue final : public Expression {
+    Continue() = default;
+    ~Continue() = default;
+    std::string to_string() const override;
+    constexpr ExpressionType expression_type() const override
+    {
+        return ExpressionType::Continue;
+    }
+};
+
+// the tokens of a block the parser skipped over, from its `{` up to and
+// including the matching `}`
+struct TokenRange {
+    const std::vector<Token>* tokens;
+    size_t begin, end;
+};
+
+// The body is either parsed along with the declaration, or skipped over by
+// the parser and parsed the first time it is used, see `Parser`.
+struct Func final : public Statement {
+    Func(const std::string name,
+        std::vector<std::unique_ptr<Parameter>> parameters,
+        std::optional<std::unique_ptr<Type>> return_type,
+        std::unique_ptr<Block> body)
+        : name { name }
+        , parameters { std::move(parameters) }
+        , return_type { std::move(return_type) }
+        , m_body { std::move(body) }
+    {
+    }
+    Func(const std::string name,
+        std::vector<std::unique_ptr<Parameter>> parameters,
+        std::optional<std::unique_ptr<Type>> return_type,
+        TokenRange body_tokens)
+        : name { name }
+        , parameters { std::move(parameters) }
+        , return_type { std::move(return_type) }
+        , body_tokens { body_tokens }
+    {
+    }
+    ~Func() = default;
+    std::string to_string() const override;
+    StatementType statement_type() const override
+    {
+        return StatementType::Func;
+    }
+
+    // parses the body if it was skipped
+    Block& body();
+    const Block& body() const;
+    bool is_body_parsed() const { return m_body != nullptr; }
+
+    const std::string name;
+    std::vector<std::unique_ptr<Parameter>> parameters;
+    std::optional<std::unique_ptr<Type>> return_type;
+    // set when the body was skipped
+    const std::optional<TokenRange> body_tokens {};
+
+private:
+    mutable std::unique_ptr<Block> m_body {};
+};
+
 }
 
+// A recursive descent parser.
+//
+// Unless it is strict, the parser only matches the braces of function bodies,
+// which are parsed the first time a later pass uses them, and functions whose
+// names don't appear in the rest of the program, outside of their own bodies,
+// are left out of it, so their bodies are never parsed at all. A strict parser
+// parses every body, reporting the syntax errors of unused functions too.
+//
+// The top level of large programs is parsed in parallel: it is split where
+// declarations and statements start, found by matching braces only, into
+// chunks which are parsed on their own and merged in source order.
 class Parser {
 public:
-    Parser(const std::vector<Token>& tokens)
-        : m_tokens { tokens }
-    {
-    }
+    // the fewest tokens worth spreading over threads
+    static constexpr size_t min_parallel_tokens = size_t { 1 } << 16;
+    static constexpr size_t chunks_per_thread = 4;
 
-    std::unique_ptr<Parsed::Node> parse();
+    Parser(const std::vector<Token>& tokens, bool strict = false)
+        : m_tokens { tokens }
+        , m_strict { strict }
+    {
+    }
+
+    std::unique_ptr<Parsed::Block> parse();
+    // parses the block starting at the token at `index`
+    std::unique_ptr<Parsed::Block> parse_block_at(size_t index);
+    void remove_unreferenced_funcs(Parsed::Block& program) const;
+    // parses top level declarations and statements up to the token at `end`
+    void parse_items(size_t end,
+        std::vector<std::unique_ptr<Parsed::Statement>>& statements,
+        std::optional<std::unique_ptr<Parsed::Expression>>& value);
+    // where the top level declarations and statements start
+    std::vector<size_t> top_level_items() const;
+    void parse_in_parallel(size_t threads,
+        std::vector<std::unique_ptr<Parsed::Statement>>& statements,
+        std::optional<std::unique_ptr<Parsed::Expression>>& value);
+    void parse_statements(
+        std::vector<std::unique_ptr<Parsed::Statement>>& statements,
+        std::optional<std::unique_ptr<Parsed::Expression>>& value,
+        TokenType end);
+    void parse_statement(
+        std::vector<std::unique_ptr<Parsed::Statement>>& statements,
+        std::optional<std::unique_ptr<Parsed::Expression>>& value,
+        TokenType end);
+    std::unique_ptr<Parsed::Func> parse_func();
     std::optional<std::unique_ptr<Parsed::Let>> maybe_parse_let();
     std::unique_ptr<Parsed::Parameter> parse_parameter();
     std::unique_ptr<Parsed::Type> parse_type();
@@ -384,15 +641,25 @@ public:
     std::optional<std::unique_ptr<Parsed::Assignment>> maybe_parse_assignment();
     std::unique_ptr<Parsed::Expression> parse_expression();
     std::unique_ptr<Parsed::If> parse_if();
+    std::unique_ptr<Parsed::Match> parse_match();
+    std::unique_ptr<Parsed::MatchArm> parse_match_arm();
+    std::unique_ptr<Parsed::Expression> parse_pattern();
+    std::unique_ptr<Parsed::While> parse_while();
+    std::unique_ptr<Parsed::Loop> parse_loop();
+    std::unique_ptr<Parsed::For> parse_for();
     std::unique_ptr<Parsed::Block> parse_block();
+    Parsed::TokenRange skip_block();
     std::unique_ptr<Parsed::Expression> parse_binary_operation();
     constexpr int binary_operator_precedence(Parsed::BinaryOperator op) const;
     std::unique_ptr<Parsed::Expression> parse_unary_operation();
     std::optional<Parsed::BinaryOperator> maybe_parse_binary_operator();
     std::unique_ptr<Parsed::Expression> parse_call();
     std::unique_ptr<Parsed::Expression> parse_value();
+    std::unique_ptr<Parsed::Array> parse_array();
     std::unique_ptr<Parsed::Expression> parse_grouped_expression();
     std::unique_ptr<Parsed::Int> parse_int();
+    // the value of an integer literal, negated for patterns like `-1`
+    int64_t int_value(const Token& token, bool negative = false);
     std::unique_ptr<Parsed::Float> parse_float();
     std::unique_ptr<Parsed::Char> parse_char();
     std::unique_ptr<Parsed::String> parse_string();
@@ -403,9 +670,27 @@ public:
     const Token& current() const;
     bool done() const;
     void step();
-    void error_and_exit(const std::string& msg);
+    // throws a `CompileError`
+    [[noreturn]] void error_and_exit(const std::string& msg);
+    [[noreturn]] void error_at(const Position& pos, const std::string& msg);
+    // how many nodes were made, for `--time-report`, function bodies parsed
+    // later aren't counted
+    size_t nodes_count() const { return m_nodes_count; }
 
 private:
+    template <typename NodeType>
+    std::unique_ptr<NodeType> at(
+        const Position& pos, std::unique_ptr<NodeType> node)
+    {
+        node->pos.emplace(pos);
+        m_nodes_count++;
+        return node;
+    }
+
     const std::vector<Token>& m_tokens;
     size_t m_index { 0 };
+    bool m_strict;
+    // the tokens of each top level function, from `func` to its closing `}`
+    std::vector<std::pair<size_t, size_t>> m_func_ranges {};
+    size_t m_nodes_count { 0 };
 };
@@ -0,0 +1,1436 @@
+#include "passes.h"
+#include "builtins.h"
+#include "ir.h"
+#include "kernels.h"
+#include "str.h"
+#include "value.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using Ir::Op;
+
+bool is_number(std::optional<ValueType> type)
+{
+    return type == ValueType::Int || type == ValueType::Float;
+}
+
+bool is_bitwise(Op op)
+{
+    return op >= Op::BitwiseAnd && op <= Op::BitwiseRightShift;
+}
+
+double to_float(const Value& value)
+{
+    return value.type == ValueType::Int ? static_cast<double>(value.int_value)
+                                        : value.float_value;
+}
+
+uint64_t bits(const Value& value)
+{
+    auto result = uint64_t { 0 };
+    std::memcpy(&result, &value.int_value, sizeof(result));
+    return result;
+}
+
+// floats are compared by their bits, so `0.0` isn't `-0.0`
+bool same_constant(const Value& a, const Value& b)
+{
+    return a.type == b.type && bits(a) == bits(b);
+}
+
+// the index of the target a `Switch` on `value` goes to
+size_t switch_target(const Ir::Instruction& switch_, const Value& value)
+{
+    const auto& cases = switch_.cases;
+    return static_cast<size_t>(
+        std::find_if(cases.begin(), cases.end(),
+            [&](const Value& case_) { return Ir::matches_case(value, case_); })
+        - cases.begin());
+}
+
+// the folding functions mirror the VM's operations, but return nothing
+// where the VM would fail, so the error is left to happen at runtime
+
+std::optional<Value> fold_int(Op op, int64_t left, int64_t right)
+{
+    const auto l = static_cast<uint64_t>(left);
+    const auto r = static_cast<uint64_t>(right);
+    switch (op) {
+    case Op::Add: return Value::make_int(static_cast<int64_t>(l + r));
+    case Op::Subtract: return Value::make_int(static_cast<int64_t>(l - r));
+    case Op::Multiply: return Value::make_int(static_cast<int64_t>(l * r));
+    case Op::Divide:
+        if (right == 0)
+            return std::nullopt;
+        if (right == -1)
+            return Value::make_int(static_cast<int64_t>(0 - l));
+        return Value::make_int(left / right);
+    case Op::Modulus:
+        if (right == 0)
+            return std::nullopt;
+        if (right == -1)
+            return Value::make_int(0);
+        return Value::make_int(left % right);
+    case Op::Exponentiate: {
+        if (right < 0)
+            return std::nullopt;
+        auto result = uint64_t { 1 };
+        auto factor = l;
+        for (auto exponent = right; exponent != 0; exponent >>= 1) {
+            if (exponent & 1)
+                result *= factor;
+            factor *= factor;
+        }
+        return Value::make_int(static_cast<int64_t>(result));
+    }
+    case Op::BitwiseAnd: return Value::make_int(left & right);
+    case Op::BitwiseOr: return Value::make_int(left | right);
+    case Op::BitwiseXor: return Value::make_int(left ^ right);
+    case Op::BitwiseLeftShift:
+        return Value::make_int(static_cast<int64_t>(l << (r & 63)));
+    case Op::BitwiseRightShift: return Value::make_int(left >> (r & 63));
+    case Op::LessThan: return Value::make_bool(left < right);
+    case Op::LessThanEqual: return Value::make_bool(left <= right);
+    case Op::GreaterThan: return Value::make_bool(left > right);
+    case Op::GreaterThanEqual: return Value::make_bool(left >= right);
+    case Op::Equal: return Value::make_bool(left == right);
+    case Op::NotEqual: return Value::make_bool(left != right);
+    default: return std::nullopt;
+    }
+}
+
+std::optional<Value> fold_float(Op op, double left, double right)
+{
+    switch (op) {
+    case Op::Add: return Value::make_float(left + right);
+    case Op::Subtract: return Value::make_float(left - right);
+    case Op::Multiply: return Value::make_float(left * right);
+    case Op::Divide: return Value::make_float(left / right);
+    case Op::Modulus: return Value::make_float(std::fmod(left, right));
+    case Op::Exponentiate: return Value::make_float(std::pow(left, right));
+    case Op::LessThan: return Value::make_bool(left < right);
+    case Op::LessThanEqual: return Value::make_bool(left <= right);
+    case Op::GreaterThan: return Value::make_bool(left > right);
+    case Op::GreaterThanEqual: return Value::make_bool(left >= right);
+    case Op::Equal: return Value::make_bool(left == right);
+    case Op::NotEqual: return Value::make_bool(left != right);
+    default: return std::nullopt;
+    }
+}
+
+std::optional<Value> fold_binary(Op op, const Value& left, const Value& right)
+{
+    if (left.type == ValueType::Int && right.type == ValueType::Int)
+        return fold_int(op, left.int_value, right.int_value);
+    if (is_number(left.type) && is_number(right.type))
+        return fold_float(op, to_float(left), to_float(right));
+    if (left.type == ValueType::Char
+        && (right.type == ValueType::Char
+            || (right.type == ValueType::Int
+                && (op == Op::Add || op == Op::Subtract)))) {
+        const auto result = fold_int(op, left.char_value,
+            right.type == ValueType::Char ? right.char_value
+                                          : right.int_value);
+        if (!result || result->type == ValueType::Bool)
+            return result;
+        return Value::make_char(static_cast<char>(result->int_value));
+    }
+    if (op == Op::Add && left.type == ValueType::String
+        && right.type == ValueType::String)
+        return Value::make_string(
+            String::intern(std::string(left.string_value->view())
+                + std::string(right.string_value->view())));
+    if (left.type == ValueType::String && right.type == ValueType::String
+        && op >= Op::LessThan && op <= Op::GreaterThanEqual)
+        return fold_int(op, left.string_value->compare(*right.string_value), 0);
+    if (op != Op::Equal && op != Op::NotEqual)
+        return std::nullopt;
+    const auto equal = [&]() {
+        if (left.type != right.type)
+            return false;
+        switch (left.type) {
+        case ValueType::Unit: return true;
+        case ValueType::Bool: return left.bool_value == right.bool_value;
+        case ValueType::String:
+            return left.string_value->equals(*right.string_value);
+        case ValueType::Builtin:
+            return left.builtin_value == right.builtin_value;
+        case ValueType::Function:
+            return left.function_value == right.function_value;
+        default: return false;
+        }
+    }();
+    return Value::make_bool(op == Op::Equal ? equal : !equal);
+}
+
+std::optional<Value> fold_unary(Op op, const Value& value)
+{
+    switch (op) {
+    case Op::LogicalNot:
+        if (value.type == ValueType::Bool)
+            return Value::make_bool(!value.bool_value);
+        break;
+    case Op::BitwiseNot:
+        if (value.type == ValueType::Int)
+            return Value::make_int(~value.int_value);
+        break;
+    case Op::Plus:
+        if (is_number(value.type))
+            return value;
+        break;
+    case Op::Negate:
+        if (value.type == ValueType::Int)
+            return Value::make_int(static_cast<int64_t>(
+                0 - static_cast<uint64_t>(value.int_value)));
+        if (value.type == ValueType::Float)
+            return Value::make_float(-value.float_value);
+        break;
+    default: break;
+    }
+    return std::nullopt;
+}
+
+// globals which are bound before `main` runs and can't be unbound
+bool is_always_defined(const Ir::Module& module, uint32_t global)
+{
+    if (find_builtin(module.globals[global]))
+        return true;
+    if (module.defined_globals[global])
+        return false;
+    return std::find(module.function_globals.begin(),
+               module.function_globals.end(), global)
+        != module.function_globals.end();
+}
+
+// whether `call` calls the builtin `name`, whose global neither a function
+// nor a top level let can rebind
+bool calls_builtin(const Ir::Module& module, const Ir::Instruction& call,
+    const std::string& name)
+{
+    if (call.op != Op::CallGlobal)
+        return false;
+    const auto global = call.index;
+    return module.globals[global] == name && find_builtin(name)
+        && !module.defined_globals[global]
+        && std::find(module.function_globals.begin(),
+               module.function_globals.end(), global)
+        == module.function_globals.end();
+}
+
+bool is_nonzero_int(const Ir::Instruction& value)
+{
+    return value.op == Op::Constant && value.value.type == ValueType::Int
+        && value.value.int_value != 0;
+}
+
+bool may_fail(const Ir::Module& module, const Ir::Instruction& instruction)
+{
+    const auto op = instruction.op;
+    if (op == Op::LoadGlobal)
+        return !is_always_defined(module, instruction.index);
+    if (op == Op::CheckType)
+        return instruction.operands[0]->type != instruction.type;
+    if (op == Op::NewArray)
+        return std::any_of(instruction.operands.begin(),
+            instruction.operands.end(), [&](const Ir::Instruction* element) {
+                return !element->type
+                    || element->type != instruction.operands[0]->type;
+            });
+    if (op == Op::Index)
+        return !instruction.in_bounds
+            || instruction.operands[0]->type != ValueType::Array;
+    // arrays of different lengths or element types
+    if (op == Op::Map)
+        return true;
+    if (is_unary(op)) {
+        const auto operand = instruction.operands[0]->type;
+        switch (op) {
+        case Op::LogicalNot: return operand != ValueType::Bool;
+        case Op::BitwiseNot: return operand != ValueType::Int;
+        default: return !is_number(operand);
+        }
+    }
+    if (!is_binary(op))
+        return false;
+    if (op == Op::Equal || op == Op::NotEqual)
+        return false;
+    const auto& right = *instruction.operands[1];
+    const auto left_type = instruction.operands[0]->type;
+    const auto right_type = right.type;
+    const auto can_divide
+        = op != Op::Divide && op != Op::Modulus && op != Op::Exponentiate;
+    if (left_type == ValueType::Int && right_type == ValueType::Int) {
+        if (op == Op::Divide || op == Op::Modulus)
+            return !is_nonzero_int(right);
+        if (op == Op::Exponentiate)
+            return right.op != Op::Constant || right.value.int_value < 0;
+        return false;
+    }
+    if (is_number(left_type) && is_number(right_type))
+        return is_bitwise(op);
+    if (left_type == ValueType::Char && right_type == ValueType::Char)
+        return !can_divide;
+    if (left_type == ValueType::Char && right_type == ValueType::Int)
+        return op != Op::Add && op != Op::Subtract;
+    if (left_type == ValueType::String && right_type == ValueType::String)
+        return op != Op::Add
+            && (op < Op::LessThan || op > Op::GreaterThanEqual);
+    return true;
+}
+
+bool is_pure(Op op) { return is_unary(op) || is_binary(op); }
+
+// whether the operation can produce an array, which is a new one each time
+bool may_make_array(const Ir::Instruction& instruction)
+{
+    const auto could_be_array = [](std::optional<ValueType> type) {
+        return !type || type == ValueType::Array;
+    };
+    return Ir::kernel_op(instruction.op)
+        && could_be_array(instruction.operands[0]->type)
+        && could_be_array(instruction.operands[1]->type);
+}
+
+// whether `user` can hold on to an array without references it takes as
+// `operand` after it is evaluated
+bool may_keep(const Ir::Module& module, const Ir::Instruction& user,
+    const Ir::Instruction& operand)
+{
+    static const auto readers = std::array<std::string, 7> {
+        "print", "println", "len", "sum", "min", "max", "dot"
+    };
+    switch (user.op) {
+    case Op::Index:
+    case Op::Map:
+    case Op::Branch:
+    case Op::Switch: return false;
+    case Op::StoreIndex: return user.operands[2] == &operand;
+    case Op::CallGlobal:
+        return std::none_of(
+            readers.begin(), readers.end(), [&](const auto& name) {
+                return calls_builtin(module, user, name);
+            });
+    default: return !Ir::is_unary(user.op) && !Ir::is_binary(user.op);
+    }
+}
+
+// whether evaluating something else before or after the instruction makes
+// no difference
+bool is_inert(const Ir::Module& module, const Ir::Instruction& instruction)
+{
+    switch (instruction.op) {
+    case Op::Constant:
+    case Op::Parameter:
+    case Op::LoadGlobal:
+    case Op::CheckType:
+    case Op::Index: return !may_fail(module, instruction);
+    default: return is_pure(instruction.op) && !may_fail(module, instruction);
+    }
+}
+
+void retarget(Ir::Block* block, Ir::Block* from, Ir::Block* to)
+{
+    for (auto& target : block->terminator()->targets)
+        if (target == from)
+            target = to;
+}
+
+bool is_predecessor(const Ir::Block* block, const Ir::Block* predecessor)
+{
+    return std::find(block->predecessors.begin(), block->predecessors.end(),
+               predecessor)
+        != block->predecessors.end();
+}
+
+// adds the edge `predecessor` -> `block`, with the phis in `block` taking the
+// values they take from `like`
+void add_predecessor_like(
+    Ir::Block* block, Ir::Block* predecessor, const Ir::Block* like)
+{
+    const auto index = block->predecessor_index(like);
+    block->predecessors.push_back(predecessor);
+    for (size_t i = 0; i < block->phis_count(); i++) {
+        auto& operands = block->instructions[i]->operands;
+        operands.push_back(operands[index]);
+    }
+}
+
+void erase_instructions(Ir::Function& function,
+    const std::unordered_set<const Ir::Instruction*>& instructions)
+{
+    if (instructions.empty())
+        return;
+    for (const auto& block : function.blocks) {
+        auto& list = block->instructions;
+        list.erase(std::remove_if(list.begin(), list.end(),
+                       [&](const auto& instruction) {
+                           return instructions.count(instruction.get()) != 0;
+                       }),
+            list.end());
+    }
+}
+
+class ConstantPropagation {
+public:
+    ConstantPropagation(Ir::Function& function)
+        : m_function { function }
+    {
+    }
+
+    bool run();
+
+private:
+    struct Lattice {
+        enum class Kind : uint8_t { Top, Constant, Overdefined };
+
+        static Lattice constant(Value value)
+        {
+            return { Kind::Constant, value, value.type };
+        }
+        static Lattice overdefined(std::optional<ValueType> type)
+        {
+            return { Kind::Overdefined, Value::make_unit(), type };
+        }
+
+        bool operator==(const Lattice& other) const
+        {
+            return kind == other.kind && type == other.type
+                && (kind != Kind::Constant
+                    || same_constant(value, other.value));
+        }
+
+        Kind kind { Kind::Top };
+        Value value {};
+        std::optional<ValueType> type {};
+    };
+
+    static Lattice meet(const Lattice& a, const Lattice& b);
+
+    void visit(Ir::Instruction* instruction);
+    Lattice evaluate(const Ir::Instruction& instruction) const;
+    void mark_edge(Ir::Block* from, Ir::Block* to);
+    const Lattice& lattice(const Ir::Instruction* instruction) const;
+    bool is_executable(const Ir::Block* from, const Ir::Block* to) const;
+    bool rewrite();
+
+    Ir::Function& m_function;
+    std::unordered_map<const Ir::Instruction*, Lattice> m_values {};
+    std::unordered_map<const Ir::Instruction*, std::vector<Ir::Instruction*>>
+        m_users {};
+    std::set<std::pair<const Ir::Block*, const Ir::Block*>> m_edges {};
+    std::unordered_set<const Ir::Block*> m_executable {};
+    std::vector<Ir::Block*> m_block_worklist {};
+    std::vector<Ir::Instruction*> m_value_worklist {};
+};
+
+bool ConstantPropagation::run()
+{
+    for (const auto& block : m_function.blocks)
+        for (const auto& instruction : block->instructions)
+            for (const auto operand : instruction->operands)
+                m_users[operand].push_back(instruction.get());
+
+    m_executable.insert(m_function.entry());
+    m_block_worklist.push_back(m_function.entry());
+    while (!m_block_worklist.empty() || !m_value_worklist.empty()) {
+        while (!m_block_worklist.empty()) {
+            const auto block = m_block_worklist.back();
+            m_block_worklist.pop_back();
+            for (const auto& instruction : block->instructions)
+                visit(instruction.get());
+        }
+        while (!m_value_worklist.empty()) {
+            const auto instruction = m_value_worklist.back();
+            m_value_worklist.pop_back();
+            if (m_executable.count(instruction->block))
+                visit(instruction);
+        }
+    }
+    return rewrite();
+}
+
+ConstantPropagation::Lattice ConstantPropagation::meet(
+    const Lattice& a, const Lattice& b)
+{
+    if (a.kind == Lattice::Kind::Top)
+        return b;
+    if (b.kind == Lattice::Kind::Top)
+        return a;
+    if (a.kind == Lattice::Kind::Constant && b.kind == Lattice::Kind::Constant
+        && same_constant(a.value, b.value))
+        return a;
+    return Lattice::overdefined(
+        a.type == b.type ? a.type : std::optional<ValueType> {});
+}
+
+void ConstantPropagation::visit(Ir::Instruction* instruction)
+{
+    const auto block = instruction->block;
+    switch (instruction->op) {
+    case Op::Jump: mark_edge(block, instruction->targets[0]); return;
+    case Op::Branch: {
+        const auto& condition = lattice(instruction->operands[0]);
+        if (condition.kind == Lattice::Kind::Top)
+            return;
+        // a constant condition which isn't a `Bool` fails at runtime, both
+        // edges are kept so the failing branch stays
+        if (condition.kind == Lattice::Kind::Constant
+            && condition.value.type == ValueType::Bool) {
+            mark_edge(
+                block, instruction->targets[condition.value.bool_value ? 0 : 1]);
+            return;
+        }
+        mark_edge(block, instruction->targets[0]);
+        mark_edge(block, instruction->targets[1]);
+        return;
+    }
+    case Op::Switch: {
+        const auto& value = lattice(instruction->operands[0]);
+        if (value.kind == Lattice::Kind::Top)
+            return;
+        if (value.kind == Lattice::Kind::Constant) {
+            mark_edge(block,
+                instruction->targets[switch_target(*instruction, value.value)]);
+            return;
+        }
+        for (const auto target : instruction->targets)
+            mark_edge(block, target);
+        return;
+    }
+    default: break;
+    }
+    if (!Ir::has_result(instruction->op))
+        return;
+    const auto& old = lattice(instruction);
+    const auto updated = meet(old, evaluate(*instruction));
+    if (updated == old)
+        return;
+    m_values[instruction] = updated;
+    const auto users = m_users.find(instruction);
+    if (users != m_users.end())
+        for (const auto user : users->second)
+            m_value_worklist.push_back(user);
+}
+
+ConstantPropagation::Lattice ConstantPropagation::evaluate(
+    const Ir::Instruction& instruction) const
+{
+    const auto op = instruction.op;
+    if (op == Op::Constant)
+        return Lattice::constant(instruction.value);
+    if (op == Op::Phi) {
+        auto result = Lattice {};
+        const auto& predecessors = instruction.block->predecessors;
+        for (size_t i = 0; i < predecessors.size(); i++)
+            if (is_executable(predecessors[i], instruction.block))
+                result = meet(result, lattice(instruction.operands[i]));
+        return result;
+    }
+    if (op == Op::CheckType) {
+        // a check of a value which has the type passes it on as is
+        const auto& operand = lattice(instruction.operands[0]);
+        if (operand.kind == Lattice::Kind::Top
+            || operand.type == instruction.type)
+            return operand;
+        return Lattice::overdefined(instruction.type);
+    }
+    if (!is_pure(op))
+        return Lattice::overdefined(instruction.type);
+
+    auto operands = std::vector<Lattice> {};
+    for (const auto operand : instruction.operands) {
+        operands.push_back(lattice(operand));
+        if (operands.back().kind == Lattice::Kind::Top)
+            return Lattice {};
+    }
+    const auto all_constant = std::all_of(
+        operands.begin(), operands.end(), [](const Lattice& operand) {
+            return operand.kind == Lattice::Kind::Constant;
+        });
+    if (is_unary(op)) {
+        if (all_constant)
+            if (const auto result = fold_unary(op, operands[0].value))
+                return Lattice::constant(*result);
+        return Lattice::overdefined(Ir::unary_type(op, operands[0].type));
+    }
+    if (all_constant)
+        if (const auto result
+            = fold_binary(op, operands[0].value, operands[1].value))
+            return Lattice::constant(*result);
+    return Lattice::overdefined(
+        Ir::binary_type(op, operands[0].type, operands[1].type));
+}
+
+void ConstantPropagation::mark_edge(Ir::Block* from, Ir::Block* to)
+{
+    if (!m_edges.insert({ from, to }).second)
+        return;
+    if (m_executable.insert(to).second) {
+        m_block_worklist.push_back(to);
+        return;
+    }
+    // the phis take another value into account
+    for (size_t i = 0; i < to->phis_count(); i++)
+        visit(to->instructions[i].get());
+}
+
+const ConstantPropagation::Lattice& ConstantPropagation::lattice(
+    const Ir::Instruction* instruction) const
+{
+    static const auto top = Lattice {};
+    const auto found = m_values.find(instruction);
+    return found != m_values.end() ? found->second : top;
+}
+
+bool ConstantPropagation::is_executable(
+    const Ir::Block* from, const Ir::Block* to) const
+{
+    return m_edges.count({ from, to }) != 0;
+}
+
+bool ConstantPropagation::rewrite()
+{
+    auto changed = false;
+    auto checks = std::unordered_map<Ir::Instruction*, Ir::Instruction*> {};
+    for (const auto& block : m_function.blocks) {
+        if (!m_executable.count(block.get()))
+            continue;
+        for (const auto& instruction : block->instructions) {
+            const auto& value = lattice(instruction.get());
+            const auto foldable = is_pure(instruction->op)
+                || instruction->op == Op::Phi
+                || instruction->op == Op::CheckType;
+            if (instruction->op == Op::CheckType
+                && value.kind != Lattice::Kind::Constant
+                && lattice(instruction->operands[0]).type
+                    == instruction->type) {
+                checks[instruction.get()] = instruction->operands[0];
+            } else if (foldable && value.kind == Lattice::Kind::Constant) {
+                instruction->op = Op::Constant;
+                instruction->operands.clear();
+                instruction->value = value.value;
+                instruction->type = value.value.type;
+                changed = true;
+            } else if (value.type && !instruction->type) {
+                instruction->type = value.type;
+                changed = true;
+            }
+        }
+        // folded phis move after the remaining ones
+        std::stable_partition(block->instructions.begin(),
+            block->instructions.end(),
+            [](const auto& instruction) { return instruction->op == Op::Phi; });
+
+        const auto terminator = block->terminator();
+        if (terminator->op == Op::Switch) {
+            const auto& value = lattice(terminator->operands[0]);
+            if (value.kind != Lattice::Kind::Constant)
+                continue;
+            const auto taken
+                = terminator->targets[switch_target(*terminator, value.value)];
+            for (const auto target : terminator->targets)
+                if (target != taken)
+                    target->remove_predecessor(block.get());
+            terminator->op = Op::Jump;
+            terminator->operands.clear();
+            terminator->cases.clear();
+            terminator->targets = { taken };
+            changed = true;
+            continue;
+        }
+        if (terminator->op != Op::Branch)
+            continue;
+        const auto& condition = lattice(terminator->operands[0]);
+        if (condition.kind != Lattice::Kind::Constant
+            || condition.value.type != ValueType::Bool)
+            continue;
+        const auto taken
+            = terminator->targets[condition.value.bool_value ? 0 : 1];
+        const auto skipped
+            = terminator->targets[condition.value.bool_value ? 1 : 0];
+        skipped->remove_predecessor(block.get());
+        terminator->op = Op::Jump;
+        terminator->operands.clear();
+        terminator->targets = { taken };
+        changed = true;
+    }
+    // checks which always pass go away
+    if (!checks.empty()) {
+        m_function.replace_uses(checks);
+        auto erased = std::unordered_set<const Ir::Instruction*> {};
+        for (const auto& [check, operand] : checks)
+            erased.insert(check);
+        erase_instructions(m_function, erased);
+        changed = true;
+    }
+    const auto blocks_count = m_function.blocks.size();
+    m_function.sort_blocks();
+    return changed || m_function.blocks.size() != blocks_count;
+}
+
+bool remove_dead_instructions(const Ir::Module& module, Ir::Function& function)
+{
+    auto live = std::unordered_set<const Ir::Instruction*> {};
+    auto worklist = std::vector<const Ir::Instruction*> {};
+    for (const auto& block : function.blocks) {
+        for (const auto& instruction : block->instructions) {
+            const auto op = instruction->op;
+            if (Ir::is_terminator(op) || !Ir::has_result(op)
+                || op == Op::Call || op == Op::CallGlobal
+                || may_fail(module, *instruction)) {
+                live.insert(instruction.get());
+                worklist.push_back(instruction.get());
+            }
+        }
+    }
+    while (!worklist.empty()) {
+        const auto instruction = worklist.back();
+        worklist.pop_back();
+        for (const auto operand : instruction->operands)
+            if (live.insert(operand).second)
+                worklist.push_back(operand);
+    }
+    auto dead = std::unordered_set<const Ir::Instruction*> {};
+    for (const auto& block : function.blocks)
+        for (const auto& instruction : block->instructions)
+            if (!live.count(instruction.get()))
+                dead.insert(instruction.get());
+    erase_instructions(function, dead);
+    return !dead.empty();
+}
+
+bool remove_trivial_phis(Ir::Function& function)
+{
+    auto replacements = std::unordered_map<Ir::Instruction*, Ir::Instruction*> {};
+    const auto resolve = [&](Ir::Instruction* value) {
+        for (auto found = replacements.find(value); found != replacements.end();
+             found = replacements.find(value))
+            value = found->second;
+        return value;
+    };
+    auto removed = std::unordered_set<const Ir::Instruction*> {};
+    for (const auto& block : function.blocks) {
+        for (size_t i = 0; i < block->phis_count(); i++) {
+            const auto phi = block->instructions[i].get();
+            auto same = static_cast<Ir::Instruction*>(nullptr);
+            auto trivial = true;
+            for (const auto operand : phi->operands) {
+                const auto value = resolve(operand);
+                if (value == same || value == phi)
+                    continue;
+                if (same)
+                    trivial = false;
+                same = value;
+            }
+            // phis without other operands are in unreachable blocks
+            if (!trivial || !same)
+                continue;
+            replacements[phi] = same;
+            removed.insert(phi);
+        }
+    }
+    function.replace_uses(replacements);
+    erase_instructions(function, removed);
+    return !removed.empty();
+}
+
+bool merge_blocks(Ir::Function& function)
+{
+    auto changed = false;
+    auto& blocks = function.blocks;
+    for (size_t i = 0; i < blocks.size();) {
+        const auto block = blocks[i].get();
+        const auto terminator = block->terminator();
+        const auto next = terminator->op == Op::Jump ? terminator->targets[0]
+                                                     : nullptr;
+        if (!next || next == block || next == function.entry()
+            || next->predecessors.size() != 1) {
+            i++;
+            continue;
+        }
+        auto replacements
+            = std::unordered_map<Ir::Instruction*, Ir::Instruction*> {};
+        const auto phis = next->phis_count();
+        for (size_t j = 0; j < phis; j++)
+            replacements[next->instructions[j].get()]
+                = next->instructions[j]->operands[0];
+        function.replace_uses(replacements);
+        next->instructions.erase(next->instructions.begin(),
+            next->instructions.begin() + static_cast<std::ptrdiff_t>(phis));
+
+        block->instructions.pop_back();
+        for (auto& instruction : next->instructions)
+            block->append(std::move(instruction));
+        for (const auto successor : block->successors())
+            std::replace(successor->predecessors.begin(),
+                successor->predecessors.end(), next, block);
+        const auto found = std::find_if(blocks.begin(), blocks.end(),
+            [&](const auto& other) { return other.get() == next; });
+        if (static_cast<size_t>(found - blocks.begin()) < i)
+            i--;
+        blocks.erase(found);
+        changed = true;
+    }
+    return changed;
+}
+
+bool forward_jumps(Ir::Function& function)
+{
+    auto changed = false;
+    for (const auto& block : function.blocks) {
+        const auto empty = block.get();
+        if (empty == function.entry() || empty->instructions.size() != 1
+            || empty->instructions[0]->op != Op::Jump
+            || empty->predecessors.empty())
+            continue;
+        const auto target = empty->instructions[0]->targets[0];
+        if (target == empty)
+            continue;
+        const auto& predecessors = empty->predecessors;
+        if (std::any_of(predecessors.begin(), predecessors.end(),
+                [&](const Ir::Block* predecessor) {
+                    return is_predecessor(target, predecessor);
+                }))
+            continue;
+        for (const auto predecessor : predecessors) {
+            add_predecessor_like(target, predecessor, empty);
+            retarget(predecessor, empty, target);
+        }
+        target->remove_predecessor(empty);
+        empty->predecessors.clear();
+        changed = true;
+    }
+    return changed;
+}
+
+bool thread_jumps(Ir::Function& function)
+{
+    auto changed = false;
+    const auto uses = function.use_counts();
+    for (const auto& block : function.blocks) {
+        // only a phi and a branch on it, so nothing else depends on going
+        // through the block
+        if (block.get() == function.entry() || block->instructions.size() != 2)
+            continue;
+        const auto phi = block->instructions[0].get();
+        const auto branch = block->instructions[1].get();
+        if (phi->op != Op::Phi || branch->op != Op::Branch
+            || branch->operands[0] != phi || uses.at(phi) != 1)
+            continue;
+        for (size_t i = block->predecessors.size(); i-- > 0;) {
+            const auto predecessor = block->predecessors[i];
+            const auto value = phi->operands[i];
+            const auto known = [&]() -> std::optional<bool> {
+                if (value->op == Op::Constant
+                    && value->value.type == ValueType::Bool)
+                    return value->value.bool_value;
+                const auto terminator = predecessor->terminator();
+                if (terminator->op == Op::Branch
+                    && terminator->operands[0] == value)
+                    return terminator->targets[0] == block.get();
+                return std::nullopt;
+            }();
+            if (!known)
+                continue;
+            const auto target = branch->targets[*known ? 0 : 1];
+            if (target == block.get() || predecessor == block.get()
+                || is_predecessor(target, predecessor))
+                continue;
+            add_predecessor_like(target, predecessor, block.get());
+            retarget(predecessor, block.get(), target);
+            block->remove_predecessor(predecessor);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// the key of an instruction in the value numbering table
+struct Expression {
+    bool operator==(const Expression& other) const = default;
+
+    Op op;
+    std::vector<const Ir::Instruction*> operands;
+    ValueType type;
+    uint64_t bits;
+    // phis are only equal within their block
+    const Ir::Block* block;
+};
+
+struct ExpressionHash {
+    size_t operator()(const Expression& expression) const
+    {
+        auto result = std::hash<uint64_t> {}(expression.bits);
+        const auto combine = [&](size_t value) {
+            result ^= value + 0x9e3779b97f4a7c15 + (result << 6) + (result >> 2);
+        };
+        combine(static_cast<size_t>(expression.op));
+        combine(static_cast<size_t>(expression.type));
+        combine(std::hash<const void*> {}(expression.block));
+        for (const auto operand : expression.operands)
+            combine(std::hash<const void*> {}(operand));
+        return result;
+    }
+};
+
+class ValueNumbering {
+public:
+    ValueNumbering(Ir::Function& function)
+        : m_function { function }
+    {
+    }
+
+    bool run();
+
+private:
+    void visit(Ir::Block* block);
+    std::optional<Expression> expression(const Ir::Instruction& instruction);
+
+    Ir::Function& m_function;
+    std::unordered_map<const Ir::Block*, std::vector<Ir::Block*>>
+        m_dominated {};
+    std::unordered_map<Expression, Ir::Instruction*, ExpressionHash>
+        m_table {};
+    std::unordered_map<Ir::Instruction*, Ir::Instruction*> m_replacements {};
+};
+
+// Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm"
+std::unordered_map<const Ir::Block*, Ir::Block*> immediate_dominators(
+    const Ir::Function& function)
+{
+    const auto order = function.reverse_postorder();
+    auto index = std::unordered_map<const Ir::Block*, size_t> {};
+    for (size_t i = 0; i < order.size(); i++)
+        index[order[i]] = i;
+    auto dominators = std::unordered_map<const Ir::Block*, Ir::Block*> {};
+    dominators[order[0]] = order[0];
+    const auto intersect = [&](Ir::Block* a, Ir::Block* b) {
+        while (a != b) {
+            while (index.at(a) > index.at(b))
+                a = dominators.at(a);
+            while (index.at(b) > index.at(a))
+                b = dominators.at(b);
+        }
+        return a;
+    };
+    for (auto changed = true; changed;) {
+        changed = false;
+        for (size_t i = 1; i < order.size(); i++) {
+            auto dominator = static_cast<Ir::Block*>(nullptr);
+            for (const auto predecessor : order[i]->predecessors) {
+                if (!dominators.count(predecessor))
+                    continue;
+                dominator = dominator ? intersect(predecessor, dominator)
+                                      : predecessor;
+            }
+            if (dominators[order[i]] != dominator) {
+                dominators[order[i]] = dominator;
+                changed = true;
+            }
+        }
+    }
+    return dominators;
+}
+
+bool ValueNumbering::run()
+{
+    const auto dominators = immediate_dominators(m_function);
+    for (const auto block : m_function.reverse_postorder())
+        if (block != m_function.entry())
+            m_dominated[dominators.at(block)].push_back(block);
+    visit(m_function.entry());
+
+    m_function.replace_uses(m_replacements);
+    auto removed = std::unordered_set<const Ir::Instruction*> {};
+    for (const auto& [instruction, replacement] : m_replacements)
+        removed.insert(instruction);
+    erase_instructions(m_function, removed);
+    return !removed.empty();
+}
+
+void ValueNumbering::visit(Ir::Block* block)
+{
+    auto added = std::vector<Expression> {};
+    for (const auto& instruction : block->instructions) {
+        for (auto& operand : instruction->operands) {
+            const auto replacement = m_replacements.find(operand);
+            if (replacement != m_replacements.end())
+                operand = replacement->second;
+        }
+        const auto key = expression(*instruction);
+        if (!key)
+            continue;
+        const auto [entry, inserted] = m_table.insert({ *key, instruction.get() });
+        if (inserted) {
+            added.push_back(*key);
+            continue;
+        }
+        if (!entry->second->type)
+            entry->second->type = instruction->type;
+        m_replacements[instruction.get()] = entry->second;
+    }
+    for (const auto dominated : m_dominated[block])
+        visit(dominated);
+    for (const auto& key : added)
+        m_table.erase(key);
+}
+
+std::optional<Expression> ValueNumbering::expression(
+    const Ir::Instruction& instruction)
+{
+    const auto op = instruction.op;
+    if ((op != Op::Constant && op != Op::Phi && !is_pure(op))
+        || (is_binary(op) && may_make_array(instruction)))
+        return std::nullopt;
+    auto result = Expression {
+        op,
+        std::vector<const Ir::Instruction*>(
+            instruction.operands.begin(), instruction.operands.end()),
+        ValueType::Unit,
+        0,
+        op == Op::Phi ? instruction.block : nullptr,
+    };
+    if (op == Op::Constant) {
+        result.type = instruction.value.type;
+        result.bits = bits(instruction.value);
+        return result;
+    }
+    // `Int + Char` fails where `Char + Int` doesn't, so addition only
+    // commutes on numbers
+    const auto commutes = [&]() {
+        switch (op) {
+        case Op::Multiply:
+        case Op::BitwiseAnd:
+        case Op::BitwiseOr:
+        case Op::BitwiseXor:
+        case Op::Equal:
+        case Op::NotEqual: return true;
+        case Op::Add:
+            return is_number(instruction.operands[0]->type)
+                && is_number(instruction.operands[1]->type);
+        default: return false;
+        }
+    }();
+    if (commutes && result.operands[1]->id < result.operands[0]->id)
+        std::swap(result.operands[0], result.operands[1]);
+    return result;
+}
+
+
+// `smaller < larger`, or `smaller <= larger` unless strict
+struct Fact {
+    const Ir::Instruction* smaller;
+    const Ir::Instruction* larger;
+    bool strict;
+};
+
+class BoundsChecks {
+public:
+    BoundsChecks(const Ir::Module& module, Ir::Function& function)
+        : m_module { module }
+        , m_function { function }
+    {
+    }
+
+    bool run();
+
+private:
+    // what the branches dominating the block tell about ints
+    const std::vector<Fact>& facts(const Ir::Block* block);
+    bool is_below_length(const Ir::Instruction* index,
+        const Ir::Instruction* array, const Ir::Block* block);
+    bool is_non_negative(
+        const Ir::Instruction* value, const Ir::Block* block);
+    // whether `value` is `len(array)`
+    bool is_length(
+        const Ir::Instruction* value, const Ir::Instruction* array) const;
+
+    const Ir::Module& m_module;
+    Ir::Function& m_function;
+    std::unordered_map<const Ir::Block*, Ir::Block*> m_dominators {};
+    std::unordered_map<const Ir::Block*, std::vector<Fact>> m_facts {};
+    // phis assumed to be non-negative while their operands are looked at
+    std::unordered_set<const Ir::Instruction*> m_assumed {};
+};
+
+// the value checked by a chain of `CheckType`s
+const Ir::Instruction* unchecked(const Ir::Instruction* value)
+{
+    while (value->op == Op::CheckType)
+        value = value->operands[0];
+    return value;
+}
+
+bool is_int_constant(const Ir::Instruction* value, int64_t minimum)
+{
+    return value->op == Op::Constant && value->value.type == ValueType::Int
+        && value->value.int_value >= minimum;
+}
+
+bool BoundsChecks::run()
+{
+    m_dominators = immediate_dominators(m_function);
+    auto changed = false;
+    for (const auto& block : m_function.blocks) {
+        for (const auto& instruction : block->instructions) {
+            if ((instruction->op != Op::Index
+                    && instruction->op != Op::StoreIndex)
+                || instruction->in_bounds)
+                continue;
+            const auto array = unchecked(instruction->operands[0]);
+            const auto index = instruction->operands[1];
+            if (index->type != ValueType::Int
+                || !is_below_length(index, array, block.get())
+                || !is_non_negative(index, block.get()))
+                continue;
+            instruction->in_bounds = true;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// A block entered only from one edge of a branch on a comparison of ints
+// knows how they compare, and so do the blocks it dominates. Comparisons of
+// ints are total, so the false edge knows the opposite.
+const std::vector<Fact>& BoundsChecks::facts(const Ir::Block* block)
+{
+    if (const auto found = m_facts.find(block); found != m_facts.end())
+        return found->second;
+    auto result = std::vector<Fact> {};
+    const auto dominator = m_dominators.find(block);
+    if (dominator != m_dominators.end() && dominator->second != block)
+        result = facts(dominator->second);
+    const auto branch = block->predecessors.size() == 1
+        ? block->predecessors[0]->terminator()
+        : nullptr;
+    if (branch && branch->op == Op::Branch) {
+        const auto& condition = *branch->operands[0];
+        const auto taken = branch->targets[0] == block;
+        if (is_binary(condition.op)
+            && condition.operands[0]->type == ValueType::Int
+            && condition.operands[1]->type == ValueType::Int) {
+            const auto left = condition.operands[0];
+            const auto right = condition.operands[1];
+            switch (condition.op) {
+            case Op::LessThan:
+                result.push_back(taken ? Fact { left, right, true }
+                                       : Fact { right, left, false });
+                break;
+            case Op::LessThanEqual:
+                result.push_back(taken ? Fact { left, right, false }
+                                       : Fact { right, left, true });
+                break;
+            case Op::GreaterThan:
+                result.push_back(taken ? Fact { right, left, true }
+                                       : Fact { left, right, false });
+                break;
+            case Op::GreaterThanEqual:
+                result.push_back(taken ? Fact { right, left, false }
+                                       : Fact { left, right, true });
+                break;
+            default: break;
+            }
+        }
+    }
+    return m_facts[block] = std::move(result);
+}
+
+bool BoundsChecks::is_below_length(const Ir::Instruction* index,
+    const Ir::Instruction* array, const Ir::Block* block)
+{
+    for (const auto& fact : facts(block))
+        if (fact.strict && unchecked(fact.smaller) == unchecked(index)
+            && is_length(fact.larger, array))
+            return true;
+    return false;
+}
+
+// Phis are non-negative when all their operands are, assuming the phi
+// itself is, which is an induction over the iterations of the loop it
+// counts. Increments by one can't overflow where the incremented value is
+// known to be less than another int.
+bool BoundsChecks::is_non_negative(
+    const Ir::Instruction* value, const Ir::Block* block)
+{
+    value = unchecked(value);
+    if (is_int_constant(value, 0) || m_assumed.count(value))
+        return true;
+    for (const auto& fact : facts(block))
+        if (unchecked(fact.larger) == value
+            && is_int_constant(fact.smaller, fact.strict ? -1 : 0))
+            return true;
+    if (value->type != ValueType::Int)
+        return false;
+    if (value->op == Op::Phi) {
+        m_assumed.insert(value);
+        auto result = true;
+        for (size_t i = 0; i < value->operands.size() && result; i++)
+            result = is_non_negative(
+                value->operands[i], value->block->predecessors[i]);
+        m_assumed.erase(value);
+        return result;
+    }
+    if (value->op == Op::Add) {
+        for (size_t i = 0; i < 2; i++) {
+            const auto increment = value->operands[i];
+            const auto incremented = value->operands[1 - i];
+            if (!is_int_constant(increment, 0)
+                || increment->value.int_value > 1
+                || !is_non_negative(incremented, value->block))
+                continue;
+            if (increment->value.int_value == 0)
+                return true;
+            for (const auto& fact : facts(value->block))
+                if (fact.strict
+                    && unchecked(fact.smaller) == unchecked(incremented))
+                    return true;
+        }
+    }
+    return false;
+}
+
+bool BoundsChecks::is_length(
+    const Ir::Instruction* value, const Ir::Instruction* array) const
+{
+    value = unchecked(value);
+    return value->operands.size() == 1
+        && unchecked(value->operands[0]) == array
+        && calls_builtin(m_module, *value, "len");
+}
+
+}
+
+bool Passes::propagate_constants(Ir::Module&, Ir::Function& function)
+{
+    return ConstantPropagation(function).run();
+}
+
+bool Passes::eliminate_dead_code(Ir::Module& module, Ir::Function& function)
+{
+    auto changed = false;
+    for (auto round = true; round;) {
+        round = remove_dead_instructions(module, function);
+        round |= remove_trivial_phis(function);
+        round |= thread_jumps(function);
+        round |= forward_jumps(function);
+        const auto blocks_count = function.blocks.size();
+        function.sort_blocks();
+        round |= function.blocks.size() != blocks_count;
+        round |= merge_blocks(function);
+        changed |= round;
+    }
+    return changed;
+}
+
+bool Passes::number_values(Ir::Module&, Ir::Function& function)
+{
+    return ValueNumbering(function).run();
+}
+
+bool Passes::eliminate_bounds_checks(
+    Ir::Module& module, Ir::Function& function)
+{
+    return BoundsChecks(module, function).run();
+}
+
+// Operations are visited in order, so the operands of an operation have
+// already become `Map`s when it is. An operand is absorbed by moving its
+// evaluation down to its user, past the instructions in between, which have
+// to be inert or be absorbed as well.
+bool Passes::fuse_array_operations(Ir::Module& module, Ir::Function& function)
+{
+    const auto uses = function.use_counts();
+    auto fused = std::unordered_set<const Ir::Instruction*> {};
+    for (const auto& block : function.blocks) {
+        auto positions = std::unordered_map<const Ir::Instruction*, size_t> {};
+        for (size_t i = 0; i < block->instructions.size(); i++)
+            positions[block->instructions[i].get()] = i;
+        for (size_t i = 0; i < block->instructions.size(); i++) {
+            auto& instruction = *block->instructions[i];
+            const auto kernel = Ir::kernel_op(instruction.op);
+            if (!kernel || instruction.operands[0]->type != ValueType::Array
+                || instruction.operands[1]->type != ValueType::Array)
+                continue;
+            auto absorbed = std::array<bool, 2> { false, false };
+            auto loads = size_t { 0 };
+            for (auto side = size_t { 2 }; side-- > 0;) {
+                const auto operand = instruction.operands[side];
+                const auto operand_loads = operand->op == Op::Map
+                    ? static_cast<size_t>(std::count(
+                        operand->expression.begin(), operand->expression.end(),
+                        Kernels::Op::Load))
+                    : size_t { 1 };
+                const auto position = positions.find(operand);
+                absorbed[side] = operand->op == Op::Map
+                    && position != positions.end() && uses.at(operand) == 1
+                    && loads + operand_loads + side <= Kernels::max_operands;
+                for (auto j = absorbed[side] ? position->second + 1 : i; j < i;
+                     j++) {
+                    const auto between = block->instructions[j].get();
+                    if (!fused.count(between) && !is_inert(module, *between)
+                        && !(side == 0 && absorbed[1]
+                            && between == instruction.operands[1]))
+                        absorbed[side] = false;
+                }
+                loads += absorbed[side] ? operand_loads : 1;
+            }
+            auto expression = Kernels::Expression {};
+            auto operands = std::vector<Ir::Instruction*> {};
+            for (size_t side = 0; side < 2; side++) {
+                const auto operand = instruction.operands[side];
+                if (!absorbed[side]) {
+                    expression.push_back(Kernels::Op::Load);
+                    operands.push_back(operand);
+                    continue;
+                }
+                expression.insert(expression.end(),
+                    operand->expression.begin(), operand->expression.end());
+                operands.insert(operands.end(), operand->operands.begin(),
+                    operand->operands.end());
+                fused.insert(operand);
+            }
+            expression.push_back(*kernel);
+            instruction.op = Op::Map;
+            instruction.expression = std::move(expression);
+            instruction.operands = std::move(operands);
+            instruction.type = ValueType::Array;
+        }
+    }
+    erase_instructions(function, fused);
+    return !fused.empty();
+}
+
+// Arrays made by `Map`s, operations on arrays and calls to `array` don't
+// escape when they are only read, indexed, stored into, compared, or passed
+// to builtins which don't keep them, through any number of `CheckType`s.
+// Flowing into a phi escapes too, so such an operation only runs again once
+// the array it made last is dead, and the VM and the C backend reuse one
+// slot of its frame for all of them.
+bool Passes::analyze_escapes(Ir::Module& module, Ir::Function& function)
+{
+    auto users = std::unordered_map<const Ir::Instruction*,
+        std::vector<const Ir::Instruction*>> {};
+    for (const auto& block : function.blocks)
+        for (const auto& instruction : block->instructions)
+            for (const auto operand : instruction->operands)
+                users[operand].push_back(instruction.get());
+    const auto escapes = [&](const Ir::Instruction& array) {
+        auto pending = std::vector<const Ir::Instruction*> { &array };
+        while (!pending.empty()) {
+            const auto value = pending.back();
+            pending.pop_back();
+            for (const auto user : users[value]) {
+                if (user->op == Op::CheckType)
+                    pending.push_back(user);
+                else if (may_keep(module, *user, *value))
+                    return true;
+            }
+        }
+        return false;
+    };
+    auto changed = false;
+    for (const auto& block : function.blocks) {
+        for (const auto& instruction : block->instructions) {
+            const auto makes_array = instruction->op == Op::Map
+                || may_make_array(*instruction)
+                || (instruction->operands.size() == 2
+                    && calls_builtin(module, *instruction, "array"));
+            if (!makes_array || instruction->local || escapes(*instruction))
+                continue;
+            instruction->local = true;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+PassManager::PassManager(Passes::InlineOptions inline_options)
+    : m_inline_options { std::move(inline_options) }
+    , m_verify { std::getenv("LPL_VERIFY_IR") != nullptr }
+{
+}
+
+void PassManager::optimize(Ir::Module& module)
+{
+    simplify(module);
+    auto inlined = false;
+    time("inline", [&]() {
+        inlined = Passes::inline_functions(module, m_inline_options);
+    });
+    verify(module, "inline");
+    if (inlined)
+        simplify(module);
+    run(module, "bce", Passes::eliminate_bounds_checks);
+    run(module, "fuse", Passes::fuse_array_operations);
+    run(module, "escape", Passes::analyze_escapes);
+}
+
+void PassManager::simplify(Ir::Module& module)
+{
+    run(module, "sccp", Passes::propagate_constants);
+    run(module, "gvn", Passes::number_values);
+    run(module, "dce", Passes::eliminate_dead_code);
+}
+
+void PassManager::run(Ir::Module& module, const std::string& name, Pass pass)
+{
+    time(name, [&]() {
+        pass(module, *module.main);
+        for (auto& function : module.functions)
+            pass(module, *function);
+    });
+    verify(module, name);
+}
+
+void PassManager::verify(
+    const Ir::Module& module, const std::string& pass) const
+{
+    if (!m_verify)
+        return;
+    Ir::verify(*module.main, pass);
+    for (const auto& function : module.functions)
+        Ir::verify(*function, pass);
+}
+
+void PassManager::time(
+    const std::string& name, const std::function<void()>& phase)
+{
+    m_phases.measure(name, phase);
+}
+
+void PassManager::write_report(std::ostream& out) const
+{
+    auto total = std::chrono::duration<double> {};
+    for (const auto& phase : m_phases.measurements())
+        total += phase.wall;
+    out << std::fixed << std::setprecision(3);
+    out << std::setw(10) << "ms" << std::setw(8) << "%"
+        << "  pass\n";
+    for (const auto& phase : m_phases.measurements()) {
+        out << std::setw(10) << phase.wall.count() * 1000 << std::setw(8)
+            << std::setprecision(1)
+            << (total.count() > 0 ? 100 * phase.wall / total : 0.0)
+            << std::setprecision(3) << "  " << phase.name << "\n";
+    }
+    out << std::setw(10) << total.count() * 1000 << std::setw(8)
+        << std::setprecision(1) << 100.0 << "  total\n";
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "ir.h"
+#include "report.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Optimization passes over the IR, each returns whether it changed the
+// function.
+namespace Passes {
+
+// sparse conditional constant propagation, after Wegman and Zadeck: folds
+// operations whose operands are constant, removes branches on constant
+// conditions along with the blocks only they reach, and records the
+// statically known types of values in `Instruction::type`
+bool propagate_constants(Ir::Module& module, Ir::Function& function);
+
+// removes instructions whose results are unused and which can't fail, then
+// simplifies the control flow graph: trivial phis are removed, blocks are
+// merged into their single predecessor, empty blocks are jumped over, and
+// branches on phis are threaded where the incoming value is known
+bool eliminate_dead_code(Ir::Module& module, Ir::Function& function);
+
+// dominator based global value numbering: pure operations which compute the
+// same value as an operation in a dominating block are replaced by it
+bool number_values(Ir::Module& module, Ir::Function& function);
+
+// range analysis for array accesses: marks an `Index` or `StoreIndex` as in
+// bounds when its index is known to be non-negative and below the length of
+// the array, from the branches dominating it, through the phis and
+// increments of counted loops
+bool eliminate_bounds_checks(Ir::Module& module, Ir::Function& function);
+
+// turns operations on arrays into `Map`s, and fuses those whose only use is
+// another one in the same block into it, so `a * b + c` is evaluated in one
+// pass over the arrays, without an array for `a * b`
+bool fuse_array_operations(Ir::Module& module, Ir::Function& function);
+
+// escape analysis: marks the operations making arrays which can't outlive
+// the frame of the function as `local`, so they are allocated in it instead
+// of the heap
+bool analyze_escapes(Ir::Module& module, Ir::Function& function);
+
+// samples of a profile written by `--profile`, per caller and callee
+struct CallProfile {
+    uint64_t samples { 0 };
+    std::map<std::pair<std::string, std::string>, uint64_t> calls {};
+};
+
+struct InlineOptions {
+    // how many instructions a callee may have, `0` disables inlining
+    size_t budget { 40 };
+    std::optional<CallProfile> profile {};
+};
+
+// reads the collapsed stacks written by `--profile`, every caller directly
+// above a callee in a stack counts as a sampled call
+CallProfile read_call_profile(std::istream& in);
+
+// inlines direct calls to non-recursive functions whose size is within the
+// budget, callees first, so their own calls are inlined before they are.
+// The budget grows with the arguments which are constant at the call site,
+// and with a profile, it grows for hot calls and shrinks for calls which
+// weren't sampled.
+bool inline_functions(Ir::Module& module, const InlineOptions& options);
+
+}
+
+// Runs passes over all functions of a module. With `LPL_VERIFY_IR` set, the
+// IR is verified after each of them.
+class PassManager {
+public:
+    using Pass = bool (*)(Ir::Module& module, Ir::Function& function);
+
+    explicit PassManager(Passes::InlineOptions inline_options = {});
+
+    // the default pipeline, run unless optimizations are disabled with `-O0`:
+    // the functions are simplified, then inlined, and simplified again with
+    // what the call sites know about the arguments, before bounds checks are
+    // eliminated, operations on arrays fused, and escapes analyzed
+    void optimize(Ir::Module& module);
+    void run(Ir::Module& module, const std::string& name, Pass pass);
+    void verify(const Ir::Module& module, const std::string& pass) const;
+    // times phases outside of the passes, like lowering and code generation,
+    // for the report
+    void time(const std::string& name, const std::function<void()>& phase);
+    // for `--time-passes`
+    void write_report(std::ostream& out) const;
+    // for `--time-report`
+    const Report::Phases& phases() const { return m_phases; }
+
+private:
+    void simplify(Ir::Module& module);
+
+    Passes::InlineOptions m_inline_options {};
+    bool m_verify { false };
+    Report::Phases m_phases {};
+};
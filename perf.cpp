@@ -0,0 +1,158 @@
+#include "perf.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#define LPL_PERF_SUPPORTED 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#else
+#define LPL_PERF_SUPPORTED 0
+#endif
+
+namespace {
+
+// see tools/perf/Documentation/jitdump-specification.txt in the linux tree
+constexpr uint32_t jitdump_magic = 0x4A695444;
+constexpr uint32_t jitdump_version = 1;
+constexpr uint32_t jitdump_header_size = 40;
+constexpr uint32_t jitdump_record_header_size = 16;
+constexpr uint32_t elf_machine_x86_64 = 62;
+
+enum class JitdumpRecord : uint32_t {
+    CodeLoad = 0,
+    DebugInfo = 2,
+};
+
+#if LPL_PERF_SUPPORTED
+uint64_t timestamp()
+{
+    auto now = timespec {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000
+        + static_cast<uint64_t>(now.tv_nsec);
+}
+#endif
+
+}
+
+Perf::Perf()
+{
+#if LPL_PERF_SUPPORTED
+    if (std::getenv("LPL_PERF_MAP") != nullptr) {
+        const auto path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+        m_map = std::fopen(path.c_str(), "w");
+    }
+    if (std::getenv("LPL_JITDUMP") != nullptr)
+        open_jitdump();
+#endif
+}
+
+Perf::~Perf()
+{
+#if LPL_PERF_SUPPORTED
+    if (m_map)
+        std::fclose(m_map);
+    if (m_dump_marker)
+        munmap(m_dump_marker, m_dump_marker_size);
+    if (m_dump)
+        std::fclose(m_dump);
+#endif
+}
+
+void Perf::code_loaded(const std::string& name, const void* code,
+    size_t size, const std::string& filename, const std::vector<Line>& lines)
+{
+#if LPL_PERF_SUPPORTED
+    const auto address = reinterpret_cast<uint64_t>(code);
+    if (m_map) {
+        std::fprintf(m_map, "%llx %zx %s\n",
+            static_cast<unsigned long long>(address), size, name.c_str());
+        std::fflush(m_map);
+    }
+    if (!m_dump)
+        return;
+
+    // debug info has to precede the code it describes
+    if (!lines.empty()) {
+        const auto entries_size = lines.size() * (16 + filename.size() + 1);
+        write(JitdumpRecord::DebugInfo);
+        write(static_cast<uint32_t>(
+            jitdump_record_header_size + 16 + entries_size));
+        write(timestamp());
+        write(address);
+        write(static_cast<uint64_t>(lines.size()));
+        for (const auto& line : lines) {
+            write(reinterpret_cast<uint64_t>(line.address));
+            write(line.row);
+            write(uint32_t { 0 });
+            write(filename.c_str(), filename.size() + 1);
+        }
+    }
+
+    write(JitdumpRecord::CodeLoad);
+    write(static_cast<uint32_t>(
+        jitdump_record_header_size + 40 + name.size() + 1 + size));
+    write(timestamp());
+    write(static_cast<uint32_t>(getpid()));
+    write(static_cast<uint32_t>(syscall(SYS_gettid)));
+    write(address);
+    write(address);
+    write(static_cast<uint64_t>(size));
+    write(m_code_index++);
+    write(name.c_str(), name.size() + 1);
+    write(code, size);
+    std::fflush(m_dump);
+#else
+    (void)name;
+    (void)code;
+    (void)size;
+    (void)filename;
+    (void)lines;
+#endif
+}
+
+void Perf::open_jitdump()
+{
+#if LPL_PERF_SUPPORTED
+    const auto path = "/tmp/jit-" + std::to_string(getpid()) + ".dump";
+    const auto fd = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd < 0)
+        return;
+    // perf finds the dump through an executable mapping of the file
+    m_dump_marker_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    m_dump_marker = mmap(nullptr, m_dump_marker_size, PROT_READ | PROT_EXEC,
+        MAP_PRIVATE, fd, 0);
+    if (m_dump_marker == MAP_FAILED) {
+        m_dump_marker = nullptr;
+        close(fd);
+        return;
+    }
+    m_dump = fdopen(fd, "wb");
+    if (!m_dump) {
+        close(fd);
+        return;
+    }
+    write(jitdump_magic);
+    write(jitdump_version);
+    write(jitdump_header_size);
+    write(elf_machine_x86_64);
+    write(uint32_t { 0 });
+    write(static_cast<uint32_t>(getpid()));
+    write(timestamp());
+    write(uint64_t { 0 });
+    std::fflush(m_dump);
+#endif
+}
+
+void Perf::write(const void* data, size_t size)
+{
+    std::fwrite(data, 1, size, m_dump);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Makes code generated at runtime visible to Linux `perf`.
+//
+// Setting `LPL_PERF_MAP` writes `/tmp/perf-<pid>.map`, which `perf report`
+// uses to symbolize samples in generated code.
+// Setting `LPL_JITDUMP` writes `/tmp/jit-<pid>.dump` in perf's jitdump
+// format, which also carries the code itself and line numbers. Record with
+// `perf record -k 1` and run `perf inject --jit` on the result to use it.
+class Perf {
+public:
+    struct Line {
+        const void* address;
+        uint32_t row;
+    };
+
+    Perf();
+    ~Perf();
+    Perf(const Perf&) = delete;
+    Perf& operator=(const Perf&) = delete;
+
+    bool enabled() const { return m_map || m_dump; }
+    // `lines` are sorted by address and refer to rows in `filename`
+    void code_loaded(const std::string& name, const void* code, size_t size,
+        const std::string& filename, const std::vector<Line>& lines);
+
+private:
+    void open_jitdump();
+    void write(const void* data, size_t size);
+    template <typename T> void write(const T& value)
+    {
+        write(&value, sizeof(value));
+    }
+
+    std::FILE* m_map { nullptr };
+    std::FILE* m_dump { nullptr };
+    void* m_dump_marker { nullptr };
+    size_t m_dump_marker_size { 0 };
+    uint64_t m_code_index { 0 };
+};
@@ -0,0 +1,155 @@
+#include "profiler.h"
+#include "bytecode.h"
+#include <algorithm>
+#include <csignal>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined(__unix__)
+#define LPL_PROFILER_SUPPORTED 1
+#include <sys/time.h>
+#else
+#define LPL_PROFILER_SUPPORTED 0
+#endif
+
+volatile std::sig_atomic_t Profiler::sample_pending = 0;
+
+namespace {
+
+#if LPL_PROFILER_SUPPORTED
+void handle_sigprof(int) { Profiler::sample_pending = 1; }
+
+void set_timer(uint32_t interval_us)
+{
+    auto timer = itimerval {};
+    timer.it_interval.tv_sec = interval_us / 1000000;
+    timer.it_interval.tv_usec = interval_us % 1000000;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+}
+#endif
+
+double percent(uint64_t count, uint64_t total)
+{
+    return total == 0 ? 0.0 : 100.0 * static_cast<double>(count)
+            / static_cast<double>(total);
+}
+
+double milliseconds(uint64_t samples)
+{
+    return static_cast<double>(samples) * Profiler::interval_us / 1000.0;
+}
+
+}
+
+Profiler::~Profiler() { stop(); }
+
+void Profiler::start()
+{
+#if LPL_PROFILER_SUPPORTED
+    struct sigaction action = {};
+    action.sa_handler = handle_sigprof;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, nullptr);
+    set_timer(interval_us);
+    m_running = true;
+#endif
+}
+
+void Profiler::stop()
+{
+#if LPL_PROFILER_SUPPORTED
+    if (!m_running)
+        return;
+    set_timer(0);
+    signal(SIGPROF, SIG_IGN);
+    sample_pending = 0;
+    m_running = false;
+#endif
+}
+
+void Profiler::record(const std::vector<Frame>& stack, bool truncated)
+{
+    if (stack.empty())
+        return;
+    m_samples++;
+    auto collapsed = std::string { truncated ? "[truncated];" : "" };
+    auto seen = std::vector<std::string> {};
+    for (size_t i = 0; i < stack.size(); i++) {
+        const auto name = frame_name(stack[i]);
+        if (i > 0)
+            collapsed += ";";
+        collapsed += name;
+        // recursive functions count once towards their total
+        if (std::find(seen.begin(), seen.end(), name) == seen.end()) {
+            m_total[name]++;
+            seen.push_back(name);
+        }
+    }
+    m_stacks[collapsed]++;
+
+    const auto& top = stack.back();
+    m_self[frame_name(top)]++;
+    const auto position = top.native
+        ? top.function->position
+        : top.function->position_of(top.ip).value_or(top.function->position);
+    m_lines[Line { top.function, position }]++;
+}
+
+void Profiler::write_collapsed(std::ostream& out) const
+{
+    for (const auto& [stack, count] : m_stacks)
+        out << stack << " " << count << "\n";
+}
+
+void Profiler::write_report(
+    std::ostream& out, const std::string& filename) const
+{
+    out << "Profile of " << filename << ": " << m_samples << " samples, "
+        << milliseconds(m_samples) << " ms\n\n";
+
+    auto functions = std::vector<std::pair<std::string, uint64_t>>(
+        m_self.begin(), m_self.end());
+    for (const auto& [name, count] : m_total) {
+        if (m_self.find(name) == m_self.end())
+            functions.push_back({ name, 0 });
+    }
+    std::stable_sort(functions.begin(), functions.end(),
+        [&](const auto& a, const auto& b) {
+            return std::pair(a.second, m_total.at(a.first))
+                > std::pair(b.second, m_total.at(b.first));
+        });
+    out << std::fixed << std::setprecision(1);
+    out << std::setw(8) << "self %" << std::setw(9) << "total %"
+        << std::setw(10) << "self ms"
+        << "  function\n";
+    for (const auto& [name, count] : functions) {
+        out << std::setw(8) << percent(count, m_samples) << std::setw(9)
+            << percent(m_total.at(name), m_samples) << std::setw(10)
+            << milliseconds(count) << "  " << name << "\n";
+    }
+
+    auto lines = std::vector<std::pair<Line, uint64_t>>(
+        m_lines.begin(), m_lines.end());
+    std::stable_sort(lines.begin(), lines.end(),
+        [](const auto& a, const auto& b) { return a.second > b.second; });
+    out << "\n"
+        << std::setw(8) << "self %" << std::setw(10) << "self ms"
+        << "  line\n";
+    for (const auto& [line, count] : lines) {
+        out << std::setw(8) << percent(count, m_samples) << std::setw(10)
+            << milliseconds(count) << "  " << filename << ":"
+            << line.position.row << ":" << line.position.col << " in "
+            << line.function->name << "\n";
+    }
+}
+
+std::string Profiler::frame_name(const Frame& frame)
+{
+    return frame.native ? frame.function->name + " [jit]"
+                        : frame.function->name;
+}
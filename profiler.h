@@ -0,0 +1,69 @@
+#pragma once
+
+#include "bytecode.h"
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// Sampling profiler for lpl programs, enabled with `--profile`.
+//
+// A `SIGPROF` timer only sets `sample_pending`, the VM checks it before each
+// instruction and records the lpl call stack when it is set. Samples taken
+// while native code from the JIT runs are recorded once it returns, with the
+// compiled function as the innermost frame.
+class Profiler {
+public:
+    static constexpr uint32_t interval_us = 1000;
+    // deeper stacks keep their innermost frames
+    static constexpr size_t max_depth = 256;
+
+    struct Frame {
+        const Bytecode::Function* function;
+        // the instruction being executed, or the call instruction in callers
+        size_t ip;
+        bool native;
+    };
+
+    static volatile std::sig_atomic_t sample_pending;
+
+    Profiler() = default;
+    ~Profiler();
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    void start();
+    void stop();
+    // `stack` is ordered outermost first
+    void record(const std::vector<Frame>& stack, bool truncated);
+
+    // one line per stack, e.g. `main;fib;fib 12`, for flamegraph tooling
+    void write_collapsed(std::ostream& out) const;
+    void write_report(std::ostream& out, const std::string& filename) const;
+
+private:
+    struct Line {
+        const Bytecode::Function* function;
+        Bytecode::SourcePosition position;
+
+        bool operator<(const Line& other) const
+        {
+            return std::tuple(function, position.row, position.col)
+                < std::tuple(
+                    other.function, other.position.row, other.position.col);
+        }
+    };
+
+    static std::string frame_name(const Frame& frame);
+
+    bool m_running { false };
+    uint64_t m_samples { 0 };
+    std::map<std::string, uint64_t> m_stacks {};
+    std::map<std::string, uint64_t> m_self {};
+    std::map<std::string, uint64_t> m_total {};
+    std::map<Line, uint64_t> m_lines {};
+};
@@ -0,0 +1,300 @@
+#include "report.h"
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+#include <new>
+#include <ostream>
+#include <string>
+#include <utility>
+
+namespace Report {
+
+namespace {
+
+    // plain integers, so they can be used before the thread is set up
+    thread_local size_t allocated_bytes = 0;
+    thread_local size_t allocations_count = 0;
+    // CPU time of the threads which worked on behalf of this one
+    thread_local double inherited_cpu = 0;
+
+    std::chrono::duration<double> thread_cpu_time()
+    {
+#if defined(__unix__)
+        auto time = timespec {};
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+        return std::chrono::duration<double>(static_cast<double>(time.tv_sec)
+            + static_cast<double>(time.tv_nsec) / 1e9);
+#else
+        return std::chrono::duration<double>(
+            static_cast<double>(std::clock()) / CLOCKS_PER_SEC);
+#endif
+    }
+
+    double milliseconds(std::chrono::duration<double> duration)
+    {
+        return duration.count() * 1000;
+    }
+
+    void write_json_string(std::ostream& out, const std::string& value)
+    {
+        out << '"';
+        for (const auto c : value) {
+            if (c == '"' || c == '\\')
+                out << '\\' << c;
+            else if (static_cast<unsigned char>(c) < 0x20)
+                out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+                    << static_cast<int>(c) << std::dec << std::setfill(' ');
+            else
+                out << c;
+        }
+        out << '"';
+    }
+
+    void write_json_measurement(std::ostream& out, const Measurement& phase)
+    {
+        out << "{\"name\": ";
+        write_json_string(out, phase.name);
+        out << ", \"wall_ms\": " << milliseconds(phase.wall)
+            << ", \"cpu_ms\": " << milliseconds(phase.usage.cpu)
+            << ", \"bytes\": " << phase.usage.bytes
+            << ", \"allocations\": " << phase.usage.allocations;
+        if (phase.count) {
+            out << ", ";
+            write_json_string(out, phase.count->first);
+            out << ": " << phase.count->second;
+        }
+        out << "}";
+    }
+
+    Measurement total(const std::vector<Measurement>& measurements)
+    {
+        auto result = Measurement { "total" };
+        for (const auto& phase : measurements) {
+            result.wall += phase.wall;
+            result.usage.cpu += phase.usage.cpu;
+            result.usage.bytes += phase.usage.bytes;
+            result.usage.allocations += phase.usage.allocations;
+        }
+        return result;
+    }
+
+}
+
+Usage Usage::operator-(const Usage& other) const
+{
+    return { cpu - other.cpu, bytes - other.bytes,
+        allocations - other.allocations };
+}
+
+Usage usage()
+{
+    return { thread_cpu_time() + std::chrono::duration<double>(inherited_cpu),
+        allocated_bytes, allocations_count };
+}
+
+void inherit(const Usage& usage)
+{
+    inherited_cpu += usage.cpu.count();
+    allocated_bytes += usage.bytes;
+    allocations_count += usage.allocations;
+}
+
+Measurement& Phases::measure(
+    const std::string& name, const std::function<void()>& phase)
+{
+    {
+        const auto timer = Timer(*this, name);
+        phase();
+    }
+    return m_measurements.back();
+}
+
+void Phases::add(Measurement measurement)
+{
+    m_measurements.push_back(std::move(measurement));
+}
+
+void Phases::append(const Phases& other)
+{
+    m_measurements.insert(m_measurements.end(), other.m_measurements.begin(),
+        other.m_measurements.end());
+}
+
+void Phases::write_text(std::ostream& out) const
+{
+    const auto write = [&](const Measurement& phase) {
+        out << std::setw(10) << milliseconds(phase.wall) << std::setw(10)
+            << milliseconds(phase.usage.cpu) << std::setw(12)
+            << static_cast<double>(phase.usage.bytes) / 1024 << std::setw(10)
+            << phase.usage.allocations << "  " << phase.name;
+        if (phase.count)
+            out << " (" << phase.count->second << " " << phase.count->first
+                << ")";
+        out << "\n";
+    };
+    out << std::fixed << std::setprecision(3);
+    out << std::setw(10) << "wall ms" << std::setw(10) << "cpu ms"
+        << std::setw(12) << "alloc KB" << std::setw(10) << "allocs"
+        << "  phase\n";
+    for (const auto& phase : m_measurements)
+        write(phase);
+    write(total(m_measurements));
+}
+
+void Phases::write_json(std::ostream& out, const std::string& filename) const
+{
+    out << "{\"file\": ";
+    write_json_string(out, filename);
+    out << ", \"phases\": [";
+    for (size_t i = 0; i < m_measurements.size(); i++) {
+        out << (i > 0 ? ", " : "");
+        write_json_measurement(out, m_measurements[i]);
+    }
+    out << "], \"total\": ";
+    write_json_measurement(out, total(m_measurements));
+    out << "}";
+}
+
+Timer::Timer(Phases& phases, std::string name)
+    : m_phases { phases }
+    , m_name { std::move(name) }
+    , m_start { std::chrono::steady_clock::now() }
+    , m_start_usage { usage() }
+{
+}
+
+Timer::~Timer()
+{
+    const auto wall = std::chrono::steady_clock::now() - m_start;
+    m_phases.add({ std::move(m_name), wall, usage() - m_start_usage });
+}
+
+}
+
+// The counting allocator. Every form of `new` and `delete` is replaced, since
+// the runtimes of sanitizers replace each of them too.
+#if !defined(_MSC_VER)
+
+void* operator new(std::size_t size)
+{
+    Report::allocated_bytes += size;
+    Report::allocations_count++;
+    while (true) {
+        if (const auto memory = std::malloc(size > 0 ? size : 1))
+            return memory;
+        const auto handler = std::get_new_handler();
+        if (!handler)
+            throw std::bad_alloc {};
+        handler();
+    }
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    Report::allocated_bytes += size;
+    Report::allocations_count++;
+    const auto align = std::max(static_cast<size_t>(alignment), sizeof(void*));
+    // `aligned_alloc` takes a multiple of the alignment
+    size = (std::max(size, size_t { 1 }) + align - 1) / align * align;
+    while (true) {
+        if (const auto memory = std::aligned_alloc(align, size))
+            return memory;
+        const auto handler = std::get_new_handler();
+        if (!handler)
+            throw std::bad_alloc {};
+        handler();
+    }
+}
+
+void* operator new[](std::size_t size) { return ::operator new(size); }
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return ::operator new(size, alignment);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    try {
+        return ::operator new(size);
+    } catch (const std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment,
+    const std::nothrow_t&) noexcept
+{
+    try {
+        return ::operator new(size, alignment);
+    } catch (const std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return ::operator new(size, std::nothrow);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment,
+    const std::nothrow_t&) noexcept
+{
+    return ::operator new(size, alignment, std::nothrow);
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+
+void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+
+void operator delete(void* memory, std::align_val_t) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, const std::nothrow_t&) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(
+    void* memory, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept { std::free(memory); }
+
+void operator delete[](void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory, std::align_val_t) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory, std::size_t, std::align_val_t) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory, const std::nothrow_t&) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](
+    void* memory, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    std::free(memory);
+}
+
+#endif
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Instrumentation for `--time-report`: the wall and CPU time each phase of
+// the compiler took, and the memory it allocated.
+//
+// Allocations are counted by replacing the global `operator new`, per thread,
+// so phases compiling other files of a batch at the same time aren't counted.
+// What the threads started by `Parallel::for_each` used is added to the
+// thread which started them once they are done.
+namespace Report {
+
+// what the current thread used so far
+struct Usage {
+    std::chrono::duration<double> cpu {};
+    size_t bytes { 0 };
+    size_t allocations { 0 };
+
+    Usage operator-(const Usage& other) const;
+};
+
+Usage usage();
+// adds what another thread used on behalf of the current one
+void inherit(const Usage& usage);
+
+struct Measurement {
+    std::string name;
+    std::chrono::duration<double> wall {};
+    Usage usage {};
+    // what the phase made, like tokens or nodes, and how many
+    std::optional<std::pair<std::string, size_t>> count {};
+};
+
+class Phases {
+public:
+    // runs and measures `phase`, the measurement is valid until the next one
+    // is added
+    Measurement& measure(
+        const std::string& name, const std::function<void()>& phase);
+    void add(Measurement measurement);
+    void append(const Phases& other);
+    const std::vector<Measurement>& measurements() const
+    {
+        return m_measurements;
+    }
+
+    void write_text(std::ostream& out) const;
+    // an object of the file and its phases
+    void write_json(std::ostream& out, const std::string& filename) const;
+
+private:
+    std::vector<Measurement> m_measurements {};
+};
+
+// measures what happens while it is in scope
+class Timer {
+public:
+    Timer(Phases& phases, std::string name);
+    ~Timer();
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+private:
+    Phases& m_phases;
+    std::string m_name;
+    std::chrono::steady_clock::time_point m_start;
+    Usage m_start_usage;
+};
+
+}
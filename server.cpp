@@ -0,0 +1,654 @@
+#include "server.h"
+#include "driver.h"
+#include "error.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#if defined(__unix__)
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#if defined(__unix__)
+
+bool write_all(int fd, const void* data, size_t size)
+{
+    auto bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        const auto written = write(fd, bytes, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        bytes += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+bool read_all(int fd, void* data, size_t size)
+{
+    auto bytes = static_cast<char*>(data);
+    while (size > 0) {
+        const auto count = read(fd, bytes, size);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        bytes += count;
+        size -= static_cast<size_t>(count);
+    }
+    return true;
+}
+
+// of the working directory and the arguments of a request, far more than
+// any invocation needs, so a client can't have the server allocate more
+constexpr auto max_request_size = uint64_t { 4 << 20 };
+
+void close_on_exec(int fd) { fcntl(fd, F_SETFD, FD_CLOEXEC); }
+
+// a byte is written to it whenever a child exits, so the server can wait
+// for its program and its client at once
+int child_exits[2] = { -1, -1 };
+
+void on_child_exit(int)
+{
+    const auto saved = errno;
+    if (write(child_exits[1], "", 1) < 0) { }
+    errno = saved;
+}
+
+// the user on the other end of a connection
+std::optional<uid_t> peer_uid(int connection)
+{
+#if defined(SO_PEERCRED)
+    auto credentials = ucred {};
+    auto size = socklen_t { sizeof(credentials) };
+    if (getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &credentials, &size)
+        != 0)
+        return std::nullopt;
+    return credentials.uid;
+#else
+    auto uid = uid_t {};
+    auto gid = gid_t {};
+    if (getpeereid(connection, &uid, &gid) != 0)
+        return std::nullopt;
+    return uid;
+#endif
+}
+
+// where the socket goes without `$LPL_SOCKET` or `$XDG_RUNTIME_DIR`
+std::string private_directory()
+{
+    return "/tmp/lplc-" + std::to_string(getuid());
+}
+
+// whether only the user can get at what is in `path`, a directory
+bool is_private(const std::string& path)
+{
+    struct stat status { };
+    return lstat(path.c_str(), &status) == 0 && S_ISDIR(status.st_mode)
+        && status.st_uid == getuid() && (status.st_mode & 077) == 0;
+}
+
+// whether the socket at `path` is in the private directory, when it should
+// be, which another user may have made first
+bool is_in_private_directory(const std::string& path)
+{
+    const auto directory = std::filesystem::path(path).parent_path().string();
+    return directory != private_directory() || is_private(directory);
+}
+
+std::optional<sockaddr_un> socket_address(const std::string& path)
+{
+    auto address = sockaddr_un {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+        return std::nullopt;
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+// writes straight to a file descriptor, the client's stdout or stderr
+class FdBuffer : public std::streambuf {
+public:
+    explicit FdBuffer(int fd)
+        : m_fd { fd }
+    {
+    }
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        if (traits_type::eq_int_type(c, traits_type::eof()))
+            return traits_type::not_eof(c);
+        const auto ch = traits_type::to_char_type(c);
+        return xsputn(&ch, 1) == 1 ? c : traits_type::eof();
+    }
+    std::streamsize xsputn(const char* data, std::streamsize size) override
+    {
+        return write_all(m_fd, data, static_cast<size_t>(size)) ? size : 0;
+    }
+
+private:
+    int m_fd;
+};
+
+#endif
+
+}
+
+std::string socket_path(const std::string& arg)
+{
+    if (const auto equals = arg.find('='); equals != std::string::npos)
+        return arg.substr(equals + 1);
+    if (const auto path = std::getenv("LPL_SOCKET"))
+        return path;
+    if (const auto directory = std::getenv("XDG_RUNTIME_DIR"))
+        return (std::filesystem::path(directory) / "lplc.sock").string();
+#if defined(__unix__)
+    // in a world-writable directory another user could listen on it first
+    const auto directory = private_directory();
+    mkdir(directory.c_str(), 0700);
+    return directory + "/lplc.sock";
+#else
+    return "lplc.sock";
+#endif
+}
+
+#if defined(__unix__)
+
+// A request is the size of its payload sent along with the client's stdout
+// and stderr, then the payload, the working directory and the arguments,
+// each ended by a null byte. The reply is the exit status. The server hangs
+// up on payloads over `max_request_size`, so clients handle those themselves.
+std::optional<int> forward_to_server(
+    const std::string& path, const std::vector<std::string>& args)
+{
+    const auto address = socket_address(path);
+    if (!address || !is_in_private_directory(path))
+        return std::nullopt;
+    const auto connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0)
+        return std::nullopt;
+    if (connect(connection, reinterpret_cast<const sockaddr*>(&*address),
+            sizeof(*address))
+        != 0) {
+        close(connection);
+        return std::nullopt;
+    }
+    // the server gets the working directory and the outputs
+    if (peer_uid(connection) != getuid()) {
+        std::cerr << "warning: ignoring the server at " << path
+                  << ", run by another user\n";
+        close(connection);
+        return std::nullopt;
+    }
+    auto payload = std::filesystem::current_path().string();
+    payload.push_back('\0');
+    for (const auto& arg : args) {
+        payload += arg;
+        payload.push_back('\0');
+    }
+    if (payload.size() > max_request_size) {
+        close(connection);
+        return std::nullopt;
+    }
+
+    auto size = static_cast<uint64_t>(payload.size());
+    auto part = iovec { &size, sizeof(size) };
+    int fds[] = { STDOUT_FILENO, STDERR_FILENO };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] {};
+    auto message = msghdr {};
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    const auto header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(header), fds, sizeof(fds));
+    std::cout << std::flush;
+    auto status = int32_t { 1 };
+    if (sendmsg(connection, &message, 0) != static_cast<ssize_t>(sizeof(size))
+        || !write_all(connection, payload.data(), payload.size())
+        || !read_all(connection, &status, sizeof(status))) {
+        std::cerr << "fatal: the server at " << path << " hung up\n";
+        status = 1;
+    }
+    close(connection);
+    return status;
+}
+
+std::optional<CompileServer::Request> CompileServer::receive(int connection)
+{
+    auto size = uint64_t { 0 };
+    auto part = iovec { &size, sizeof(size) };
+    alignas(cmsghdr) char control[CMSG_SPACE(2 * sizeof(int))] {};
+    auto message = msghdr {};
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    if (recvmsg(connection, &message, 0) != static_cast<ssize_t>(sizeof(size)))
+        return std::nullopt;
+    const auto header = CMSG_FIRSTHDR(&message);
+    if (!header || header->cmsg_type != SCM_RIGHTS
+        || header->cmsg_len != CMSG_LEN(2 * sizeof(int)))
+        return std::nullopt;
+    int fds[2];
+    std::memcpy(fds, CMSG_DATA(header), sizeof(fds));
+    close_on_exec(fds[0]);
+    close_on_exec(fds[1]);
+    if (size > max_request_size) {
+        close(fds[0]);
+        close(fds[1]);
+        return std::nullopt;
+    }
+
+    auto payload = std::string(size, '\0');
+    if (!read_all(connection, payload.data(), payload.size())) {
+        close(fds[0]);
+        close(fds[1]);
+        return std::nullopt;
+    }
+    auto request = Request { {}, {}, fds[0], fds[1], connection };
+    auto parts = std::istringstream(payload);
+    std::getline(parts, request.directory, '\0');
+    for (auto arg = std::string {}; std::getline(parts, arg, '\0');)
+        request.args.push_back(arg);
+    return request;
+}
+
+int CompileServer::serve()
+{
+    const auto address = socket_address(m_socket_path);
+    if (!address) {
+        std::cerr << "fatal: socket path " << m_socket_path
+                  << " is too long\n";
+        return 1;
+    }
+    if (!is_in_private_directory(m_socket_path)) {
+        std::cerr << "fatal: "
+                  << std::filesystem::path(m_socket_path).parent_path().string()
+                  << " must be a directory only its owner can access\n";
+        return 1;
+    }
+    m_listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_listener < 0) {
+        std::cerr << "fatal: " << std::strerror(errno) << "\n";
+        return 1;
+    }
+    close_on_exec(m_listener);
+    // left behind by a server which was killed
+    unlink(m_socket_path.c_str());
+    if (bind(m_listener, reinterpret_cast<const sockaddr*>(&*address),
+            sizeof(*address))
+            != 0
+        || listen(m_listener, SOMAXCONN) != 0) {
+        std::cerr << "fatal: can't listen on " << m_socket_path << ": "
+                  << std::strerror(errno) << "\n";
+        close(m_listener);
+        return 1;
+    }
+    // a client going away mustn't take the server down
+    std::signal(SIGPIPE, SIG_IGN);
+    if (pipe(child_exits) != 0) {
+        std::cerr << "fatal: " << std::strerror(errno) << "\n";
+        close(m_listener);
+        return 1;
+    }
+    for (const auto fd : child_exits) {
+        close_on_exec(fd);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    std::signal(SIGCHLD, on_child_exit);
+    std::cout << "Listening on " << m_socket_path << "\n" << std::flush;
+    while (true) {
+        auto events = std::vector<pollfd> { { m_listener, POLLIN, 0 },
+            { child_exits[0], POLLIN, 0 } };
+        // clients send nothing more, so a connection only becomes readable
+        // once its client hangs up, killed or interrupted while it waits
+        for (const auto& child : m_children) {
+            if (!child.killed)
+                events.push_back({ child.request.connection, POLLIN, 0 });
+        }
+        if (poll(events.data(), events.size(), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "fatal: " << std::strerror(errno) << "\n";
+            close(m_listener);
+            return 1;
+        }
+        for (auto byte = char {}; read(child_exits[0], &byte, 1) > 0;) { }
+        auto hung_up = events.begin() + 2;
+        for (auto& child : m_children) {
+            if (child.killed)
+                continue;
+            if ((hung_up++)->revents != 0) {
+                kill(-child.pid, SIGKILL);
+                child.killed = true;
+            }
+        }
+        reap_children();
+        if (events[0].revents != 0)
+            accept_request();
+    }
+}
+
+void CompileServer::accept_request()
+{
+    const auto connection = accept(m_listener, nullptr, nullptr);
+    if (connection < 0)
+        return;
+    close_on_exec(connection);
+    // other users could otherwise have programs run as this one
+    if (peer_uid(connection) != getuid()) {
+        close(connection);
+        return;
+    }
+    // clients send their request right away, one which doesn't only holds
+    // up the server this long
+    auto timeout = timeval { 5, 0 };
+    setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    const auto request = receive(connection);
+    if (!request) {
+        close(connection);
+        return;
+    }
+    if (const auto status = handle(*request))
+        reply(*request, *status);
+}
+
+void CompileServer::reply(const Request& request, int status)
+{
+    close(request.out);
+    close(request.err);
+    const auto reply = static_cast<int32_t>(status);
+    write_all(request.connection, &reply, sizeof(reply));
+    close(request.connection);
+    std::cout << "lplc";
+    for (const auto& arg : request.args)
+        std::cout << " " << arg;
+    std::cout << ": " << status << "\n" << std::flush;
+}
+
+void CompileServer::reap_children()
+{
+    for (auto child = m_children.begin(); child != m_children.end();) {
+        auto status = 0;
+        const auto waited = waitpid(child->pid, &status, WNOHANG);
+        if (waited == 0 || (waited < 0 && errno == EINTR)) {
+            ++child;
+            continue;
+        }
+        if (waited < 0)
+            reply(child->request, 1);
+        else if (WIFSIGNALED(status))
+            reply(child->request, 128 + WTERMSIG(status));
+        else
+            reply(child->request, WEXITSTATUS(status));
+        child = m_children.erase(child);
+    }
+}
+
+std::optional<int> CompileServer::handle(const Request& request)
+{
+    auto err_buffer = FdBuffer(request.err);
+    auto err = std::ostream(&err_buffer);
+    // whatever escapes a request fails it, not the server
+    try {
+        return dispatch(request, err);
+    } catch (const InternalError& error) {
+        err << error.what();
+    } catch (const std::exception& error) {
+        err << "fatal: " << error.what() << "\n";
+    } catch (...) {
+        err << "fatal: unknown error\n";
+    }
+    return 1;
+}
+
+std::optional<int> CompileServer::dispatch(
+    const Request& request, std::ostream& err)
+{
+    auto directory_error = std::error_code {};
+    std::filesystem::current_path(request.directory, directory_error);
+    if (directory_error) {
+        err << "fatal: " << request.directory << ": "
+            << directory_error.message() << "\n";
+        return 1;
+    }
+    auto options = Options {};
+    try {
+        options = parse_options(request.args);
+    } catch (const CompileError& error) {
+        err << error.what();
+        return 1;
+    }
+    if (options.inputs.empty()) {
+        write_usage(err);
+        return 1;
+    }
+    auto input_error = std::error_code {};
+    const auto is_batch = options.inputs.size() > 1
+        || std::filesystem::is_directory(options.inputs.front(), input_error);
+    if (!is_cacheable(options)
+        || (is_batch && (options.output || options.profile)))
+        return run_in_child(request, [&]() { return drive(options); });
+    if (is_batch)
+        return compile_batch(options, request);
+    options.filename = options.inputs.front();
+    return compile_and_run(options, request);
+}
+
+int CompileServer::compile_batch(
+    const Options& options, const Request& request)
+{
+    const auto files = batch_files(options.inputs);
+    auto file_options = std::vector<Options>(files.size(), options);
+    auto results = std::vector<BatchResult>(files.size());
+    auto states = std::vector<std::optional<FileState>>(files.size());
+    auto stale = std::vector<size_t> {};
+    for (size_t i = 0; i < files.size(); i++) {
+        file_options[i].filename = files[i];
+        const auto found = m_batches.find(cache_key(file_options[i]));
+        if (found != m_batches.end()
+            && is_fresh(files[i], found->second.file)) {
+            results[i] = found->second.result;
+        } else {
+            // before compiling, so a change while it does is seen next time
+            states[i] = file_state(files[i]);
+            stale.push_back(i);
+        }
+    }
+    Parallel::for_each(stale.size(), options.jobs, [&](size_t i) {
+        results[stale[i]] = compile_batch_file(file_options[stale[i]]);
+    });
+    for (const auto i : stale) {
+        if (states[i])
+            m_batches[cache_key(file_options[i])] = { *states[i], results[i] };
+    }
+    auto out_buffer = FdBuffer(request.out);
+    auto out = std::ostream(&out_buffer);
+    auto err_buffer = FdBuffer(request.err);
+    auto err = std::ostream(&err_buffer);
+    return write_batch_results(files, results, out, err);
+}
+
+std::optional<int> CompileServer::compile_and_run(
+    const Options& options, const Request& request)
+{
+    const auto key = cache_key(options);
+    auto found = m_programs.find(key);
+    if (found == m_programs.end()
+        || !is_fresh(options.filename, found->second.file)) {
+        auto entry = ProgramEntry {};
+        // unreadable files are compiled, and fail, each time
+        entry.file = file_state(options.filename).value_or(FileState {});
+        auto output = std::ostringstream {};
+        auto errors = std::ostringstream {};
+        try {
+            entry.compiled = std::make_unique<Compiled>(
+                compile(options, output, errors));
+        } catch (const CompileError& error) {
+            entry.error = error.what();
+        } catch (const InternalError& error) {
+            entry.error = error.what();
+        }
+        entry.output = output.str();
+        found = m_programs.insert_or_assign(key, std::move(entry)).first;
+    }
+    const auto& entry = found->second;
+    {
+        auto out_buffer = FdBuffer(request.out);
+        auto out = std::ostream(&out_buffer);
+        out << entry.output << std::flush;
+    }
+    if (entry.error) {
+        auto err_buffer = FdBuffer(request.err);
+        auto err = std::ostream(&err_buffer);
+        err << *entry.error << std::flush;
+        return 1;
+    }
+    if (options.check || options.emit == Emit::Ir)
+        return 0;
+    // the VM changes the bytecode as it runs, which only the child sees
+    return run_in_child(
+        request, [&]() { return run(options, *entry.compiled); });
+}
+
+std::optional<int> CompileServer::run_in_child(
+    const Request& request, const std::function<int()>& run)
+{
+    std::cout << std::flush;
+    std::cerr << std::flush;
+    const auto pid = fork();
+    if (pid < 0) {
+        auto err_buffer = FdBuffer(request.err);
+        auto err = std::ostream(&err_buffer);
+        err << "fatal: " << std::strerror(errno) << "\n";
+        return 1;
+    }
+    if (pid == 0) {
+        std::signal(SIGPIPE, SIG_DFL);
+        std::signal(SIGCHLD, SIG_DFL);
+        // in a group of its own, which is killed along with what it started
+        setpgid(0, 0);
+        // the outputs of the other clients see their end once the server
+        // is done with them, not once this child is
+        close(m_listener);
+        for (const auto& child : m_children) {
+            close(child.request.out);
+            close(child.request.err);
+            close(child.request.connection);
+        }
+        dup2(request.out, STDOUT_FILENO);
+        dup2(request.err, STDERR_FILENO);
+        // it mustn't go on serving in the child
+        auto status = 1;
+        try {
+            status = run();
+        } catch (const std::exception& error) {
+            std::cerr << "fatal: " << error.what() << "\n";
+        } catch (...) {
+            std::cerr << "fatal: unknown error\n";
+        }
+        std::cout << std::flush;
+        std::cerr << std::flush;
+        std::exit(status);
+    }
+    setpgid(pid, pid);
+    m_children.push_back({ pid, request });
+    return std::nullopt;
+}
+
+#else
+
+std::optional<int> forward_to_server(
+    const std::string&, const std::vector<std::string>&)
+{
+    return std::nullopt;
+}
+
+int CompileServer::serve()
+{
+    std::cerr << "fatal: the compile server needs Unix sockets\n";
+    return 1;
+}
+
+#endif
+
+bool CompileServer::is_cacheable(const Options& options)
+{
+    // the cache replays what was printed, not files written with -o
+    return !options.inlining.profile && !options.time_passes
+        && !options.time_report && !options.output
+        && (options.emit == Emit::None || options.emit == Emit::Ir);
+}
+
+std::string CompileServer::cache_key(const Options& options)
+{
+    auto key = std::stringstream {};
+    key << std::filesystem::absolute(options.filename).string() << "\n"
+        << "optimize " << options.optimize << "\n"
+        << "inline " << options.inlining.budget << "\n"
+        << "strict " << options.strict << "\n"
+        << "check " << options.check << "\n"
+        << "emit " << static_cast<int>(options.emit) << "\n";
+    return key.str();
+}
+
+bool CompileServer::is_fresh(const std::string& path, FileState& file)
+{
+    auto time_error = std::error_code {};
+    auto size_error = std::error_code {};
+    const auto modified = std::filesystem::last_write_time(path, time_error);
+    const auto size = std::filesystem::file_size(path, size_error);
+    if (time_error || size_error)
+        return false;
+    if (modified == file.modified && size == file.size)
+        return true;
+    const auto current = file_state(path);
+    if (!current || current->hash != file.hash)
+        return false;
+    file = *current;
+    return true;
+}
+
+std::optional<CompileServer::FileState> CompileServer::file_state(
+    const std::string& path)
+{
+    auto time_error = std::error_code {};
+    auto size_error = std::error_code {};
+    auto state = FileState {};
+    state.modified = std::filesystem::last_write_time(path, time_error);
+    state.size = std::filesystem::file_size(path, size_error);
+    auto file = std::ifstream(path, std::ios::binary);
+    if (time_error || size_error || !file.is_open())
+        return std::nullopt;
+    const auto text = std::string(std::istreambuf_iterator<char>(file), {});
+    state.hash = std::hash<std::string> {}(text);
+    return state;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "driver.h"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A compile server, a long-lived process handling the invocations forwarded
+// to it over a Unix socket by `lplc --client`, without paying for starting
+// a process and for compiling the files which didn't change.
+//
+// A client sends its working directory, its arguments, and its stdout and
+// stderr, the server does what `lplc` would with them, writing to the
+// client's outputs, and replies with the exit status. Compiled files are kept
+// along with their tokens, ASTs and bytecode, and the interned strings live
+// as long as the server, so a file is only compiled again once its contents
+// change, which is checked by hashing it once its size or modification time
+// changed. Programs are run in a child process, so runtime errors don't take
+// the server down, and so does anything else the cache doesn't cover: the C
+// backend, profiles, pass timings and time reports. Children run alongside
+// each other and the requests which come in meanwhile, and are killed when
+// their client hangs up, while the server compiles one request at a time.
+// The server's own environment applies to every invocation, not the
+// client's.
+//
+// The socket is `<socket>` for `--server=<socket>`, otherwise `$LPL_SOCKET`,
+// or `lplc.sock` in `$XDG_RUNTIME_DIR` or in `/tmp/lplc-<uid>`, which must
+// only be accessible by the user. The server and its clients only talk to
+// processes of the same user.
+class CompileServer {
+public:
+    explicit CompileServer(std::string socket_path)
+        : m_socket_path { std::move(socket_path) }
+    {
+    }
+
+    // serves until the process is killed, returns when the socket can't be
+    // listened on
+    int serve();
+
+private:
+    struct Request {
+        std::string directory;
+        std::vector<std::string> args;
+        int out;
+        int err;
+        int connection;
+    };
+
+    // what a file looked like when it was compiled
+    struct FileState {
+        std::filesystem::file_time_type modified {};
+        uintmax_t size { 0 };
+        size_t hash { 0 };
+    };
+
+    struct ProgramEntry {
+        FileState file {};
+        std::string output {};
+        std::optional<std::string> error {};
+        std::unique_ptr<Compiled> compiled {};
+    };
+
+    struct BatchEntry {
+        FileState file {};
+        BatchResult result {};
+    };
+
+    // a child running a request, which it replies to once it exits
+    struct Child {
+        int pid;
+        Request request;
+        bool killed { false };
+    };
+
+    static std::optional<Request> receive(int connection);
+    void accept_request();
+    // does what `lplc` would for the request, returns its exit status, or
+    // nothing when a child replies to it
+    std::optional<int> handle(const Request& request);
+    std::optional<int> dispatch(const Request& request, std::ostream& err);
+    int compile_batch(const Options& options, const Request& request);
+    std::optional<int> compile_and_run(
+        const Options& options, const Request& request);
+    // starts running `run` in a child writing to the client's outputs,
+    // returns a status only when it couldn't
+    std::optional<int> run_in_child(
+        const Request& request, const std::function<int()>& run);
+    // replies to the requests of the children which exited
+    void reap_children();
+    static void reply(const Request& request, int status);
+    // whether the cache covers compiling with `options`
+    static bool is_cacheable(const Options& options);
+    // the options compiling a file depends on, along with its path
+    static std::string cache_key(const Options& options);
+    // whether `file` still describes the file at `path`
+    static bool is_fresh(const std::string& path, FileState& file);
+    static std::optional<FileState> file_state(const std::string& path);
+
+    std::string m_socket_path;
+    int m_listener { -1 };
+    std::vector<Child> m_children {};
+    std::map<std::string, ProgramEntry> m_programs {};
+    std::map<std::string, BatchEntry> m_batches {};
+};
+
+// the socket of `--server[=<socket>]` or `--client[=<socket>]`
+std::string socket_path(const std::string& arg);
+// has the server listening on `path` handle the invocation, returns its exit
+// status, or nothing when no server is listening
+std::optional<int> forward_to_server(
+    const std::string& path, const std::vector<std::string>& args);
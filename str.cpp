@@ -0,0 +1,151 @@
+#include "str.h"
+#include "gc.h"
+#include "kernels.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+std::unordered_map<std::string_view, const String*>& interned()
+{
+    static auto interned
+        = std::unordered_map<std::string_view, const String*> {};
+    return interned;
+}
+
+}
+
+String::String(size_t size, int64_t length, uint64_t hash, uint64_t power)
+    : Gc::Object(Kind::String, size)
+    , length { length }
+    , hash { hash }
+    , power { power }
+    , m_data { nullptr }
+    , m_left { nullptr }
+    , m_right { nullptr }
+{
+}
+
+String* String::make_in(void* memory, std::string_view value)
+{
+    auto hash = uint64_t { 0 };
+    auto power = uint64_t { 1 };
+    for (const auto c : value) {
+        hash = hash * hash_base + static_cast<uint8_t>(c);
+        power *= hash_base;
+    }
+    const auto result = new (memory) String(sizeof(String) + value.size(),
+        static_cast<int64_t>(value.size()), hash, power);
+    const auto data = reinterpret_cast<char*>(result + 1);
+    std::memcpy(data, value.data(), value.size());
+    result->m_data = data;
+    return result;
+}
+
+const String* String::make(std::string_view value)
+{
+    return make_in(Gc::heap().allocate(sizeof(String) + value.size()), value);
+}
+
+const String* String::intern(std::string_view value)
+{
+    // files of a batch are lowered side by side
+    static auto mutex = std::mutex {};
+    const auto lock = std::lock_guard { mutex };
+    auto& strings = interned();
+    if (const auto found = strings.find(value); found != strings.end())
+        return found->second;
+    const auto result = make_in(
+        Gc::heap().allocate_permanent(sizeof(String) + value.size()), value);
+    result->permanent = true;
+    strings.emplace(result->view(), result);
+    return result;
+}
+
+const String* String::concatenate(const String* left, const String* right)
+{
+    if (left->length == 0)
+        return right;
+    if (right->length == 0)
+        return left;
+    const auto length = left->length + right->length;
+    if (length < min_rope_length) {
+        char buffer[min_rope_length];
+        const auto left_view = left->view();
+        const auto right_view = right->view();
+        std::memcpy(buffer, left_view.data(), left_view.size());
+        std::memcpy(
+            buffer + left_view.size(), right_view.data(), right_view.size());
+        return make(std::string_view(buffer, static_cast<size_t>(length)));
+    }
+    auto& heap = Gc::heap();
+    const auto result = new (heap.allocate(sizeof(String)))
+        String(sizeof(String), length, left->hash * right->power + right->hash,
+            left->power * right->power);
+    result->m_left = left;
+    result->m_right = right;
+    heap.write_barrier(*result, left);
+    heap.write_barrier(*result, right);
+    return result;
+}
+
+std::string_view String::view() const
+{
+    if (is_rope())
+        flatten();
+    return std::string_view(m_data, static_cast<size_t>(length));
+}
+
+bool String::equals(const String& other) const
+{
+    if (this == &other)
+        return true;
+    if (length != other.length || hash != other.hash)
+        return false;
+    return Kernels::mismatch(
+               view().data(), other.view().data(), static_cast<size_t>(length))
+        == static_cast<size_t>(length);
+}
+
+int String::compare(const String& other) const
+{
+    const auto left = view();
+    const auto right = other.view();
+    const auto common = std::min(left.size(), right.size());
+    const auto index = Kernels::mismatch(left.data(), right.data(), common);
+    if (index < common)
+        return static_cast<uint8_t>(left[index])
+            - static_cast<uint8_t>(right[index]);
+    return left.size() < right.size() ? -1 : left.size() > right.size();
+}
+
+// iteratively, ropes built by appending in a loop are as deep as they are
+// long
+void String::flatten() const
+{
+    const auto data = new char[static_cast<size_t>(length)];
+    auto size = size_t { 0 };
+    auto pending = std::vector<const String*> { this };
+    while (!pending.empty()) {
+        const auto string = pending.back();
+        pending.pop_back();
+        if (string->is_rope()) {
+            pending.push_back(string->m_right);
+            pending.push_back(string->m_left);
+        } else {
+            std::memcpy(data + size, string->m_data,
+                static_cast<size_t>(string->length));
+            size += static_cast<size_t>(string->length);
+        }
+    }
+    m_data = data;
+    m_left = nullptr;
+    m_right = nullptr;
+    Gc::heap().add_external(const_cast<String&>(*this));
+}
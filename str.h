@@ -0,0 +1,64 @@
+#pragma once
+
+#include "gc.h"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// The immutable strings of the VM.
+//
+// The bytes of flat strings follow the string in the same allocation, so
+// making one takes a single bump of the nursery. String constants are
+// interned, so every use of a literal shares one permanent object.
+//
+// Concatenations of at least `min_rope_length` bytes are ropes, which only
+// point to their halves and are flattened into a buffer the first time their
+// bytes are needed, so appending to a string in a loop doesn't copy it each
+// time. Their hash is combined from the hashes of the halves, so it is known
+// without flattening them.
+//
+// Strings are allocated on the collected heap, see gc.h.
+struct String : Gc::Object {
+    static constexpr int64_t min_rope_length = 64;
+
+    static const String* make(std::string_view value);
+    // the same permanent string for equal values, safe to call from any
+    // thread
+    static const String* intern(std::string_view value);
+    static const String* concatenate(const String* left, const String* right);
+
+    // flattens ropes
+    std::string_view view() const;
+    bool equals(const String& other) const;
+    // negative, zero or positive as the string orders before, the same as or
+    // after `other`, byte by byte
+    int compare(const String& other) const;
+    bool is_rope() const { return m_data == nullptr; }
+
+    const int64_t length;
+    // the bytes as the digits of a number in base `hash_base`, modulo 2^64
+    const uint64_t hash;
+    // `hash_base` to the power of the length
+    const uint64_t power;
+
+private:
+    friend class Gc::Heap;
+
+    static constexpr uint64_t hash_base = 0x100000001b3;
+
+    String(size_t size, int64_t length, uint64_t hash, uint64_t power);
+
+    // a flat string of `value` in `memory`
+    static String* make_in(void* memory, std::string_view value);
+    const char* inline_data() const
+    {
+        return reinterpret_cast<const char*>(this + 1);
+    }
+    void flatten() const;
+
+    // null while the string is a rope of `m_left` and `m_right`, otherwise
+    // the inline bytes or, once a rope is flattened, a buffer of its own
+    mutable const char* m_data;
+    mutable const String* m_left;
+    mutable const String* m_right;
+};
@@ -1,8 +1,15 @@
+#include "array.h"
+#include "bytecode.h"
+#include "ir.h"
+#include "kernels.h"
 #include "lexer.h"
 #include "parser.h"
+#include "str.h"
+#include "value.h"
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
 
 std::string Parsed::SymbolType::to_string() const
 {
@@ -94,6 +101,24 @@ std::string Parsed::Call::to_string() const
     return result.str();
 }
 
+std::string Parsed::Index::to_string() const
+{
+    auto result = std::stringstream {};
+    result << "Index { array: " << array->to_string()
+           << ", index: " << index->to_string() << " }";
+    return result.str();
+}
+
+std::string Parsed::Array::to_string() const
+{
+    auto result = std::stringstream {};
+    result << "Array { elements: [ ";
+    for (const auto& element : elements)
+        result << element->to_string() << ", ";
+    result << " ] }";
+    return result.str();
+}
+
 std::string Parsed::Int::to_string() const
 {
     auto result = std::stringstream {};
@@ -186,6 +211,76 @@ std::string Parsed::If::to_string() const
     return result.str();
 }
 
+std::string Parsed::MatchArm::to_string() const
+{
+    auto result = std::stringstream {};
+    result << "MatchArm { patterns: [ ";
+    for (const auto& pattern : patterns)
+        result << pattern->to_string() << ", ";
+    result << " ]";
+    if (binding)
+        result << ", binding: \"" << *binding << "\"";
+    if (guard)
+        result << ", guard: " << (*guard)->to_string();
+    result << ", body: " << body->to_string() << " }";
+    return result.str();
+}
+
+std::string Parsed::Match::to_string() const
+{
+    auto result = std::stringstream {};
+    result << "Match { value: " << value->to_string() << ", arms: [ ";
+    for (const auto& arm : arms)
+        result << arm->to_string() << ", ";
+    result << " ] }";
+    return result.str();
+}
+
+std::string Parsed::While::to_string() const
+{
+    auto result = std::stringstream {};
+    result << "While { condition: " << condition->to_string()
+           << ", body: " << body->to_string() << " }";
+    return result.str();
+}
+
+std::string Parsed::Loop::to_string() const
+{
+    auto result = std::stringstream {};
+    result << "Loop { body: " << body->to_string() << " }";
+    return result.str();
+}
+
+std::string Parsed::For::to_string() const
+{
+    auto result = std::stringstream {};
+    result << "For { name: \"" << name << "\", start: " << start->to_string()
+           << ", end: " << end->to_string() << ", body: " << body->to_string()
+           << " }";
+    return result.str();
+}
+
+std::string Parsed::Break::to_string() const { return "Break"; }
+
+std::string Parsed::Continue::to_string() const { return "Continue"; }
+
+std::string Parsed::Func::to_string() const
+{
+    auto result = std::stringstream {};
+    result << "Func { name: \"" << name << "\", parameters: [ ";
+    for (const auto& p : parameters)
+        result << p->to_string() << ", ";
+    result << " ]";
+    if (return_type)
+        result << ", return_type: " << (*return_type)->to_string();
+    if (is_body_parsed())
+        result << ", body: " << body().to_string() << " }";
+    else
+        result << ", body: Skipped { tokens: " << body_tokens->begin << ".."
+               << body_tokens->end << " } }";
+    return result.str();
+}
+
 std::string token_type_to_string(TokenType type)
 {
     switch (type) {
@@ -197,8 +292,13 @@ std::string token_type_to_string(TokenType type)
     case TokenType::Name: return "Name";
     case TokenType::If: return "If";
     case TokenType::Else: return "Else";
+    case TokenType::Match: return "Match";
     case TokenType::While: return "While";
+    case TokenType::Loop: return "Loop";
+    case TokenType::For: return "For";
+    case TokenType::In: return "In";
     case TokenType::Break: return "Break";
+    case TokenType::Continue: return "Continue";
     case TokenType::Func: return "Func";
     case TokenType::Return: return "Return";
     case TokenType::Let: return "Let";
@@ -237,6 +337,8 @@ std::string token_type_to_string(TokenType type)
     case TokenType::Colon: return "Colon";
     case TokenType::Semicolon: return "Semicolon";
     case TokenType::ThinArrow: return "ThinArrow";
+    case TokenType::FatArrow: return "FatArrow";
+    case TokenType::DotDot: return "DotDot";
     }
     std::cerr << "internal: unexhaustive match at " << __FILE__ << ":"
               << __LINE__ << ": in " << __func__ << "\n";
@@ -250,3 +352,406 @@ std::string Token::to_string() const
            << value << "\"}";
     return result.str();
 }
+
+std::string value_type_to_string(ValueType type)
+{
+    switch (type) {
+    case ValueType::Unit: return "Unit";
+    case ValueType::Int: return "Int";
+    case ValueType::Float: return "Float";
+    case ValueType::Char: return "Char";
+    case ValueType::Bool: return "Bool";
+    case ValueType::String: return "String";
+    case ValueType::Builtin: return "Builtin";
+    case ValueType::Function: return "Function";
+    case ValueType::Array: return "Array";
+    }
+    std::cerr << "internal: unexhaustive match at " << __FILE__ << ":"
+              << __LINE__ << ": in " << __func__ << "\n";
+    exit(1);
+}
+
+std::string Value::to_string() const
+{
+    auto result = std::stringstream {};
+    switch (type) {
+    case ValueType::Unit: result << "()"; break;
+    case ValueType::Int: result << int_value; break;
+    case ValueType::Float: result << float_value; break;
+    case ValueType::Char: result << char_value; break;
+    case ValueType::Bool: result << (bool_value ? "true" : "false"); break;
+    case ValueType::String: result << string_value->view(); break;
+    case ValueType::Builtin:
+        result << "<builtin " << builtin_value->name << ">";
+        break;
+    case ValueType::Function:
+        result << "<func " << function_value->name << ">";
+        break;
+    case ValueType::Array:
+        result << "[";
+        for (int64_t i = 0; i < array_value->length; i++)
+            result << (i == 0 ? "" : ", ") << array_value->get(i).to_string();
+        result << "]";
+        break;
+    }
+    return result.str();
+}
+
+std::string Bytecode::op_to_string(Bytecode::Op op)
+{
+    switch (op) {
+    case Bytecode::Op::PushConstant: return "PushConstant";
+    case Bytecode::Op::PushUnit: return "PushUnit";
+    case Bytecode::Op::Pop: return "Pop";
+    case Bytecode::Op::Dup: return "Dup";
+    case Bytecode::Op::LoadLocal: return "LoadLocal";
+    case Bytecode::Op::StoreLocal: return "StoreLocal";
+    case Bytecode::Op::LoadGlobal: return "LoadGlobal";
+    case Bytecode::Op::StoreGlobal:
+    case Bytecode::Op::DefineGlobal: return "StoreGlobal";
+    case Bytecode::Op::Jump: return "Jump";
+    case Bytecode::Op::JumpIfFalse: return "JumpIfFalse";
+    case Bytecode::Op::TableSwitch: return "TableSwitch";
+    case Bytecode::Op::LookupSwitch: return "LookupSwitch";
+    case Bytecode::Op::StringSwitch: return "StringSwitch";
+    case Bytecode::Op::Call: return "Call";
+    case Bytecode::Op::CallGlobal: return "CallGlobal";
+    case Bytecode::Op::TailCall: return "TailCall";
+    case Bytecode::Op::TailCallGlobal: return "TailCallGlobal";
+    case Bytecode::Op::Return: return "Return";
+    case Bytecode::Op::CheckType: return "CheckType";
+    case Bytecode::Op::NewArray: return "NewArray";
+    case Bytecode::Op::Index: return "Index";
+    case Bytecode::Op::IndexInBounds: return "IndexInBounds";
+    case Bytecode::Op::StoreIndex: return "StoreIndex";
+    case Bytecode::Op::StoreIndexInBounds: return "StoreIndexInBounds";
+    case Bytecode::Op::Map: return "Map";
+    case Bytecode::Op::LogicalNot: return "LogicalNot";
+    case Bytecode::Op::BitwiseNot: return "BitwiseNot";
+    case Bytecode::Op::Plus: return "Plus";
+    case Bytecode::Op::Negate: return "Negate";
+    case Bytecode::Op::Add: return "Add";
+    case Bytecode::Op::Subtract: return "Subtract";
+    case Bytecode::Op::Multiply: return "Multiply";
+    case Bytecode::Op::Divide: return "Divide";
+    case Bytecode::Op::Modulus: return "Modulus";
+    case Bytecode::Op::Exponentiate: return "Exponentiate";
+    case Bytecode::Op::BitwiseAnd: return "BitwiseAnd";
+    case Bytecode::Op::BitwiseOr: return "BitwiseOr";
+    case Bytecode::Op::BitwiseXor: return "BitwiseXor";
+    case Bytecode::Op::BitwiseLeftShift: return "BitwiseLeftShift";
+    case Bytecode::Op::BitwiseRightShift: return "BitwiseRightShift";
+    case Bytecode::Op::LessThan: return "LessThan";
+    case Bytecode::Op::LessThanEqual: return "LessThanEqual";
+    case Bytecode::Op::GreaterThan: return "GreaterThan";
+    case Bytecode::Op::GreaterThanEqual: return "GreaterThanEqual";
+    case Bytecode::Op::Equal: return "Equal";
+    case Bytecode::Op::NotEqual: return "NotEqual";
+    case Bytecode::Op::AddInt: return "AddInt";
+    case Bytecode::Op::SubtractInt: return "SubtractInt";
+    case Bytecode::Op::MultiplyInt: return "MultiplyInt";
+    case Bytecode::Op::DivideInt: return "DivideInt";
+    case Bytecode::Op::ModulusInt: return "ModulusInt";
+    case Bytecode::Op::ExponentiateInt: return "ExponentiateInt";
+    case Bytecode::Op::BitwiseAndInt: return "BitwiseAndInt";
+    case Bytecode::Op::BitwiseOrInt: return "BitwiseOrInt";
+    case Bytecode::Op::BitwiseXorInt: return "BitwiseXorInt";
+    case Bytecode::Op::BitwiseLeftShiftInt: return "BitwiseLeftShiftInt";
+    case Bytecode::Op::BitwiseRightShiftInt: return "BitwiseRightShiftInt";
+    case Bytecode::Op::LessThanInt: return "LessThanInt";
+    case Bytecode::Op::LessThanEqualInt: return "LessThanEqualInt";
+    case Bytecode::Op::GreaterThanInt: return "GreaterThanInt";
+    case Bytecode::Op::GreaterThanEqualInt: return "GreaterThanEqualInt";
+    case Bytecode::Op::EqualInt: return "EqualInt";
+    case Bytecode::Op::NotEqualInt: return "NotEqualInt";
+    case Bytecode::Op::AddFloat: return "AddFloat";
+    case Bytecode::Op::SubtractFloat: return "SubtractFloat";
+    case Bytecode::Op::MultiplyFloat: return "MultiplyFloat";
+    case Bytecode::Op::DivideFloat: return "DivideFloat";
+    case Bytecode::Op::ModulusFloat: return "ModulusFloat";
+    case Bytecode::Op::ExponentiateFloat: return "ExponentiateFloat";
+    case Bytecode::Op::LessThanFloat: return "LessThanFloat";
+    case Bytecode::Op::LessThanEqualFloat: return "LessThanEqualFloat";
+    case Bytecode::Op::GreaterThanFloat: return "GreaterThanFloat";
+    case Bytecode::Op::GreaterThanEqualFloat: return "GreaterThanEqualFloat";
+    case Bytecode::Op::EqualFloat: return "EqualFloat";
+    case Bytecode::Op::NotEqualFloat: return "NotEqualFloat";
+    }
+    std::cerr << "internal: unexhaustive match at " << __FILE__ << ":"
+              << __LINE__ << ": in " << __func__ << "\n";
+    exit(1);
+}
+
+std::string Bytecode::Instruction::to_string() const
+{
+    auto result = std::stringstream {};
+    result << op_to_string(op);
+    switch (op) {
+    case Bytecode::Op::PushConstant:
+    case Bytecode::Op::LoadLocal:
+    case Bytecode::Op::StoreLocal:
+    case Bytecode::Op::LoadGlobal:
+    case Bytecode::Op::StoreGlobal:
+    case Bytecode::Op::DefineGlobal:
+    case Bytecode::Op::Jump:
+    case Bytecode::Op::JumpIfFalse:
+    case Bytecode::Op::TableSwitch:
+    case Bytecode::Op::LookupSwitch:
+    case Bytecode::Op::StringSwitch:
+    case Bytecode::Op::Call:
+    case Bytecode::Op::CallGlobal:
+    case Bytecode::Op::TailCall:
+    case Bytecode::Op::TailCallGlobal:
+    case Bytecode::Op::NewArray:
+    case Bytecode::Op::Map: result << " " << operand; break;
+    case Bytecode::Op::CheckType:
+        result << " "
+               << value_type_to_string(static_cast<ValueType>(operand));
+        break;
+    default:
+        // the frame slot of a generic binary operation making local arrays
+        if (op >= Bytecode::Op::Add && op <= Bytecode::Op::NotEqual
+            && operand != 0)
+            result << " " << operand;
+        break;
+    }
+    return result.str();
+}
+
+std::string Bytecode::Function::to_string() const
+{
+    auto result = std::stringstream {};
+    result << "Function " << name << " at " << position.row << ":"
+           << position.col << " (arity: " << arity
+           << ", locals: " << locals_count << ", slots: " << slots_count
+           << ")\n";
+    for (size_t i = 0; i < constants.size(); i++)
+        result << "\tconstant " << i << ": " << constants[i].to_string()
+               << "\n";
+    for (size_t i = 0; i < switch_tables.size(); i++) {
+        const auto& table = switch_tables[i];
+        result << "\tswitch " << i << ": " << value_type_to_string(table.type)
+               << " ";
+        if (table.keys.empty())
+            result << table.first << ".. ";
+        result << "[";
+        for (size_t j = 0; j < table.targets.size(); j++) {
+            result << (j == 0 ? "" : ", ");
+            if (!table.strings.empty())
+                result << "\"" << table.strings[j]->view() << "\": ";
+            else if (!table.keys.empty())
+                result << table.keys[j] << ": ";
+            result << table.targets[j];
+        }
+        result << "], default " << table.default_target << "\n";
+    }
+    auto entry = line_table.begin();
+    for (size_t i = 0; i < code.size(); i++) {
+        result << "\t" << i << ":\t" << code[i].to_string();
+        if (entry != line_table.end() && entry->ip == i) {
+            result << "\t// " << entry->position.row << ":"
+                   << entry->position.col;
+            entry++;
+        }
+        result << "\n";
+    }
+    return result.str();
+}
+
+std::string Bytecode::Program::to_string() const
+{
+    auto result = std::stringstream {};
+    result << "Program { globals: [ ";
+    for (const auto& global : globals)
+        result << global << ", ";
+    result << " ] }\n" << main->to_string();
+    for (const auto& function : functions)
+        result << function->to_string();
+    return result.str();
+}
+
+std::string Kernels::op_to_string(Kernels::Op op)
+{
+    switch (op) {
+    case Kernels::Op::Load: return "Load";
+    case Kernels::Op::Add: return "Add";
+    case Kernels::Op::Subtract: return "Subtract";
+    case Kernels::Op::Multiply: return "Multiply";
+    case Kernels::Op::BitwiseAnd: return "BitwiseAnd";
+    case Kernels::Op::BitwiseOr: return "BitwiseOr";
+    case Kernels::Op::BitwiseXor: return "BitwiseXor";
+    }
+    std::cerr << "internal: unexhaustive match at " << __FILE__ << ":"
+              << __LINE__ << ": in " << __func__ << "\n";
+    exit(1);
+}
+
+std::string Ir::op_to_string(Ir::Op op)
+{
+    switch (op) {
+    case Ir::Op::Constant: return "Constant";
+    case Ir::Op::Parameter: return "Parameter";
+    case Ir::Op::Phi: return "Phi";
+    case Ir::Op::LoadGlobal: return "LoadGlobal";
+    case Ir::Op::StoreGlobal: return "StoreGlobal";
+    case Ir::Op::DefineGlobal: return "DefineGlobal";
+    case Ir::Op::Call: return "Call";
+    case Ir::Op::CallGlobal: return "CallGlobal";
+    case Ir::Op::CheckType: return "CheckType";
+    case Ir::Op::NewArray: return "NewArray";
+    case Ir::Op::Map: return "Map";
+    case Ir::Op::Index: return "Index";
+    case Ir::Op::StoreIndex: return "StoreIndex";
+    case Ir::Op::LogicalNot: return "LogicalNot";
+    case Ir::Op::BitwiseNot: return "BitwiseNot";
+    case Ir::Op::Plus: return "Plus";
+    case Ir::Op::Negate: return "Negate";
+    case Ir::Op::Add: return "Add";
+    case Ir::Op::Subtract: return "Subtract";
+    case Ir::Op::Multiply: return "Multiply";
+    case Ir::Op::Divide: return "Divide";
+    case Ir::Op::Modulus: return "Modulus";
+    case Ir::Op::Exponentiate: return "Exponentiate";
+    case Ir::Op::BitwiseAnd: return "BitwiseAnd";
+    case Ir::Op::BitwiseOr: return "BitwiseOr";
+    case Ir::Op::BitwiseXor: return "BitwiseXor";
+    case Ir::Op::BitwiseLeftShift: return "BitwiseLeftShift";
+    case Ir::Op::BitwiseRightShift: return "BitwiseRightShift";
+    case Ir::Op::LessThan: return "LessThan";
+    case Ir::Op::LessThanEqual: return "LessThanEqual";
+    case Ir::Op::GreaterThan: return "GreaterThan";
+    case Ir::Op::GreaterThanEqual: return "GreaterThanEqual";
+    case Ir::Op::Equal: return "Equal";
+    case Ir::Op::NotEqual: return "NotEqual";
+    case Ir::Op::Jump: return "Jump";
+    case Ir::Op::Branch: return "Branch";
+    case Ir::Op::Switch: return "Switch";
+    case Ir::Op::Return: return "Return";
+    }
+    std::cerr << "internal: unexhaustive match at " << __FILE__ << ":"
+              << __LINE__ << ": in " << __func__ << "\n";
+    exit(1);
+}
+
+namespace {
+
+std::string constant_to_string(const Value& value)
+{
+    if (value.type == ValueType::String)
+        return std::string { "\"" } + value.to_string() + "\"";
+    if (value.type == ValueType::Char)
+        return std::string { "'" } + value.to_string() + "'";
+    return value.to_string();
+}
+
+}
+
+std::string Ir::Instruction::to_string() const
+{
+    auto result = std::stringstream {};
+    if (has_result(op)) {
+        result << "v" << id;
+        if (type)
+            result << ": " << value_type_to_string(*type);
+        result << " = ";
+    }
+    result << op_to_string(op);
+    auto separator = " ";
+    switch (op) {
+    case Ir::Op::Constant:
+        result << " " << constant_to_string(value);
+        separator = ", ";
+        break;
+    case Ir::Op::Switch:
+        result << " v" << operands[0]->id;
+        for (size_t i = 0; i < cases.size(); i++)
+            result << ", " << constant_to_string(cases[i]) << ": b"
+                   << targets[i]->id;
+        result << ", b" << targets.back()->id;
+        return result.str();
+    case Ir::Op::Parameter:
+    case Ir::Op::LoadGlobal:
+    case Ir::Op::StoreGlobal:
+    case Ir::Op::DefineGlobal:
+    case Ir::Op::CallGlobal:
+        result << " " << index;
+        separator = ", ";
+        break;
+    default: break;
+    }
+    for (const auto operand : operands) {
+        result << separator << "v" << operand->id;
+        separator = ", ";
+    }
+    for (const auto target : targets) {
+        result << separator << "b" << target->id;
+        separator = ", ";
+    }
+    auto comments = std::vector<std::string> {};
+    if (in_bounds)
+        comments.push_back("in bounds");
+    if (local)
+        comments.push_back("local");
+    if (op == Ir::Op::Map) {
+        // the fused expression, as in `Add(Multiply(v1, v2), v3)`
+        auto stack = std::vector<std::string> {};
+        auto next = operands.begin();
+        for (const auto step : expression) {
+            if (step == Kernels::Op::Load) {
+                stack.push_back(
+                    std::string { "v" } + std::to_string((*next++)->id));
+                continue;
+            }
+            const auto right = stack.back();
+            stack.pop_back();
+            stack.back() = Kernels::op_to_string(step) + "(" + stack.back()
+                + ", " + right + ")";
+        }
+        comments.push_back(stack.back());
+    }
+    for (size_t i = 0; i < comments.size(); i++)
+        result << (i == 0 ? " // " : ", ") << comments[i];
+    return result.str();
+}
+
+std::string Ir::Block::to_string() const
+{
+    auto result = std::stringstream {};
+    result << "b" << id << ":";
+    if (!predecessors.empty()) {
+        result << "\t// preds:";
+        for (const auto predecessor : predecessors)
+            result << " b" << predecessor->id;
+    }
+    result << "\n";
+    for (const auto& instruction : instructions) {
+        result << "\t" << instruction->to_string();
+        if (instruction->position)
+            result << "\t// " << instruction->position->row << ":"
+                   << instruction->position->col;
+        result << "\n";
+    }
+    return result.str();
+}
+
+std::string Ir::Function::to_string() const
+{
+    auto result = std::stringstream {};
+    result << "Function " << name << " at " << position.row << ":"
+           << position.col << " (arity: " << arity << ")\n";
+    for (const auto& block : blocks)
+        result << block->to_string();
+    return result.str();
+}
+
+std::string Ir::Module::to_string() const
+{
+    auto result = std::stringstream {};
+    result << "Module { globals: [ ";
+    for (const auto& global : globals)
+        result << global << ", ";
+    result << " ] }\n" << main->to_string();
+    for (const auto& function : functions)
+        result << function->to_string();
+    return result.str();
+}
@@ -0,0 +1,2049 @@
+#include "transpiler.h"
+#include "builtins.h"
+#include "bytecode.h"
+#include "ir.h"
+#include "str.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// mirrors `VM`'s operations and error messages, see vm.cpp
+const char* const runtime = R"runtime(#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__)
+#define LPL_NORETURN __attribute__((noreturn))
+#else
+#define LPL_NORETURN
+#endif
+
+#define LPL_MAX_FRAMES 100000
+#define LPL_MAX_MAP_OPERANDS 8
+#define LPL_LANES 8
+#define LPL_MIN_ROPE_LENGTH 64
+#define LPL_HASH_BASE UINT64_C(0x100000001b3)
+
+/* results of floats must not depend on whether multiplications and
+ * additions are fused */
+#pragma STDC FP_CONTRACT OFF
+
+typedef enum {
+    LPL_UNDEFINED,
+    LPL_UNIT,
+    LPL_INT,
+    LPL_FLOAT,
+    LPL_CHAR,
+    LPL_BOOL,
+    LPL_STRING,
+    LPL_BUILTIN,
+    LPL_FUNCTION,
+    LPL_ARRAY
+} lpl_type;
+
+typedef struct lpl_value lpl_value;
+
+/* like the VM's, strings are immutable, concatenations of at least
+ * LPL_MIN_ROPE_LENGTH bytes are ropes of their halves until their bytes are
+ * needed, and the hash is the bytes as digits in base LPL_HASH_BASE */
+typedef struct lpl_string lpl_string;
+struct lpl_string {
+    const char* data; /* NULL while a rope of `left` and `right` */
+    size_t length;
+    uint64_t hash;
+    uint64_t power; /* LPL_HASH_BASE to the power of the length */
+    const lpl_string* left;
+    const lpl_string* right;
+};
+
+/* ints and floats are stored unboxed, other elements as values */
+typedef struct {
+    lpl_type element;
+    int64_t length;
+    void* data;
+} lpl_array;
+
+/* the arrays made by an operation which don't escape its function, see
+ * `Passes::analyze_escapes`, reuse the storage of a slot local to the
+ * function, which is freed when it returns */
+typedef struct {
+    lpl_array array;
+    char* storage;
+    size_t size;
+} lpl_slot;
+
+#define LPL_SLOT { { LPL_UNIT, 0, NULL }, NULL, 0 }
+
+typedef struct {
+    const char* name;
+    /* -1 when variadic */
+    int arity;
+    lpl_value (*call)(const lpl_value* args, size_t count);
+} lpl_callable;
+
+struct lpl_value {
+    lpl_type type;
+    union {
+        int64_t i;
+        double f;
+        char c;
+        bool b;
+        const lpl_string* s;
+        const lpl_callable* fn;
+        lpl_array* a;
+    } as;
+};
+
+enum {
+    LPL_OP_ADD,
+    LPL_OP_SUBTRACT,
+    LPL_OP_MULTIPLY,
+    LPL_OP_DIVIDE,
+    LPL_OP_MODULUS,
+    LPL_OP_EXPONENTIATE,
+    LPL_OP_BITWISE_AND,
+    LPL_OP_BITWISE_OR,
+    LPL_OP_BITWISE_XOR,
+    LPL_OP_BITWISE_LEFT_SHIFT,
+    LPL_OP_BITWISE_RIGHT_SHIFT,
+    LPL_OP_LESS_THAN,
+    LPL_OP_LESS_THAN_EQUAL,
+    LPL_OP_GREATER_THAN,
+    LPL_OP_GREATER_THAN_EQUAL,
+    LPL_OP_EQUAL,
+    LPL_OP_NOT_EQUAL,
+    LPL_OP_LOGICAL_NOT,
+    LPL_OP_BITWISE_NOT,
+    LPL_OP_PLUS,
+    LPL_OP_NEGATE
+};
+
+static const char* const lpl_op_names[] = { "Add", "Subtract", "Multiply",
+    "Divide", "Modulus", "Exponentiate", "BitwiseAnd", "BitwiseOr",
+    "BitwiseXor", "BitwiseLeftShift", "BitwiseRightShift", "LessThan",
+    "LessThanEqual", "GreaterThan", "GreaterThanEqual", "Equal", "NotEqual",
+    "LogicalNot", "BitwiseNot", "Plus", "Negate" };
+
+static const char* const lpl_type_names[] = { "Undefined", "Unit", "Int",
+    "Float", "Char", "Bool", "String", "Builtin", "Function", "Array" };
+
+static size_t lpl_depth = 0;
+
+static LPL_NORETURN void lpl_error(const char* message)
+{
+    fflush(stdout);
+    fprintf(stderr, "RuntimeError: %s\n", message);
+    exit(1);
+}
+
+static lpl_value lpl_unit(void)
+{
+    lpl_value value;
+    value.type = LPL_UNIT;
+    value.as.i = 0;
+    return value;
+}
+
+static lpl_value lpl_int(int64_t i)
+{
+    lpl_value value;
+    value.type = LPL_INT;
+    value.as.i = i;
+    return value;
+}
+
+static lpl_value lpl_float(double f)
+{
+    lpl_value value;
+    value.type = LPL_FLOAT;
+    value.as.f = f;
+    return value;
+}
+
+static lpl_value lpl_char(char c)
+{
+    lpl_value value;
+    value.type = LPL_CHAR;
+    value.as.c = c;
+    return value;
+}
+
+static lpl_value lpl_bool(bool b)
+{
+    lpl_value value;
+    value.type = LPL_BOOL;
+    value.as.b = b;
+    return value;
+}
+
+static lpl_value lpl_string_value(const lpl_string* s)
+{
+    lpl_value value;
+    value.type = LPL_STRING;
+    value.as.s = s;
+    return value;
+}
+
+static lpl_value lpl_builtin(const lpl_callable* fn)
+{
+    lpl_value value;
+    value.type = LPL_BUILTIN;
+    value.as.fn = fn;
+    return value;
+}
+
+static lpl_value lpl_function(const lpl_callable* fn)
+{
+    lpl_value value;
+    value.type = LPL_FUNCTION;
+    value.as.fn = fn;
+    return value;
+}
+
+static LPL_NORETURN void lpl_unsupported_operands(
+    int op, lpl_type left, lpl_type right)
+{
+    char message[128];
+    snprintf(message, sizeof(message), "unsupported operands `%s` %s `%s`",
+        lpl_type_names[left], lpl_op_names[op], lpl_type_names[right]);
+    lpl_error(message);
+}
+
+static int64_t lpl_int_pow(int64_t base, int64_t exponent)
+{
+    uint64_t result = 1;
+    uint64_t factor = (uint64_t)base;
+    if (exponent < 0)
+        lpl_error("negative exponent in integer `**`");
+    while (exponent != 0) {
+        if (exponent & 1)
+            result *= factor;
+        factor *= factor;
+        exponent >>= 1;
+    }
+    return (int64_t)result;
+}
+
+static inline lpl_value lpl_int_operation(int op, int64_t left, int64_t right)
+{
+    uint64_t l = (uint64_t)left;
+    uint64_t r = (uint64_t)right;
+    switch (op) {
+    case LPL_OP_ADD: return lpl_int((int64_t)(l + r));
+    case LPL_OP_SUBTRACT: return lpl_int((int64_t)(l - r));
+    case LPL_OP_MULTIPLY: return lpl_int((int64_t)(l * r));
+    case LPL_OP_DIVIDE:
+        if (right == 0)
+            lpl_error("division by zero");
+        if (right == -1)
+            return lpl_int((int64_t)(0 - l));
+        return lpl_int(left / right);
+    case LPL_OP_MODULUS:
+        if (right == 0)
+            lpl_error("division by zero");
+        if (right == -1)
+            return lpl_int(0);
+        return lpl_int(left % right);
+    case LPL_OP_EXPONENTIATE: return lpl_int(lpl_int_pow(left, right));
+    case LPL_OP_BITWISE_AND: return lpl_int(left & right);
+    case LPL_OP_BITWISE_OR: return lpl_int(left | right);
+    case LPL_OP_BITWISE_XOR: return lpl_int(left ^ right);
+    case LPL_OP_BITWISE_LEFT_SHIFT: return lpl_int((int64_t)(l << (r & 63)));
+    case LPL_OP_BITWISE_RIGHT_SHIFT: return lpl_int(left >> (r & 63));
+    case LPL_OP_LESS_THAN: return lpl_bool(left < right);
+    case LPL_OP_LESS_THAN_EQUAL: return lpl_bool(left <= right);
+    case LPL_OP_GREATER_THAN: return lpl_bool(left > right);
+    case LPL_OP_GREATER_THAN_EQUAL: return lpl_bool(left >= right);
+    case LPL_OP_EQUAL: return lpl_bool(left == right);
+    case LPL_OP_NOT_EQUAL: return lpl_bool(left != right);
+    }
+    lpl_error("internal: unexhaustive match in lpl_int_operation");
+}
+
+static inline lpl_value lpl_float_operation(int op, double left, double right)
+{
+    switch (op) {
+    case LPL_OP_ADD: return lpl_float(left + right);
+    case LPL_OP_SUBTRACT: return lpl_float(left - right);
+    case LPL_OP_MULTIPLY: return lpl_float(left * right);
+    case LPL_OP_DIVIDE: return lpl_float(left / right);
+    case LPL_OP_MODULUS: return lpl_float(fmod(left, right));
+    case LPL_OP_EXPONENTIATE: return lpl_float(pow(left, right));
+    case LPL_OP_LESS_THAN: return lpl_bool(left < right);
+    case LPL_OP_LESS_THAN_EQUAL: return lpl_bool(left <= right);
+    case LPL_OP_GREATER_THAN: return lpl_bool(left > right);
+    case LPL_OP_GREATER_THAN_EQUAL: return lpl_bool(left >= right);
+    case LPL_OP_EQUAL: return lpl_bool(left == right);
+    case LPL_OP_NOT_EQUAL: return lpl_bool(left != right);
+    }
+    lpl_unsupported_operands(op, LPL_FLOAT, LPL_FLOAT);
+}
+
+static inline bool lpl_is_number(lpl_value value)
+{
+    return value.type == LPL_INT || value.type == LPL_FLOAT;
+}
+
+static inline double lpl_to_float(lpl_value value)
+{
+    return value.type == LPL_INT ? (double)value.as.i : value.as.f;
+}
+
+/* iteratively, ropes built by appending in a loop are as deep as they are
+ * long */
+static const char* lpl_flatten(const lpl_string* s)
+{
+    lpl_string* rope = (lpl_string*)s;
+    const lpl_string** pending;
+    size_t count = 1, capacity = 16, size = 0;
+    char* data;
+    if (s->data)
+        return s->data;
+    data = (char*)malloc(s->length);
+    pending = (const lpl_string**)malloc(capacity * sizeof(*pending));
+    if (!data || !pending)
+        lpl_error("out of memory");
+    pending[0] = s;
+    while (count > 0) {
+        const lpl_string* string = pending[--count];
+        if (string->data) {
+            memcpy(data + size, string->data, string->length);
+            size += string->length;
+            continue;
+        }
+        if (count + 2 > capacity) {
+            capacity *= 2;
+            pending = (const lpl_string**)realloc(
+                (void*)pending, capacity * sizeof(*pending));
+            if (!pending)
+                lpl_error("out of memory");
+        }
+        pending[count++] = string->right;
+        pending[count++] = string->left;
+    }
+    free((void*)pending);
+    rope->data = data;
+    rope->left = NULL;
+    rope->right = NULL;
+    return data;
+}
+
+/* flat strings are allocated along with their bytes, strings live as long
+ * as the program */
+static const lpl_string* lpl_make_string(const char* data, size_t length)
+{
+    lpl_string* result = (lpl_string*)malloc(sizeof(lpl_string) + length);
+    char* bytes;
+    size_t i;
+    if (!result)
+        lpl_error("out of memory");
+    bytes = (char*)(result + 1);
+    memcpy(bytes, data, length);
+    result->data = bytes;
+    result->length = length;
+    result->hash = 0;
+    result->power = 1;
+    for (i = 0; i < length; i++) {
+        result->hash = result->hash * LPL_HASH_BASE + (unsigned char)data[i];
+        result->power *= LPL_HASH_BASE;
+    }
+    result->left = NULL;
+    result->right = NULL;
+    return result;
+}
+
+static const lpl_string* lpl_concatenate(
+    const lpl_string* left, const lpl_string* right)
+{
+    size_t length = left->length + right->length;
+    lpl_string* result;
+    if (left->length == 0)
+        return right;
+    if (right->length == 0)
+        return left;
+    if (length < LPL_MIN_ROPE_LENGTH) {
+        char* data;
+        result = (lpl_string*)malloc(sizeof(lpl_string) + length);
+        if (!result)
+            lpl_error("out of memory");
+        data = (char*)(result + 1);
+        memcpy(data, lpl_flatten(left), left->length);
+        memcpy(data + left->length, lpl_flatten(right), right->length);
+        result->data = data;
+        result->left = NULL;
+        result->right = NULL;
+    } else {
+        result = (lpl_string*)malloc(sizeof(lpl_string));
+        if (!result)
+            lpl_error("out of memory");
+        result->data = NULL;
+        result->left = left;
+        result->right = right;
+    }
+    result->length = length;
+    result->hash = left->hash * right->power + right->hash;
+    result->power = left->power * right->power;
+    return result;
+}
+
+/* negative, zero or positive as `left` orders before, the same as or after
+ * `right`, byte by byte */
+static int64_t lpl_compare(const lpl_string* left, const lpl_string* right)
+{
+    size_t common = left->length < right->length ? left->length : right->length;
+    int order = memcmp(lpl_flatten(left), lpl_flatten(right), common);
+    if (order != 0)
+        return order;
+    return left->length < right->length ? -1 : left->length > right->length;
+}
+
+static bool lpl_equal(lpl_value left, lpl_value right)
+{
+    if (left.type != right.type)
+        return false;
+    switch (left.type) {
+    case LPL_UNIT: return true;
+    case LPL_BOOL: return left.as.b == right.as.b;
+    case LPL_STRING:
+        return left.as.s == right.as.s
+            || (left.as.s->length == right.as.s->length
+                && left.as.s->hash == right.as.s->hash
+                && memcmp(lpl_flatten(left.as.s), lpl_flatten(right.as.s),
+                       left.as.s->length)
+                    == 0);
+    case LPL_BUILTIN:
+    case LPL_FUNCTION: return left.as.fn == right.as.fn;
+    case LPL_ARRAY: return left.as.a == right.as.a;
+    default: return false;
+    }
+}
+
+/* the key `match` dispatches strings on, the same as the VM's */
+static uint64_t lpl_string_key(const lpl_string* s) { return s->hash; }
+
+static lpl_value lpl_array_binary(
+    int op, lpl_value left, lpl_value right, lpl_slot* slot);
+
+static inline lpl_value lpl_binary(int op, lpl_value left, lpl_value right)
+{
+    if (left.type == LPL_INT && right.type == LPL_INT)
+        return lpl_int_operation(op, left.as.i, right.as.i);
+    if (lpl_is_number(left) && lpl_is_number(right))
+        return lpl_float_operation(
+            op, lpl_to_float(left), lpl_to_float(right));
+    if (left.type == LPL_CHAR && right.type == LPL_CHAR) {
+        lpl_value result = lpl_int_operation(op, left.as.c, right.as.c);
+        if (result.type == LPL_BOOL)
+            return result;
+        return lpl_char((char)result.as.i);
+    }
+    if (left.type == LPL_CHAR && right.type == LPL_INT
+        && (op == LPL_OP_ADD || op == LPL_OP_SUBTRACT))
+        return lpl_char(
+            (char)lpl_int_operation(op, left.as.c, right.as.i).as.i);
+    if (op == LPL_OP_ADD && left.type == LPL_STRING
+        && right.type == LPL_STRING)
+        return lpl_string_value(lpl_concatenate(left.as.s, right.as.s));
+    if (left.type == LPL_STRING && right.type == LPL_STRING
+        && op >= LPL_OP_LESS_THAN && op <= LPL_OP_GREATER_THAN_EQUAL)
+        return lpl_int_operation(op, lpl_compare(left.as.s, right.as.s), 0);
+    if (left.type == LPL_ARRAY && right.type == LPL_ARRAY
+        && (op <= LPL_OP_MULTIPLY
+            || (op >= LPL_OP_BITWISE_AND && op <= LPL_OP_BITWISE_XOR)))
+        return lpl_array_binary(op, left, right, NULL);
+    if (op == LPL_OP_EQUAL || op == LPL_OP_NOT_EQUAL) {
+        bool equal = lpl_equal(left, right);
+        return lpl_bool(op == LPL_OP_EQUAL ? equal : !equal);
+    }
+    lpl_unsupported_operands(op, left.type, right.type);
+}
+
+/* like `lpl_binary`, with a resulting array made in `slot` */
+static lpl_value lpl_binary_in(
+    int op, lpl_value left, lpl_value right, lpl_slot* slot)
+{
+    if (left.type == LPL_ARRAY && right.type == LPL_ARRAY
+        && (op <= LPL_OP_MULTIPLY
+            || (op >= LPL_OP_BITWISE_AND && op <= LPL_OP_BITWISE_XOR)))
+        return lpl_array_binary(op, left, right, slot);
+    return lpl_binary(op, left, right);
+}
+
+static lpl_value lpl_unary(int op, lpl_value value)
+{
+    char message[128];
+    switch (op) {
+    case LPL_OP_LOGICAL_NOT:
+        if (value.type == LPL_BOOL)
+            return lpl_bool(!value.as.b);
+        break;
+    case LPL_OP_BITWISE_NOT:
+        if (value.type == LPL_INT)
+            return lpl_int(~value.as.i);
+        break;
+    case LPL_OP_PLUS:
+        if (lpl_is_number(value))
+            return value;
+        break;
+    case LPL_OP_NEGATE:
+        if (value.type == LPL_INT)
+            return lpl_int((int64_t)(0 - (uint64_t)value.as.i));
+        if (value.type == LPL_FLOAT)
+            return lpl_float(-value.as.f);
+        break;
+    }
+    snprintf(message, sizeof(message), "unsupported operand %s `%s`",
+        lpl_op_names[op], lpl_type_names[value.type]);
+    lpl_error(message);
+}
+
+static inline lpl_value lpl_check_type(lpl_value value, lpl_type type)
+{
+    char message[128];
+    if (value.type == type)
+        return value;
+    snprintf(message, sizeof(message), "expected `%s`, got `%s`",
+        lpl_type_names[type], lpl_type_names[value.type]);
+    lpl_error(message);
+}
+
+/* the storage is aligned to and rounded up to 64 bytes like the VM's,
+ * arrays live as long as the program */
+static lpl_value lpl_new_array(lpl_type element, int64_t length)
+{
+    char message[128];
+    size_t size;
+    char* storage;
+    lpl_array* array;
+    lpl_value value;
+    int64_t i;
+    if (length < 0 || length > (INT64_C(1) << 32)) {
+        snprintf(message, sizeof(message), "invalid array length %" PRId64,
+            length);
+        lpl_error(message);
+    }
+    size = (element == LPL_INT || element == LPL_FLOAT ? sizeof(int64_t)
+                                                       : sizeof(lpl_value))
+        * (size_t)length;
+    size = (size + 63) / 64 * 64;
+    storage = (char*)calloc(1, size + 64);
+    array = (lpl_array*)malloc(sizeof(lpl_array));
+    if (!storage || !array)
+        lpl_error("out of memory");
+    array->element = element;
+    array->length = length;
+    array->data = storage + (64 - (uintptr_t)storage % 64);
+    if (element != LPL_INT && element != LPL_FLOAT)
+        for (i = 0; i < length; i++)
+            ((lpl_value*)array->data)[i] = lpl_unit();
+    value.type = LPL_ARRAY;
+    value.as.a = array;
+    return value;
+}
+
+/* arrays of ints and floats are made in `slot` when there is one */
+static lpl_value lpl_new_array_in(
+    lpl_slot* slot, lpl_type element, int64_t length)
+{
+    size_t size;
+    lpl_value value;
+    if (!slot || (element != LPL_INT && element != LPL_FLOAT) || length < 0
+        || length > (INT64_C(1) << 32))
+        return lpl_new_array(element, length);
+    size = ((size_t)length * sizeof(int64_t) + 63) / 64 * 64;
+    if (!slot->storage || slot->size < size) {
+        free(slot->storage);
+        slot->storage = (char*)malloc(size + 64);
+        if (!slot->storage)
+            lpl_error("out of memory");
+        slot->size = size;
+    }
+    slot->array.element = element;
+    slot->array.length = length;
+    slot->array.data = slot->storage + (64 - (uintptr_t)slot->storage % 64);
+    memset(slot->array.data, 0, size);
+    value.type = LPL_ARRAY;
+    value.as.a = &slot->array;
+    return value;
+}
+
+static inline lpl_value lpl_get(const lpl_array* array, int64_t index)
+{
+    switch (array->element) {
+    case LPL_INT: return lpl_int(((const int64_t*)array->data)[index]);
+    case LPL_FLOAT: return lpl_float(((const double*)array->data)[index]);
+    default: return ((const lpl_value*)array->data)[index];
+    }
+}
+
+static inline void lpl_set(lpl_array* array, int64_t index, lpl_value value)
+{
+    char message[128];
+    if (value.type != array->element) {
+        snprintf(message, sizeof(message),
+            "cannot store `%s` in an array of `%s`",
+            lpl_type_names[value.type], lpl_type_names[array->element]);
+        lpl_error(message);
+    }
+    switch (array->element) {
+    case LPL_INT: ((int64_t*)array->data)[index] = value.as.i; break;
+    case LPL_FLOAT: ((double*)array->data)[index] = value.as.f; break;
+    default: ((lpl_value*)array->data)[index] = value; break;
+    }
+}
+
+static lpl_value lpl_array_of(const lpl_value* elements, size_t count)
+{
+    char message[128];
+    lpl_type element = count == 0 ? LPL_UNIT : elements[0].type;
+    lpl_value array = lpl_new_array(element, (int64_t)count);
+    size_t i;
+    for (i = 0; i < count; i++) {
+        if (elements[i].type != element) {
+            snprintf(message, sizeof(message),
+                "array elements have different types `%s` and `%s`",
+                lpl_type_names[element], lpl_type_names[elements[i].type]);
+            lpl_error(message);
+        }
+        lpl_set(array.as.a, (int64_t)i, elements[i]);
+    }
+    return array;
+}
+
+/* the array `array` after checking that it is one, and that `index` is an
+ * int and, unless `check_bounds` is false, in bounds */
+static inline lpl_array* lpl_element(
+    lpl_value array, lpl_value index, bool check_bounds)
+{
+    char message[128];
+    if (array.type != LPL_ARRAY) {
+        snprintf(message, sizeof(message), "cannot index `%s`",
+            lpl_type_names[array.type]);
+        lpl_error(message);
+    }
+    if (index.type != LPL_INT) {
+        snprintf(message, sizeof(message), "expected `Int` index, got `%s`",
+            lpl_type_names[index.type]);
+        lpl_error(message);
+    }
+    if (check_bounds
+        && (uint64_t)index.as.i >= (uint64_t)array.as.a->length) {
+        snprintf(message, sizeof(message),
+            "index %" PRId64 " out of bounds for array of length %" PRId64,
+            index.as.i, array.as.a->length);
+        lpl_error(message);
+    }
+    return array.as.a;
+}
+
+/* the character at `index` of `string`, whose bounds are always checked */
+static lpl_value lpl_character(const lpl_string* string, lpl_value index)
+{
+    char message[128];
+    if (index.type != LPL_INT) {
+        snprintf(message, sizeof(message), "expected `Int` index, got `%s`",
+            lpl_type_names[index.type]);
+        lpl_error(message);
+    }
+    if ((uint64_t)index.as.i >= (uint64_t)string->length) {
+        snprintf(message, sizeof(message),
+            "index %" PRId64 " out of bounds for string of length %zu",
+            index.as.i, string->length);
+        lpl_error(message);
+    }
+    return lpl_char(lpl_flatten(string)[index.as.i]);
+}
+
+static inline lpl_value lpl_index(
+    lpl_value array, lpl_value index, bool check_bounds)
+{
+    if (array.type == LPL_STRING)
+        return lpl_character(array.as.s, index);
+    return lpl_get(lpl_element(array, index, check_bounds), index.as.i);
+}
+
+static inline void lpl_store_index(
+    lpl_value array, lpl_value index, lpl_value value, bool check_bounds)
+{
+    lpl_set(lpl_element(array, index, check_bounds), index.as.i, value);
+}
+
+/* `steps` are element-wise operations over arrays in postfix order, `L`
+ * loads the next operand and `+`, `-`, `*`, `&`, `|` and `^` apply to the
+ * two arrays on top; checks them the way evaluating them one at a time would
+ * and returns an array for the result */
+static lpl_value lpl_map_result(
+    const char* steps, const lpl_value* operands, lpl_slot* slot)
+{
+    static const char symbols[] = "+-*???&|^";
+    char message[128];
+    lpl_type types[LPL_MAX_MAP_OPERANDS];
+    int64_t lengths[LPL_MAX_MAP_OPERANDS];
+    size_t depth = 0;
+    for (; *steps; steps++) {
+        lpl_type type;
+        int op;
+        if (*steps == 'L') {
+            types[depth] = operands->as.a->element;
+            lengths[depth] = operands->as.a->length;
+            operands++;
+            depth++;
+            continue;
+        }
+        op = (int)(strchr(symbols, *steps) - symbols);
+        depth--;
+        type = types[depth - 1];
+        if (type != types[depth]
+            || (type != LPL_INT
+                && (type != LPL_FLOAT || op > LPL_OP_MULTIPLY))) {
+            snprintf(message, sizeof(message),
+                "unsupported array elements `%s` %s `%s`",
+                lpl_type_names[type], lpl_op_names[op],
+                lpl_type_names[types[depth]]);
+            lpl_error(message);
+        }
+        if (lengths[depth - 1] != lengths[depth]) {
+            snprintf(message, sizeof(message),
+                "mismatched array lengths %" PRId64 " and %" PRId64,
+                lengths[depth - 1], lengths[depth]);
+            lpl_error(message);
+        }
+    }
+    return lpl_new_array_in(slot, types[0], lengths[0]);
+}
+
+static lpl_value lpl_array_binary(
+    int op, lpl_value left, lpl_value right, lpl_slot* slot)
+{
+    static const char symbols[] = "+-*???&|^";
+    char steps[4] = { 'L', 'L', 0, 0 };
+    lpl_value operands[2];
+    lpl_value result;
+    int64_t i;
+    steps[2] = symbols[op];
+    operands[0] = left;
+    operands[1] = right;
+    result = lpl_map_result(steps, operands, slot);
+    for (i = 0; i < result.as.a->length; i++)
+        lpl_set(result.as.a, i,
+            lpl_binary(op, lpl_get(left.as.a, i), lpl_get(right.as.a, i)));
+    return result;
+}
+
+static inline bool lpl_condition(lpl_value value)
+{
+    char message[128];
+    if (value.type == LPL_BOOL)
+        return value.as.b;
+    snprintf(message, sizeof(message), "expected `Bool` condition, got `%s`",
+        lpl_type_names[value.type]);
+    lpl_error(message);
+}
+
+static LPL_NORETURN void lpl_undefined_symbol(const char* name)
+{
+    char message[512];
+    snprintf(message, sizeof(message), "undefined symbol `%s`", name);
+    lpl_error(message);
+}
+
+static inline lpl_value lpl_load_global(lpl_value global, const char* name)
+{
+    if (global.type == LPL_UNDEFINED)
+        lpl_undefined_symbol(name);
+    return global;
+}
+
+static void lpl_store_global(
+    lpl_value* global, lpl_value value, const char* name)
+{
+    char message[512];
+    if (global->type == LPL_UNDEFINED)
+        lpl_undefined_symbol(name);
+    if (global->type == LPL_BUILTIN) {
+        snprintf(message, sizeof(message), "cannot assign to builtin `%s`",
+            name);
+        lpl_error(message);
+    }
+    *global = value;
+}
+
+static inline void lpl_enter(void)
+{
+    if (lpl_depth >= LPL_MAX_FRAMES)
+        lpl_error("stack overflow");
+    lpl_depth++;
+}
+
+static inline void lpl_leave(void) { lpl_depth--; }
+
+static LPL_NORETURN void lpl_arity_error(
+    const char* name, int arity, size_t count)
+{
+    char message[512];
+    snprintf(message, sizeof(message), "`%s` expected %d arguments, got %zu",
+        name, arity, count);
+    lpl_error(message);
+}
+
+static lpl_value lpl_call(lpl_value callee, const lpl_value* args, size_t count)
+{
+    char message[128];
+    if (callee.type != LPL_BUILTIN && callee.type != LPL_FUNCTION) {
+        snprintf(message, sizeof(message), "`%s` is not callable",
+            lpl_type_names[callee.type]);
+        lpl_error(message);
+    }
+    if (callee.as.fn->arity >= 0 && (size_t)callee.as.fn->arity != count)
+        lpl_arity_error(callee.as.fn->name, callee.as.fn->arity, count);
+    return callee.as.fn->call(args, count);
+}
+
+static void lpl_print_value(lpl_value value)
+{
+    switch (value.type) {
+    case LPL_UNIT: fputs("()", stdout); break;
+    case LPL_INT: printf("%" PRId64, value.as.i); break;
+    case LPL_FLOAT: printf("%g", value.as.f); break;
+    case LPL_CHAR: putchar(value.as.c); break;
+    case LPL_BOOL: fputs(value.as.b ? "true" : "false", stdout); break;
+    case LPL_STRING:
+        fwrite(lpl_flatten(value.as.s), 1, value.as.s->length, stdout);
+        break;
+    case LPL_BUILTIN: printf("<builtin %s>", value.as.fn->name); break;
+    case LPL_FUNCTION: printf("<func %s>", value.as.fn->name); break;
+    case LPL_ARRAY: {
+        int64_t i;
+        putchar('[');
+        for (i = 0; i < value.as.a->length; i++) {
+            if (i > 0)
+                fputs(", ", stdout);
+            lpl_print_value(lpl_get(value.as.a, i));
+        }
+        putchar(']');
+        break;
+    }
+    default: break;
+    }
+}
+
+static lpl_value lpl_call_print(const lpl_value* args, size_t count)
+{
+    size_t i;
+    for (i = 0; i < count; i++)
+        lpl_print_value(args[i]);
+    return lpl_unit();
+}
+
+static lpl_value lpl_call_println(const lpl_value* args, size_t count)
+{
+    lpl_call_print(args, count);
+    putchar('\n');
+    return lpl_unit();
+}
+
+static lpl_value lpl_call_len(const lpl_value* args, size_t count)
+{
+    char message[128];
+    (void)count;
+    if (args[0].type == LPL_ARRAY)
+        return lpl_int(args[0].as.a->length);
+    if (args[0].type == LPL_STRING)
+        return lpl_int((int64_t)args[0].as.s->length);
+    snprintf(message, sizeof(message),
+        "`len` expected `Array` or `String`, got `%s`",
+        lpl_type_names[args[0].type]);
+    lpl_error(message);
+}
+
+/* "`Array` of `Int`" or "`Int`" */
+static void lpl_describe(char* text, size_t size, lpl_value value)
+{
+    if (value.type == LPL_ARRAY)
+        snprintf(text, size, "`Array` of `%s`",
+            lpl_type_names[value.as.a->element]);
+    else
+        snprintf(text, size, "`%s`", lpl_type_names[value.type]);
+}
+
+/* the array of `Int`s or `Float`s a reduction is over */
+static const lpl_array* lpl_numbers(const char* name, lpl_value value)
+{
+    char message[128];
+    char described[64];
+    if (value.type == LPL_ARRAY
+        && (value.as.a->element == LPL_INT
+            || value.as.a->element == LPL_FLOAT))
+        return value.as.a;
+    lpl_describe(described, sizeof(described), value);
+    snprintf(message, sizeof(message),
+        "`%s` expected `Array` of `Int` or `Float`, got %s", name, described);
+    lpl_error(message);
+}
+
+/* Reductions accumulate element `i` into lane `i % LPL_LANES`, then combine
+ * the upper half of the lanes into the lower half until one is left, like
+ * the VM's kernels, so floats add up the same. */
+
+static lpl_value lpl_call_sum(const lpl_value* args, size_t count)
+{
+    const lpl_array* array = lpl_numbers("sum", args[0]);
+    int64_t i;
+    int j, width;
+    (void)count;
+    if (array->element == LPL_INT) {
+        const int64_t* values = (const int64_t*)array->data;
+        uint64_t lane[LPL_LANES] = { 0 };
+        for (i = 0; i < array->length; i++)
+            lane[i % LPL_LANES] += (uint64_t)values[i];
+        for (width = LPL_LANES / 2; width > 0; width /= 2)
+            for (j = 0; j < width; j++)
+                lane[j] += lane[j + width];
+        return lpl_int((int64_t)lane[0]);
+    } else {
+        const double* values = (const double*)array->data;
+        double lane[LPL_LANES] = { 0 };
+        for (i = 0; i < array->length; i++)
+            lane[i % LPL_LANES] += values[i];
+        for (width = LPL_LANES / 2; width > 0; width /= 2)
+            for (j = 0; j < width; j++)
+                lane[j] += lane[j + width];
+        return lpl_float(lane[0]);
+    }
+}
+
+/* NaNs are compared like `x < min ? x : min` */
+static lpl_value lpl_extremum(const char* name, lpl_value value, bool is_min)
+{
+    const lpl_array* array = lpl_numbers(name, value);
+    char message[128];
+    int64_t i;
+    int j, width;
+    if (array->length == 0) {
+        snprintf(message, sizeof(message), "`%s` of an empty array", name);
+        lpl_error(message);
+    }
+    if (array->element == LPL_INT) {
+        const int64_t* values = (const int64_t*)array->data;
+        int64_t lane[LPL_LANES];
+        for (j = 0; j < LPL_LANES; j++)
+            lane[j] = values[0];
+        for (i = 0; i < array->length; i++) {
+            int64_t* current = &lane[i % LPL_LANES];
+            if (is_min ? values[i] < *current : values[i] > *current)
+                *current = values[i];
+        }
+        for (width = LPL_LANES / 2; width > 0; width /= 2)
+            for (j = 0; j < width; j++)
+                if (is_min ? lane[j + width] < lane[j]
+                           : lane[j + width] > lane[j])
+                    lane[j] = lane[j + width];
+        return lpl_int(lane[0]);
+    } else {
+        const double* values = (const double*)array->data;
+        double lane[LPL_LANES];
+        for (j = 0; j < LPL_LANES; j++)
+            lane[j] = values[0];
+        for (i = 0; i < array->length; i++) {
+            double* current = &lane[i % LPL_LANES];
+            if (is_min ? values[i] < *current : values[i] > *current)
+                *current = values[i];
+        }
+        for (width = LPL_LANES / 2; width > 0; width /= 2)
+            for (j = 0; j < width; j++)
+                if (is_min ? lane[j + width] < lane[j]
+                           : lane[j + width] > lane[j])
+                    lane[j] = lane[j + width];
+        return lpl_float(lane[0]);
+    }
+}
+
+static lpl_value lpl_call_min(const lpl_value* args, size_t count)
+{
+    (void)count;
+    return lpl_extremum("min", args[0], true);
+}
+
+static lpl_value lpl_call_max(const lpl_value* args, size_t count)
+{
+    (void)count;
+    return lpl_extremum("max", args[0], false);
+}
+
+static lpl_value lpl_call_dot(const lpl_value* args, size_t count)
+{
+    const lpl_array* left = lpl_numbers("dot", args[0]);
+    const lpl_array* right = lpl_numbers("dot", args[1]);
+    char message[192];
+    char described[2][64];
+    int64_t i;
+    int j, width;
+    (void)count;
+    if (left->element != right->element) {
+        lpl_describe(described[0], sizeof(described[0]), args[0]);
+        lpl_describe(described[1], sizeof(described[1]), args[1]);
+        snprintf(message, sizeof(message),
+            "`dot` expected arrays of the same type, got %s and %s",
+            described[0], described[1]);
+        lpl_error(message);
+    }
+    if (left->length != right->length) {
+        snprintf(message, sizeof(message),
+            "mismatched array lengths %" PRId64 " and %" PRId64, left->length,
+            right->length);
+        lpl_error(message);
+    }
+    if (left->element == LPL_INT) {
+        const int64_t* l = (const int64_t*)left->data;
+        const int64_t* r = (const int64_t*)right->data;
+        uint64_t lane[LPL_LANES] = { 0 };
+        for (i = 0; i < left->length; i++)
+            lane[i % LPL_LANES] += (uint64_t)l[i] * (uint64_t)r[i];
+        for (width = LPL_LANES / 2; width > 0; width /= 2)
+            for (j = 0; j < width; j++)
+                lane[j] += lane[j + width];
+        return lpl_int((int64_t)lane[0]);
+    } else {
+        const double* l = (const double*)left->data;
+        const double* r = (const double*)right->data;
+        double lane[LPL_LANES] = { 0 };
+        for (i = 0; i < left->length; i++)
+            lane[i % LPL_LANES] += l[i] * r[i];
+        for (width = LPL_LANES / 2; width > 0; width /= 2)
+            for (j = 0; j < width; j++)
+                lane[j] += lane[j + width];
+        return lpl_float(lane[0]);
+    }
+}
+
+static const lpl_string* lpl_string_argument(const char* name, lpl_value value)
+{
+    char message[128];
+    if (value.type == LPL_STRING)
+        return value.as.s;
+    snprintf(message, sizeof(message), "`%s` expected `String`, got `%s`",
+        name, lpl_type_names[value.type]);
+    lpl_error(message);
+}
+
+/* the index of the first occurrence of `needle` from `start` on, or
+ * SIZE_MAX */
+static size_t lpl_find_from(
+    const lpl_string* haystack, const lpl_string* needle, size_t start)
+{
+    const char* bytes = lpl_flatten(haystack);
+    const char* pattern = lpl_flatten(needle);
+    const char* candidate = bytes + start;
+    const char* end;
+    if (needle->length == 0)
+        return start;
+    if (haystack->length - start < needle->length)
+        return SIZE_MAX;
+    end = bytes + haystack->length - needle->length + 1;
+    while ((candidate = (const char*)memchr(
+                candidate, pattern[0], (size_t)(end - candidate)))
+        != NULL) {
+        if (memcmp(candidate + 1, pattern + 1, needle->length - 1) == 0)
+            return (size_t)(candidate - bytes);
+        candidate++;
+    }
+    return SIZE_MAX;
+}
+
+static lpl_value lpl_call_find(const lpl_value* args, size_t count)
+{
+    size_t found = lpl_find_from(lpl_string_argument("find", args[0]),
+        lpl_string_argument("find", args[1]), 0);
+    (void)count;
+    return lpl_int(found == SIZE_MAX ? -1 : (int64_t)found);
+}
+
+static lpl_value lpl_call_contains(const lpl_value* args, size_t count)
+{
+    (void)count;
+    return lpl_bool(lpl_find_from(lpl_string_argument("contains", args[0]),
+                        lpl_string_argument("contains", args[1]), 0)
+        != SIZE_MAX);
+}
+
+static lpl_value lpl_call_starts_with(const lpl_value* args, size_t count)
+{
+    const lpl_string* string = lpl_string_argument("starts_with", args[0]);
+    const lpl_string* prefix = lpl_string_argument("starts_with", args[1]);
+    (void)count;
+    return lpl_bool(prefix->length <= string->length
+        && memcmp(lpl_flatten(string), lpl_flatten(prefix), prefix->length)
+            == 0);
+}
+
+static lpl_value lpl_call_split(const lpl_value* args, size_t count)
+{
+    const lpl_string* string = lpl_string_argument("split", args[0]);
+    const lpl_string* separator = lpl_string_argument("split", args[1]);
+    const char* bytes = lpl_flatten(string);
+    size_t parts = 1, start = 0, found;
+    int64_t i = 0;
+    lpl_value result;
+    (void)count;
+    if (separator->length == 0)
+        lpl_error("`split` expected a non-empty separator");
+    while ((found = lpl_find_from(string, separator, start)) != SIZE_MAX) {
+        parts++;
+        start = found + separator->length;
+    }
+    result = lpl_new_array(LPL_STRING, (int64_t)parts);
+    start = 0;
+    while ((found = lpl_find_from(string, separator, start)) != SIZE_MAX) {
+        lpl_set(result.as.a, i++,
+            lpl_string_value(
+                lpl_make_string(bytes + start, found - start)));
+        start = found + separator->length;
+    }
+    lpl_set(result.as.a, i,
+        lpl_string_value(
+            lpl_make_string(bytes + start, string->length - start)));
+    return result;
+}
+
+static lpl_value lpl_call_replace(const lpl_value* args, size_t count)
+{
+    const lpl_string* string = lpl_string_argument("replace", args[0]);
+    const lpl_string* pattern = lpl_string_argument("replace", args[1]);
+    const lpl_string* replacement = lpl_string_argument("replace", args[2]);
+    const char* bytes = lpl_flatten(string);
+    size_t length = 0, start = 0, found;
+    const lpl_string* result;
+    char* buffer;
+    (void)count;
+    if (pattern->length == 0)
+        lpl_error("`replace` expected a non-empty pattern");
+    if (lpl_find_from(string, pattern, 0) == SIZE_MAX)
+        return args[0];
+    while ((found = lpl_find_from(string, pattern, start)) != SIZE_MAX) {
+        length += found - start + replacement->length;
+        start = found + pattern->length;
+    }
+    length += string->length - start;
+    buffer = (char*)malloc(length + 1);
+    if (!buffer)
+        lpl_error("out of memory");
+    length = 0;
+    start = 0;
+    while ((found = lpl_find_from(string, pattern, start)) != SIZE_MAX) {
+        memcpy(buffer + length, bytes + start, found - start);
+        length += found - start;
+        memcpy(buffer + length, lpl_flatten(replacement), replacement->length);
+        length += replacement->length;
+        start = found + pattern->length;
+    }
+    memcpy(buffer + length, bytes + start, string->length - start);
+    length += string->length - start;
+    result = lpl_make_string(buffer, length);
+    free(buffer);
+    return lpl_string_value(result);
+}
+
+static lpl_value lpl_make_array(const lpl_value* args, lpl_slot* slot)
+{
+    char message[128];
+    lpl_value array;
+    int64_t i;
+    if (args[0].type != LPL_INT) {
+        snprintf(message, sizeof(message),
+            "`array` expected `Int` length, got `%s`",
+            lpl_type_names[args[0].type]);
+        lpl_error(message);
+    }
+    array = lpl_new_array_in(slot, args[1].type, args[0].as.i);
+    for (i = 0; i < array.as.a->length; i++)
+        lpl_set(array.as.a, i, args[1]);
+    return array;
+}
+
+static lpl_value lpl_call_array(const lpl_value* args, size_t count)
+{
+    (void)count;
+    return lpl_make_array(args, NULL);
+}
+
+static const lpl_callable lpl_builtin_print = { "print", -1, lpl_call_print };
+static const lpl_callable lpl_builtin_println
+    = { "println", -1, lpl_call_println };
+static const lpl_callable lpl_builtin_len = { "len", 1, lpl_call_len };
+static const lpl_callable lpl_builtin_array = { "array", 2, lpl_call_array };
+static const lpl_callable lpl_builtin_sum = { "sum", 1, lpl_call_sum };
+static const lpl_callable lpl_builtin_min = { "min", 1, lpl_call_min };
+static const lpl_callable lpl_builtin_max = { "max", 1, lpl_call_max };
+static const lpl_callable lpl_builtin_dot = { "dot", 2, lpl_call_dot };
+static const lpl_callable lpl_builtin_find = { "find", 2, lpl_call_find };
+static const lpl_callable lpl_builtin_contains
+    = { "contains", 2, lpl_call_contains };
+static const lpl_callable lpl_builtin_starts_with
+    = { "starts_with", 2, lpl_call_starts_with };
+static const lpl_callable lpl_builtin_split = { "split", 2, lpl_call_split };
+static const lpl_callable lpl_builtin_replace
+    = { "replace", 3, lpl_call_replace };
+)runtime";
+
+// the field and C constant of a case of a `Switch`
+std::string case_field(ValueType type)
+{
+    switch (type) {
+    case ValueType::Char: return "c";
+    case ValueType::Bool: return "b";
+    default: return "i";
+    }
+}
+
+std::string case_label(const Value& value)
+{
+    switch (value.type) {
+    case ValueType::String:
+        return "UINT64_C("
+            + std::to_string(static_cast<uint64_t>(Bytecode::switch_key(value)))
+            + ")";
+    case ValueType::Int:
+        if (value.int_value == INT64_MIN)
+            return "INT64_MIN";
+        return "INT64_C(" + std::to_string(value.int_value) + ")";
+    default: return std::to_string(Bytecode::switch_key(value));
+    }
+}
+
+std::string operator_name(Ir::Op op)
+{
+    switch (op) {
+    case Ir::Op::Add: return "LPL_OP_ADD";
+    case Ir::Op::Subtract: return "LPL_OP_SUBTRACT";
+    case Ir::Op::Multiply: return "LPL_OP_MULTIPLY";
+    case Ir::Op::Divide: return "LPL_OP_DIVIDE";
+    case Ir::Op::Modulus: return "LPL_OP_MODULUS";
+    case Ir::Op::Exponentiate: return "LPL_OP_EXPONENTIATE";
+    case Ir::Op::BitwiseAnd: return "LPL_OP_BITWISE_AND";
+    case Ir::Op::BitwiseOr: return "LPL_OP_BITWISE_OR";
+    case Ir::Op::BitwiseXor: return "LPL_OP_BITWISE_XOR";
+    case Ir::Op::BitwiseLeftShift: return "LPL_OP_BITWISE_LEFT_SHIFT";
+    case Ir::Op::BitwiseRightShift: return "LPL_OP_BITWISE_RIGHT_SHIFT";
+    case Ir::Op::LessThan: return "LPL_OP_LESS_THAN";
+    case Ir::Op::LessThanEqual: return "LPL_OP_LESS_THAN_EQUAL";
+    case Ir::Op::GreaterThan: return "LPL_OP_GREATER_THAN";
+    case Ir::Op::GreaterThanEqual: return "LPL_OP_GREATER_THAN_EQUAL";
+    case Ir::Op::Equal: return "LPL_OP_EQUAL";
+    case Ir::Op::NotEqual: return "LPL_OP_NOT_EQUAL";
+    case Ir::Op::LogicalNot: return "LPL_OP_LOGICAL_NOT";
+    case Ir::Op::BitwiseNot: return "LPL_OP_BITWISE_NOT";
+    case Ir::Op::Plus: return "LPL_OP_PLUS";
+    case Ir::Op::Negate: return "LPL_OP_NEGATE";
+    default: break;
+    }
+    std::cerr << "internal: unexhaustive match at " << __FILE__ << ":"
+              << __LINE__ << ": in " << __func__ << "\n";
+    exit(1);
+}
+
+std::string type_name(ValueType type)
+{
+    switch (type) {
+    case ValueType::Unit: return "LPL_UNIT";
+    case ValueType::Int: return "LPL_INT";
+    case ValueType::Float: return "LPL_FLOAT";
+    case ValueType::Char: return "LPL_CHAR";
+    case ValueType::Bool: return "LPL_BOOL";
+    case ValueType::String: return "LPL_STRING";
+    case ValueType::Builtin: return "LPL_BUILTIN";
+    case ValueType::Function: return "LPL_FUNCTION";
+    case ValueType::Array: return "LPL_ARRAY";
+    }
+    std::cerr << "internal: unexhaustive match at " << __FILE__ << ":"
+              << __LINE__ << ": in " << __func__ << "\n";
+    exit(1);
+}
+
+// the C type of values of `type` when they are unboxed
+std::string c_type(std::optional<ValueType> type)
+{
+    switch (type.value_or(ValueType::Unit)) {
+    case ValueType::Int: return "int64_t";
+    case ValueType::Float: return "double";
+    case ValueType::Bool: return "bool";
+    default: return "lpl_value";
+    }
+}
+
+// boxes a raw C value of `type`
+std::string box(const std::string& raw, ValueType type)
+{
+    switch (type) {
+    case ValueType::Int: return "lpl_int(" + raw + ")";
+    case ValueType::Float: return "lpl_float(" + raw + ")";
+    case ValueType::Bool: return "lpl_bool(" + raw + ")";
+    default: return raw;
+    }
+}
+
+// the raw C value of a boxed value of `type`
+std::string unbox(const std::string& boxed, ValueType type)
+{
+    switch (type) {
+    case ValueType::Int: return boxed + ".as.i";
+    case ValueType::Float: return boxed + ".as.f";
+    case ValueType::Bool: return boxed + ".as.b";
+    default: return boxed;
+    }
+}
+
+// the C operator of `op` on raw numbers of `type`, the operations which need
+// the runtime's checks have none
+std::optional<std::string> c_operator(Ir::Op op, ValueType type)
+{
+    // integer division traps on zero, bitwise operations are integer only
+    if (type == ValueType::Int ? op == Ir::Op::Divide
+                               : op >= Ir::Op::BitwiseAnd
+            && op <= Ir::Op::BitwiseXor)
+        return std::nullopt;
+    switch (op) {
+    case Ir::Op::Add: return "+";
+    case Ir::Op::Subtract: return "-";
+    case Ir::Op::Multiply: return "*";
+    case Ir::Op::Divide: return "/";
+    case Ir::Op::BitwiseAnd: return "&";
+    case Ir::Op::BitwiseOr: return "|";
+    case Ir::Op::BitwiseXor: return "^";
+    case Ir::Op::LessThan: return "<";
+    case Ir::Op::LessThanEqual: return "<=";
+    case Ir::Op::GreaterThan: return ">";
+    case Ir::Op::GreaterThanEqual: return ">=";
+    case Ir::Op::Equal: return "==";
+    case Ir::Op::NotEqual: return "!=";
+    default: return std::nullopt;
+    }
+}
+
+// escapes everything but printable ascii, octal escapes are always three
+// digits long so they can't run into a following digit
+std::string c_string_literal(const std::string& value)
+{
+    auto result = std::string { "\"" };
+    for (const auto c : value) {
+        const auto byte = static_cast<unsigned char>(c);
+        if (byte >= 0x20 && byte < 0x7f && c != '"' && c != '\\' && c != '?') {
+            result.push_back(c);
+        } else {
+            char escaped[5];
+            std::snprintf(escaped, sizeof(escaped), "\\%03o", byte);
+            result += escaped;
+        }
+    }
+    return result + "\"";
+}
+
+std::string float_literal(double value)
+{
+    if (std::isnan(value))
+        return "NAN";
+    if (std::isinf(value))
+        return value > 0 ? "HUGE_VAL" : "-HUGE_VAL";
+    char literal[32];
+    std::snprintf(literal, sizeof(literal), "%.17g", value);
+    return literal;
+}
+
+std::string join(const std::vector<std::string>& values)
+{
+    auto result = std::string {};
+    for (size_t i = 0; i < values.size(); i++)
+        result += (i > 0 ? ", " : "") + values[i];
+    return result;
+}
+
+}
+
+std::string Transpiler::transpile(const Ir::Module& module)
+{
+    m_module = &module;
+    auto declarations = std::stringstream {};
+    for (const auto& function : module.functions) {
+        declarations << "static lpl_value lpl_f_" << function->name << "(";
+        for (uint32_t i = 0; i < function->arity; i++)
+            declarations << (i > 0 ? ", " : "") << "lpl_value";
+        declarations << (function->arity == 0 ? "void" : "") << ");\n"
+                     << "static lpl_value lpl_w_" << function->name
+                     << "(const lpl_value* args, size_t count);\n"
+                     << "static const lpl_callable lpl_fn_" << function->name
+                     << " = { \"" << function->name << "\", "
+                     << function->arity << ", lpl_w_" << function->name
+                     << " };\n";
+        transpile_function(*function, "lpl_f_" + function->name);
+    }
+    transpile_function(*module.main, "lpl_program");
+
+    auto result = std::stringstream {};
+    result << "/* generated by lplc from " << m_filename << " */\n\n"
+           << runtime << "\n";
+    for (const auto& name : module.globals)
+        result << "static lpl_value lpl_g_" << name << ";\n";
+    result << "\n" << m_strings.str() << "\n" << declarations.str() << "\n"
+           << m_functions.str() << "int main(void)\n{\n";
+    for (uint32_t i = 0; i < module.globals.size(); i++) {
+        const auto& name = module.globals[i];
+        if (function_of(i))
+            result << "    lpl_g_" << name << " = lpl_function(&lpl_fn_"
+                   << name << ");\n";
+        else if (find_builtin(name))
+            result << "    lpl_g_" << name << " = lpl_builtin(&lpl_builtin_"
+                   << name << ");\n";
+    }
+    result << "    lpl_print_value(lpl_program());\n"
+           << "    putchar('\\n');\n"
+           << "    return 0;\n"
+           << "}\n";
+    return result.str();
+}
+
+void Transpiler::transpile_function(
+    const Ir::Function& function, const std::string& c_name)
+{
+    m_function = &function;
+    m_uses = function.use_counts();
+    m_tail_calls.clear();
+    m_jump_targets.clear();
+    m_jumps_to_start = false;
+    m_slots.clear();
+    for (const auto& block : function.blocks)
+        for (const auto& instruction : block->instructions)
+            if (instruction->local)
+                m_slots.push_back(instruction.get());
+
+    // direct calls right before the `Return` of their result become tail
+    // calls, only constants may be in between
+    for (const auto& block : function.blocks) {
+        const auto terminator = block->terminator();
+        if (terminator->op != Ir::Op::Return)
+            continue;
+        const auto value = terminator->operands[0];
+        if (value->op != Ir::Op::CallGlobal || value->block != block.get()
+            || m_uses.at(value) != 1 || !direct_callee(*value)
+            || direct_callee(*value)->arity != value->operands.size())
+            continue;
+        auto it = block->instructions.rbegin() + 1;
+        while ((*it)->op == Ir::Op::Constant)
+            ++it;
+        if (it->get() == value)
+            m_tail_calls.insert(value);
+    }
+
+    auto blocks = std::vector<std::pair<const Ir::Block*, std::string>> {};
+    for (size_t i = 0; i < function.blocks.size(); i++) {
+        const auto next = i + 1 < function.blocks.size()
+            ? function.blocks[i + 1].get()
+            : nullptr;
+        m_body = std::stringstream {};
+        m_indent = 1;
+        transpile_block(*function.blocks[i], next);
+        blocks.push_back({ function.blocks[i].get(), m_body.str() });
+    }
+
+    m_functions << "static lpl_value " << c_name << "(";
+    for (uint32_t i = 0; i < function.arity; i++)
+        m_functions << (i > 0 ? ", " : "") << "lpl_value a" << i;
+    m_functions << (function.arity == 0 ? "void" : "") << ")\n{\n";
+    auto values = std::map<std::string, std::vector<std::string>> {};
+    for (const auto& block : function.blocks)
+        for (const auto& instruction : block->instructions)
+            if (is_variable(*instruction))
+                values[c_type(unboxed_type(*instruction))].push_back(
+                    variable(*instruction));
+    for (const auto& [type, names] : values)
+        m_functions << "    " << type << " " << join(names) << ";\n";
+    for (const auto instruction : m_slots)
+        m_functions << "    lpl_slot s" << instruction->id << " = LPL_SLOT;\n";
+    m_functions << "    lpl_enter();\n";
+    if (m_jumps_to_start)
+        m_functions << "lpl_start:;\n";
+    for (const auto& [block, body] : blocks) {
+        if (m_jump_targets.count(block))
+            m_functions << "b" << block->id << ":;\n";
+        m_functions << body;
+    }
+    m_functions << "}\n\n";
+    if (&function == m_module->main.get())
+        return;
+
+    m_functions << "static lpl_value lpl_w_" << function.name
+                << "(const lpl_value* args, size_t count)\n{\n"
+                << "    (void)count;\n"
+                << (function.arity == 0 ? "    (void)args;\n" : "")
+                << "    return " << c_name << "(";
+    for (uint32_t i = 0; i < function.arity; i++)
+        m_functions << (i > 0 ? ", " : "") << "args[" << i << "]";
+    m_functions << ");\n}\n\n";
+}
+
+void Transpiler::transpile_block(const Ir::Block& block, const Ir::Block* next)
+{
+    for (const auto& instruction : block.instructions) {
+        if (Ir::is_terminator(instruction->op))
+            transpile_terminator(*instruction, block, next);
+        else if (!m_tail_calls.count(instruction.get()))
+            transpile_instruction(*instruction);
+    }
+}
+
+void Transpiler::transpile_instruction(const Ir::Instruction& instruction)
+{
+    const auto op = instruction.op;
+    const auto& operands = instruction.operands;
+    if (Ir::is_unary(op)) {
+        if (!transpile_unboxed_unary(instruction))
+            assign(instruction,
+                "lpl_unary(" + operator_name(op) + ", " + value(*operands[0])
+                    + ")");
+        return;
+    }
+    if (Ir::is_binary(op)) {
+        if (transpile_unboxed_binary(instruction))
+            return;
+        if (operands[0]->type == ValueType::Int
+            && operands[1]->type == ValueType::Int)
+            assign(instruction,
+                "lpl_int_operation(" + operator_name(op) + ", "
+                    + unboxed(*operands[0], ValueType::Int) + ", "
+                    + unboxed(*operands[1], ValueType::Int) + ")");
+        else if (instruction.local)
+            assign(instruction,
+                "lpl_binary_in(" + operator_name(op) + ", "
+                    + value(*operands[0]) + ", " + value(*operands[1]) + ", "
+                    + slot(instruction) + ")");
+        else
+            assign(instruction,
+                "lpl_binary(" + operator_name(op) + ", " + value(*operands[0])
+                    + ", " + value(*operands[1]) + ")");
+        return;
+    }
+    switch (op) {
+    case Ir::Op::Constant:
+    case Ir::Op::Phi: return;
+    case Ir::Op::Parameter:
+        assign(instruction, "a" + std::to_string(instruction.index));
+        return;
+    case Ir::Op::CheckType:
+        assign(instruction,
+            "lpl_check_type(" + value(*operands[0]) + ", "
+                + type_name(*instruction.type) + ")");
+        return;
+    case Ir::Op::NewArray: {
+        auto elements = std::vector<std::string> {};
+        for (const auto operand : operands)
+            elements.push_back(value(*operand));
+        if (elements.empty())
+            assign(instruction, "lpl_array_of(NULL, 0)");
+        else
+            assign(instruction,
+                "lpl_array_of((lpl_value[]) { " + join(elements) + " }, "
+                    + std::to_string(elements.size()) + ")");
+        return;
+    }
+    case Ir::Op::Index:
+        assign(instruction,
+            "lpl_index(" + value(*operands[0]) + ", " + value(*operands[1])
+                + (instruction.in_bounds ? ", false)" : ", true)"));
+        return;
+    case Ir::Op::StoreIndex:
+        line("lpl_store_index(" + value(*operands[0]) + ", "
+            + value(*operands[1]) + ", " + value(*operands[2])
+            + (instruction.in_bounds ? ", false);" : ", true);"));
+        return;
+    case Ir::Op::Map: transpile_map(instruction); return;
+    case Ir::Op::LoadGlobal: {
+        const auto& name = m_module->globals[instruction.index];
+        if (function_of(instruction.index)
+            && !m_module->defined_globals[instruction.index])
+            assign(instruction, "lpl_function(&lpl_fn_" + name + ")");
+        else
+            assign(instruction,
+                "lpl_load_global(lpl_g_" + name + ", \"" + name + "\")");
+        return;
+    }
+    case Ir::Op::StoreGlobal: {
+        const auto& name = m_module->globals[instruction.index];
+        line("lpl_store_global(&lpl_g_" + name + ", " + value(*operands[0])
+            + ", \"" + name + "\");");
+        return;
+    }
+    case Ir::Op::DefineGlobal:
+        line("lpl_g_" + m_module->globals[instruction.index] + " = "
+            + value(*operands[0]) + ";");
+        return;
+    case Ir::Op::Call:
+    case Ir::Op::CallGlobal: {
+        if (const auto callee = direct_callee(instruction);
+            callee && callee->arity != operands.size()) {
+            line("lpl_arity_error(\"" + callee->name + "\", "
+                + std::to_string(callee->arity) + ", "
+                + std::to_string(operands.size()) + ");");
+            return;
+        }
+        // only calls to the builtin `array` are local
+        if (instruction.local) {
+            assign(instruction,
+                "lpl_make_array((lpl_value[]) { " + value(*operands[0]) + ", "
+                    + value(*operands[1]) + " }, " + slot(instruction) + ")");
+            return;
+        }
+        assign(instruction, call(instruction));
+        return;
+    }
+    default: break;
+    }
+    std::cerr << "internal: unexhaustive match at " << __FILE__ << ":"
+              << __LINE__ << ": in " << __func__ << "\n";
+    exit(1);
+}
+
+// integer and float operations on unboxed values are plain C, returns false
+// when they need the runtime
+bool Transpiler::transpile_unboxed_binary(const Ir::Instruction& instruction)
+{
+    const auto left = instruction.operands[0];
+    const auto right = instruction.operands[1];
+    if (!left->type || left->type != right->type)
+        return false;
+    const auto type = *left->type;
+    if (type != ValueType::Int && type != ValueType::Float)
+        return false;
+    const auto c_op = c_operator(instruction.op, type);
+    if (!c_op)
+        return false;
+    const auto result_type = instruction.op >= Ir::Op::LessThan
+        ? ValueType::Bool
+        : type;
+    // integers wrap around like the VM's
+    if (type == ValueType::Int && result_type == ValueType::Int
+        && instruction.op <= Ir::Op::Multiply)
+        assign_raw(instruction,
+            "(int64_t)((uint64_t)" + unboxed(*left, type) + " " + *c_op
+                + " (uint64_t)" + unboxed(*right, type) + ")",
+            result_type);
+    else
+        assign_raw(instruction,
+            unboxed(*left, type) + " " + *c_op + " " + unboxed(*right, type),
+            result_type);
+    return true;
+}
+
+bool Transpiler::transpile_unboxed_unary(const Ir::Instruction& instruction)
+{
+    const auto operand = instruction.operands[0];
+    switch (instruction.op) {
+    case Ir::Op::LogicalNot:
+        if (operand->type != ValueType::Bool)
+            return false;
+        assign_raw(instruction, "!" + unboxed(*operand, ValueType::Bool),
+            ValueType::Bool);
+        return true;
+    case Ir::Op::BitwiseNot:
+        if (operand->type != ValueType::Int)
+            return false;
+        assign_raw(instruction, "~" + unboxed(*operand, ValueType::Int),
+            ValueType::Int);
+        return true;
+    case Ir::Op::Negate:
+        if (operand->type == ValueType::Int) {
+            assign_raw(instruction,
+                "(int64_t)(0 - (uint64_t)" + unboxed(*operand, ValueType::Int)
+                    + ")",
+                ValueType::Int);
+            return true;
+        }
+        if (operand->type != ValueType::Float)
+            return false;
+        assign_raw(instruction, "-" + unboxed(*operand, ValueType::Float),
+            ValueType::Float);
+        return true;
+    default: return false;
+    }
+}
+
+void Transpiler::transpile_map(const Ir::Instruction& map)
+{
+    const auto& operands = map.operands;
+    auto elements = std::vector<std::string> {};
+    for (const auto operand : operands)
+        elements.push_back(value(*operand));
+    auto steps = std::string {};
+    auto has_bitwise = false;
+    for (const auto op : map.expression) {
+        switch (op) {
+        case Kernels::Op::Load: steps += 'L'; break;
+        case Kernels::Op::Add: steps += '+'; break;
+        case Kernels::Op::Subtract: steps += '-'; break;
+        case Kernels::Op::Multiply: steps += '*'; break;
+        case Kernels::Op::BitwiseAnd: steps += '&'; break;
+        case Kernels::Op::BitwiseOr: steps += '|'; break;
+        case Kernels::Op::BitwiseXor: steps += '^'; break;
+        }
+        has_bitwise = has_bitwise || op >= Kernels::Op::BitwiseAnd;
+    }
+    const auto result = variable(map);
+    line("{");
+    m_indent++;
+    line("lpl_value m[] = { " + join(elements) + " };");
+    line("int64_t i;");
+    line(result + " = lpl_map_result(\"" + steps + "\", m, " + slot(map)
+        + ");");
+    // one loop per element type, the infix form of the steps over the
+    // operands' data, with ints computed unsigned so they wrap around
+    const auto loop = [&](const std::string& c_type, const std::string& cast) {
+        auto stack = std::vector<std::string> {};
+        auto next = size_t { 0 };
+        for (const auto step : steps) {
+            if (step == 'L') {
+                stack.push_back(cast + "((const " + c_type + "*)m["
+                    + std::to_string(next++) + "].as.a->data)[i]");
+                continue;
+            }
+            const auto right = stack.back();
+            stack.pop_back();
+            stack.back() = "(" + stack.back() + " " + step + " " + right + ")";
+        }
+        line("for (i = 0; i < " + result + ".as.a->length; i++)");
+        line("    ((" + c_type + "*)" + result + ".as.a->data)[i] = "
+            + (cast.empty() ? "" : "(" + c_type + ")") + stack.back() + ";");
+    };
+    if (has_bitwise) {
+        loop("int64_t", "(uint64_t)");
+    } else {
+        line("if (" + result + ".as.a->element == LPL_INT)");
+        m_indent++;
+        loop("int64_t", "(uint64_t)");
+        m_indent--;
+        line("else");
+        m_indent++;
+        loop("double", "");
+        m_indent--;
+    }
+    m_indent--;
+    line("}");
+}
+
+void Transpiler::transpile_terminator(const Ir::Instruction& terminator,
+    const Ir::Block& block, const Ir::Block* next)
+{
+    switch (terminator.op) {
+    case Ir::Op::Jump:
+        transpile_edge(block, *terminator.targets[0], next);
+        return;
+    case Ir::Op::Branch: {
+        const auto& tested = *terminator.operands[0];
+        const auto condition = tested.type == ValueType::Bool
+            ? "(" + unboxed(tested, ValueType::Bool) + ")"
+            : "lpl_condition(" + value(tested) + ")";
+        // the edge to the next block goes last, so it can fall through
+        const auto inverted = terminator.targets[0] == next;
+        const auto first = terminator.targets[inverted ? 1 : 0];
+        const auto second = terminator.targets[inverted ? 0 : 1];
+        line("if (" + std::string(inverted ? "!" : "") + condition + ") {");
+        m_indent++;
+        transpile_edge(block, *first, nullptr);
+        m_indent--;
+        line("}");
+        transpile_edge(block, *second, next);
+        return;
+    }
+    case Ir::Op::Switch: {
+        const auto& tested = *terminator.operands[0];
+        const auto type = terminator.cases[0].type;
+        const auto is_string = type == ValueType::String;
+        // a value of another type takes the default edge after the switch
+        const auto is_typed = tested.type == type && !is_string;
+        const auto boxed = is_typed ? std::string {} : value(tested);
+        if (!is_typed) {
+            line("if (" + boxed + ".type == " + type_name(type) + ") {");
+            m_indent++;
+        }
+        // chars are boxed even when their type is known
+        const auto key = is_string ? "lpl_string_key(" + boxed + ".as.s)"
+            : is_typed && unboxed_type(tested) == type
+            ? "(int64_t)" + variable(tested)
+            : "(int64_t)" + value(tested) + ".as." + case_field(type);
+        // strings with the same key share a label and are compared in turn
+        auto labels = std::map<std::string, std::vector<size_t>> {};
+        for (size_t i = 0; i < terminator.cases.size(); i++)
+            labels[case_label(terminator.cases[i])].push_back(i);
+        line("switch (" + key + ") {");
+        for (const auto& [label, cases] : labels) {
+            line("case " + label + ":");
+            m_indent++;
+            for (const auto i : cases) {
+                if (is_string) {
+                    line("if (lpl_equal(" + boxed + ", "
+                        + string_value(*terminator.cases[i].string_value)
+                        + ")) {");
+                    m_indent++;
+                }
+                transpile_edge(block, *terminator.targets[i], nullptr);
+                if (is_string) {
+                    m_indent--;
+                    line("}");
+                }
+            }
+            if (is_string)
+                line("break;");
+            m_indent--;
+        }
+        line("default: break;");
+        line("}");
+        if (!is_typed) {
+            m_indent--;
+            line("}");
+        }
+        transpile_edge(block, *terminator.targets.back(), next);
+        return;
+    }
+    case Ir::Op::Return: {
+        const auto returned = terminator.operands[0];
+        if (!m_tail_calls.count(returned)) {
+            free_slots();
+            line("lpl_leave();");
+            line("return " + value(*returned) + ";");
+            return;
+        }
+        if (direct_callee(*returned) == m_function) {
+            // arguments are values of their own, so they can be assigned
+            // to the parameters in any order
+            for (size_t i = 0; i < returned->operands.size(); i++)
+                line("a" + std::to_string(i) + " = "
+                    + value(*returned->operands[i]) + ";");
+            line("goto lpl_start;");
+            m_jumps_to_start = true;
+            return;
+        }
+        free_slots();
+        line("lpl_leave();");
+        line("return " + call(*returned) + ";");
+        return;
+    }
+    default: break;
+    }
+    std::cerr << "internal: unexhaustive match at " << __FILE__ << ":"
+              << __LINE__ << ": in " << __func__ << "\n";
+    exit(1);
+}
+
+// assigns the phis of `to` their values from `from` and jumps there, phis
+// which are values of other phis go through temporaries
+void Transpiler::transpile_edge(
+    const Ir::Block& from, const Ir::Block& to, const Ir::Block* next)
+{
+    const auto index = to.predecessor_index(&from);
+    auto phis = std::vector<const Ir::Instruction*> {};
+    for (size_t i = 0; i < to.phis_count(); i++)
+        if (m_uses.count(to.instructions[i].get()))
+            phis.push_back(to.instructions[i].get());
+    const auto is_read = [&](const Ir::Instruction* phi) {
+        return std::any_of(phis.begin(), phis.end(), [&](const auto* other) {
+            return other != phi && other->operands[index] == phi;
+        });
+    };
+    auto temporaries = std::vector<std::string>(phis.size());
+    for (size_t i = 0; i < phis.size(); i++) {
+        if (!is_read(phis[i]))
+            continue;
+        temporaries[i] = "t" + std::to_string(phis[i]->id);
+        line(c_type(unboxed_type(*phis[i])) + " " + temporaries[i] + " = "
+            + phi_operand(*phis[i], index) + ";");
+    }
+    for (size_t i = 0; i < phis.size(); i++) {
+        if (temporaries[i].empty())
+            line(variable(*phis[i]) + " = " + phi_operand(*phis[i], index)
+                + ";");
+    }
+    for (size_t i = 0; i < phis.size(); i++) {
+        if (!temporaries[i].empty())
+            line(variable(*phis[i]) + " = " + temporaries[i] + ";");
+    }
+    if (&to == next)
+        return;
+    line("goto b" + std::to_string(to.id) + ";");
+    m_jump_targets.insert(&to);
+}
+
+std::string Transpiler::call(const Ir::Instruction& call)
+{
+    auto args = std::vector<std::string> {};
+    for (const auto operand : call.operands)
+        args.push_back(value(*operand));
+    if (const auto callee = direct_callee(call))
+        return "lpl_f_" + callee->name + "(" + join(args) + ")";
+    // the callee of a global call is resolved after evaluating the
+    // arguments, which are all values by now
+    auto callee = std::string {};
+    if (call.op == Ir::Op::CallGlobal) {
+        const auto& name = m_module->globals[call.index];
+        callee = "lpl_load_global(lpl_g_" + name + ", \"" + name + "\")";
+    } else {
+        callee = args.front();
+        args.erase(args.begin());
+    }
+    if (args.empty())
+        return "lpl_call(" + callee + ", NULL, 0)";
+    return "lpl_call(" + callee + ", (lpl_value[]) { " + join(args) + " }, "
+        + std::to_string(args.size()) + ")";
+}
+
+std::string Transpiler::slot(const Ir::Instruction& instruction) const
+{
+    if (!instruction.local)
+        return "NULL";
+    return "&s" + std::to_string(instruction.id);
+}
+
+void Transpiler::free_slots()
+{
+    for (const auto instruction : m_slots)
+        line("free(s" + std::to_string(instruction->id) + ".storage);");
+}
+
+std::string Transpiler::phi_operand(const Ir::Instruction& phi, size_t index)
+{
+    const auto& operand = *phi.operands[index];
+    if (const auto type = unboxed_type(phi))
+        return unboxed(operand, *type);
+    return value(operand);
+}
+
+std::string Transpiler::value(const Ir::Instruction& value)
+{
+    if (value.op != Ir::Op::Constant) {
+        if (const auto type = unboxed_type(value))
+            return box(variable(value), *type);
+        return variable(value);
+    }
+    const auto& constant = value.value;
+    switch (constant.type) {
+    case ValueType::Unit: return "lpl_unit()";
+    case ValueType::Int:
+        if (constant.int_value == INT64_MIN)
+            return "lpl_int(INT64_MIN)";
+        return "lpl_int(INT64_C(" + std::to_string(constant.int_value) + "))";
+    case ValueType::Float:
+        return "lpl_float(" + float_literal(constant.float_value) + ")";
+    case ValueType::Char:
+        return "lpl_char((char)"
+            + std::to_string(static_cast<int>(constant.char_value)) + ")";
+    case ValueType::Bool:
+        return constant.bool_value ? "lpl_bool(true)" : "lpl_bool(false)";
+    case ValueType::String: return string_value(*constant.string_value);
+    default: break;
+    }
+    std::cerr << "internal: unexhaustive match at " << __FILE__ << ":"
+              << __LINE__ << ": in " << __func__ << "\n";
+    exit(1);
+}
+
+std::string Transpiler::unboxed(const Ir::Instruction& value, ValueType type)
+{
+    if (value.op == Ir::Op::Constant && value.value.type == type) {
+        const auto& constant = value.value;
+        switch (type) {
+        case ValueType::Int:
+            if (constant.int_value == INT64_MIN)
+                return "INT64_MIN";
+            return "INT64_C(" + std::to_string(constant.int_value) + ")";
+        case ValueType::Float:
+            // literals of integral floats have no decimal point
+            return "(double)" + float_literal(constant.float_value);
+        case ValueType::Bool: return constant.bool_value ? "true" : "false";
+        default: break;
+        }
+    }
+    if (unboxed_type(value) == type)
+        return variable(value);
+    return unbox(this->value(value), type);
+}
+
+std::string Transpiler::variable(const Ir::Instruction& value) const
+{
+    return "v" + std::to_string(value.id);
+}
+
+std::optional<ValueType> Transpiler::unboxed_type(
+    const Ir::Instruction& value) const
+{
+    if (!is_variable(value) || c_type(value.type) == "lpl_value")
+        return std::nullopt;
+    return value.type;
+}
+
+void Transpiler::assign(
+    const Ir::Instruction& instruction, const std::string& boxed)
+{
+    const auto type = unboxed_type(instruction);
+    line(variable(instruction) + " = " + (type ? unbox(boxed, *type) : boxed)
+        + ";");
+}
+
+void Transpiler::assign_raw(const Ir::Instruction& instruction,
+    const std::string& raw, ValueType type)
+{
+    if (unboxed_type(instruction) == type)
+        line(variable(instruction) + " = " + raw + ";");
+    else
+        assign(instruction, box(raw, type));
+}
+
+std::string Transpiler::string_value(const String& string)
+{
+    auto [name, inserted] = m_string_names.try_emplace(&string);
+    if (inserted) {
+        name->second = "lpl_string_" + std::to_string(m_string_names.size() - 1);
+        m_strings << "static const lpl_string " << name->second << " = { "
+                  << c_string_literal(std::string(string.view())) << ", "
+                  << string.length << ", UINT64_C(" << string.hash
+                  << "), UINT64_C(" << string.power << "), NULL, NULL };\n";
+    }
+    return "lpl_string_value(&" + name->second + ")";
+}
+
+bool Transpiler::is_variable(const Ir::Instruction& instruction) const
+{
+    return Ir::has_result(instruction.op) && instruction.op != Ir::Op::Constant;
+}
+
+const Ir::Function* Transpiler::function_of(uint32_t global) const
+{
+    const auto& globals = m_module->function_globals;
+    const auto found = std::find(globals.begin(), globals.end(), global);
+    if (found == globals.end())
+        return nullptr;
+    return m_module->functions[static_cast<size_t>(found - globals.begin())]
+        .get();
+}
+
+const Ir::Function* Transpiler::direct_callee(
+    const Ir::Instruction& call) const
+{
+    if (call.op != Ir::Op::CallGlobal || m_module->defined_globals[call.index])
+        return nullptr;
+    return function_of(call.index);
+}
+
+void Transpiler::line(const std::string& text)
+{
+    m_body << std::string(static_cast<size_t>(m_indent) * 4, ' ') << text
+           << "\n";
+}
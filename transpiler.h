@@ -0,0 +1,87 @@
+#pragma once
+
+#include "ir.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Lowers a program to C99, see `lplc --emit=c`.
+//
+// Values keep the VM's dynamic representation, a tagged union, and every
+// operation goes through a small runtime emitted at the top of the file
+// which mirrors the VM's semantics and error messages. The program is
+// generated from the IR: each value is a C variable, blocks are labels and
+// phis are assigned on the edges into their block. Values statically known
+// to be `Int`, `Float` or `Bool` are unboxed into `int64_t`, `double` and
+// `bool` variables, and the operations on them which can't fail are plain C.
+//
+// Calls to top level functions are direct C calls. Self tail calls become
+// jumps to the start of the function, other tail calls are emitted as
+// `return f(...)` so the C compiler can turn them into sibling calls.
+class Transpiler {
+public:
+    Transpiler(const std::string& filename)
+        : m_filename { filename }
+    {
+    }
+
+    std::string transpile(const Ir::Module& module);
+
+private:
+    void transpile_function(
+        const Ir::Function& function, const std::string& c_name);
+    void transpile_block(const Ir::Block& block, const Ir::Block* next);
+    void transpile_instruction(const Ir::Instruction& instruction);
+    bool transpile_unboxed_binary(const Ir::Instruction& instruction);
+    bool transpile_unboxed_unary(const Ir::Instruction& instruction);
+    void transpile_map(const Ir::Instruction& map);
+    void transpile_terminator(const Ir::Instruction& terminator,
+        const Ir::Block& block, const Ir::Block* next);
+    void transpile_edge(
+        const Ir::Block& from, const Ir::Block& to, const Ir::Block* next);
+    std::string call(const Ir::Instruction& call);
+    // the pointer to the slot a `local` instruction makes its arrays in, or
+    // `NULL`, see `lpl_slot`
+    std::string slot(const Ir::Instruction& instruction) const;
+    void free_slots();
+    std::string phi_operand(const Ir::Instruction& phi, size_t index);
+    // a C expression for the value, constants are inlined
+    std::string value(const Ir::Instruction& value);
+    // a C expression for the raw value, which has the type
+    std::string unboxed(const Ir::Instruction& value, ValueType type);
+    std::string variable(const Ir::Instruction& value) const;
+    // the type of the value when its variable is unboxed
+    std::optional<ValueType> unboxed_type(const Ir::Instruction& value) const;
+    void assign(const Ir::Instruction& instruction, const std::string& boxed);
+    void assign_raw(const Ir::Instruction& instruction, const std::string& raw,
+        ValueType type);
+    std::string string_value(const String& string);
+    bool is_variable(const Ir::Instruction& instruction) const;
+    // the top level function bound to `global`, if any
+    const Ir::Function* function_of(uint32_t global) const;
+    // the function called directly by `call`, if it can't be rebound
+    const Ir::Function* direct_callee(const Ir::Instruction& call) const;
+    void line(const std::string& text);
+
+    const std::string m_filename;
+    const Ir::Module* m_module { nullptr };
+    std::stringstream m_functions {};
+    std::stringstream m_strings {};
+    std::unordered_map<const String*, std::string> m_string_names {};
+
+    // state of the function being transpiled
+    const Ir::Function* m_function { nullptr };
+    std::unordered_map<const Ir::Instruction*, size_t> m_uses {};
+    std::unordered_set<const Ir::Instruction*> m_tail_calls {};
+    std::unordered_set<const Ir::Block*> m_jump_targets {};
+    std::stringstream m_body {};
+    int m_indent { 1 };
+    bool m_jumps_to_start { false };
+    std::vector<const Ir::Instruction*> m_slots {};
+};
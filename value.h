@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+enum class ValueType : uint8_t {
+    Unit,
+    Int,
+    Float,
+    Char,
+    Bool,
+    String,
+    Builtin,
+    Function,
+    Array,
+};
+
+std::string value_type_to_string(ValueType type);
+
+struct Value;
+struct Array;
+struct String;
+
+namespace Bytecode {
+struct Function;
+}
+
+using BuiltinFunction = Value (*)(const Value* args, size_t args_count);
+
+struct Builtin {
+    Builtin(const std::string name, int arity, BuiltinFunction function,
+        std::optional<ValueType> result_type = std::nullopt)
+        : name { name }
+        , arity { arity }
+        , function { function }
+        , result_type { result_type }
+    {
+    }
+
+    const std::string name;
+    // -1 means variadic
+    const int arity;
+    const BuiltinFunction function;
+    // the type of the result whenever the call succeeds, if it has one
+    const std::optional<ValueType> result_type;
+};
+
+struct Value {
+    Value()
+        : Value(ValueType::Unit)
+    {
+    }
+
+    static Value make_unit() { return Value(ValueType::Unit); }
+    static Value make_int(int64_t value)
+    {
+        auto result = Value(ValueType::Int);
+        result.int_value = value;
+        return result;
+    }
+    static Value make_float(double value)
+    {
+        auto result = Value(ValueType::Float);
+        result.float_value = value;
+        return result;
+    }
+    static Value make_char(char value)
+    {
+        auto result = Value(ValueType::Char);
+        result.char_value = value;
+        return result;
+    }
+    static Value make_bool(bool value)
+    {
+        auto result = Value(ValueType::Bool);
+        result.bool_value = value;
+        return result;
+    }
+    static Value make_string(const String* value)
+    {
+        auto result = Value(ValueType::String);
+        result.string_value = value;
+        return result;
+    }
+    static Value make_builtin(const Builtin* value)
+    {
+        auto result = Value(ValueType::Builtin);
+        result.builtin_value = value;
+        return result;
+    }
+
+    static Value make_function(Bytecode::Function* value)
+    {
+        auto result = Value(ValueType::Function);
+        result.function_value = value;
+        return result;
+    }
+    static Value make_array(Array* value)
+    {
+        auto result = Value(ValueType::Array);
+        result.array_value = value;
+        return result;
+    }
+
+    std::string to_string() const;
+
+    ValueType type;
+    union {
+        int64_t int_value;
+        double float_value;
+        char char_value;
+        bool bool_value;
+        const String* string_value;
+        const Builtin* builtin_value;
+        Bytecode::Function* function_value;
+        Array* array_value;
+    };
+
+private:
+    Value(ValueType type)
+        : type { type }
+        , int_value { 0 }
+    {
+    }
+};
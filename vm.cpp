@@ -0,0 +1,795 @@
+#include "vm.h"
+#include "array.h"
+#include "builtins.h"
+#include "bytecode.h"
+#include "gc.h"
+#include "kernels.h"
+#include "str.h"
+#include "value.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+namespace {
+
+using Bytecode::Op;
+
+[[noreturn]] void runtime_error_and_exit(const std::string& msg)
+{
+    std::cerr << "RuntimeError: " << msg << "\n";
+    exit(1);
+}
+
+[[noreturn]] void unsupported_operands(
+    Op op, const Value& left, const Value& right)
+{
+    runtime_error_and_exit("unsupported operands `"
+        + value_type_to_string(left.type) + "` " + op_to_string(op) + " `"
+        + value_type_to_string(right.type) + "`");
+}
+
+int64_t int_power(int64_t base, int64_t exponent)
+{
+    if (exponent < 0)
+        runtime_error_and_exit("negative exponent in integer `**`");
+    auto result = uint64_t { 1 };
+    auto factor = static_cast<uint64_t>(base);
+    while (exponent != 0) {
+        if (exponent & 1)
+            result *= factor;
+        factor *= factor;
+        exponent >>= 1;
+    }
+    return static_cast<int64_t>(result);
+}
+
+// shared by the generic and the int-int specialized operations, `op` is
+// always the generic op so the switch folds away in the specialized cases
+inline Value int_operation(Op op, int64_t left, int64_t right)
+{
+    const auto l = static_cast<uint64_t>(left);
+    const auto r = static_cast<uint64_t>(right);
+    switch (op) {
+    case Op::Add: return Value::make_int(static_cast<int64_t>(l + r));
+    case Op::Subtract: return Value::make_int(static_cast<int64_t>(l - r));
+    case Op::Multiply: return Value::make_int(static_cast<int64_t>(l * r));
+    case Op::Divide:
+        if (right == 0)
+            runtime_error_and_exit("division by zero");
+        if (right == -1)
+            return Value::make_int(static_cast<int64_t>(0 - l));
+        return Value::make_int(left / right);
+    case Op::Modulus:
+        if (right == 0)
+            runtime_error_and_exit("division by zero");
+        if (right == -1)
+            return Value::make_int(0);
+        return Value::make_int(left % right);
+    case Op::Exponentiate: return Value::make_int(int_power(left, right));
+    case Op::BitwiseAnd: return Value::make_int(left & right);
+    case Op::BitwiseOr: return Value::make_int(left | right);
+    case Op::BitwiseXor: return Value::make_int(left ^ right);
+    case Op::BitwiseLeftShift:
+        return Value::make_int(static_cast<int64_t>(l << (r & 63)));
+    case Op::BitwiseRightShift: return Value::make_int(left >> (r & 63));
+    case Op::LessThan: return Value::make_bool(left < right);
+    case Op::LessThanEqual: return Value::make_bool(left <= right);
+    case Op::GreaterThan: return Value::make_bool(left > right);
+    case Op::GreaterThanEqual: return Value::make_bool(left >= right);
+    case Op::Equal: return Value::make_bool(left == right);
+    case Op::NotEqual: return Value::make_bool(left != right);
+    default: break;
+    }
+    std::cerr << "internal: unexhaustive match at " << __FILE__ << ":"
+              << __LINE__ << ": in " << __func__ << "\n";
+    exit(1);
+}
+
+inline Value float_operation(Op op, double left, double right)
+{
+    switch (op) {
+    case Op::Add: return Value::make_float(left + right);
+    case Op::Subtract: return Value::make_float(left - right);
+    case Op::Multiply: return Value::make_float(left * right);
+    case Op::Divide: return Value::make_float(left / right);
+    case Op::Modulus: return Value::make_float(std::fmod(left, right));
+    case Op::Exponentiate: return Value::make_float(std::pow(left, right));
+    case Op::LessThan: return Value::make_bool(left < right);
+    case Op::LessThanEqual: return Value::make_bool(left <= right);
+    case Op::GreaterThan: return Value::make_bool(left > right);
+    case Op::GreaterThanEqual: return Value::make_bool(left >= right);
+    case Op::Equal: return Value::make_bool(left == right);
+    case Op::NotEqual: return Value::make_bool(left != right);
+    default:
+        unsupported_operands(
+            op, Value::make_float(left), Value::make_float(right));
+    }
+}
+
+std::optional<Kernels::Op> kernel_op(Op op)
+{
+    switch (op) {
+    case Op::Add: return Kernels::Op::Add;
+    case Op::Subtract: return Kernels::Op::Subtract;
+    case Op::Multiply: return Kernels::Op::Multiply;
+    case Op::BitwiseAnd: return Kernels::Op::BitwiseAnd;
+    case Op::BitwiseOr: return Kernels::Op::BitwiseOr;
+    case Op::BitwiseXor: return Kernels::Op::BitwiseXor;
+    default: return std::nullopt;
+    }
+}
+
+bool is_number(const Value& value)
+{
+    return value.type == ValueType::Int || value.type == ValueType::Float;
+}
+
+double to_float(const Value& value)
+{
+    return value.type == ValueType::Int ? static_cast<double>(value.int_value)
+                                        : value.float_value;
+}
+
+}
+
+VM::VM(Bytecode::Program& program, Profiler* profiler)
+    : m_program { program }
+    , m_jit { m_program.filename, m_globals, m_global_versions }
+    , m_profiler { profiler }
+{
+    for (const auto& name : m_program.globals) {
+        if (const auto builtin = find_builtin(name))
+            m_globals.push_back(Value::make_builtin(builtin));
+        else
+            m_globals.push_back(std::nullopt);
+    }
+    for (size_t i = 0; i < m_program.functions.size(); i++)
+        m_globals[m_program.function_globals[i]]
+            = Value::make_function(m_program.functions[i].get());
+    m_global_versions.resize(m_globals.size(), 0);
+    if (m_jit.perf_enabled()) {
+        m_program.main->trampoline
+            = m_jit.make_trampoline(*m_program.main, &VM::trampoline_entry);
+        for (auto& function : m_program.functions)
+            function->trampoline
+                = m_jit.make_trampoline(*function, &VM::trampoline_entry);
+    }
+}
+
+Value VM::run()
+{
+    push_frame(*m_program.main, 0);
+    if (m_program.main->trampoline) {
+        m_program.main->trampoline(this);
+        return pop();
+    }
+    return execute();
+}
+
+void VM::trampoline_entry(void* vm)
+{
+    auto& self = *static_cast<VM*>(vm);
+    self.push(self.execute());
+}
+
+Value VM::execute()
+{
+    const auto entry_frames = m_frames.size();
+    auto* frame = &m_frames.back();
+
+    // specialized operations guard on their operand types and deoptimize
+    // back to the generic operation when the guard fails
+    const auto int_int = [&](Bytecode::Instruction& instruction, Op op) {
+        auto& left = peek(1);
+        const auto& right = peek(0);
+        if (left.type != ValueType::Int || right.type != ValueType::Int)
+            [[unlikely]] {
+            deoptimize(instruction);
+            generic_binary_operation(instruction);
+            return;
+        }
+        left = int_operation(op, left.int_value, right.int_value);
+        m_stack.pop_back();
+    };
+    const auto float_float = [&](Bytecode::Instruction& instruction, Op op) {
+        auto& left = peek(1);
+        const auto& right = peek(0);
+        if (left.type != ValueType::Float || right.type != ValueType::Float)
+            [[unlikely]] {
+            deoptimize(instruction);
+            generic_binary_operation(instruction);
+            return;
+        }
+        left = float_operation(op, left.float_value, right.float_value);
+        m_stack.pop_back();
+    };
+
+    while (true) {
+        if (Profiler::sample_pending) [[unlikely]]
+            take_sample(nullptr);
+        if (Gc::Heap::collection_pending) [[unlikely]]
+            collect_garbage();
+        auto& instruction = frame->function->code[frame->ip++];
+        switch (instruction.op) {
+        case Op::PushConstant:
+            push(frame->function->constants[instruction.operand]);
+            break;
+        case Op::PushUnit: push(Value::make_unit()); break;
+        case Op::Pop: m_stack.pop_back(); break;
+        case Op::Dup: push(peek(0)); break;
+        case Op::LoadLocal:
+            push(m_stack[frame->base + instruction.operand]);
+            break;
+        case Op::StoreLocal:
+            m_stack[frame->base + instruction.operand] = pop();
+            break;
+        case Op::LoadGlobal: {
+            const auto& global = m_globals[instruction.operand];
+            if (!global)
+                error_and_exit("undefined symbol `"
+                    + m_program.globals[instruction.operand] + "`");
+            push(*global);
+            break;
+        }
+        case Op::StoreGlobal: {
+            auto& global = m_globals[instruction.operand];
+            const auto& name = m_program.globals[instruction.operand];
+            if (!global)
+                error_and_exit("undefined symbol `" + name + "`");
+            if (global->type == ValueType::Builtin)
+                error_and_exit("cannot assign to builtin `" + name + "`");
+            global = pop();
+            m_global_versions[instruction.operand]++;
+            break;
+        }
+        case Op::DefineGlobal:
+            m_globals[instruction.operand] = pop();
+            m_global_versions[instruction.operand]++;
+            break;
+        case Op::Jump: frame->ip = instruction.operand; break;
+        case Op::JumpIfFalse: {
+            const auto condition = pop();
+            if (condition.type != ValueType::Bool)
+                error_and_exit("expected `Bool` condition, got `"
+                    + value_type_to_string(condition.type) + "`");
+            if (!condition.bool_value)
+                frame->ip = instruction.operand;
+            break;
+        }
+        case Op::TableSwitch: {
+            const auto value = pop();
+            const auto& table
+                = frame->function->switch_tables[instruction.operand];
+            frame->ip = table.default_target;
+            if (value.type != table.type)
+                break;
+            const auto entry = static_cast<uint64_t>(Bytecode::switch_key(value))
+                - static_cast<uint64_t>(table.first);
+            if (entry < table.targets.size())
+                frame->ip = table.targets[entry];
+            break;
+        }
+        case Op::LookupSwitch:
+        case Op::StringSwitch: {
+            const auto value = pop();
+            const auto& table
+                = frame->function->switch_tables[instruction.operand];
+            frame->ip = table.default_target;
+            if (value.type != table.type)
+                break;
+            const auto key = Bytecode::switch_key(value);
+            const auto found
+                = std::lower_bound(table.keys.begin(), table.keys.end(), key);
+            for (auto i = static_cast<size_t>(found - table.keys.begin());
+                 i < table.keys.size() && table.keys[i] == key; i++) {
+                if (instruction.op == Op::LookupSwitch
+                    || table.strings[i]->equals(*value.string_value)) {
+                    frame->ip = table.targets[i];
+                    break;
+                }
+            }
+            break;
+        }
+        case Op::Call:
+        case Op::TailCall:
+            call(frame->function->call_caches[instruction.operand],
+                instruction.op == Op::TailCall);
+            frame = &m_frames.back();
+            break;
+        case Op::CallGlobal:
+        case Op::TailCallGlobal: {
+            auto& cache = frame->function->call_caches[instruction.operand];
+            // only calls to the builtin `array` have a slot
+            if (cache.slot != 0) [[unlikely]]
+                Gc::heap().set_slot(&slot(cache.slot));
+            call_global(cache, instruction.op == Op::TailCallGlobal);
+            Gc::heap().set_slot(nullptr);
+            frame = &m_frames.back();
+            break;
+        }
+        case Op::Return: {
+            const auto result = pop();
+            m_stack.resize(frame->return_base);
+            m_frames.pop_back();
+            if (m_frames.size() < entry_frames)
+                return result;
+            frame = &m_frames.back();
+            push(result);
+            break;
+        }
+        case Op::CheckType: {
+            const auto type = static_cast<ValueType>(instruction.operand);
+            if (peek(0).type != type)
+                error_and_exit("expected `" + value_type_to_string(type)
+                    + "`, got `" + value_type_to_string(peek(0).type) + "`");
+            break;
+        }
+        case Op::NewArray: new_array(instruction.operand); break;
+        case Op::Map: {
+            const auto& kernel = frame->function->kernels[instruction.operand];
+            const auto& expression = kernel.expression;
+            const auto count = static_cast<size_t>(std::count(
+                expression.begin(), expression.end(), Kernels::Op::Load));
+            // the operands are statically known to be arrays
+            auto operands = std::array<const Array*, Kernels::max_operands> {};
+            for (size_t i = 0; i < count; i++)
+                operands[i] = m_stack[m_stack.size() - count + i].array_value;
+            if (kernel.slot != 0)
+                Gc::heap().set_slot(&slot(kernel.slot));
+            const auto result = map(expression, operands.data());
+            Gc::heap().set_slot(nullptr);
+            m_stack.resize(m_stack.size() - count);
+            push(result);
+            break;
+        }
+        case Op::Index:
+        case Op::IndexInBounds: {
+            const auto index = pop();
+            auto& top = peek(0);
+            if (top.type == ValueType::String) {
+                top = character(*top.string_value, index);
+                break;
+            }
+            top = element(top, index, instruction.op == Op::Index)
+                      .get(index.int_value);
+            break;
+        }
+        case Op::StoreIndex:
+        case Op::StoreIndexInBounds: {
+            const auto value = pop();
+            const auto index = pop();
+            auto& array
+                = element(pop(), index, instruction.op == Op::StoreIndex);
+            if (value.type != array.element_type)
+                error_and_exit("cannot store `"
+                    + value_type_to_string(value.type) + "` in an array of `"
+                    + value_type_to_string(array.element_type) + "`");
+            array.set(index.int_value, value);
+            break;
+        }
+        case Op::LogicalNot:
+        case Op::BitwiseNot:
+        case Op::Plus:
+        case Op::Negate:
+            peek(0) = unary_operation(instruction.op, peek(0));
+            break;
+        case Op::Add:
+        case Op::Subtract:
+        case Op::Multiply:
+        case Op::Divide:
+        case Op::Modulus:
+        case Op::Exponentiate:
+        case Op::BitwiseAnd:
+        case Op::BitwiseOr:
+        case Op::BitwiseXor:
+        case Op::BitwiseLeftShift:
+        case Op::BitwiseRightShift:
+        case Op::LessThan:
+        case Op::LessThanEqual:
+        case Op::GreaterThan:
+        case Op::GreaterThanEqual:
+        case Op::Equal:
+        case Op::NotEqual: generic_binary_operation(instruction); break;
+        case Op::AddInt: int_int(instruction, Op::Add); break;
+        case Op::SubtractInt: int_int(instruction, Op::Subtract); break;
+        case Op::MultiplyInt: int_int(instruction, Op::Multiply); break;
+        case Op::DivideInt: int_int(instruction, Op::Divide); break;
+        case Op::ModulusInt: int_int(instruction, Op::Modulus); break;
+        case Op::ExponentiateInt: int_int(instruction, Op::Exponentiate); break;
+        case Op::BitwiseAndInt: int_int(instruction, Op::BitwiseAnd); break;
+        case Op::BitwiseOrInt: int_int(instruction, Op::BitwiseOr); break;
+        case Op::BitwiseXorInt: int_int(instruction, Op::BitwiseXor); break;
+        case Op::BitwiseLeftShiftInt:
+            int_int(instruction, Op::BitwiseLeftShift);
+            break;
+        case Op::BitwiseRightShiftInt:
+            int_int(instruction, Op::BitwiseRightShift);
+            break;
+        case Op::LessThanInt: int_int(instruction, Op::LessThan); break;
+        case Op::LessThanEqualInt:
+            int_int(instruction, Op::LessThanEqual);
+            break;
+        case Op::GreaterThanInt: int_int(instruction, Op::GreaterThan); break;
+        case Op::GreaterThanEqualInt:
+            int_int(instruction, Op::GreaterThanEqual);
+            break;
+        case Op::EqualInt: int_int(instruction, Op::Equal); break;
+        case Op::NotEqualInt: int_int(instruction, Op::NotEqual); break;
+        case Op::AddFloat: float_float(instruction, Op::Add); break;
+        case Op::SubtractFloat: float_float(instruction, Op::Subtract); break;
+        case Op::MultiplyFloat: float_float(instruction, Op::Multiply); break;
+        case Op::DivideFloat: float_float(instruction, Op::Divide); break;
+        case Op::ModulusFloat: float_float(instruction, Op::Modulus); break;
+        case Op::ExponentiateFloat:
+            float_float(instruction, Op::Exponentiate);
+            break;
+        case Op::LessThanFloat: float_float(instruction, Op::LessThan); break;
+        case Op::LessThanEqualFloat:
+            float_float(instruction, Op::LessThanEqual);
+            break;
+        case Op::GreaterThanFloat:
+            float_float(instruction, Op::GreaterThan);
+            break;
+        case Op::GreaterThanEqualFloat:
+            float_float(instruction, Op::GreaterThanEqual);
+            break;
+        case Op::EqualFloat: float_float(instruction, Op::Equal); break;
+        case Op::NotEqualFloat: float_float(instruction, Op::NotEqual); break;
+        }
+    }
+}
+
+// every value the program can still use is on the stack or in a global
+// between instructions, constants are interned and never collected
+void VM::collect_garbage()
+{
+    Gc::heap().collect([&](const Gc::Heap::Visitor& visit) {
+        for (auto& value : m_stack)
+            visit(value);
+        for (auto& global : m_globals) {
+            if (global)
+                visit(*global);
+        }
+    });
+}
+
+void VM::take_sample(const Bytecode::Function* native)
+{
+    Profiler::sample_pending = 0;
+    if (!m_profiler)
+        return;
+    m_sample_stack.clear();
+    const auto depth = std::min(m_frames.size(), Profiler::max_depth);
+    for (auto i = m_frames.size() - depth; i < m_frames.size(); i++) {
+        const auto& frame = m_frames[i];
+        // callers have already stepped past their call instruction
+        const auto executing = i + 1 == m_frames.size() && !native;
+        const auto ip = executing || frame.ip == 0 ? frame.ip : frame.ip - 1;
+        m_sample_stack.push_back({ frame.function, ip, false });
+    }
+    if (native)
+        m_sample_stack.push_back({ native, 0, true });
+    m_profiler->record(m_sample_stack, depth < m_frames.size());
+}
+
+void VM::call(Bytecode::CallCache& cache, bool tail)
+{
+    const auto args_count = cache.args_count;
+    const auto return_base = m_stack.size() - args_count - 1;
+    const auto& callee = m_stack[return_base];
+    for (uint8_t i = 0; i < cache.targets_count; i++) {
+        const auto& target = cache.targets[i];
+        if ((callee.type == ValueType::Function
+                && target.function == callee.function_value)
+            || (callee.type == ValueType::Builtin
+                && target.builtin == callee.builtin_value))
+            return invoke(target, args_count, return_base, tail);
+    }
+    const auto target = resolve_call_target(callee, args_count);
+    if (cache.targets_count < Bytecode::CallCache::max_targets)
+        cache.targets[cache.targets_count++] = target;
+    invoke(target, args_count, return_base, tail);
+}
+
+void VM::call_global(Bytecode::CallCache& cache, bool tail)
+{
+    const auto return_base = m_stack.size() - cache.args_count;
+    if (cache.global_version == m_global_versions[cache.global]) [[likely]]
+        return invoke(cache.targets[0], cache.args_count, return_base, tail);
+    const auto& global = m_globals[cache.global];
+    if (!global)
+        error_and_exit(
+            "undefined symbol `" + m_program.globals[cache.global] + "`");
+    cache.targets[0] = resolve_call_target(*global, cache.args_count);
+    cache.targets_count = 1;
+    cache.global_version = m_global_versions[cache.global];
+    invoke(cache.targets[0], cache.args_count, return_base, tail);
+}
+
+Bytecode::CallTarget VM::resolve_call_target(
+    const Value& callee, uint32_t args_count)
+{
+    const auto check_arity = [&](const std::string& name, int64_t arity) {
+        if (arity >= 0 && static_cast<uint32_t>(arity) != args_count)
+            error_and_exit("`" + name + "` expected " + std::to_string(arity)
+                + " arguments, got " + std::to_string(args_count));
+    };
+    switch (callee.type) {
+    case ValueType::Builtin:
+        check_arity(callee.builtin_value->name, callee.builtin_value->arity);
+        return Bytecode::CallTarget { callee.builtin_value, nullptr };
+    case ValueType::Function:
+        check_arity(
+            callee.function_value->name, callee.function_value->arity);
+        return Bytecode::CallTarget { nullptr, callee.function_value };
+    default:
+        error_and_exit(
+            "`" + value_type_to_string(callee.type) + "` is not callable");
+    }
+}
+
+void VM::invoke(const Bytecode::CallTarget& target, uint32_t args_count,
+    size_t return_base, bool tail)
+{
+    if (target.function && m_jit.enabled()) {
+        const auto args = m_stack.data() + m_stack.size() - args_count;
+        const auto result = m_jit.try_run(*target.function, args);
+        if (Profiler::sample_pending) [[unlikely]]
+            take_sample(target.function);
+        if (result) {
+            m_stack.resize(return_base);
+            push(*result);
+            return;
+        }
+    }
+    if (target.function && tail)
+        return replace_frame(*target.function);
+    if (target.function) {
+        push_frame(*target.function, return_base);
+        if (target.function->trampoline
+            && m_frames.size() <= max_trampoline_frames)
+            target.function->trampoline(this);
+        return;
+    }
+    const auto args_begin = m_stack.size() - args_count;
+    const auto result
+        = target.builtin->function(m_stack.data() + args_begin, args_count);
+    m_stack.resize(return_base);
+    push(result);
+}
+
+void VM::push_frame(Bytecode::Function& function, size_t return_base)
+{
+    if (m_frames.size() >= max_frames)
+        error_and_exit("stack overflow");
+    const auto base = m_stack.size() - function.arity;
+    m_stack.resize(base + function.locals_count);
+    const auto slots = m_frames.empty()
+        ? 0
+        : m_frames.back().slots + m_frames.back().function->slots_count;
+    if (m_slots.size() < slots + function.slots_count)
+        m_slots.resize(slots + function.slots_count);
+    m_frames.push_back(Frame { &function, 0, base, return_base, slots });
+}
+
+void VM::replace_frame(Bytecode::Function& function)
+{
+    auto& frame = m_frames.back();
+    const auto args_begin = m_stack.end() - function.arity;
+    std::copy(args_begin, m_stack.end(), m_stack.begin() + frame.base);
+    m_stack.resize(frame.base + function.locals_count);
+    if (m_slots.size() < frame.slots + function.slots_count)
+        m_slots.resize(frame.slots + function.slots_count);
+    frame.function = &function;
+    frame.ip = 0;
+}
+
+Gc::Slot& VM::slot(uint32_t slot)
+{
+    return m_slots[m_frames.back().slots + slot - 1];
+}
+
+void VM::new_array(uint32_t count)
+{
+    const auto elements = m_stack.end() - count;
+    const auto type = count == 0 ? ValueType::Unit : elements->type;
+    const auto array = Array::make(type, count);
+    for (uint32_t i = 0; i < count; i++) {
+        if (elements[i].type != type)
+            error_and_exit("array elements have different types `"
+                + value_type_to_string(type) + "` and `"
+                + value_type_to_string(elements[i].type) + "`");
+        array->set(i, elements[i]);
+    }
+    m_stack.erase(elements, m_stack.end());
+    push(Value::make_array(array));
+}
+
+Array& VM::element(const Value& array, const Value& index, bool check_bounds)
+{
+    if (array.type != ValueType::Array)
+        error_and_exit(
+            "cannot index `" + value_type_to_string(array.type) + "`");
+    if (index.type != ValueType::Int)
+        error_and_exit("expected `Int` index, got `"
+            + value_type_to_string(index.type) + "`");
+    if (check_bounds && !array.array_value->in_bounds(index.int_value))
+        error_and_exit("index " + std::to_string(index.int_value)
+            + " out of bounds for array of length "
+            + std::to_string(array.array_value->length));
+    return *array.array_value;
+}
+
+Value VM::character(const String& string, const Value& index)
+{
+    if (index.type != ValueType::Int)
+        error_and_exit("expected `Int` index, got `"
+            + value_type_to_string(index.type) + "`");
+    if (static_cast<uint64_t>(index.int_value)
+        >= static_cast<uint64_t>(string.length))
+        error_and_exit("index " + std::to_string(index.int_value)
+            + " out of bounds for string of length "
+            + std::to_string(string.length));
+    return Value::make_char(
+        string.view()[static_cast<size_t>(index.int_value)]);
+}
+
+Value VM::map(
+    const Kernels::Expression& expression, const Array* const* operands)
+{
+    if (const auto error = Kernels::check(expression, operands))
+        error_and_exit(*error);
+    return Value::make_array(Kernels::evaluate(expression, operands));
+}
+
+void VM::generic_binary_operation(Bytecode::Instruction& instruction)
+{
+    const auto right = pop();
+    const auto left = pop();
+    record_feedback(instruction, left, right);
+    if (instruction.operand != 0)
+        Gc::heap().set_slot(&slot(instruction.operand));
+    push(binary_operation(
+        Bytecode::generic_variant(instruction.op), left, right));
+    Gc::heap().set_slot(nullptr);
+}
+
+Value VM::binary_operation(Op op, const Value& left, const Value& right)
+{
+    if (left.type == ValueType::Int && right.type == ValueType::Int)
+        return int_operation(op, left.int_value, right.int_value);
+    if (is_number(left) && is_number(right))
+        return float_operation(op, to_float(left), to_float(right));
+    if (left.type == ValueType::Char && right.type == ValueType::Char) {
+        const auto result
+            = int_operation(op, left.char_value, right.char_value);
+        if (result.type == ValueType::Bool)
+            return result;
+        return Value::make_char(static_cast<char>(result.int_value));
+    }
+    if (left.type == ValueType::Char && right.type == ValueType::Int
+        && (op == Op::Add || op == Op::Subtract))
+        return Value::make_char(static_cast<char>(
+            int_operation(op, left.char_value, right.int_value).int_value));
+    if (op == Op::Add && left.type == ValueType::String
+        && right.type == ValueType::String)
+        return Value::make_string(
+            String::concatenate(left.string_value, right.string_value));
+    if (left.type == ValueType::String && right.type == ValueType::String
+        && op >= Op::LessThan && op <= Op::GreaterThanEqual)
+        return int_operation(
+            op, left.string_value->compare(*right.string_value), 0);
+    if (left.type == ValueType::Array && right.type == ValueType::Array) {
+        if (const auto kernel = kernel_op(op)) {
+            const Array* operands[] = { left.array_value, right.array_value };
+            return map(
+                { Kernels::Op::Load, Kernels::Op::Load, *kernel }, operands);
+        }
+    }
+    if (op == Op::Equal || op == Op::NotEqual) {
+        const auto equal = [&]() {
+            if (left.type != right.type)
+                return false;
+            switch (left.type) {
+            case ValueType::Unit: return true;
+            case ValueType::Bool: return left.bool_value == right.bool_value;
+            case ValueType::String:
+                return left.string_value->equals(*right.string_value);
+            case ValueType::Builtin:
+                return left.builtin_value == right.builtin_value;
+            case ValueType::Function:
+                return left.function_value == right.function_value;
+            case ValueType::Array:
+                return left.array_value == right.array_value;
+            default: return false;
+            }
+        }();
+        return Value::make_bool(op == Op::Equal ? equal : !equal);
+    }
+    unsupported_operands(op, left, right);
+}
+
+void VM::record_feedback(
+    Bytecode::Instruction& instruction, const Value& left, const Value& right)
+{
+    if (instruction.deopts >= max_deopts)
+        return;
+    const auto feedback = [&]() {
+        if (left.type == ValueType::Int && right.type == ValueType::Int)
+            return Bytecode::Feedback::IntInt;
+        else if (left.type == ValueType::Float
+            && right.type == ValueType::Float)
+            return Bytecode::Feedback::FloatFloat;
+        else
+            return Bytecode::Feedback::Other;
+    }();
+    if (feedback != instruction.feedback) {
+        instruction.feedback = feedback;
+        instruction.feedback_hits = 0;
+    }
+    if (feedback == Bytecode::Feedback::Other)
+        return;
+    if (++instruction.feedback_hits < quickening_threshold)
+        return;
+    instruction.op = feedback == Bytecode::Feedback::IntInt
+        ? Bytecode::int_variant(instruction.op)
+        : Bytecode::float_variant(instruction.op);
+}
+
+void VM::deoptimize(Bytecode::Instruction& instruction)
+{
+    instruction.op = Bytecode::generic_variant(instruction.op);
+    instruction.feedback = Bytecode::Feedback::None;
+    instruction.feedback_hits = 0;
+    instruction.deopts++;
+}
+
+Value VM::unary_operation(Op op, const Value& value)
+{
+    switch (op) {
+    case Op::LogicalNot:
+        if (value.type == ValueType::Bool)
+            return Value::make_bool(!value.bool_value);
+        break;
+    case Op::BitwiseNot:
+        if (value.type == ValueType::Int)
+            return Value::make_int(~value.int_value);
+        break;
+    case Op::Plus:
+        if (is_number(value))
+            return value;
+        break;
+    case Op::Negate:
+        if (value.type == ValueType::Int)
+            return Value::make_int(static_cast<int64_t>(
+                0 - static_cast<uint64_t>(value.int_value)));
+        if (value.type == ValueType::Float)
+            return Value::make_float(-value.float_value);
+        break;
+    default: break;
+    }
+    error_and_exit("unsupported operand " + op_to_string(op) + " `"
+        + value_type_to_string(value.type) + "`");
+}
+
+Value& VM::peek(size_t distance)
+{
+    return m_stack[m_stack.size() - 1 - distance];
+}
+
+Value VM::pop()
+{
+    const auto value = m_stack.back();
+    m_stack.pop_back();
+    return value;
+}
+
+void VM::push(Value value) { m_stack.push_back(value); }
+
+void VM::error_and_exit(const std::string& msg)
+{
+    runtime_error_and_exit(msg);
+}
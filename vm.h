@@ -0,0 +1,89 @@
+#pragma once
+
+#include "bytecode.h"
+#include "gc.h"
+#include "jit.h"
+#include "kernels.h"
+#include "profiler.h"
+#include "value.h"
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+class VM {
+public:
+    // generic operations quicken after this many executions with the same
+    // operand types, and stay generic after this many deoptimizations
+    static constexpr uint8_t quickening_threshold = 8;
+    static constexpr uint8_t max_deopts = 4;
+    static constexpr size_t max_frames = 100000;
+    // interpreted calls only go through their function's trampoline up to
+    // this many frames deep, as each one nests the interpreter loop on the
+    // machine stack
+    static constexpr size_t max_trampoline_frames = 2000;
+
+    // samples are recorded into `profiler` when set, see profiler.h
+    VM(Bytecode::Program& program, Profiler* profiler = nullptr);
+
+    Value run();
+
+private:
+    struct Frame {
+        Bytecode::Function* function;
+        size_t ip;
+        size_t base;
+        // where the stack is truncated to on return, below `base` when the
+        // callee itself is on the stack
+        size_t return_base;
+        // where the function's slots start in `m_slots`
+        size_t slots;
+    };
+
+    // runs until the current frame returns and returns its result
+    Value execute();
+    static void trampoline_entry(void* vm);
+    // at the start of an instruction, see gc.h
+    void collect_garbage();
+    // `native` is set when the sample was taken while it ran in the JIT
+    void take_sample(const Bytecode::Function* native);
+    void call(Bytecode::CallCache& cache, bool tail);
+    void call_global(Bytecode::CallCache& cache, bool tail);
+    Bytecode::CallTarget resolve_call_target(
+        const Value& callee, uint32_t args_count);
+    void invoke(const Bytecode::CallTarget& target, uint32_t args_count,
+        size_t return_base, bool tail);
+    void push_frame(Bytecode::Function& function, size_t return_base);
+    void replace_frame(Bytecode::Function& function);
+    // the current frame's slot `slot` minus one, see `Gc::Slot`
+    Gc::Slot& slot(uint32_t slot);
+    void new_array(uint32_t count);
+    // the array `array` after checking that it is one, and that `index` is
+    // an int and, unless `check_bounds` is false, in bounds
+    Array& element(const Value& array, const Value& index, bool check_bounds);
+    // the character at `index` after checking that it is an int in bounds
+    Value character(const String& string, const Value& index);
+    Value map(
+        const Kernels::Expression& expression, const Array* const* operands);
+    void generic_binary_operation(Bytecode::Instruction& instruction);
+    Value binary_operation(
+        Bytecode::Op op, const Value& left, const Value& right);
+    void record_feedback(Bytecode::Instruction& instruction,
+        const Value& left, const Value& right);
+    void deoptimize(Bytecode::Instruction& instruction);
+    Value unary_operation(Bytecode::Op op, const Value& value);
+    Value& peek(size_t distance);
+    Value pop();
+    void push(Value value);
+    [[noreturn]] void error_and_exit(const std::string& msg);
+
+    Bytecode::Program& m_program;
+    std::vector<Frame> m_frames {};
+    std::vector<Value> m_stack {};
+    std::vector<Gc::Slot> m_slots {};
+    std::vector<std::optional<Value>> m_globals {};
+    std::vector<uint32_t> m_global_versions {};
+    Jit m_jit;
+    Profiler* m_profiler;
+    std::vector<Profiler::Frame> m_sample_stack {};
+};